@@ -156,6 +156,7 @@ PCH_SOURCES = \
 	decallib.cpp \
 	dobject.cpp \
 	dobjgc.cpp \
+	dobjpool.cpp \
 	dobjtype.cpp \
 	doomstat.cpp \
 	dsectoreffect.cpp \
@@ -237,6 +238,7 @@ PCH_SOURCES = \
 	p_tick.cpp \
 	p_trace.cpp \
 	p_udmf.cpp \
+	p_udmfscanner.cpp \
 	p_usdf.cpp \
 	p_user.cpp \
 	p_xlat.cpp \
@@ -431,6 +433,7 @@ PCH_SOURCES = \
 	scripting/decorate/thingdef_states.cpp \
 	scripting/vm/vmexec.cpp \
 	scripting/vm/vmframe.cpp \
+	scripting/vm/vmprofile.cpp \
 	scripting/zscript/ast.cpp \
 	scripting/zscript/zcc_compile.cpp \
 	scripting/zscript/zcc_parser.cpp \
@@ -651,6 +651,9 @@ bool FCajunMaster::LoadBots ()
 	return true;
 }
 
+ADD_CYCLE_STAT (botthink, BotThinkCycles)
+ADD_CYCLE_STAT (botsupport, BotSupportCycles)
+
 ADD_STAT (bots)
 {
 	FString out;
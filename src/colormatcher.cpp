@@ -34,20 +34,122 @@
 ** It was, but the results were not as good as I would like, so I didn't
 ** actually use it. But I did keep the code around in case I ever felt like
 ** revisiting the problem. I never did, so now it's relegated to the mists
-** of SVN history, and this is just a thin wrapper around BestColor().
+** of SVN history.
+**
+** What is here now splits the RGB space into 32x32x32 cells and stores for
+** every cell the palette entries that can be the closest color for any
+** point inside it. Pick() only has to compare against those, and returns
+** exactly what BestColor() would.
 **
 */
 
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include "doomtype.h"
 #include "colormatcher.h"
 #include "v_palette.h"
+#include "templates.h"
+#include "i_time.h"
+#include "c_dispatch.h"
+
+// BestColor() defaults to searching the entries 1 to 254.
+enum
+{
+	CUBE_FIRST = 1,
+	CUBE_NUM = 255,
+	CUBE_BITS = 5,
+	CUBE_SIZE = 1 << CUBE_BITS,
+	CUBE_SHIFT = 8 - CUBE_BITS,
+	CUBE_CELLS = CUBE_SIZE * CUBE_SIZE * CUBE_SIZE
+};
+
+struct FColorMatcher::FCube
+{
+	PalEntry Colors[256];
+	uint32_t Start[CUBE_CELLS + 1];		// candidates of cell i are Candidates[Start[i]] to Candidates[Start[i+1]-1]
+	TArray<uint8_t> Candidates;
+};
+
+//==========================================================================
+//
+// FColorMatcher :: GetCube
+//
+// Returns the candidate cube for a palette, building it the first time
+// the palette is seen. A palette entry can only be the closest color for
+// some point in a cell if its smallest possible distance to the cell is
+// not larger than the largest possible distance of the best entry, so
+// everything else is left out. Candidates stay sorted by index, so that
+// ties are resolved the same way as by BestColor().
+//
+//==========================================================================
+
+const FColorMatcher::FCube *FColorMatcher::GetCube (const PalEntry *palette)
+{
+	static TDeletingArray<FCube *> ColorCubes;
+
+	for (auto cube : ColorCubes)
+	{
+		if (memcmp (cube->Colors, palette, sizeof(cube->Colors)) == 0)
+		{
+			return cube;
+		}
+	}
+
+	FCube *cube = new FCube;
+	memcpy (cube->Colors, palette, sizeof(cube->Colors));
+
+	// Per channel and cell row, the nearest and farthest squared distance of each entry.
+	static int mindist[3][CUBE_SIZE][256], maxdist[3][CUBE_SIZE][256];
+	for (int i = CUBE_FIRST; i < CUBE_NUM; ++i)
+	{
+		const int channel[3] = { palette[i].r, palette[i].g, palette[i].b };
+		for (int c = 0; c < 3; ++c)
+		{
+			for (int cell = 0; cell < CUBE_SIZE; ++cell)
+			{
+				int lo = cell << CUBE_SHIFT, hi = lo + (1 << CUBE_SHIFT) - 1;
+				int nearest = channel[c] < lo ? lo - channel[c] : channel[c] > hi ? channel[c] - hi : 0;
+				int farthest = MAX(abs(channel[c] - lo), abs(channel[c] - hi));
+				mindist[c][cell][i] = nearest * nearest;
+				maxdist[c][cell][i] = farthest * farthest;
+			}
+		}
+	}
+
+	for (int r = 0, cell = 0; r < CUBE_SIZE; ++r)
+	{
+		for (int g = 0; g < CUBE_SIZE; ++g)
+		{
+			for (int b = 0; b < CUBE_SIZE; ++b, ++cell)
+			{
+				int bound = INT_MAX;
+				for (int i = CUBE_FIRST; i < CUBE_NUM; ++i)
+				{
+					bound = MIN(bound, maxdist[0][r][i] + maxdist[1][g][i] + maxdist[2][b][i]);
+				}
+				cube->Start[cell] = cube->Candidates.Size();
+				for (int i = CUBE_FIRST; i < CUBE_NUM; ++i)
+				{
+					if (mindist[0][r][i] + mindist[1][g][i] + mindist[2][b][i] <= bound)
+					{
+						cube->Candidates.Push(i);
+					}
+				}
+			}
+		}
+	}
+	cube->Start[CUBE_CELLS] = cube->Candidates.Size();
+	cube->Candidates.ShrinkToFit();
+	ColorCubes.Push(cube);
+	return cube;
+}
 
 FColorMatcher::FColorMatcher ()
 {
 	Pal = NULL;
+	Cube = NULL;
 }
 
 FColorMatcher::FColorMatcher (const uint32_t *palette)
@@ -63,12 +165,14 @@ FColorMatcher::FColorMatcher (const FColorMatcher &other)
 FColorMatcher &FColorMatcher::operator= (const FColorMatcher &other)
 {
 	Pal = other.Pal;
+	Cube = other.Cube;
 	return *this;
 }
 
 void FColorMatcher::SetPalette (const uint32_t *palette)
 {
 	Pal = (const PalEntry *)palette;
+	Cube = Pal != NULL ? GetCube (Pal) : NULL;
 }
 
 uint8_t FColorMatcher::Pick (int r, int g, int b)
@@ -76,5 +180,99 @@ uint8_t FColorMatcher::Pick (int r, int g, int b)
 	if (Pal == NULL)
 		return 1;
 
-	return (uint8_t)BestColor ((uint32_t *)Pal, r, g, b);
+	if ((unsigned)(r | g | b) > 255)
+	{ // Out of range colors are not covered by the cube.
+		return (uint8_t)BestColor ((uint32_t *)Pal, r, g, b);
+	}
+
+	int cell = ((r >> CUBE_SHIFT) << (2*CUBE_BITS)) | ((g >> CUBE_SHIFT) << CUBE_BITS) | (b >> CUBE_SHIFT);
+	const uint8_t *candidate = &Cube->Candidates[Cube->Start[cell]];
+	const uint8_t *end = &Cube->Candidates[0] + Cube->Start[cell + 1];
+	int bestcolor = *candidate;
+	int bestdist = INT_MAX;
+
+	if (end - candidate == 1)
+	{
+		return bestcolor;
+	}
+	for (; candidate < end; ++candidate)
+	{
+		int x = r - Pal[*candidate].r;
+		int y = g - Pal[*candidate].g;
+		int z = b - Pal[*candidate].b;
+		int dist = x*x + y*y + z*z;
+		if (dist < bestdist)
+		{
+			if (dist == 0)
+				return *candidate;
+
+			bestdist = dist;
+			bestcolor = *candidate;
+		}
+	}
+	return bestcolor;
+}
+
+//==========================================================================
+//
+// FColorMatcher :: StaticBenchmark
+//
+// Times Pick() against the exhaustive search on random colors, the way
+// truecolor textures are converted, and checks that both agree.
+//
+//==========================================================================
+
+void FColorMatcher::StaticBenchmark (int passes)
+{
+	if (ColorMatcher.Pal == NULL)
+	{
+		Printf ("No palette has been set\n");
+		return;
+	}
+
+	const int count = 65536;
+	TArray<uint32_t> colors(count, true);
+	TArray<uint8_t> fast(count, true), exact(count, true);
+	uint32_t seed = 1;
+	for (auto &color : colors)
+	{
+		seed = seed * 1664525 + 1013904223;
+		color = seed >> 8;
+	}
+
+	uint64_t start = I_nsTime();
+	for (int pass = 0; pass < passes; ++pass)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			fast[i] = ColorMatcher.Pick (RPART(colors[i]), GPART(colors[i]), BPART(colors[i]));
+		}
+	}
+	uint64_t cubetime = I_nsTime() - start;
+
+	start = I_nsTime();
+	for (int pass = 0; pass < passes; ++pass)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			exact[i] = BestColor ((uint32_t *)ColorMatcher.Pal, RPART(colors[i]), GPART(colors[i]), BPART(colors[i]));
+		}
+	}
+	uint64_t searchtime = I_nsTime() - start;
+
+	int mismatches = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		if (fast[i] != exact[i]) mismatches++;
+	}
+
+	double pixels = double(count) * passes;
+	Printf ("Cube: %u candidates, %.1f Mpixels/s\n", ColorMatcher.Cube->Candidates.Size(), pixels * 1000. / MAX<uint64_t>(cubetime, 1));
+	Printf ("Exhaustive search: %.1f Mpixels/s\n", pixels * 1000. / MAX<uint64_t>(searchtime, 1));
+	Printf ("%d mismatches\n", mismatches);
+}
+
+CCMD (colormatchbench)
+{
+	FColorMatcher::StaticBenchmark (argv.argc() > 1 ? MAX(atoi(argv[1]), 1) : 10);
 }
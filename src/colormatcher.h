@@ -50,8 +50,15 @@ public:
 
 	FColorMatcher &operator= (const FColorMatcher &other);
 
+	static void StaticBenchmark (int passes);
+
 private:
+	struct FCube;
+
+	static const FCube *GetCube (const PalEntry *palette);
+
 	const PalEntry *Pal;
+	const FCube *Cube;
 };
 
 extern FColorMatcher ColorMatcher;
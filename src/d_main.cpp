@@ -104,6 +104,9 @@
 #include "r_data/r_vanillatrans.h"
 #include "s_music.h"
 #include "swrenderer/r_swcolormaps.h"
+#include "swrenderer/r_swrenderer.h"
+#include "stats.h"
+#include "m_alloc.h"
 
 EXTERN_CVAR(Bool, hud_althud)
 EXTERN_CVAR(Bool, cl_customizeinvulmap)
@@ -178,6 +181,7 @@ extern bool gameisdead;
 extern bool demorecording;
 extern bool M_DemoNoPlay;	// [RH] if true, then skip any demos in the loop
 extern bool insave;
+extern int currentrenderer;
 extern TDeletingArray<FLightDefaults *> LightDefaults;
 
 
@@ -1150,6 +1154,186 @@ void D_DoomLoop ()
 	}
 }
 
+//==========================================================================
+//
+// D_RunBenchmark
+//
+// Headless benchmark: plays back a demo with single tics and renders
+// every tic with the software or poly renderer into an offscreen canvas,
+// without a video backend. Writes timing and memory statistics as JSON,
+// including the time of every registered FCycleStat for every tic.
+//
+// -benchdemo <demo> [-benchout <file>] [-benchwidth <w>] [-benchheight <h>]
+// [-benchpoly]
+//
+//==========================================================================
+
+struct FBenchmarkFrame
+{
+	int Tic;
+	double PlaysimMS;
+	double RenderMS;
+	size_t Allocs;
+	int64_t AllocBytes;		// Net change of GC::AllocBytes during the tic
+	TArray<double> CyclesMS;	// One entry per FCycleStat
+};
+
+static FString JSONString(const char *str)
+{
+	FString out = "\"";
+	for (; *str; str++)
+	{
+		switch (*str)
+		{
+		case '"':	out << "\\\""; break;
+		case '\\':	out << "\\\\"; break;
+		case '\n':	out << "\\n"; break;
+		case '\t':	out << "\\t"; break;
+		default:
+			if ((uint8_t)*str < 32) out.AppendFormat("\\u%04x", (uint8_t)*str);
+			else out << *str;
+			break;
+		}
+	}
+	out << '"';
+	return out;
+}
+
+static int D_RunBenchmark(const char *demoname)
+{
+	EXTERN_CVAR(Bool, r_polyrenderer)
+
+	const char *v;
+	FString outname = (v = Args->CheckValue("-benchout")) ? v : "benchmark.json";
+	int width = (v = Args->CheckValue("-benchwidth")) ? clamp(atoi(v), 64, MAXWIDTH) : 640;
+	int height = (v = Args->CheckValue("-benchheight")) ? clamp(atoi(v), 48, MAXHEIGHT) : 400;
+	bool oldpoly = r_polyrenderer;
+
+	r_polyrenderer = !!Args->CheckParm("-benchpoly");
+
+	TArray<FBenchmarkFrame> frames;
+	DSimpleCanvas canvas(width, height, false);
+	bool rendered = true;
+
+	// The dummy frame buffer cannot display anything, so keep the regular drawing code out of the way.
+	nodrawers = true;
+	singledemo = true;
+	singletics = true;
+	r_NoInterpolate = true;
+	G_DeferedPlayDemo(demoname);
+
+	uint64_t starttime = I_nsTime();
+	for (;;)
+	{
+		uint64_t playsimstart = I_nsTime();
+		size_t allocs = M_AllocCount;
+		size_t allocbytes = GC::AllocBytes;
+
+		D_ProcessEvents ();
+		G_BuildTiccmd (&netcmds[consoleplayer][maketic%BACKUPTICS]);
+		C_Ticker ();
+		M_Ticker ();
+		G_Ticker ();
+		S_UpdateSounds (players[consoleplayer].camera);
+		gametic++;
+		maketic++;
+		GC::CheckGC ();
+		Net_NewMakeTic ();
+
+		// The first tic starts the demo, so if it is not playing now it either ended or could not be loaded.
+		if (!demoplayback)
+		{
+			break;
+		}
+
+		uint64_t renderstart = I_nsTime();
+		if (gamestate == GS_LEVEL && players[consoleplayer].camera != nullptr)
+		{
+			canvas.Lock(true);
+			rendered = Renderer->RenderViewToCanvas(&players[consoleplayer], &canvas, width, height);
+			canvas.Unlock();
+		}
+		uint64_t renderend = I_nsTime();
+
+		FBenchmarkFrame &frame = frames[frames.Reserve(1)];
+		frame.Tic = gametic;
+		frame.PlaysimMS = (renderstart - playsimstart) / 1e6;
+		frame.RenderMS = (renderend - renderstart) / 1e6;
+		frame.Allocs = M_AllocCount - allocs;
+		frame.AllocBytes = int64_t(GC::AllocBytes - allocbytes);
+		for (FCycleStat *stat = FCycleStat::GetFirst(); stat != nullptr; stat = stat->GetNext())
+		{
+			frame.CyclesMS.Push(stat->TimeMS());
+		}
+		if (!rendered)
+		{
+			Printf("The current renderer cannot render offscreen.\n");
+			break;
+		}
+	}
+	double totaltime = (I_nsTime() - starttime) / 1e9;
+
+	FileWriter *fw = FileWriter::Open(outname);
+	if (fw == nullptr)
+	{
+		Printf("Could not open %s for writing\n", outname.GetChars());
+		r_polyrenderer = oldpoly;
+		return -1;
+	}
+
+	double playsimtotal = 0, rendertotal = 0;
+	size_t alloctotal = 0;
+	TArray<double> cyclestotal;
+	for (FCycleStat *stat = FCycleStat::GetFirst(); stat != nullptr; stat = stat->GetNext())
+	{
+		cyclestotal.Push(0);
+	}
+	for (auto &frame : frames)
+	{
+		playsimtotal += frame.PlaysimMS;
+		rendertotal += frame.RenderMS;
+		alloctotal += frame.Allocs;
+		for (unsigned j = 0; j < frame.CyclesMS.Size(); j++)
+		{
+			cyclestotal[j] += frame.CyclesMS[j];
+		}
+	}
+
+	fw->Printf("{\n\t\"demo\": %s,\n\t\"map\": %s,\n\t\"renderer\": \"%s\",\n\t\"width\": %d,\n\t\"height\": %d,\n",
+		JSONString(demoname).GetChars(), JSONString(level.MapName).GetChars(), r_polyrenderer ? "poly" : "software", width, height);
+	fw->Printf("\t\"frames\": %u,\n\t\"total_seconds\": %.6f,\n\t\"playsim_ms\": %.6f,\n\t\"render_ms\": %.6f,\n\t\"allocations\": %zu,\n\t\"peak_rss\": %zu,\n",
+		frames.Size(), totaltime, playsimtotal, rendertotal, alloctotal, I_GetPeakMemoryUsage());
+
+	// Milliseconds summed over all tics, keyed by the FCycleStat's name.
+	fw->Printf("\t\"cycles_ms\": {");
+	unsigned j = 0;
+	for (FCycleStat *stat = FCycleStat::GetFirst(); stat != nullptr && j < cyclestotal.Size(); stat = stat->GetNext(), j++)
+	{
+		fw->Printf("%s\n\t\t%s: %.6f", j == 0 ? "" : ",", JSONString(stat->GetName()).GetChars(), cyclestotal[j]);
+	}
+	fw->Printf("\n\t},\n\t\"per_frame\": [");
+
+	for (unsigned i = 0; i < frames.Size(); i++)
+	{
+		auto &frame = frames[i];
+		fw->Printf("%s\n\t\t{ \"tic\": %d, \"playsim_ms\": %.6f, \"render_ms\": %.6f, \"allocations\": %zu, \"alloc_bytes\": %lld, \"cycles_ms\": {",
+			i == 0 ? "" : ",", frame.Tic, frame.PlaysimMS, frame.RenderMS, frame.Allocs, (long long)frame.AllocBytes);
+		j = 0;
+		for (FCycleStat *stat = FCycleStat::GetFirst(); stat != nullptr && j < frame.CyclesMS.Size(); stat = stat->GetNext(), j++)
+		{
+			fw->Printf("%s %s: %.6f", j == 0 ? "" : ",", JSONString(stat->GetName()).GetChars(), frame.CyclesMS[j]);
+		}
+		fw->Printf(" } }");
+	}
+	fw->Printf("\n\t]\n}\n");
+	delete fw;
+
+	Printf("Benchmark: %u frames in %.3f s (playsim %.3f ms, render %.3f ms per frame), written to %s\n", frames.Size(), totaltime,
+		frames.Size() ? playsimtotal / frames.Size() : 0., frames.Size() ? rendertotal / frames.Size() : 0., outname.GetChars());
+	r_polyrenderer = oldpoly;
+	return 0;
+}
+
 //==========================================================================
 //
 // D_PageTicker
@@ -2693,7 +2877,16 @@ static int D_DoomMain_Internal (void)
 		{
 			if (!batchrun) Printf ("I_Init: Setting up machine state.\n");
 			I_Init ();
+			if (Args->CheckParm("-benchdemo"))
+			{
+				// The headless benchmark can only use the software renderers.
+				Renderer = new FSoftwareRenderer;
+			}
 			I_CreateRenderer();
+			if (Args->CheckParm("-benchdemo"))
+			{
+				currentrenderer = 0;
+			}
 		}
 
 		if (!batchrun) Printf ("V_Init: allocate screen.\n");
@@ -2898,6 +3091,12 @@ static int D_DoomMain_Internal (void)
 				return 1337; // special exit
 			}
 
+			v = Args->CheckValue("-benchdemo");
+			if (v != NULL)
+			{
+				return D_RunBenchmark(v);
+			}
+
 			V_Init2();
 			gl_PatchMenu();
 			//UpdateJoystickMenu(NULL);
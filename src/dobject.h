@@ -106,6 +106,10 @@ struct ClassReg
 
 enum EInPlace { EC_InPlace };
 
+// Storage for DObjects, from the size-classed pools in dobjpool.cpp
+void *M_AllocObject(size_t size);
+void M_FreeObject(void *mem);
+
 #define DECLARE_ABSTRACT_CLASS(cls,parent) \
 public: \
 	virtual PClass *StaticType() const; \
@@ -265,18 +269,18 @@ private:
 
 	void *operator new(size_t len, nonew&)
 	{
-		return M_Malloc(len);
+		return M_AllocObject(len);
 	}
 public:
 
 	void operator delete (void *mem, nonew&)
 	{
-		M_Free(mem);
+		M_FreeObject(mem);
 	}
 
 	void operator delete (void *mem)
 	{
-		M_Free(mem);
+		M_FreeObject(mem);
 	}
 
 	// GC fiddling
@@ -343,7 +347,7 @@ protected:
 
 	void operator delete (void *mem, EInPlace *)
 	{
-		M_Free (mem);
+		M_FreeObject (mem);
 	}
 
 	template<typename T, typename... Args>
@@ -80,6 +80,7 @@
 #include "intermission/intermission.h"
 #include "g_levellocals.h"
 #include "events.h"
+#include "i_time.h"
 
 // MACROS ------------------------------------------------------------------
 
@@ -136,6 +137,47 @@ public:
 
 IMPLEMENT_CLASS(DSectorMarker, false, false)
 
+// Spawns and destroys a steady stream of actors to load the collector.
+// Controlled with 'gc stress'.
+class DGCStress : public DThinker
+{
+	DECLARE_CLASS(DGCStress, DThinker)
+public:
+	DGCStress() : DThinker(STAT_DEFAULT) {}
+	void Serialize(FSerializer &arc);
+	void Tick();
+	size_t PropagateMark();
+	void OnDestroy() override;
+
+	PClassActor *Type = nullptr;
+	int PerMinute = 0;
+	int Lifetime = 0;
+	int Accumulated = 0;
+	int64_t Spawned = 0;
+	TArray<AActor *> Live;
+	TArray<int> Expires;
+};
+
+IMPLEMENT_CLASS(DGCStress, false, false)
+
+// Time spent in each collector phase during one Step() call. The last
+// entry covers the whole step, i.e. the pause the game actually sees.
+struct FGCPauseStat
+{
+	double Last, Max, Total;
+	unsigned Count;
+
+	void Add(double ms)
+	{
+		Last = ms;
+		Max = MAX(Max, ms);
+		Total += ms;
+		Count++;
+	}
+};
+
+enum { GCP_Step = GC::GCS_Finalize + 1, GCP_Full, NUM_GCPAUSESTATS };
+
 // EXTERNAL FUNCTION PROTOTYPES --------------------------------------------
 
 // PUBLIC FUNCTION PROTOTYPES ----------------------------------------------
@@ -173,6 +215,8 @@ static DSectorMarker *SectorMarker;
 static int LastCollectTime;		// Time last time collector finished
 static size_t LastCollectAlloc;	// Memory allocation when collector finished
 static size_t MinStepSize;		// Cover at least this much memory per step
+static FGCPauseStat PauseStats[NUM_GCPAUSESTATS];
+static DGCStress *Stress;
 
 // CODE --------------------------------------------------------------------
 
@@ -503,9 +547,24 @@ void Step()
 	// However, we also don't want to go slower than what was decided upon
 	// when the sweep began if the rate of allocation has slowed.
 	size_t lim = MAX(CalcStepSize(), MinStepSize);
+
+	// Only phase changes are timed, not every single step, so this costs
+	// next to nothing while propagating through thousands of objects.
+	int64_t stepstart = I_nsTime(), phasestart = stepstart;
+	int64_t phasetime[GCS_Finalize + 1] = {};
+	bool ran[GCS_Finalize + 1] = {};
+	EGCState phase = State;
 	do
 	{
+		ran[State] = true;
 		size_t done = SingleStep();
+		if (State != phase)
+		{
+			int64_t now = I_nsTime();
+			phasetime[phase] += now - phasestart;
+			phasestart = now;
+			phase = State;
+		}
 		if (done < lim)
 		{
 			lim -= done;
@@ -515,6 +574,15 @@ void Step()
 			lim = 0;
 		}
 	} while (lim && State != GCS_Pause);
+
+	int64_t stepend = I_nsTime();
+	phasetime[phase] += stepend - phasestart;
+	for (int i = 0; i <= GCS_Finalize; i++)
+	{
+		if (ran[i]) PauseStats[i].Add(phasetime[i] / 1e6);
+	}
+	PauseStats[GCP_Step].Add((stepend - stepstart) / 1e6);
+
 	if (State != GCS_Pause)
 	{
 		Threshold = AllocBytes;
@@ -537,6 +605,7 @@ void Step()
 
 void FullGC()
 {
+	int64_t start = I_nsTime();
 	if (State <= GCS_Propagate)
 	{
 		// Reset sweep mark to sweep all elements (returning them to white)
@@ -556,6 +625,7 @@ void FullGC()
 		SingleStep();
 	}
 	SetThreshold();
+	PauseStats[GCP_Full].Add((I_nsTime() - start) / 1e6);
 }
 
 //==========================================================================
@@ -747,6 +817,88 @@ size_t DSectorMarker::PropagateMark()
 	return marked;
 }
 
+//==========================================================================
+//
+// DGCStress
+//
+// Spawns PerMinute actors per minute of game time around the console
+// player and destroys each of them Lifetime tics later, so the collector
+// always has a stream of short-lived garbage to deal with.
+//
+//==========================================================================
+
+void DGCStress::Serialize(FSerializer &arc)
+{
+	Super::Serialize(arc);
+	arc("type", Type)
+		("perminute", PerMinute)
+		("lifetime", Lifetime)
+		("accumulated", Accumulated)
+		("spawned", Spawned)
+		("live", Live)
+		("expires", Expires);
+	if (arc.isReading())
+	{
+		unsigned count = MIN(Live.Size(), Expires.Size());
+		Live.Resize(count);
+		Expires.Resize(count);
+		GC::Stress = this;
+	}
+}
+
+void DGCStress::Tick()
+{
+	int time = level.maptime;
+
+	unsigned keep = 0;
+	for (unsigned i = 0; i < Live.Size(); i++)
+	{
+		AActor *mo = GC::ReadBarrier(Live[i]);
+		if (mo != nullptr && Expires[i] <= time)
+		{
+			mo->Destroy();
+		}
+		else if (mo != nullptr)
+		{
+			Live[keep] = mo;
+			Expires[keep++] = Expires[i];
+		}
+	}
+	Live.Resize(keep);
+	Expires.Resize(keep);
+
+	AActor *center = players[consoleplayer].mo;
+	if (Type == nullptr || center == nullptr) return;
+
+	Accumulated += PerMinute;
+	int count = Accumulated / (60 * TICRATE);
+	Accumulated -= count * 60 * TICRATE;
+	for (int i = 0; i < count; i++, Spawned++)
+	{
+		// Spread them out on a grid so they do not all pile up in one block.
+		DVector3 pos = center->Pos() + DVector3((Spawned & 15) * 8. - 60, ((Spawned >> 4) & 15) * 8. - 60, 0);
+		AActor *mo = Spawn(Type, pos, NO_REPLACE);
+		if (mo != nullptr)
+		{
+			Live.Push(mo);
+			Expires.Push(time + Lifetime);
+		}
+	}
+}
+
+size_t DGCStress::PropagateMark()
+{
+	// Actors that removed themselves before their time is up get nulled here.
+	if (Live.Size() > 0) GC::MarkArray(Live);
+	return Super::PropagateMark();
+}
+
+void DGCStress::OnDestroy()
+{
+	if (GC::Stress == this) GC::Stress = nullptr;
+	Super::OnDestroy();
+}
+
 //==========================================================================
 //
 // STAT gc
@@ -770,6 +922,14 @@ ADD_STAT(gc)
 		(GC::Estimate + 1023) >> 10,
 		GC::StepCount,
 		(GC::MinStepSize + 1023) >> 10);
+
+	auto &p = GC::PauseStats;
+	out.AppendFormat("\nGC - ms last/max: Root %.2f/%.2f  Mark %.2f/%.2f  Sweep %.2f/%.2f  Step %.2f/%.2f  Full %.2f",
+		p[GC::GCS_Pause].Last, p[GC::GCS_Pause].Max,
+		p[GC::GCS_Propagate].Last, p[GC::GCS_Propagate].Max,
+		p[GC::GCS_Sweep].Last, p[GC::GCS_Sweep].Max,
+		p[GCP_Step].Last, p[GCP_Step].Max,
+		p[GCP_Full].Last);
 	return out;
 }
 
@@ -785,7 +945,7 @@ CCMD(gc)
 {
 	if (argv.argc() == 1)
 	{
-		Printf ("Usage: gc stop|now|full|count|pause [size]|stepmul [size]\n");
+		Printf ("Usage: gc stop|now|full|count|pause [size]|stepmul [size]|pauses|stress [perminute] [class] [lifetime]\n");
 		return;
 	}
 	if (stricmp(argv[1], "stop") == 0)
@@ -828,5 +988,46 @@ CCMD(gc)
 			GC::StepMul = MAX(100, atoi(argv[2]));
 		}
 	}
+	else if (stricmp(argv[1], "pauses") == 0)
+	{
+		static const char *PhaseNames[] = { "Root", "Mark", "Sweep", "Finalize", "Step", "Full" };
+		Printf(TEXTCOLOR_YELLOW "Phase       Count    Last ms     Avg ms     Max ms\n");
+		for (int i = 0; i < NUM_GCPAUSESTATS; i++)
+		{
+			auto &p = GC::PauseStats[i];
+			Printf("%-8s %8u %10.3f %10.3f %10.3f\n", PhaseNames[i], p.Count, p.Last, p.Count > 0 ? p.Total / p.Count : 0., p.Max);
+		}
+		memset(GC::PauseStats, 0, sizeof(GC::PauseStats));
+	}
+	else if (stricmp(argv[1], "stress") == 0)
+	{
+		// This changes the world outside of the tic commands, so demos would desync.
+		if (netgame || demorecording || demoplayback || gamestate != GS_LEVEL)
+		{
+			Printf("gc stress is only available in a single player level without a demo\n");
+			return;
+		}
+		int perminute = argv.argc() > 2 ? atoi(argv[2]) : 100000;
+		if (perminute <= 0)
+		{
+			if (GC::Stress != nullptr) GC::Stress->Destroy();
+			return;
+		}
+		const char *classname = argv.argc() > 3 ? argv[3] : "Blood";
+		PClassActor *type = PClass::FindActor(classname);
+		if (type == nullptr)
+		{
+			Printf("Unknown actor class '%s'\n", classname);
+			return;
+		}
+		if (GC::Stress == nullptr)
+		{
+			GC::Stress = Create<DGCStress>();
+		}
+		GC::Stress->Type = type;
+		GC::Stress->PerMinute = perminute;
+		GC::Stress->Lifetime = argv.argc() > 4 ? MAX(1, atoi(argv[4])) : TICRATE;
+		Printf("Spawning %d %s per minute, each living %d tics\n", perminute, type->TypeName.GetChars(), GC::Stress->Lifetime);
+	}
 }
 
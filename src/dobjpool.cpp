@@ -0,0 +1,302 @@
+/*
+** dobjpool.cpp
+** Size-classed slab pools for DObject storage
+**
+**---------------------------------------------------------------------------
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+**
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+** 3. The name of the author may not be used to endorse or promote products
+**    derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+** OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+** IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+** INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+** NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+** THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**---------------------------------------------------------------------------
+**
+** Every DObject is allocated through M_AllocObject. Objects up to
+** MAX_POOLED_SLOT bytes come from slabs of equally sized slots, one pool
+** per 16 byte size class, so all instances of a class share a pool and
+** the actors the game spawns and destroys constantly do not go through
+** malloc one by one. Each object is preceded by a small header pointing
+** to its slab, so it can be freed without knowing its size. Larger
+** objects get the same header in front of a plain M_Malloc block.
+**
+** DObjects are only created and destroyed by the game thread, so the
+** pools are not locked.
+**
+*/
+
+#include <stdlib.h>
+
+#include "dobject.h"
+#include "m_alloc.h"
+#include "c_cvars.h"
+#include "c_dispatch.h"
+#include "i_system.h"
+#include "stats.h"
+#include "templates.h"
+#include "v_text.h"
+
+CVAR(Bool, gc_objectpools, true, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
+
+struct FObjectPool;
+
+struct FObjectSlab
+{
+	FObjectPool *Pool;
+	FObjectSlab *Prev, *Next;		// links in the pool's list of slabs with free slots
+	uint8_t *FreeList;
+	uint8_t *Bump;					// slots from here on have never been used
+	unsigned Live;
+	unsigned Capacity;
+};
+
+struct FObjectPool
+{
+	size_t SlotSize;
+	FObjectSlab *Partial;		// slabs that have free slots
+	FObjectSlab *Spare;			// one empty slab is kept to avoid thrashing
+	unsigned NumSlabs;
+	unsigned Live;
+	size_t Allocs;
+};
+
+enum
+{
+	OBJECT_HEADER = 16,			// keeps objects 16 byte aligned
+	MAX_POOLED_SLOT = 4096,
+	SLAB_BYTES = 64 * 1024,
+	MIN_SLAB_SLOTS = 16,
+};
+
+static const size_t SLAB_HEADER = (sizeof(FObjectSlab) + 15) & ~size_t(15);
+
+static FObjectPool ObjectPools[MAX_POOLED_SLOT / 16 + 1];
+static size_t LargeObjectAllocs;
+
+static inline FObjectSlab *&SlabOf(uint8_t *block)
+{
+	return *(FObjectSlab **)block;
+}
+
+static inline uint8_t *&NextFree(uint8_t *block)
+{
+	return *(uint8_t **)block;
+}
+
+//==========================================================================
+//
+// Slab list maintenance
+//
+//==========================================================================
+
+static unsigned SlabCapacity(size_t slotsize)
+{
+	return unsigned(MAX<size_t>(SLAB_BYTES / slotsize, MIN_SLAB_SLOTS));
+}
+
+static size_t SlabBytes(size_t slotsize)
+{
+	return SLAB_HEADER + SlabCapacity(slotsize) * slotsize;
+}
+
+static void LinkPartial(FObjectPool &pool, FObjectSlab *slab)
+{
+	slab->Prev = nullptr;
+	slab->Next = pool.Partial;
+	if (pool.Partial != nullptr) pool.Partial->Prev = slab;
+	pool.Partial = slab;
+}
+
+static void UnlinkPartial(FObjectPool &pool, FObjectSlab *slab)
+{
+	if (slab->Prev != nullptr) slab->Prev->Next = slab->Next;
+	else pool.Partial = slab->Next;
+	if (slab->Next != nullptr) slab->Next->Prev = slab->Prev;
+	slab->Prev = slab->Next = nullptr;
+}
+
+static void ResetSlab(FObjectSlab *slab)
+{
+	slab->FreeList = nullptr;
+	slab->Bump = (uint8_t *)slab + SLAB_HEADER;
+	slab->Live = 0;
+}
+
+static FObjectSlab *NewSlab(FObjectPool &pool)
+{
+	FObjectSlab *slab = (FObjectSlab *)malloc(SlabBytes(pool.SlotSize));
+	if (slab == nullptr)
+	{
+		I_FatalError("Could not allocate an object slab of %zu bytes", SlabBytes(pool.SlotSize));
+	}
+	M_AllocCount++;
+	slab->Pool = &pool;
+	slab->Capacity = SlabCapacity(pool.SlotSize);
+	ResetSlab(slab);
+	pool.NumSlabs++;
+	return slab;
+}
+
+//==========================================================================
+//
+// M_AllocObject
+//
+// The memory is accounted in GC::AllocBytes like M_Malloc's, so the
+// collector's pace does not depend on whether the pools are used.
+//
+//==========================================================================
+
+void *M_AllocObject(size_t size)
+{
+	size_t slotsize = (size + OBJECT_HEADER + 15) & ~size_t(15);
+
+	if (!gc_objectpools || slotsize > MAX_POOLED_SLOT)
+	{
+		uint8_t *block = (uint8_t *)M_Malloc(size + OBJECT_HEADER);
+		SlabOf(block) = nullptr;
+		LargeObjectAllocs++;
+		return block + OBJECT_HEADER;
+	}
+
+	FObjectPool &pool = ObjectPools[slotsize / 16];
+	FObjectSlab *slab = pool.Partial;
+	if (slab == nullptr)
+	{
+		pool.SlotSize = slotsize;
+		if (pool.Spare != nullptr)
+		{
+			slab = pool.Spare;
+			pool.Spare = nullptr;
+		}
+		else
+		{
+			slab = NewSlab(pool);
+		}
+		LinkPartial(pool, slab);
+	}
+
+	uint8_t *block;
+	if (slab->FreeList != nullptr)
+	{
+		block = slab->FreeList;
+		slab->FreeList = NextFree(block);
+	}
+	else
+	{
+		block = slab->Bump;
+		slab->Bump += slotsize;
+	}
+	if (++slab->Live == slab->Capacity)
+	{
+		UnlinkPartial(pool, slab);
+	}
+
+	SlabOf(block) = slab;
+	pool.Live++;
+	pool.Allocs++;
+	GC::AllocBytes += slotsize;
+	return block + OBJECT_HEADER;
+}
+
+//==========================================================================
+//
+// M_FreeObject
+//
+//==========================================================================
+
+void M_FreeObject(void *mem)
+{
+	if (mem == nullptr) return;
+
+	uint8_t *block = (uint8_t *)mem - OBJECT_HEADER;
+	FObjectSlab *slab = SlabOf(block);
+	if (slab == nullptr)
+	{
+		M_Free(block);
+		return;
+	}
+
+	FObjectPool &pool = *slab->Pool;
+	NextFree(block) = slab->FreeList;
+	slab->FreeList = block;
+	if (slab->Live-- == slab->Capacity)
+	{
+		LinkPartial(pool, slab);
+	}
+	pool.Live--;
+	GC::AllocBytes -= pool.SlotSize;
+
+	if (slab->Live == 0)
+	{
+		UnlinkPartial(pool, slab);
+		if (pool.Spare == nullptr)
+		{
+			ResetSlab(slab);
+			pool.Spare = slab;
+		}
+		else
+		{
+			free(slab);
+			pool.NumSlabs--;
+		}
+	}
+}
+
+//==========================================================================
+//
+// Occupancy report
+//
+//==========================================================================
+
+CCMD(objpoolstat)
+{
+	size_t totalslabs = 0, totallive = 0, totalbytes = 0;
+
+	Printf(TEXTCOLOR_YELLOW " Slot  Slabs     Live Capacity  Used     KBytes     Allocs\n");
+	for (auto &pool : ObjectPools)
+	{
+		if (pool.NumSlabs == 0) continue;
+
+		unsigned capacity = SlabCapacity(pool.SlotSize) * pool.NumSlabs;
+		size_t bytes = SlabBytes(pool.SlotSize) * pool.NumSlabs;
+		Printf("%5zu %6u %8u %8u %4.0f%% %10zu %10zu\n", pool.SlotSize, pool.NumSlabs, pool.Live, capacity,
+			100. * pool.Live / capacity, bytes / 1024, pool.Allocs);
+		totalslabs += pool.NumSlabs;
+		totallive += pool.Live * pool.SlotSize;
+		totalbytes += bytes;
+	}
+	Printf("%zu slabs, %zu KB, %zu KB in use (%.0f%%), %zu objects allocated outside the pools\n",
+		totalslabs, totalbytes / 1024, totallive / 1024, totalbytes > 0 ? 100. * totallive / totalbytes : 0., LargeObjectAllocs);
+}
+
+ADD_STAT(objpools)
+{
+	FString out;
+	size_t slabs = 0, live = 0, bytes = 0;
+
+	for (auto &pool : ObjectPools)
+	{
+		if (pool.NumSlabs == 0) continue;
+		slabs += pool.NumSlabs;
+		live += pool.Live;
+		bytes += SlabBytes(pool.SlotSize) * pool.NumSlabs;
+	}
+	out.Format("Object pools: %zu slabs, %zu KB, %zu objects, %zu mallocs", slabs, bytes / 1024, live, M_AllocCount.load());
+	return out;
+}
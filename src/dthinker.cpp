@@ -47,6 +47,7 @@
 #include "v_text.h"
 #include "g_levellocals.h"
 #include "a_dynlight.h"
+#include "m_random.h"
 
 
 static int ThinkCount;
@@ -600,6 +601,156 @@ struct ProfileInfo
 TMap<FName, ProfileInfo> Profiles;
 
 
+//==========================================================================
+//
+// thinkerislands
+//
+// Partitions the actors into islands that cannot affect each other within
+// one tic: actors are joined when their reach overlaps in the blockmap or
+// when they reference each other through target, master or tracer. This
+// measures how much a concurrent tick could gain on the current map.
+// Ticking the islands concurrently is not done because the VM stack,
+// FRandom, validcount and the GC write barrier are all process-global.
+//
+//==========================================================================
+
+static int FindIsland(TArray<int> &parent, int i)
+{
+	while (parent[i] != i)
+	{
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+static void MergeIslands(TArray<int> &parent, int a, int b)
+{
+	a = FindIsland(parent, a);
+	b = FindIsland(parent, b);
+	if (a != b) parent[MAX(a, b)] = MIN(a, b);	// keep the lowest index as the root so the result is deterministic
+}
+
+CCMD(thinkerislands)
+{
+	if (gamestate != GS_LEVEL || level.blockmap.blockcells == nullptr)
+	{
+		Printf("Not in a level\n");
+		return;
+	}
+
+	auto &bmap = level.blockmap;
+	const int numcells = bmap.bmapwidth * bmap.bmapheight;
+
+	// Islands 0..numcells-1 are blockmap cells, numcells is the catch-all for
+	// actors outside the blockmap or in a portal group other than the default.
+	TArray<int> parent(numcells + 1, true);
+	for (int i = 0; i <= numcells; i++) parent[i] = i;
+
+	TArray<AActor *> actors;
+	TArray<int> actorcell;
+	TMap<AActor *, int> actorindex;
+
+	auto it = TThinkerIterator<AActor>();
+	while (auto ac = it.Next())
+	{
+		// Reach is the distance an actor can affect within a tic: its own size and movement plus a melee attack.
+		double reach = ac->radius + MAX(ac->Speed, ac->Vel.XY().Length()) + ac->meleerange;
+		int x1 = bmap.GetBlockX(ac->X() - reach), x2 = bmap.GetBlockX(ac->X() + reach);
+		int y1 = bmap.GetBlockY(ac->Y() - reach), y2 = bmap.GetBlockY(ac->Y() + reach);
+		int first = numcells;
+
+		if (ac->Sector->PortalGroup == 0 && bmap.isValidBlock(x1, y1) && bmap.isValidBlock(x2, y2))
+		{
+			first = y1 * bmap.bmapwidth + x1;
+			for (int y = y1; y <= y2; y++)
+			{
+				for (int x = x1; x <= x2; x++)
+				{
+					MergeIslands(parent, first, y * bmap.bmapwidth + x);
+				}
+			}
+		}
+		actorindex[ac] = actors.Size();
+		actors.Push(ac);
+		actorcell.Push(first);
+	}
+
+	for (unsigned i = 0; i < actors.Size(); i++)
+	{
+		for (AActor *other : { actors[i]->target.Get(), actors[i]->master.Get(), actors[i]->tracer.Get() })
+		{
+			int *index = other != nullptr ? actorindex.CheckKey(other) : nullptr;
+			if (index != nullptr) MergeIslands(parent, actorcell[i], actorcell[*index]);
+		}
+	}
+
+	TMap<int, int> islandsizes;
+	for (auto cell : actorcell)
+	{
+		islandsizes[FindIsland(parent, cell)]++;
+	}
+
+	int largest = 0;
+	TMap<int, int>::Iterator sit(islandsizes);
+	TMap<int, int>::Pair *pair;
+	while (sit.NextPair(pair))
+	{
+		largest = MAX(largest, pair->Value);
+	}
+
+	Printf("%u actors in %u islands, largest island has %d actors\n", actors.Size(), islandsizes.CountUsed(), largest);
+	if (largest > 0)
+	{
+		Printf("Best case concurrent tick speedup: %.2fx\n", double(actors.Size()) / largest);
+	}
+}
+
+//==========================================================================
+//
+// playsimchecksum
+//
+// Prints a checksum of the RNG seeds and all actor positions, velocities,
+// angles, health and sprite frames. Compare the output at the same gametic of two
+// runs of a demo to check that a playsim change kept it bit-identical.
+//
+//==========================================================================
+
+CCMD(playsimchecksum)
+{
+	if (gamestate != GS_LEVEL)
+	{
+		Printf("Not in a level\n");
+		return;
+	}
+
+	uint32_t sum = FRandom::StaticSumSeeds();
+	int count = 0;
+	auto mix = [&](const void *data, size_t size)
+	{
+		auto bytes = (const uint8_t *)data;
+		for (size_t i = 0; i < size; i++)
+		{
+			sum = (sum ^ bytes[i]) * 16777619u;	// FNV-1a
+		}
+	};
+
+	auto it = TThinkerIterator<AActor>();
+	while (auto ac = it.Next())
+	{
+		DVector3 pos = ac->Pos();
+		mix(&pos, sizeof(pos));
+		mix(&ac->Vel, sizeof(ac->Vel));
+		mix(&ac->Angles, sizeof(ac->Angles));
+		mix(&ac->health, sizeof(ac->health));
+		mix(&ac->tics, sizeof(ac->tics));
+		mix(&ac->sprite, sizeof(ac->sprite));
+		mix(&ac->frame, sizeof(ac->frame));
+		count++;
+	}
+	Printf("gametic %d: %d actors, checksum %08x\n", gametic, count, sum);
+}
+
 void DThinker::RunThinkers ()
 {
 	int i, count;
@@ -1045,6 +1196,9 @@ DThinker *FThinkerIterator::Next (bool exact)
 //
 //==========================================================================
 
+ADD_CYCLE_STAT (think, ThinkCycles)
+ADD_CYCLE_STAT (action, ActionCycles)
+
 ADD_STAT (think)
 {
 	FString out;
@@ -33,6 +33,16 @@
 **
 */
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include "files.h"
 #include "i_system.h"
 #include "templates.h"
@@ -350,6 +360,88 @@ public:
 
 
 
+//==========================================================================
+//
+// MappedFileReader
+//
+// reads data from a file that is mapped into memory. Since GetBuffer
+// returns the mapping, stored lumps of an archive opened this way are
+// accessed directly from the mapping instead of being copied to the heap.
+//
+// The mapping is private and writable so that code modifying a lump's
+// cache in place only gets a copy of the affected pages.
+//
+//==========================================================================
+
+class MappedFileReader : public MemoryReader
+{
+#ifdef _WIN32
+	HANDLE hFile = INVALID_HANDLE_VALUE;
+	HANDLE hMapping = nullptr;
+#endif
+
+public:
+	MappedFileReader()
+	{}
+
+	~MappedFileReader()
+	{
+#ifdef _WIN32
+		if (bufptr != nullptr) UnmapViewOfFile(bufptr);
+		if (hMapping != nullptr) CloseHandle(hMapping);
+		if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+#else
+		if (bufptr != nullptr) munmap((void*)bufptr, Length);
+#endif
+		bufptr = nullptr;
+	}
+
+	bool Open(const char *filename)
+	{
+#ifdef _WIN32
+		hFile = CreateFileW(WideString(filename).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (hFile == INVALID_HANDLE_VALUE) return false;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(hFile, &size) || size.QuadPart <= 0 || size.QuadPart > MaxLength()) return false;
+
+		hMapping = CreateFileMappingW(hFile, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+		if (hMapping == nullptr) return false;
+
+		bufptr = (const char *)MapViewOfFile(hMapping, FILE_MAP_COPY, 0, 0, 0);
+		if (bufptr == nullptr) return false;
+		Length = (long)size.QuadPart;
+#else
+		int fd = open(filename, O_RDONLY);
+		if (fd < 0) return false;
+
+		struct stat info;
+		if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0 || info.st_size > MaxLength())
+		{
+			close(fd);
+			return false;
+		}
+		void *mem = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);	// the mapping keeps its own reference to the file.
+		if (mem == MAP_FAILED) return false;
+
+		bufptr = (const char *)mem;
+		Length = (long)info.st_size;
+#endif
+		FilePos = 0;
+		return true;
+	}
+
+private:
+	// 'long' offsets limit files to 2 GB. On 32 bit systems mapping large files
+	// would also quickly exhaust the address space so be more conservative there.
+	static int64_t MaxLength()
+	{
+		return sizeof(void*) >= 8 ? 0x7fffffff : 0x10000000;
+	}
+};
+
+
 //==========================================================================
 //
 // FileReader
@@ -371,6 +463,19 @@ bool FileReader::OpenFile(const char *filename, FileReader::Size start, FileRead
 	return true;
 }
 
+bool FileReader::OpenMappedFile(const char *filename)
+{
+	auto reader = new MappedFileReader;
+	if (!reader->Open(filename))
+	{
+		delete reader;
+		return false;
+	}
+	Close();
+	mReader = reader;
+	return true;
+}
+
 bool FileReader::OpenFilePart(FileReader &parent, FileReader::Size start, FileReader::Size length)
 {
 	auto reader = new FileReaderRedirect(parent, (long)start, (long)length);
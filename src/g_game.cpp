@@ -28,6 +28,8 @@
 #include <stddef.h>
 #include <time.h>
 #include <memory>
+#include <thread>
+#include <atomic>
 #ifdef __APPLE__
 #include <CoreServices/CoreServices.h>
 #endif
@@ -48,6 +50,7 @@
 #include "i_system.h"
 #include "p_saveg.h"
 #include "p_tick.h"
+#include "p_setup.h"
 #include "d_main.h"
 #include "wi_stuff.h"
 #include "hu_stuff.h"
@@ -128,12 +131,14 @@ bool WriteZip(const char *filename, TArray<FString> &filenames, TArray<FCompress
 
 FIntCVar gameskill ("skill", 2, CVAR_SERVERINFO|CVAR_LATCH);
 CVAR(Bool, save_formatted, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)	// use formatted JSON for saves (more readable but a larger files and a bit slower.
+CVAR(Bool, save_binary, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)	// use the compact binary format for level and global data (info.json always stays JSON).
 CVAR (Int, deathmatch, 0, CVAR_SERVERINFO|CVAR_LATCH);
 CVAR (Bool, chasedemo, false, 0);
 CVAR (Bool, storesavepic, false, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
 CVAR (Bool, longsavemessages, true, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
 CVAR (String, save_dir, "", CVAR_ARCHIVE|CVAR_GLOBALCONFIG);
 CVAR (Bool, cl_waitforsave, true, CVAR_ARCHIVE | CVAR_GLOBALCONFIG);
+CVAR (Bool, save_async, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG);	// compress and write savegames on a background thread.
 CVAR (Bool, enablescriptscreenshot, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG);
 EXTERN_CVAR (Float, con_midtime);
 EXTERN_CVAR(Bool, vr_teleport);
@@ -1218,6 +1223,8 @@ void G_Ticker ()
 		}
 		C_AdjustBottom ();
 	}
+	P_WarmNodeCacheTicker();
+	G_CompleteAsyncSave(false);
 
 	if (oldgamestate != gamestate)
 	{
@@ -1943,6 +1950,9 @@ void G_DoLoadGame ()
 	hidecon = gameaction == ga_loadgamehidecon;
 	gameaction = ga_nothing;
 
+	// The file may still be in the process of being written.
+	G_CompleteAsyncSave(true);
+
 	std::unique_ptr<FResourceFile> resfile(FResourceFile::OpenResourceFile(savename.GetChars(), true, true));
 	if (resfile == nullptr)
 	{
@@ -2292,12 +2302,120 @@ static void PutSavePic (FileWriter *file, int width, int height)
 	}
 }
 
+//==========================================================================
+//
+// Background savegame writer
+//
+// With save_async the game thread only builds the savegame's JSON data.
+// Compressing it and writing the zip is done by a worker thread. Only one
+// save can be in flight at a time, so a new save or a load first waits
+// for the previous one to be finished.
+//
+//==========================================================================
+
+struct FSaveGameJob
+{
+	FString filename;
+	FString description;
+	bool okForQuicksave;
+	bool forceQuicksave;
+	TArray<FString> filenames;
+	TArray<FCompressedBuffer> content;	// owned by the job
+	bool written = false;
+	uint64_t worktime = 0;
+	std::atomic<bool> done { false };
+	std::thread thread;
+};
+
+static FSaveGameJob *SaveJob;
+static double SaveBlockedMS, SaveWaitMS, SaveWorkMS;
+static bool SaveWasAsync;
+
+static struct FSaveGameShutdown
+{
+	~FSaveGameShutdown()
+	{
+		// Let a pending save complete so that the file does not get truncated on exit.
+		if (SaveJob != nullptr && SaveJob->thread.joinable()) SaveJob->thread.join();
+	}
+} SaveGameShutdown;
+
+static void G_WriteSaveGameJob(FSaveGameJob *job)
+{
+	uint64_t start = I_nsTime();
+	for (unsigned i = 0; i < job->content.Size(); i++)
+	{
+		// The savepic is a PNG which is compressed already.
+		if (job->filenames[i].CompareNoCase("savepic.png") != 0) job->content[i].Compress();
+	}
+	job->written = WriteZip(job->filename, job->filenames, job->content);
+	for (auto &buf : job->content) buf.Clean();
+	job->worktime = I_nsTime() - start;
+	job->done = true;
+}
+
+static void G_FinishSaveGame(const FString &filename, const char *description, bool okForQuicksave, bool forceQuicksave, bool written)
+{
+	bool succeeded = false;
+
+	if (written)
+	{
+		// Check whether the file is ok by trying to open it.
+		FResourceFile *test = FResourceFile::OpenResourceFile(filename, true);
+		if (test != nullptr)
+		{
+			delete test;
+			succeeded = true;
+		}
+	}
+
+	if (succeeded)
+	{
+		savegameManager.NotifyNewSave(filename, description, okForQuicksave, forceQuicksave);
+		BackupSaveName = filename;
+
+		if (longsavemessages) Printf("%s (%s)\n", GStrings("GGSAVED"), filename.GetChars());
+		else Printf("%s\n", GStrings("GGSAVED"));
+	}
+	else
+	{
+		Printf(PRINT_HIGH, "%s\n", GStrings("TXT_SAVEFAILED"));
+	}
+}
+
+//==========================================================================
+//
+// Reports the result of a background save once it is done.
+// If 'wait' is set this blocks until the save has been written.
+//
+//==========================================================================
+
+void G_CompleteAsyncSave(bool wait)
+{
+	if (SaveJob == nullptr || (!wait && !SaveJob->done)) return;
+
+	SaveJob->thread.join();
+	SaveWorkMS = SaveJob->worktime / 1e6;
+	G_FinishSaveGame(SaveJob->filename, SaveJob->description, SaveJob->okForQuicksave, SaveJob->forceQuicksave, SaveJob->written);
+	delete SaveJob;
+	SaveJob = nullptr;
+}
+
+ADD_STAT (savegame)
+{
+	FString out;
+	out.Format("Last save (%s): game thread blocked %.2f ms, waiting for previous save %.2f ms, background %.2f ms%s",
+		SaveWasAsync ? "async" : "sync", SaveBlockedMS, SaveWaitMS, SaveWorkMS, SaveJob != nullptr ? " (writing)" : "");
+	return out;
+}
+
 void G_DoSaveGame (bool okForQuicksave, bool forceQuicksave, FString filename, const char *description)
 {
 	TArray<FCompressedBuffer> savegame_content;
 	TArray<FString> savegame_filenames;
 
 	char buf[100];
+	uint64_t savestart = I_nsTime();
 
 	// Do not even try, if we're not in a level. (Can happen after
 	// a demo finishes playback.)
@@ -2311,13 +2429,22 @@ void G_DoSaveGame (bool okForQuicksave, bool forceQuicksave, FString filename, c
 		filename = G_BuildSaveName ("demosave." SAVEGAME_EXT, -1);
 	}
 
+	bool async = save_async;
+	SaveWaitMS = 0;
+	if (SaveJob != nullptr)
+	{
+		uint64_t waitstart = I_nsTime();
+		G_CompleteAsyncSave(true);
+		SaveWaitMS = (I_nsTime() - waitstart) / 1e6;
+	}
+
 	if (cl_waitforsave)
 		I_FreezeTime(true);
 
 	insave = true;
 	try
 	{
-		G_SnapshotLevel();
+		G_SnapshotLevel(!async);
 	}
 	catch(CRecoverableError &err)
 	{
@@ -2344,7 +2471,7 @@ void G_DoSaveGame (bool okForQuicksave, bool forceQuicksave, FString filename, c
 	FSerializer savegameglobals;	// and this for non-level related info that must be saved.
 
 	savegameinfo.OpenWriter(true);
-	savegameglobals.OpenWriter(save_formatted);
+	savegameglobals.OpenWriter(save_formatted, save_binary);
 
 	SaveVersion = SAVEVER;
 	PutSavePic(&savepic, SAVEPICWIDTH, SAVEPICHEIGHT);
@@ -2394,45 +2521,54 @@ void G_DoSaveGame (bool okForQuicksave, bool forceQuicksave, FString filename, c
 
 	savegame_content.Push(bufpng);
 	savegame_filenames.Push("savepic.png");
-	savegame_content.Push(savegameinfo.GetCompressedOutput());
+	// In async mode the worker compresses the JSON data.
+	// These two buffers are ours, everything else belongs to someone else.
+	unsigned infoindex = savegame_content.Push(async ? savegameinfo.GetStoredOutput() : savegameinfo.GetCompressedOutput());
 	savegame_filenames.Push("info.json");
-	savegame_content.Push(savegameglobals.GetCompressedOutput());
+	unsigned globalsindex = savegame_content.Push(async ? savegameglobals.GetStoredOutput() : savegameglobals.GetCompressedOutput());
 	savegame_filenames.Push("globals.json");
 
 	G_WriteSnapshots (savegame_filenames, savegame_content);
 	
 
-	bool succeeded = false;
-
-	if (WriteZip(filename, savegame_filenames, savegame_content))
+	if (async)
 	{
-		// Check whether the file is ok by trying to open it.
-		FResourceFile *test = FResourceFile::OpenResourceFile(filename, true);
-		if (test != nullptr)
+		auto job = new FSaveGameJob;
+		job->filename = filename;
+		job->description = description;
+		job->okForQuicksave = okForQuicksave;
+		job->forceQuicksave = forceQuicksave;
+		job->filenames = std::move(savegame_filenames);
+
+		for (unsigned i = 0; i < savegame_content.Size(); i++)
 		{
-			delete test;
-			succeeded = true;
+			FCompressedBuffer cbuf = savegame_content[i];
+			if (cbuf.mBuffer == level.info->Snapshot.mBuffer)
+			{
+				// The current level's snapshot gets discarded below so the job can take it over.
+				level.info->Snapshot.mBuffer = nullptr;
+			}
+			else if (i != infoindex && i != globalsindex)
+			{
+				// The savepic and the snapshots of other hub levels are not ours, so the job needs a copy.
+				cbuf.mBuffer = new char[cbuf.mCompressedSize];
+				memcpy(cbuf.mBuffer, savegame_content[i].mBuffer, cbuf.mCompressedSize);
+			}
+			job->content.Push(cbuf);
 		}
-	}
-
-	if (succeeded)
-	{
-		savegameManager.NotifyNewSave(filename, description, okForQuicksave, forceQuicksave);
-		BackupSaveName = filename;
-
-		if (longsavemessages) Printf("%s (%s)\n", GStrings("GGSAVED"), filename.GetChars());
-		else Printf("%s\n", GStrings("GGSAVED"));
+		job->thread = std::thread(G_WriteSaveGameJob, job);
+		SaveJob = job;
 	}
 	else
 	{
-		Printf(PRINT_HIGH, "%s\n", GStrings("TXT_SAVEFAILED"));
-	}
-
+		G_FinishSaveGame(filename, description, okForQuicksave, forceQuicksave, WriteZip(filename, savegame_filenames, savegame_content));
 
-	// delete the JSON buffers we created just above. Everything else will
-	// either still be needed or taken care of automatically.
-	savegame_content[1].Clean();
-	savegame_content[2].Clean();
+		// delete the JSON buffers we created just above. Everything else will
+		// either still be needed or taken care of automatically.
+		savegame_content[infoindex].Clean();
+		savegame_content[globalsindex].Clean();
+		SaveWorkMS = 0;
+	}
 
 	// We don't need the snapshot any longer.
 	level.info->Snapshot.Clean();
@@ -2441,6 +2577,9 @@ void G_DoSaveGame (bool okForQuicksave, bool forceQuicksave, FString filename, c
 
 	if (cl_waitforsave)
 		I_FreezeTime(false);
+
+	SaveWasAsync = async;
+	SaveBlockedMS = (I_nsTime() - savestart) / 1e6;
 }
 
 
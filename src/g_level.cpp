@@ -106,6 +106,7 @@ void STAT_StartNewGame(const char *lev);
 void STAT_ChangeLevel(const char *newl);
 
 EXTERN_CVAR(Bool, save_formatted)
+EXTERN_CVAR(Bool, save_binary)
 EXTERN_CVAR (Float, sv_gravity)
 EXTERN_CVAR (Float, sv_aircontrol)
 EXTERN_CVAR (Int, disableautosave)
@@ -1714,7 +1715,7 @@ void G_AirControlChanged ()
 //
 //==========================================================================
 
-void G_SnapshotLevel ()
+void G_SnapshotLevel (bool compress)
 {
 	level.info->Snapshot.Clean();
 
@@ -1722,11 +1723,11 @@ void G_SnapshotLevel ()
 	{
 		FSerializer arc;
 
-		if (arc.OpenWriter(save_formatted))
+		if (arc.OpenWriter(save_formatted, save_binary))
 		{
 			SaveVersion = SAVEVER;
 			G_SerializeLevel(arc, false);
-			level.info->Snapshot = arc.GetCompressedOutput();
+			level.info->Snapshot = compress ? arc.GetCompressedOutput() : arc.GetStoredOutput();
 		}
 	}
 }
@@ -1953,6 +1954,64 @@ CCMD(listsnapshots)
 	}
 }
 
+//==========================================================================
+//
+// Compares the savegame formats on the current level.
+// Only the document decoding is timed for loading because restoring
+// the level from it is the same for all formats.
+//
+//==========================================================================
+
+CCMD(bench_saveformat)
+{
+	static const char *const formatnames[] = { "JSON", "JSON (formatted)", "binary" };
+
+	if (gamestate != GS_LEVEL || !level.info->isValid())
+	{
+		Printf("Not in a level\n");
+		return;
+	}
+	int count = argv.argc() > 1 ? clamp(atoi(argv[1]), 1, 100) : 5;
+
+	Printf("%s, %d runs:\n", level.MapName.GetChars(), count);
+	for (int format = 0; format < 3; format++)
+	{
+		uint64_t writetime = 0, readtime = 0;
+		unsigned size = 0, compressedsize = 0;
+
+		for (int i = 0; i < count; i++)
+		{
+			FCompressedBuffer buff;
+			uint64_t start = I_nsTime();
+			{
+				FSerializer arc;
+				arc.OpenWriter(format == 1, format == 2);
+				SaveVersion = SAVEVER;
+				G_SerializeLevel(arc, false);
+				buff = arc.GetStoredOutput();
+			}
+			writetime += I_nsTime() - start;
+
+			start = I_nsTime();
+			{
+				FSerializer arc;
+				arc.OpenReader(&buff);
+			}
+			readtime += I_nsTime() - start;
+
+			size = buff.mSize;
+			if (i == 0)
+			{
+				buff.Compress();
+				compressedsize = buff.mCompressedSize;
+			}
+			buff.Clean();
+		}
+		Printf("%-17s write %7.2f ms, parse %7.2f ms, %9u bytes, %8u compressed\n", formatnames[format],
+			writetime / (count * 1e6), readtime / (count * 1e6), size, compressedsize);
+	}
+}
+
 //==========================================================================
 //
 //
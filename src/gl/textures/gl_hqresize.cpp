@@ -34,11 +34,32 @@
 **
 */
 
+#include <sys/stat.h>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <zlib.h>
+
+#ifndef _WIN32
+#include <utime.h>
+#else
+#include <sys/utime.h>
+#endif
+
 #include "gl/system/gl_system.h"
 #include "gl/system/gl_interface.h"
 #include "gl/renderer/gl_renderer.h"
 #include "gl/textures/gl_texture.h"
+#include "gl/textures/gl_material.h"
 #include "c_cvars.h"
+#include "c_dispatch.h"
+#include "cmdlib.h"
+#include "m_misc.h"
+#include "m_swap.h"
+#include "md5.h"
+#include "files.h"
+#include "doomerrors.h"
+#include "i_time.h"
 #include "gl/hqnx/hqx.h"
 #ifdef HAVE_MMX
 #include "gl/hqnx_asm/hqnx_asm.h"
@@ -98,6 +119,9 @@ CUSTOM_CVAR(Int, gl_texture_hqresize_mt_height, 4, CVAR_ARCHIVE | CVAR_GLOBALCON
 
 CVAR(Int, xbrz_colorformat, 0, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
 
+CVAR(Bool, gl_texture_hqresize_cache, true, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
+CVAR(Int, gl_texture_hqresize_cachesize, 256, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)	// in MB, 0 means unlimited
+
 static void xbrzApplyOptions()
 {
 	if (gl_texture_hqresizemult != 0 && (gl_texture_hqresizemode == 4 || gl_texture_hqresizemode == 5))
@@ -285,13 +309,8 @@ static unsigned char *hqNxAsmHelper( void (*hqNxFunction) ( int*, unsigned char*
 	outWidth = N * inWidth;
 	outHeight = N *inHeight;
 
-	static int initdone = false;
-
-	if (!initdone)
-	{
-		HQnX_asm::InitLUTs();
-		initdone = true;
-	}
+	// The precache threads can get here at the same time.
+	static bool initdone = (HQnX_asm::InitLUTs(), true);
 
 	HQnX_asm::CImage cImageIn;
 	cImageIn.SetImage(inputBuffer, inWidth, inHeight, 32);
@@ -312,13 +331,8 @@ static unsigned char *hqNxHelper( void (HQX_CALLCONV *hqNxFunction) ( unsigned*,
 							  int &outWidth,
 							  int &outHeight )
 {
-	static int initdone = false;
-
-	if (!initdone)
-	{
-		hqxInit();
-		initdone = true;
-	}
+	// The precache threads can get here at the same time.
+	static bool initdone = (hqxInit(), true);
 	outWidth = N * inWidth;
 	outHeight = N *inHeight;
 
@@ -400,6 +414,237 @@ static void xbrzOldScale(size_t factor, const uint32_t* src, uint32_t* trg, int
 	xbrz_old::scale(factor, src, trg, srcWidth, srcHeight, cfg, yFirst, yLast);
 }
 
+//===========================================================================
+//
+// Runs the selected scaler. Returns inputBuffer if there is nothing to do,
+// otherwise frees it and returns the upsampled buffer.
+//
+//===========================================================================
+
+static unsigned char *UpscaleBuffer(int type, int mult, unsigned char *inputBuffer, const int inWidth, const int inHeight, int &outWidth, int &outHeight)
+{
+	switch (type)
+	{
+	case 1:
+		switch(mult)
+		{
+		case 2:
+			return scaleNxHelper( &scale2x, 2, inputBuffer, inWidth, inHeight, outWidth, outHeight );
+		case 3:
+			return scaleNxHelper( &scale3x, 3, inputBuffer, inWidth, inHeight, outWidth, outHeight );
+		default:
+			return scaleNxHelper( &scale4x, 4, inputBuffer, inWidth, inHeight, outWidth, outHeight );
+		}
+	case 2:
+		switch(mult)
+		{
+		case 2:
+			return hqNxHelper( &hq2x_32, 2, inputBuffer, inWidth, inHeight, outWidth, outHeight );
+		case 3:
+			return hqNxHelper( &hq3x_32, 3, inputBuffer, inWidth, inHeight, outWidth, outHeight );
+		default:
+			return hqNxHelper( &hq4x_32, 4, inputBuffer, inWidth, inHeight, outWidth, outHeight );
+		}
+#ifdef HAVE_MMX
+	case 3:
+		switch(mult)
+		{
+		case 2:
+			return hqNxAsmHelper( &HQnX_asm::hq2x_32, 2, inputBuffer, inWidth, inHeight, outWidth, outHeight );
+		case 3:
+			return hqNxAsmHelper( &HQnX_asm::hq3x_32, 3, inputBuffer, inWidth, inHeight, outWidth, outHeight );
+		default:
+			return hqNxAsmHelper( &HQnX_asm::hq4x_32, 4, inputBuffer, inWidth, inHeight, outWidth, outHeight );
+		}
+#endif
+	case 4:
+		return xbrzHelper(xbrz::scale, mult, inputBuffer, inWidth, inHeight, outWidth, outHeight );
+	case 5:			
+		return xbrzHelper(xbrzOldScale, mult, inputBuffer, inWidth, inHeight, outWidth, outHeight );
+	case 6:
+		return normalNx(mult, inputBuffer, inWidth, inHeight, outWidth, outHeight );
+	}
+	return inputBuffer;
+}
+
+//===========================================================================
+//
+// Upscale cache
+//
+// Results of the expensive scalers are kept on disk, named after the MD5
+// of the source pixels and everything that affects the scaler's output.
+// The files are the scaled pixels, deflated. Hits touch the file, and
+// the directory is kept below gl_texture_hqresize_cachesize by evicting
+// the least recently used files after each precache. These functions can
+// be called from the precache threads.
+//
+//===========================================================================
+
+static const uint32_t UPSCALE_CACHE_VERSION = 1;
+
+static std::atomic<int> UpscaleCacheWrites;
+
+static FString UpscaleCacheDir(bool create)
+{
+	FString path = M_GetCachePath(create);
+	path << "/hqresize";
+	if (create) CreatePath(path);
+	return path;
+}
+
+static FString UpscaleCacheName(const uint8_t *md5, bool create)
+{
+	FString path = UpscaleCacheDir(create);
+	path << '/';
+	for (int i = 0; i < 16; i++)
+	{
+		path.AppendFormat("%02x", md5[i]);
+	}
+	path << ".hqc";
+	return path;
+}
+
+static void UpscaleCacheKey(uint8_t *md5, int type, int mult, const unsigned char *inputBuffer, int inWidth, int inHeight)
+{
+	MD5Context context;
+	int32_t params[] = { (int32_t)UPSCALE_CACHE_VERSION, type, mult, inWidth, inHeight, 0 };
+	if (type == 4 || type == 5)
+	{
+		params[5] = xbrz_colorformat;
+	}
+	context.Update((const uint8_t *)params, sizeof(params));
+	if (type == 4 || type == 5)
+	{
+		float cfg[] = { xbrz_luminanceweight, xbrz_equalcolortolerance, xbrz_centerdirectionbias, xbrz_dominantdirectionthreshold, xbrz_steepdirectionthreshold };
+		context.Update((const uint8_t *)cfg, sizeof(cfg));
+	}
+	context.Update(inputBuffer, inWidth * inHeight * 4);
+	context.Final(md5);
+}
+
+static unsigned char *ReadUpscaleCache(const uint8_t *md5, int outWidth, int outHeight)
+{
+	FString path = UpscaleCacheName(md5, false);
+	FileReader fr;
+	uint32_t header[4];
+
+	if (!fr.OpenFile(path) || fr.Read(header, sizeof(header)) != sizeof(header) ||
+		memcmp(header, "HQRC", 4) || LittleLong(header[1]) != UPSCALE_CACHE_VERSION ||
+		LittleLong(header[2]) != (uint32_t)outWidth || LittleLong(header[3]) != (uint32_t)outHeight)
+	{
+		return nullptr;
+	}
+
+	TArray<Bytef> compressed;
+	compressed.Resize(unsigned(fr.GetLength() - sizeof(header)));
+	if (fr.Read(compressed.Data(), compressed.Size()) != (long)compressed.Size())
+	{
+		return nullptr;
+	}
+	fr.Close();
+
+	uLongf size = uLongf(outWidth) * outHeight * 4;
+	unsigned char *buffer = new unsigned char[size];
+	if (uncompress(buffer, &size, compressed.Data(), compressed.Size()) != Z_OK || size != uLongf(outWidth) * outHeight * 4)
+	{
+		delete[] buffer;
+		return nullptr;
+	}
+	// Mark the file as recently used for the eviction policy.
+	utime(path, nullptr);
+	return buffer;
+}
+
+static void WriteUpscaleCache(const uint8_t *md5, const unsigned char *buffer, int outWidth, int outHeight)
+{
+	uLong size = uLong(outWidth) * outHeight * 4;
+	uLongf outlen = compressBound(size);
+	TArray<Bytef> compressed;
+	uint32_t header[4] = { 0, LittleLong(UPSCALE_CACHE_VERSION), LittleLong((uint32_t)outWidth), LittleLong((uint32_t)outHeight) };
+
+	memcpy(header, "HQRC", 4);
+	compressed.Resize(unsigned(outlen + sizeof(header)));
+	memcpy(compressed.Data(), header, sizeof(header));
+	if (compress2(compressed.Data() + sizeof(header), &outlen, buffer, size, Z_BEST_SPEED) != Z_OK)
+	{
+		return;
+	}
+
+	// Write to a temporary file first so that no other thread can see a partial one.
+	FString path = UpscaleCacheName(md5, true);
+	FString temp;
+	temp.Format("%s.%d.tmp", path.GetChars(), UpscaleCacheWrites++);
+	FILE *f = fopen(temp, "wb");
+	if (f != nullptr)
+	{
+		bool ok = fwrite(compressed.Data(), 1, outlen + sizeof(header), f) == outlen + sizeof(header);
+		ok &= fclose(f) == 0;
+		remove(path);
+		if (!ok || rename(temp, path) != 0)
+		{
+			remove(temp);
+		}
+	}
+}
+
+//===========================================================================
+//
+// Removes leftovers and evicts the least recently used files until the
+// cache fits within gl_texture_hqresize_cachesize.
+//
+//===========================================================================
+
+void gl_TrimUpscaleCache()
+{
+	struct FCacheEntry
+	{
+		FString Filename;
+		int64_t Size;
+		time_t Time;
+	};
+	TArray<FFileList> list;
+	TArray<FCacheEntry> entries;
+	int64_t total = 0;
+	int64_t limit = int64_t(*gl_texture_hqresize_cachesize) << 20;
+	FString dir = UpscaleCacheDir(false);
+
+	if (UpscaleCacheWrites == 0 || !DirExists(dir)) return;
+	UpscaleCacheWrites = 0;
+	try
+	{
+		ScanDirectory(list, dir + "/");
+	}
+	catch (CRecoverableError &)
+	{
+		return;
+	}
+
+	for (auto &file : list)
+	{
+		struct stat info;
+		if (file.isDirectory || stat(file.Filename, &info) != 0) continue;
+
+		if (file.Filename.Len() < 4 || file.Filename.Right(4).CompareNoCase(".hqc"))
+		{
+			// Only leftovers of interrupted writes can be in here, unless they are being written right now.
+			if (time(nullptr) - info.st_mtime > 60) remove(file.Filename);
+			continue;
+		}
+		entries.Push({ file.Filename, (int64_t)info.st_size, info.st_mtime });
+		total += info.st_size;
+	}
+
+	if (limit <= 0 || total <= limit) return;
+
+	std::sort(entries.begin(), entries.end(), [](const FCacheEntry &a, const FCacheEntry &b) { return a.Time < b.Time; });
+	for (unsigned i = 0; i < entries.Size() && total > limit; i++)
+	{
+		if (remove(entries[i].Filename) == 0)
+		{
+			total -= entries[i].Size;
+		}
+	}
+}
 
 //===========================================================================
 // 
@@ -463,47 +708,106 @@ unsigned char *gl_CreateUpsampledTextureBuffer ( const FTexture *inputTexture, u
 		if (mult < 2)
 			type = 0;
 
-		switch (type)
+		// scaleNx and plain resizing are cheaper than reading the cache.
+		if (gl_texture_hqresize_cache && type >= 2 && type <= 5)
 		{
-		case 1:
-			switch(mult)
+			uint8_t md5[16];
+			UpscaleCacheKey(md5, type, mult, inputBuffer, inWidth, inHeight);
+			unsigned char *cached = ReadUpscaleCache(md5, inWidth * mult, inHeight * mult);
+			if (cached != nullptr)
 			{
-			case 2:
-				return scaleNxHelper( &scale2x, 2, inputBuffer, inWidth, inHeight, outWidth, outHeight );
-			case 3:
-				return scaleNxHelper( &scale3x, 3, inputBuffer, inWidth, inHeight, outWidth, outHeight );
-			default:
-				return scaleNxHelper( &scale4x, 4, inputBuffer, inWidth, inHeight, outWidth, outHeight );
+				delete[] inputBuffer;
+				outWidth = inWidth * mult;
+				outHeight = inHeight * mult;
+				return cached;
 			}
-		case 2:
-			switch(mult)
-			{
-			case 2:
-				return hqNxHelper( &hq2x_32, 2, inputBuffer, inWidth, inHeight, outWidth, outHeight );
-			case 3:
-				return hqNxHelper( &hq3x_32, 3, inputBuffer, inWidth, inHeight, outWidth, outHeight );
-			default:
-				return hqNxHelper( &hq4x_32, 4, inputBuffer, inWidth, inHeight, outWidth, outHeight );
-			}
-#ifdef HAVE_MMX
-		case 3:
-			switch(mult)
+			unsigned char *buffer = UpscaleBuffer(type, mult, inputBuffer, inWidth, inHeight, outWidth, outHeight);
+			if (buffer != inputBuffer)
 			{
-			case 2:
-				return hqNxAsmHelper( &HQnX_asm::hq2x_32, 2, inputBuffer, inWidth, inHeight, outWidth, outHeight );
-			case 3:
-				return hqNxAsmHelper( &HQnX_asm::hq3x_32, 3, inputBuffer, inWidth, inHeight, outWidth, outHeight );
-			default:
-				return hqNxAsmHelper( &HQnX_asm::hq4x_32, 4, inputBuffer, inWidth, inHeight, outWidth, outHeight );
+				WriteUpscaleCache(md5, buffer, outWidth, outHeight);
 			}
-#endif
-		case 4:
-			return xbrzHelper(xbrz::scale, mult, inputBuffer, inWidth, inHeight, outWidth, outHeight );
-		case 5:			
-			return xbrzHelper(xbrzOldScale, mult, inputBuffer, inWidth, inHeight, outWidth, outHeight );
-		case 6:
-			return normalNx(mult, inputBuffer, inWidth, inHeight, outWidth, outHeight );
+			return buffer;
 		}
+		return UpscaleBuffer(type, mult, inputBuffer, inWidth, inHeight, outWidth, outHeight);
 	}
 	return inputBuffer;
 }
+
+//===========================================================================
+//
+// Cache prefill
+//
+// gl_texture_hqresize_prefill scales every wall, flat and sprite in the
+// loaded resources, so that the cache is warm before they are first used.
+// The textures are scaled on worker threads, but the command waits for
+// them: reading the texture sources is only safe while the main thread
+// is not reading lumps or pixels itself, the same as during the precache.
+// Cached textures are skipped quickly, so it can be run again anytime.
+//
+//===========================================================================
+
+EXTERN_CVAR(Int, gl_precache_threads)
+
+CCMD(gl_texture_hqresize_prefill)
+{
+	if (!gl_texture_hqresize_cache || gl_texture_hqresizemult < 2 || gl_texture_hqresizemode < 2 || gl_texture_hqresizemode > 5)
+	{
+		Printf("The upscale cache is only used for hqNx and xBRZ scaling.\n");
+		return;
+	}
+
+	TArray<FGLTexture *> layers;
+	TArray<FTexture *> hireschecks;
+	for (int i = 0; i < TexMan.NumTextures(); i++)
+	{
+		FTexture *tex = TexMan.ByIndex(i);
+		bool sprite;
+		switch (tex->UseType)
+		{
+		case ETextureType::Wall:
+		case ETextureType::Flat:
+		case ETextureType::Override:
+			sprite = false;
+			break;
+
+		case ETextureType::Sprite:
+		case ETextureType::SkinSprite:
+			sprite = true;
+			break;
+
+		default:
+			continue;
+		}
+		// Materials can only be created here on the main thread.
+		FMaterial *mat = FMaterial::ValidateTexture(tex, sprite);
+		FTexture *hirescheck;
+		FGLTexture *layer = mat != nullptr ? mat->GetPrecacheLayer(&hirescheck) : nullptr;
+		if (layer != nullptr)
+		{
+			layers.Push(layer);
+			hireschecks.Push(hirescheck);
+		}
+	}
+
+	Printf("Prefilling the upscale cache with %u textures\n", layers.Size());
+	uint64_t start = I_msTime();
+
+	int count = gl_precache_threads > 0 ? MIN(*gl_precache_threads, 8) : clamp((int)std::thread::hardware_concurrency() - 1, 1, 8);
+	std::atomic<unsigned> next = { 0 };
+	std::vector<std::thread> threads;
+	for (int i = 0; i < count; i++)
+	{
+		threads.emplace_back([&]()
+		{
+			for (unsigned j = next++; j < layers.Size(); j = next++)
+			{
+				int w, h;
+				delete[] layers[j]->CreateTexBuffer(0, w, h, hireschecks[j]);
+			}
+		});
+	}
+	for (auto &thread : threads) thread.join();
+
+	Printf("Upscale cache prefilled in %.1f s\n", (I_msTime() - start) / 1000.);
+	gl_TrimUpscaleCache();
+}
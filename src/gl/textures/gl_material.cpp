@@ -66,6 +66,8 @@ extern TArray<UserShaderDesc> usershaders;
 //
 //===========================================================================
 
+std::mutex FGLTexture::SourceLock;
+
 //===========================================================================
 //
 // Constructor
@@ -195,6 +197,7 @@ unsigned char * FGLTexture::CreateTexBuffer(int translation, int & w, int & h, F
 	unsigned char * buffer;
 	int W, H;
 	int isTransparent = -1;
+	std::unique_lock<std::mutex> lock(SourceLock);
 
 
 	// Textures that are already scaled in the texture lump will not get replaced
@@ -252,6 +255,7 @@ unsigned char * FGLTexture::CreateTexBuffer(int translation, int & w, int & h, F
 
 	// if we just want the texture for some checks there's no need for upsampling.
 	if (!createexpanded) return buffer;
+	lock.unlock();
 
 	// [BB] The hqnx upsampling (not the scaleN one) destroys partial transparency, don't upsamle textures using it.
 	// [BB] Potentially upsample the buffer.
@@ -320,7 +324,7 @@ const FHardwareTexture *FGLTexture::Bind(int texunit, int clampmode, int transla
 			// Create this texture
 			unsigned char * buffer = NULL;
 			
-			if (!tex->bHasCanvas)
+			if (!tex->bHasCanvas && (translation != 0 || alphatrans || (buffer = gl_TakePrecachedBuffer(this, hirescheck, w, h)) == NULL))
 			{
 				buffer = CreateTexBuffer(translation, w, h, hirescheck, true, alphatrans);
 				if (tex->bWarped && gl.legacyMode && w*h <= 256*256)	// do not software-warp larger textures, especially on the old systems that still need this fallback.
@@ -333,6 +337,7 @@ const FHardwareTexture *FGLTexture::Bind(int texunit, int clampmode, int transla
 					buffer = warpbuffer;
 					wt->GenTime[0] = screen->FrameTime;
 				}
+				std::lock_guard<std::mutex> lock(SourceLock);
 				tex->ProcessData(buffer, w, h, false);
 			}
 			if (!hwtex->CreateTexture(buffer, w, h, texunit, needmipmap, translation, "FGLTexture.Bind",true))
@@ -708,6 +713,31 @@ void FMaterial::Precache()
 	Bind(0, 0);
 }
 
+//===========================================================================
+//
+// Returns the layer Precache() will have to create an untranslated buffer
+// for and the hires check it will use, or NULL if that is already uploaded
+// or needs more than CreateTexBuffer and ProcessData.
+//
+//===========================================================================
+FGLTexture *FMaterial::GetPrecacheLayer(FTexture **hirescheck)
+{
+	FTexture *basetex = mBaseLayer->tex;
+
+	if (basetex->UseType == ETextureType::Null || basetex->bHasCanvas || basetex->bWarped || tex->bHasCanvas)
+	{
+		return NULL;
+	}
+	if (mBaseLayer->mHwTexture != NULL && mBaseLayer->mHwTexture->GetTextureHandle(0) != 0)
+	{
+		return NULL;
+	}
+	// Must match what Bind decides for the clamp modes used by precaching.
+	bool allowhires = tex->Scale.X == 1 && tex->Scale.Y == 1 && !mExpanded;
+	*hirescheck = allowhires ? tex : NULL;
+	return mBaseLayer;
+}
+
 //===========================================================================
 //
 //
@@ -2,6 +2,7 @@
 #ifndef __GL_MATERIAL_H
 #define __GL_MATERIAL_H
 
+#include <mutex>
 #include "m_fixed.h"
 #include "textures/textures.h"
 #include "gl/textures/gl_hwtexture.h"
@@ -43,6 +44,10 @@ public:
 	int8_t bIsTransparent;
 	int HiresLump;
 
+	// Serializes everything in CreateTexBuffer that reads texture sources,
+	// so that buffers can be created on the precache threads.
+	static std::mutex SourceLock;
+
 private:
 	FHardwareTexture *mHwTexture;
 
@@ -113,6 +118,7 @@ public:
 	~FMaterial();
 	void Precache();
 	void PrecacheList(SpriteHits &translations);
+	FGLTexture *GetPrecacheLayer(FTexture **hirescheck);
 	bool isMasked() const
 	{
 		return mBaseLayer->tex->bMasked;
@@ -24,6 +24,8 @@
 **
 */
 
+#include <thread>
+#include <condition_variable>
 #include "gl/system/gl_system.h"
 #include "c_cvars.h"
 #include "w_wad.h"
@@ -49,6 +51,7 @@
 #include "gl/textures/gl_translate.h"
 #include "gl/models/gl_models.h"
 #include "stats.h"
+#include "i_time.h"
 
 //==========================================================================
 //
@@ -91,6 +94,8 @@ CUSTOM_CVAR(Bool, gl_texture_usehires, true, CVAR_ARCHIVE|CVAR_NOINITCALL)
 }
 
 CVAR(Bool, gl_precache, true, CVAR_ARCHIVE)
+CVAR(Int, gl_precache_threads, 0, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)		// 0 = automatic, < 0 = decode on the main thread
+CVAR(Int, gl_precache_cachesize, 128, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)	// in MB, decoded textures waiting for upload
 
 TexFilter_s TexFilter[]={
 	{GL_NEAREST,					GL_NEAREST,		false},
@@ -592,6 +597,241 @@ void AddAutoMaterials()
 	}
 }
 
+//==========================================================================
+//
+// Precache decoding
+//
+// The untranslated buffers the precache is going to upload are created
+// ahead of time on worker threads, in the order the precache visits the
+// textures, and FGLTexture::Bind picks them up instead of creating them
+// itself. Reading the texture sources goes through the WAD and patch
+// caches, so it is serialized by FGLTexture::SourceLock. The workers run in
+// parallel for upscaling, and all of them overlap with the uploads on the
+// main thread. Decoded buffers that wait for upload are limited to
+// gl_precache_cachesize.
+//
+//==========================================================================
+
+struct FPrecacheJob
+{
+	enum EState { Queued, Decoding, Done, Taken, Discard };
+
+	FGLTexture *Tex;
+	FTexture *HiresCheck;
+	const char *Format;
+	unsigned char *Buffer = nullptr;
+	int Width = 0, Height = 0;
+	uint64_t DecodeTime = 0;
+	EState State = Queued;
+};
+
+struct FPrecacheFormatStats
+{
+	int Count = 0;
+	uint64_t Time = 0;
+	uint64_t Pixels = 0;
+};
+
+static struct FPrecacheDecoder
+{
+	std::mutex Lock;
+	std::condition_variable Wake;
+	std::condition_variable Done;
+	std::vector<std::thread> Threads;
+	TArray<FPrecacheJob> Jobs;
+	TMap<FGLTexture *, unsigned> JobIndex;
+	unsigned Next = 0;			// next job for the workers
+	unsigned Retired = 0;		// jobs before this one are past the precache loop
+	size_t WaitingBytes = 0;	// decoded but not uploaded yet
+	size_t MaxBytes = 0;
+	bool Active = false;
+
+	// Results of the last precache, for gl_precachestats.
+	TMap<FString, FPrecacheFormatStats> FormatStats;
+	double WallTime = 0;
+	int Decoded = 0, Queued = 0;
+
+	void Worker();
+	void Start(int threads);
+	void Stop();
+	void Retire(unsigned count);
+	unsigned char *Take(FGLTexture *gltex, FTexture *hirescheck, int &w, int &h);
+} PrecacheDecoder;
+
+void FPrecacheDecoder::Worker()
+{
+	std::unique_lock<std::mutex> lock(Lock);
+	while (true)
+	{
+		Wake.wait(lock, [this] { return Next >= Jobs.Size() || WaitingBytes < MaxBytes; });
+		if (Next >= Jobs.Size()) break;
+
+		FPrecacheJob &job = Jobs[Next++];
+		if (job.State != FPrecacheJob::Queued) continue;
+		job.State = FPrecacheJob::Decoding;
+		lock.unlock();
+
+		uint64_t start = I_nsTime();
+		int w = 0, h = 0;
+		unsigned char *buffer = job.Tex->CreateTexBuffer(0, w, h, job.HiresCheck);
+		{
+			std::lock_guard<std::mutex> source(FGLTexture::SourceLock);
+			job.Tex->tex->ProcessData(buffer, w, h, false);
+		}
+		uint64_t time = I_nsTime() - start;
+
+		lock.lock();
+		job.DecodeTime = time;
+		job.Width = w;
+		job.Height = h;
+		if (job.State == FPrecacheJob::Discard)
+		{
+			delete[] buffer;
+		}
+		else
+		{
+			job.Buffer = buffer;
+			job.State = FPrecacheJob::Done;
+			WaitingBytes += size_t(w) * h * 4;
+		}
+		Done.notify_all();
+	}
+}
+
+void FPrecacheDecoder::Start(int threads)
+{
+	Next = Retired = 0;
+	WaitingBytes = 0;
+	MaxBytes = size_t(MAX(*gl_precache_cachesize, 1)) << 20;
+	Active = true;
+	for (int i = 0; i < threads; i++)
+	{
+		Threads.emplace_back([this] { Worker(); });
+	}
+}
+
+// Waits for the workers and frees everything that was not uploaded.
+void FPrecacheDecoder::Stop()
+{
+	Retire(Jobs.Size());
+	for (auto &thread : Threads) thread.join();
+	Threads.clear();
+	Active = false;
+
+	FormatStats.Clear();
+	Decoded = 0;
+	Queued = Jobs.Size();
+	for (auto &job : Jobs)
+	{
+		if (job.DecodeTime > 0)
+		{
+			auto &stats = FormatStats[job.Format];
+			stats.Count++;
+			stats.Time += job.DecodeTime;
+			stats.Pixels += uint64_t(job.Width) * job.Height;
+			Decoded++;
+		}
+	}
+	Jobs.Clear();
+	JobIndex.Clear();
+}
+
+// Called when the precache loop is done with the first count jobs.
+// Nothing will pick those up anymore.
+void FPrecacheDecoder::Retire(unsigned count)
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	for (; Retired < count; Retired++)
+	{
+		FPrecacheJob &job = Jobs[Retired];
+		switch (job.State)
+		{
+		case FPrecacheJob::Queued:
+			job.State = FPrecacheJob::Taken;
+			break;
+
+		case FPrecacheJob::Decoding:
+			job.State = FPrecacheJob::Discard;
+			break;
+
+		case FPrecacheJob::Done:
+			delete[] job.Buffer;
+			job.Buffer = nullptr;
+			WaitingBytes -= size_t(job.Width) * job.Height * 4;
+			job.State = FPrecacheJob::Taken;
+			break;
+
+		default:
+			break;
+		}
+	}
+	Wake.notify_all();
+}
+
+unsigned char *FPrecacheDecoder::Take(FGLTexture *gltex, FTexture *hirescheck, int &w, int &h)
+{
+	std::unique_lock<std::mutex> lock(Lock);
+	unsigned *index = JobIndex.CheckKey(gltex);
+	if (index == nullptr)
+	{
+		return nullptr;
+	}
+	FPrecacheJob &job = Jobs[*index];
+	if (job.HiresCheck != hirescheck || job.State == FPrecacheJob::Queued)
+	{
+		// Not started yet, so the caller is faster doing it right away.
+		if (job.State == FPrecacheJob::Queued) job.State = FPrecacheJob::Taken;
+		return nullptr;
+	}
+	Done.wait(lock, [&job] { return job.State != FPrecacheJob::Decoding; });
+	if (job.State != FPrecacheJob::Done)
+	{
+		return nullptr;
+	}
+	unsigned char *buffer = job.Buffer;
+	w = job.Width;
+	h = job.Height;
+	job.Buffer = nullptr;
+	job.State = FPrecacheJob::Taken;
+	WaitingBytes -= size_t(w) * h * 4;
+	Wake.notify_all();
+	return buffer;
+}
+
+unsigned char *gl_TakePrecachedBuffer(FGLTexture *gltex, FTexture *hirescheck, int &w, int &h)
+{
+	return PrecacheDecoder.Active ? PrecacheDecoder.Take(gltex, hirescheck, w, h) : nullptr;
+}
+
+static void QueuePrecacheJob(FMaterial *mat)
+{
+	FTexture *hirescheck;
+	FGLTexture *layer = mat != nullptr ? mat->GetPrecacheLayer(&hirescheck) : nullptr;
+	if (layer != nullptr && PrecacheDecoder.JobIndex.CheckKey(layer) == nullptr)
+	{
+		FPrecacheJob job;
+		job.Tex = layer;
+		job.HiresCheck = hirescheck;
+		job.Format = layer->tex->GetFormatName();
+		PrecacheDecoder.JobIndex[layer] = PrecacheDecoder.Jobs.Push(job);
+	}
+}
+
+CCMD(gl_precachestats)
+{
+	auto &decoder = PrecacheDecoder;
+	Printf("Last precache: %.3f ms, %d of %d queued textures decoded on worker threads\n", decoder.WallTime, decoder.Decoded, decoder.Queued);
+
+	TMap<FString, FPrecacheFormatStats>::Iterator it(decoder.FormatStats);
+	TMap<FString, FPrecacheFormatStats>::Pair *pair;
+	while (it.NextPair(pair))
+	{
+		auto &stats = pair->Value;
+		Printf("%-24s %5d textures %10.3f ms %8.3f ms/Mpixel\n", pair->Key.GetChars(), stats.Count, stats.Time / 1e6,
+			stats.Pixels > 0 ? stats.Time / 1e6 / (stats.Pixels / 1e6) : 0.);
+	}
+}
+
 //==========================================================================
 //
 // DFrameBuffer :: PrecacheTexture
@@ -608,6 +848,7 @@ static void PrecacheTexture(FTexture *tex, int cache)
 	else
 	{
 		// make sure that software pixel buffers do not stick around for unneeded textures.
+		std::lock_guard<std::mutex> lock(FGLTexture::SourceLock);
 		tex->Unload();
 	}
 }
@@ -752,6 +993,36 @@ void gl_PrecacheTexture(uint8_t *texhitlist, TMap<PClassActor*, bool> &actorhitl
 		precache.Reset();
 		precache.Clock();
 
+		int threads = gl_precache_threads > 0 ? MIN(*gl_precache_threads, 8) : clamp((int)std::thread::hardware_concurrency() - 1, 1, 8);
+		TArray<unsigned> jobsdone;
+		if (gl_precache_threads >= 0)
+		{
+			// Queue the buffers in the order the loop below will need them.
+			// All materials the loop uses are created here, because creating
+			// one reads the texture source for the default brightmap, which
+			// must not happen on the main thread once the workers run.
+			jobsdone.Resize(cnt);
+			for (int i = cnt - 1; i >= 0; i--)
+			{
+				FTexture *tex = TexMan.ByIndex(i);
+				if (tex != nullptr)
+				{
+					if (texhitlist[i] & (FTextureManager::HIT_Wall | FTextureManager::HIT_Flat | FTextureManager::HIT_Sky))
+					{
+						QueuePrecacheJob(FMaterial::ValidateTexture(tex, false));
+					}
+					if (spritehitlist[i] != nullptr && (*spritehitlist[i]).CountUsed() > 0)
+					{
+						FMaterial *mat = FMaterial::ValidateTexture(tex, true);
+						// Translated sprites are not decoded ahead of time.
+						if ((*spritehitlist[i]).CheckKey(0) != nullptr) QueuePrecacheJob(mat);
+					}
+				}
+				jobsdone[i] = PrecacheDecoder.Jobs.Size();
+			}
+			PrecacheDecoder.Start(threads);
+		}
+
 		// cache all used textures
 		for (int i = cnt - 1; i >= 0; i--)
 		{
@@ -764,6 +1035,14 @@ void gl_PrecacheTexture(uint8_t *texhitlist, TMap<PClassActor*, bool> &actorhitl
 					PrecacheSprite(tex, *spritehitlist[i]);
 				}
 			}
+			if (PrecacheDecoder.Active)
+			{
+				PrecacheDecoder.Retire(jobsdone[i]);
+			}
+		}
+		if (PrecacheDecoder.Active)
+		{
+			PrecacheDecoder.Stop();
 		}
 
 		// cache all used models
@@ -775,7 +1054,9 @@ void gl_PrecacheTexture(uint8_t *texhitlist, TMap<PClassActor*, bool> &actorhitl
 		}
 
 		precache.Unclock();
+		PrecacheDecoder.WallTime = precache.TimeMS();
 		DPrintf(DMSG_NOTIFY, "Textures precached in %.3f ms\n", precache.TimeMS());
+		gl_TrimUpscaleCache();
 	}
 
 	delete[] spritehitlist;
@@ -20,9 +20,13 @@ protected:
 
 void gl_GenerateGlobalBrightmapFromColormap();
 
+class FGLTexture;
+unsigned char *gl_TakePrecachedBuffer(FGLTexture *gltex, FTexture *hirescheck, int &w, int &h);
+
 
 
 unsigned char *gl_CreateUpsampledTextureBuffer ( const FTexture *inputTexture, unsigned char *inputBuffer, const int inWidth, const int inHeight, int &outWidth, int &outHeight, bool hasAlpha );
+void gl_TrimUpscaleCache();
 int CheckDDPK3(FTexture *tex);
 int CheckExternalFile(FTexture *tex, bool & hascolorkey);
 
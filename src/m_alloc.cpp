@@ -60,6 +60,8 @@
 #define _msize(p)				malloc_usable_size(p)	// from glibc/FreeBSD
 #endif
 
+std::atomic<size_t> M_AllocCount;
+
 #ifndef _DEBUG
 #if !defined(__solaris__) && !defined(__OpenBSD__) && !defined(__ANDROID__)
 void *M_Malloc(size_t size)
@@ -70,6 +72,7 @@ void *M_Malloc(size_t size)
 		I_FatalError("Could not malloc %zu bytes", size);
 
 	GC::AllocBytes += _msize(block);
+	M_AllocCount++;
 	return block;
 }
 
@@ -85,6 +88,7 @@ void *M_Realloc(void *memblock, size_t size)
 		I_FatalError("Could not realloc %zu bytes", size);
 	}
 	GC::AllocBytes += _msize(block);
+	M_AllocCount++;
 	return block;
 }
 #else
@@ -100,6 +104,7 @@ void *M_Malloc(size_t size)
 	block = sizeStore+1;
 
 	GC::AllocBytes += _msize(block);
+	M_AllocCount++;
 	return block;
 }
 
@@ -123,6 +128,7 @@ void *M_Realloc(void *memblock, size_t size)
 	block = sizeStore+1;
 
 	GC::AllocBytes += _msize(block);
+	M_AllocCount++;
 	return block;
 }
 #endif
@@ -140,6 +146,7 @@ void *M_Malloc_Dbg(size_t size, const char *file, int lineno)
 		I_FatalError("Could not malloc %zu bytes", size);
 
 	GC::AllocBytes += _msize(block);
+	M_AllocCount++;
 	return block;
 }
 
@@ -155,6 +162,7 @@ void *M_Realloc_Dbg(void *memblock, size_t size, const char *file, int lineno)
 		I_FatalError("Could not realloc %zu bytes", size);
 	}
 	GC::AllocBytes += _msize(block);
+	M_AllocCount++;
 	return block;
 }
 #else
@@ -170,6 +178,7 @@ void *M_Malloc_Dbg(size_t size, const char *file, int lineno)
 	block = sizeStore+1;
 
 	GC::AllocBytes += _msize(block);
+	M_AllocCount++;
 	return block;
 }
 
@@ -194,6 +203,7 @@ void *M_Realloc_Dbg(void *memblock, size_t size, const char *file, int lineno)
 	block = sizeStore+1;
 
 	GC::AllocBytes += _msize(block);
+	M_AllocCount++;
 	return block;
 }
 #endif
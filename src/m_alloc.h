@@ -35,6 +35,7 @@
 #define __M_ALLOC_H__
 
 #include <stdlib.h>
+#include <atomic>
 
 // These are the same as the same stdlib functions,
 // except they bomb out with a fatal error
@@ -53,4 +54,7 @@ void *M_Realloc (void *memblock, size_t size);
 
 void M_Free (void *memblock);
 
+// Number of M_Malloc/M_Realloc calls, for statistics. Worker threads allocate too.
+extern std::atomic<size_t> M_AllocCount;
+
 #endif //__M_ALLOC_H__
@@ -50,10 +50,22 @@
 #include "tarray.h"
 #include "m_bbox.h"
 #include "c_console.h"
+#include "c_cvars.h"
 #include "r_state.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
 
 const int MaxSegs = 64;
 const int SplitCost = 8;
+
+// Splitter scoring is spread over worker threads once a set needs at least
+// this many seg classifications (candidates * segs in set).
+const uint64_t MinThreadedWork = 1 << 18;
+
+// 0 = one thread per core, 1 = score splitters on the calling thread only
+CVAR(Int, nodebuild_threads, 0, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
 const int AAPreference = 16;
 
 #if 0
@@ -62,28 +74,58 @@ const int AAPreference = 16;
 #define D(x) do{}while(0)
 #endif
 
+// The workers persist for the whole build. Each call to ScoreSplitters
+// bumps Generation; the first Stride - 1 workers score their share of the
+// candidates and the last one to finish wakes the builder.
+struct FNodeBuilder::FScoreThreads
+{
+	std::mutex Lock;
+	std::condition_variable Wake, Done;
+	std::vector<std::thread> Threads;
+	std::vector<TArray<int>> Lists;	// Touched and Colinear for each worker
+	unsigned int Generation = 0;
+	int Stride = 0;
+	int Pending = 0;
+	uint32_t Set = 0;
+	bool NoSplit = false;
+	bool Quit = false;
+};
+
+static int NodeBuildThreads (int threads)
+{
+	if (threads < 0) threads = nodebuild_threads;
+	if (threads == 0) threads = (int)std::thread::hardware_concurrency();
+	return MAX(threads, 1);
+}
+
 FNodeBuilder::FNodeBuilder(FLevel &level)
 : Level(level), GLNodes(false), SegsStuffed(0)
 {
 	VertexMap = NULL;
 	OldVertexTable = NULL;
+	ScoreThreads = NULL;
+	NumThreads = 1;
 }
 
 FNodeBuilder::FNodeBuilder (FLevel &level,
 							TArray<FPolyStart> &polyspots, TArray<FPolyStart> &anchors,
-							bool makeGLNodes)
+							bool makeGLNodes, int threads)
 	: Level(level), GLNodes(makeGLNodes), SegsStuffed(0)
 {
+	ScoreThreads = NULL;
+	NumThreads = NodeBuildThreads (threads);
 	VertexMap = new FVertexMap (*this, Level.MinX, Level.MinY, Level.MaxX, Level.MaxY);
 	FindUsedVertices (Level.Vertices, Level.NumVertices);
 	MakeSegsFromSides ();
 	FindPolyContainers (polyspots, anchors);
 	GroupSegPlanes ();
 	BuildTree ();
+	StopScoreThreads ();
 }
 
 FNodeBuilder::~FNodeBuilder()
 {
+	StopScoreThreads ();
 	if (VertexMap != NULL)
 	{
 		delete VertexMap;
@@ -97,8 +139,10 @@ FNodeBuilder::~FNodeBuilder()
 void FNodeBuilder::BuildMini(bool makeGLNodes)
 {
 	GLNodes = makeGLNodes;
+	NumThreads = NodeBuildThreads(-1);
 	GroupSegPlanesSimple();
 	BuildTree();
+	StopScoreThreads();
 }
 
 void FNodeBuilder::Clear()
@@ -131,6 +175,44 @@ void FNodeBuilder::BuildTree ()
 	CreateSubsectorsForReal ();
 }
 
+// Hashes the built tree so that builds with different thread counts can be
+// compared without extracting them. Only used by -nodebench.
+
+uint32_t FNodeBuilder::GetChecksum () const
+{
+	uint32_t sum = 2166136261u;
+	auto mix = [&](int value)
+	{
+		for (int i = 0; i < 4; i++, value >>= 8)
+		{
+			sum = (sum ^ (value & 0xff)) * 16777619u;	// FNV-1a
+		}
+	};
+
+	for (auto &node : Nodes)
+	{
+		mix (node.x); mix (node.y); mix (node.dx); mix (node.dy);
+		mix (node.intchildren[0]); mix (node.intchildren[1]);
+		for (int i = 0; i < 4; i++)
+		{
+			mix (node.nb_bbox[0][i]); mix (node.nb_bbox[1][i]);
+		}
+	}
+	for (auto &seg : Segs)
+	{
+		mix (seg.v1); mix (seg.v2); mix (seg.linedef); mix (seg.sidedef); mix (seg.partner);
+	}
+	for (auto &vert : Vertices)
+	{
+		mix (vert.x); mix (vert.y);
+	}
+	for (auto &sub : Subsectors)
+	{
+		mix ((int)(size_t)sub.firstline); mix (sub.numlines);
+	}
+	return sum;
+}
+
 int FNodeBuilder::CreateNode (uint32_t set, unsigned int count, fixed_t bbox[4])
 {
 	node_t node;
@@ -436,7 +518,7 @@ bool FNodeBuilder::ShoveSegBehind (uint32_t set, node_t &node, uint32_t seg, uin
 		node.dx = -node.dx;
 		node.dy = -node.dy;
 	}
-	return Heuristic (node, set, false) > 0;
+	return Heuristic (node, set, false, Touched, Colinear) > 0;
 }
 
 // Splitters are chosen to coincide with segs in the given set. To reduce the
@@ -452,6 +534,7 @@ int FNodeBuilder::SelectSplitter (uint32_t set, node_t &node, uint32_t &splitseg
 	int bestvalue;
 	uint32_t bestseg;
 	uint32_t seg;
+	unsigned int segcount;
 	bool nosplitters = false;
 
 	bestvalue = 0;
@@ -459,11 +542,15 @@ int FNodeBuilder::SelectSplitter (uint32_t set, node_t &node, uint32_t &splitseg
 
 	seg = set;
 	stepleft = 0;
+	segcount = 0;
 
 	memset (&PlaneChecked[0], 0, PlaneChecked.Size());
+	SplitterCandidates.Clear();
 
 	D(Printf (PRINT_LOG, "Processing set %d\n", set));
 
+	// Pick the candidates first. Which segs get scored does not depend on
+	// the scores, so the scoring can run in any order.
 	while (seg != UINT_MAX)
 	{
 		FPrivSeg *pseg = &Segs[seg];
@@ -481,28 +568,35 @@ int FNodeBuilder::SelectSplitter (uint32_t set, node_t &node, uint32_t &splitseg
 				}
 
 				stepleft = step;
-				SetNodeFromSeg (node, pseg);
-
-				int value = Heuristic (node, set, nosplit);
-
-				D(Printf (PRINT_LOG, "Seg %5d, ld %d (%5d,%5d)-(%5d,%5d) scores %d\n", seg, Segs[seg].linedef, node.x>>16, node.y>>16,
-					(node.x+node.dx)>>16, (node.y+node.dy)>>16, value));
-
-				if (value > bestvalue)
-				{
-					bestvalue = value;
-					bestseg = seg;
-				}
-				else if (value < 0)
-				{
-					nosplitters = true;
-				}
+				SplitterCandidates.Push(seg);
 			}
 		}
 
+		segcount++;
 		seg = pseg->next;
 	}
 
+	ScoreSplitters (set, nosplit, segcount);
+
+	// Walk the scores in candidate order so that ties are resolved the same way no matter how they were computed.
+	for (unsigned int i = 0; i < SplitterCandidates.Size(); i++)
+	{
+		int value = SplitterScores[i];
+		seg = SplitterCandidates[i];
+
+		D(Printf (PRINT_LOG, "Seg %5d, ld %d scores %d\n", seg, Segs[seg].linedef, value));
+
+		if (value > bestvalue)
+		{
+			bestvalue = value;
+			bestseg = seg;
+		}
+		else if (value < 0)
+		{
+			nosplitters = true;
+		}
+	}
+
 	if (bestseg == UINT_MAX)
 	{ // No lines split any others into two sets, so this is a convex region.
 	D(Printf (PRINT_LOG, "set %d, step %d, nosplit %d has no good splitter (%d)\n", set, step, nosplit, nosplitters));
@@ -516,13 +610,131 @@ int FNodeBuilder::SelectSplitter (uint32_t set, node_t &node, uint32_t &splitseg
 	return 1;
 }
 
+// Computes the Heuristic score of every seg in SplitterCandidates. Large sets
+// are spread over the score threads; each one has its own node and loop lists
+// and only writes the scores of the candidates it was given.
+
+void FNodeBuilder::ScoreSplitters (uint32_t set, bool nosplit, unsigned int segcount)
+{
+	const unsigned int count = SplitterCandidates.Size();
+	SplitterScores.Resize(count);
+
+	int numthreads = NumThreads;
+	if (uint64_t(count) * segcount < MinThreadedWork)
+	{
+		numthreads = 1;
+	}
+	numthreads = clamp<int>(numthreads, 1, count / 4 + 1);
+
+	if (numthreads == 1)
+	{
+		ScoreRange (0, 1, set, nosplit, Touched, Colinear);
+		return;
+	}
+
+	if (ScoreThreads == NULL)
+	{
+		StartScoreThreads ();
+	}
+
+	// Interleave the candidates because the early outs make their cost uneven.
+	FScoreThreads *pool = ScoreThreads;
+	{
+		std::lock_guard<std::mutex> lock(pool->Lock);
+		pool->Set = set;
+		pool->NoSplit = nosplit;
+		pool->Stride = numthreads;
+		pool->Pending = numthreads - 1;
+		pool->Generation++;
+	}
+	pool->Wake.notify_all();
+
+	ScoreRange (0, numthreads, set, nosplit, Touched, Colinear);
+
+	std::unique_lock<std::mutex> lock(pool->Lock);
+	pool->Done.wait(lock, [=] { return pool->Pending == 0; });
+}
+
+void FNodeBuilder::ScoreRange (int first, int stride, uint32_t set, bool nosplit, TArray<int> &touched, TArray<int> &colinear)
+{
+	const unsigned int count = SplitterCandidates.Size();
+	node_t node;
+	for (unsigned int i = first; i < count; i += stride)
+	{
+		SetNodeFromSeg (node, &Segs[SplitterCandidates[i]]);
+		SplitterScores[i] = Heuristic (node, set, nosplit, touched, colinear);
+	}
+}
+
+// Worker i scores every stride'th candidate starting at i, for as long as
+// the build runs. The calling thread is number 0.
+
+void FNodeBuilder::StartScoreThreads ()
+{
+	FScoreThreads *pool = new FScoreThreads;
+	pool->Lists.resize((NumThreads - 1) * 2);
+	for (int i = 1; i < NumThreads; i++)
+	{
+		pool->Threads.push_back(std::thread([=]()
+		{
+			TArray<int> &touched = pool->Lists[(i - 1) * 2];
+			TArray<int> &colinear = pool->Lists[(i - 1) * 2 + 1];
+			unsigned int generation = 0;
+
+			std::unique_lock<std::mutex> lock(pool->Lock);
+			for (;;)
+			{
+				pool->Wake.wait(lock, [&] { return pool->Quit || pool->Generation != generation; });
+				if (pool->Quit)
+				{
+					return;
+				}
+				generation = pool->Generation;
+				if (i < pool->Stride)
+				{
+					const int stride = pool->Stride;
+					const uint32_t set = pool->Set;
+					const bool nosplit = pool->NoSplit;
+					lock.unlock();
+					ScoreRange (i, stride, set, nosplit, touched, colinear);
+					lock.lock();
+					if (--pool->Pending == 0)
+					{
+						pool->Done.notify_one();
+					}
+				}
+			}
+		}));
+	}
+	ScoreThreads = pool;
+}
+
+void FNodeBuilder::StopScoreThreads ()
+{
+	if (ScoreThreads == NULL)
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(ScoreThreads->Lock);
+		ScoreThreads->Quit = true;
+	}
+	ScoreThreads->Wake.notify_all();
+	for (auto &thread : ScoreThreads->Threads)
+	{
+		thread.join();
+	}
+	delete ScoreThreads;
+	ScoreThreads = NULL;
+}
+
 // Given a splitter (node), returns a score based on how "good" the resulting
 // split in a set of segs is. Higher scores are better. -1 means this splitter
 // splits something it shouldn't and will only be returned if honorNoSplit is
 // true. A score of 0 means that the splitter does not split any of the segs
 // in the set.
 
-int FNodeBuilder::Heuristic (node_t &node, uint32_t set, bool honorNoSplit)
+int FNodeBuilder::Heuristic (node_t &node, uint32_t set, bool honorNoSplit, TArray<int> &touched, TArray<int> &colinear)
 {
 	// Set the initial score above 0 so that near vertex anti-weighting is less likely to produce a negative score.
 	int score = 1000000;
@@ -537,8 +749,8 @@ int FNodeBuilder::Heuristic (node_t &node, uint32_t set, bool honorNoSplit)
 	unsigned int max, m2, p, q;
 	double frac;
 
-	Touched.Clear ();
-	Colinear.Clear ();
+	touched.Clear ();
+	colinear.Clear ();
 
 	while (i != UINT_MAX)
 	{
@@ -564,32 +776,32 @@ int FNodeBuilder::Heuristic (node_t &node, uint32_t set, bool honorNoSplit)
 			{
 				if ((sidev[0] | sidev[1]) != 0)
 				{
-					max = Touched.Size();
+					max = touched.Size();
 					for (p = 0; p < max; ++p)
 					{
-						if (Touched[p] == test->loopnum)
+						if (touched[p] == test->loopnum)
 						{
 							break;
 						}
 					}
 					if (p == max)
 					{
-						Touched.Push (test->loopnum);
+						touched.Push (test->loopnum);
 					}
 				}
 				else
 				{
-					max = Colinear.Size();
+					max = colinear.Size();
 					for (p = 0; p < max; ++p)
 					{
-						if (Colinear[p] == test->loopnum)
+						if (colinear[p] == test->loopnum)
 						{
 							break;
 						}
 					}
 					if (p == max)
 					{
-						Colinear.Push (test->loopnum);
+						colinear.Push (test->loopnum);
 					}
 				}
 			}
@@ -706,8 +918,8 @@ int FNodeBuilder::Heuristic (node_t &node, uint32_t set, bool honorNoSplit)
 	// seg of that sector must be crossing the container's corner and does not
 	// actually split the container.
 
-	max = Touched.Size ();
-	m2 = Colinear.Size ();
+	max = touched.Size ();
+	m2 = colinear.Size ();
 
 	// If honorNoSplit is false, then both these lists will be empty.
 
@@ -720,10 +932,10 @@ int FNodeBuilder::Heuristic (node_t &node, uint32_t set, bool honorNoSplit)
 
 	for (p = 0; p < max; ++p)
 	{
-		int look = Touched[p];
+		int look = touched[p];
 		for (q = 0; q < m2; ++q)
 		{
-			if (look == Colinear[q])
+			if (look == colinear[q])
 			{
 				break;
 			}
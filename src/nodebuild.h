@@ -228,13 +228,15 @@ public:
 	};
 
 	FNodeBuilder (FLevel &level);
+	// threads < 0 uses nodebuild_threads, 0 one thread per core
 	FNodeBuilder (FLevel &level,
 		TArray<FPolyStart> &polyspots, TArray<FPolyStart> &anchors,
-		bool makeGLNodes);
+		bool makeGLNodes, int threads = -1);
 	~FNodeBuilder ();
 
 	void Extract(FLevelLocals &level);
 	const int *GetOldVertexTable();
+	uint32_t GetChecksum() const;
 
 	// These are used for building sub-BSP trees for polyobjects.
 	void Clear();
@@ -266,8 +268,14 @@ private:
 
 	TArray<int> Touched;	// Loops a splitter touches on a vertex
 	TArray<int> Colinear;	// Loops with edges colinear to a splitter
+	TArray<uint32_t> SplitterCandidates;	// Segs scored by SelectSplitter
+	TArray<int> SplitterScores;			// Heuristic for each SplitterCandidates entry
 	FEventTree Events;		// Vertices intersected by the current splitter
 
+	struct FScoreThreads;
+	FScoreThreads *ScoreThreads;	// Splitter scoring workers, started by the first large set
+	int NumThreads;			// Threads that score splitters, including the calling one
+
 	TArray<FSplitSharer> SplitSharers;	// Segs colinear with the current splitter
 
 	uint32_t HackSeg;			// Seg to force to back of splitter
@@ -296,7 +304,11 @@ private:
 	bool ShoveSegBehind (uint32_t set, node_t &node, uint32_t seg, uint32_t mate);	int SelectSplitter (uint32_t set, node_t &node, uint32_t &splitseg, int step, bool nosplit);
 	void SplitSegs (uint32_t set, node_t &node, uint32_t splitseg, uint32_t &outset0, uint32_t &outset1, unsigned int &count0, unsigned int &count1);
 	uint32_t SplitSeg (uint32_t segnum, int splitvert, int v1InFront);
-	int Heuristic (node_t &node, uint32_t set, bool honorNoSplit);
+	void ScoreSplitters (uint32_t set, bool nosplit, unsigned int segcount);
+	void ScoreRange (int first, int stride, uint32_t set, bool nosplit, TArray<int> &touched, TArray<int> &colinear);
+	void StartScoreThreads ();
+	void StopScoreThreads ();
+	int Heuristic (node_t &node, uint32_t set, bool honorNoSplit, TArray<int> &touched, TArray<int> &colinear);
 
 	// Returns:
 	//	0 = seg is in front
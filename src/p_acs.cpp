@@ -36,6 +36,7 @@
 */
 
 #include <assert.h>
+#include <algorithm>
 
 #include "templates.h"
 #include "doomdef.h"
@@ -80,6 +81,9 @@
 #include "vm.h"
 #include "scriptutil.h"
 #include "s_music.h"
+#include "i_time.h"
+#include "m_crc32.h"
+#include "backend/vmbuilder.h"
 
 	// P-codes for ACS scripts
 	enum
@@ -472,7 +476,10 @@
 		PCD_TRANSLATIONRANGE4,
 		PCD_TRANSLATIONRANGE5,
 
-/*381*/	PCODE_COMMAND_COUNT
+/*381*/	PCODE_COMMAND_COUNT,
+
+		// Only found in pre-decoded code
+		PCD_PUSHWORDS = PCODE_COMMAND_COUNT,
 	};
 
 	// Some constants used by ACS scripts
@@ -545,6 +552,10 @@ extern FILE *Logfile;
 
 FRandom pr_acs ("ACS", false);
 
+// These only affect modules that are loaded after changing them.
+CVAR (Bool, acs_predecode, true, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
+CVAR (Bool, acs_vm, false, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
+
 // I imagine this much stack space is probably overkill, but it could
 // potentially get used with recursive functions.
 #define STACK_SIZE 4096
@@ -2454,6 +2465,7 @@ bool FBehavior::Init(int lumpnum, FileReader * fr, int len, int reallumpnum)
 				funcm->ImportNum = funcf->ImportNum;
 				funcm->LocalCount = funcf->LocalCount;
 				funcm->Address = LittleLong(funcf->Address);
+				funcm->VMFunc = nullptr;
 			}
 		}
 
@@ -2754,10 +2766,1132 @@ bool FBehavior::Init(int lumpnum, FileReader * fr, int len, int reallumpnum)
 		}
 	}
 
+	if (acs_predecode && Format != ACS_Unknown && !DecodeCode(Code, CodeMap, CodeOfs))
+	{
+		Code.Clear();
+		CodeMap.Clear();
+		CodeOfs.Clear();
+		DPrintf (DMSG_NOTIFY, "Could not pre-decode %s, running it from the lump\n", ModuleName);
+	}
+	if (acs_vm && Format != ACS_Unknown)
+	{
+		int lowered = 0;
+		for (i = 0; i < NumFunctions; ++i)
+		{
+			Functions[i].VMFunc = LowerFunction(i);
+			lowered += Functions[i].VMFunc != nullptr;
+		}
+		DPrintf (DMSG_NOTIFY, "Lowered %d of %d functions in %s to the VM\n", lowered, NumFunctions, ModuleName);
+	}
+
 	DPrintf (DMSG_NOTIFY, "Loaded %d scripts, %d functions\n", NumScripts, NumFunctions);
 	return true;
 }
 
+//==========================================================================
+//
+// DecodeInstruction
+//
+// Reads one instruction at ofs the way the interpreter would and hands
+// its opcode and operands to the sink as full words. The byte-sized
+// instructions are rewritten to their word-sized counterparts so that
+// the pre-decoded code never needs to look at single bytes.
+//
+//==========================================================================
+
+template<class Sink>
+static bool DecodeInstruction(const uint8_t *data, uint32_t size, ACSFormat fmt, uint32_t ofs, uint32_t &next, bool &fallthrough, TArray<uint32_t> &targets, Sink &&emit)
+{
+	uint32_t pos = ofs;
+	bool ok = true;
+
+	auto readbyte = [&]() -> int
+	{
+		if (pos + 1 > size) { ok = false; return 0; }
+		return data[pos++];
+	};
+	auto readshort = [&]() -> int
+	{
+		int16_t val;
+		if (pos + 2 > size) { ok = false; return 0; }
+		memcpy(&val, data + pos, 2);
+		pos += 2;
+		return LittleShort(val);
+	};
+	auto readword = [&]() -> int
+	{
+		int32_t val;
+		if (pos + 4 > size) { ok = false; return 0; }
+		memcpy(&val, data + pos, 4);
+		pos += 4;
+		return LittleLong(val);
+	};
+	auto readarg = [&]() -> int
+	{
+		return fmt == ACS_LittleEnhanced ? readbyte() : readword();
+	};
+	auto jump = [&]()
+	{
+		int target = readword();
+		targets.Push(target);
+		return target;
+	};
+
+	int pcd;
+	if (fmt == ACS_LittleEnhanced)
+	{
+		pcd = readbyte();
+		if (pcd >= 256-16)
+		{
+			pcd = (256-16) + ((pcd - (256-16)) << 8) + readbyte();
+		}
+	}
+	else
+	{
+		pcd = readword();
+	}
+	// Unknown p-codes are left to the interpreter of the original code to report.
+	if (!ok || pcd < 0 || pcd >= PCODE_COMMAND_COUNT)
+	{
+		return false;
+	}
+
+	fallthrough = true;
+	switch (pcd)
+	{
+	case PCD_GOTO:
+		emit(pcd);
+		emit(jump());
+		fallthrough = false;
+		break;
+
+	case PCD_GOTOSTACK:
+	case PCD_TERMINATE:
+	case PCD_RESTART:
+	case PCD_RETURNVOID:
+	case PCD_RETURNVAL:
+		emit(pcd);
+		fallthrough = false;
+		break;
+
+	case PCD_IFGOTO:
+	case PCD_IFNOTGOTO:
+		emit(pcd);
+		emit(jump());
+		break;
+
+	case PCD_CASEGOTO:
+		emit(pcd);
+		emit(readword());
+		emit(jump());
+		break;
+
+	case PCD_CASEGOTOSORTED:
+		{
+			emit(pcd);
+			// The count and jump table are 4-byte aligned. Pre-decoded code is always aligned.
+			pos += (0 - (size_t)(data + pos)) & 3;
+			int numcases = readword();
+			if (numcases < 0 || numcases > int((size - pos) / 8))
+			{
+				return false;
+			}
+			emit(numcases);
+			for (int i = 0; i < numcases; ++i)
+			{
+				emit(readword());
+				emit(jump());
+			}
+		}
+		break;
+
+	case PCD_PUSHBYTE:
+		emit(PCD_PUSHNUMBER);
+		emit(readbyte());
+		break;
+
+	case PCD_PUSH2BYTES:
+	case PCD_PUSH3BYTES:
+	case PCD_PUSH4BYTES:
+	case PCD_PUSH5BYTES:
+	case PCD_PUSHBYTES:
+		{
+			int count = pcd == PCD_PUSHBYTES ? readbyte() : pcd - PCD_PUSH2BYTES + 2;
+			emit(PCD_PUSHWORDS);
+			emit(count);
+			for (int i = 0; i < count; ++i)
+			{
+				emit(readbyte());
+			}
+		}
+		break;
+
+	case PCD_LSPEC1DIRECTB:
+	case PCD_LSPEC2DIRECTB:
+	case PCD_LSPEC3DIRECTB:
+	case PCD_LSPEC4DIRECTB:
+	case PCD_LSPEC5DIRECTB:
+		{
+			int count = pcd - PCD_LSPEC1DIRECTB + 1;
+			emit(PCD_LSPEC1DIRECT + count - 1);
+			emit(readbyte());
+			for (int i = 0; i < count; ++i)
+			{
+				emit(readbyte());
+			}
+		}
+		break;
+
+	case PCD_DELAYDIRECTB:
+		emit(PCD_DELAYDIRECT);
+		emit(readbyte());
+		break;
+
+	case PCD_RANDOMDIRECTB:
+		emit(PCD_RANDOMDIRECT);
+		emit(readbyte());
+		emit(readbyte());
+		break;
+
+	case PCD_LSPEC1DIRECT:
+	case PCD_LSPEC2DIRECT:
+	case PCD_LSPEC3DIRECT:
+	case PCD_LSPEC4DIRECT:
+	case PCD_LSPEC5DIRECT:
+		emit(pcd);
+		emit(readarg());
+		for (int i = pcd - PCD_LSPEC1DIRECT + 1; i > 0; --i)
+		{
+			emit(readword());
+		}
+		break;
+
+	case PCD_CALLFUNC:
+		emit(pcd);
+		emit(readarg());
+		emit(fmt == ACS_LittleEnhanced ? readshort() : readword());
+		break;
+
+	case PCD_LSPEC5EX:
+	case PCD_LSPEC5EXRESULT:
+	case PCD_PUSHNUMBER:
+	case PCD_DELAYDIRECT:
+	case PCD_TAGWAITDIRECT:
+	case PCD_POLYWAITDIRECT:
+	case PCD_SETFONTDIRECT:
+	case PCD_SETGRAVITYDIRECT:
+	case PCD_SETAIRCONTROLDIRECT:
+	case PCD_CHECKINVENTORYDIRECT:
+	case PCD_SCRIPTWAITDIRECT:
+		emit(pcd);
+		emit(readword());
+		break;
+
+	case PCD_RANDOMDIRECT:
+	case PCD_THINGCOUNTDIRECT:
+	case PCD_CHANGEFLOORDIRECT:
+	case PCD_CHANGECEILINGDIRECT:
+	case PCD_GIVEINVENTORYDIRECT:
+	case PCD_TAKEINVENTORYDIRECT:
+		emit(pcd);
+		emit(readword());
+		emit(readword());
+		break;
+
+	// The music instructions carry an unused third operand.
+	case PCD_SETMUSICDIRECT:
+	case PCD_LOCALSETMUSICDIRECT:
+	case PCD_CONSOLECOMMANDDIRECT:
+		emit(pcd);
+		for (int i = 0; i < 3; ++i) emit(readword());
+		break;
+
+	case PCD_SPAWNSPOTDIRECT:
+		emit(pcd);
+		for (int i = 0; i < 4; ++i) emit(readword());
+		break;
+
+	case PCD_SPAWNDIRECT:
+		emit(pcd);
+		for (int i = 0; i < 6; ++i) emit(readword());
+		break;
+
+	case PCD_LSPEC1: case PCD_LSPEC2: case PCD_LSPEC3: case PCD_LSPEC4: case PCD_LSPEC5: case PCD_LSPEC5RESULT:
+	case PCD_CALL: case PCD_CALLDISCARD: case PCD_PUSHFUNCTION:
+	case PCD_ASSIGNSCRIPTVAR: case PCD_ASSIGNMAPVAR: case PCD_ASSIGNWORLDVAR: case PCD_ASSIGNGLOBALVAR:
+	case PCD_ASSIGNSCRIPTARRAY: case PCD_ASSIGNMAPARRAY: case PCD_ASSIGNWORLDARRAY: case PCD_ASSIGNGLOBALARRAY:
+	case PCD_PUSHSCRIPTVAR: case PCD_PUSHMAPVAR: case PCD_PUSHWORLDVAR: case PCD_PUSHGLOBALVAR:
+	case PCD_PUSHSCRIPTARRAY: case PCD_PUSHMAPARRAY: case PCD_PUSHWORLDARRAY: case PCD_PUSHGLOBALARRAY:
+	case PCD_ADDSCRIPTVAR: case PCD_ADDMAPVAR: case PCD_ADDWORLDVAR: case PCD_ADDGLOBALVAR:
+	case PCD_ADDSCRIPTARRAY: case PCD_ADDMAPARRAY: case PCD_ADDWORLDARRAY: case PCD_ADDGLOBALARRAY:
+	case PCD_SUBSCRIPTVAR: case PCD_SUBMAPVAR: case PCD_SUBWORLDVAR: case PCD_SUBGLOBALVAR:
+	case PCD_SUBSCRIPTARRAY: case PCD_SUBMAPARRAY: case PCD_SUBWORLDARRAY: case PCD_SUBGLOBALARRAY:
+	case PCD_MULSCRIPTVAR: case PCD_MULMAPVAR: case PCD_MULWORLDVAR: case PCD_MULGLOBALVAR:
+	case PCD_MULSCRIPTARRAY: case PCD_MULMAPARRAY: case PCD_MULWORLDARRAY: case PCD_MULGLOBALARRAY:
+	case PCD_DIVSCRIPTVAR: case PCD_DIVMAPVAR: case PCD_DIVWORLDVAR: case PCD_DIVGLOBALVAR:
+	case PCD_DIVSCRIPTARRAY: case PCD_DIVMAPARRAY: case PCD_DIVWORLDARRAY: case PCD_DIVGLOBALARRAY:
+	case PCD_MODSCRIPTVAR: case PCD_MODMAPVAR: case PCD_MODWORLDVAR: case PCD_MODGLOBALVAR:
+	case PCD_MODSCRIPTARRAY: case PCD_MODMAPARRAY: case PCD_MODWORLDARRAY: case PCD_MODGLOBALARRAY:
+	case PCD_ANDSCRIPTVAR: case PCD_ANDMAPVAR: case PCD_ANDWORLDVAR: case PCD_ANDGLOBALVAR:
+	case PCD_ANDSCRIPTARRAY: case PCD_ANDMAPARRAY: case PCD_ANDWORLDARRAY: case PCD_ANDGLOBALARRAY:
+	case PCD_EORSCRIPTVAR: case PCD_EORMAPVAR: case PCD_EORWORLDVAR: case PCD_EORGLOBALVAR:
+	case PCD_EORSCRIPTARRAY: case PCD_EORMAPARRAY: case PCD_EORWORLDARRAY: case PCD_EORGLOBALARRAY:
+	case PCD_ORSCRIPTVAR: case PCD_ORMAPVAR: case PCD_ORWORLDVAR: case PCD_ORGLOBALVAR:
+	case PCD_ORSCRIPTARRAY: case PCD_ORMAPARRAY: case PCD_ORWORLDARRAY: case PCD_ORGLOBALARRAY:
+	case PCD_LSSCRIPTVAR: case PCD_LSMAPVAR: case PCD_LSWORLDVAR: case PCD_LSGLOBALVAR:
+	case PCD_LSSCRIPTARRAY: case PCD_LSMAPARRAY: case PCD_LSWORLDARRAY: case PCD_LSGLOBALARRAY:
+	case PCD_RSSCRIPTVAR: case PCD_RSMAPVAR: case PCD_RSWORLDVAR: case PCD_RSGLOBALVAR:
+	case PCD_RSSCRIPTARRAY: case PCD_RSMAPARRAY: case PCD_RSWORLDARRAY: case PCD_RSGLOBALARRAY:
+	case PCD_INCSCRIPTVAR: case PCD_INCMAPVAR: case PCD_INCWORLDVAR: case PCD_INCGLOBALVAR:
+	case PCD_INCSCRIPTARRAY: case PCD_INCMAPARRAY: case PCD_INCWORLDARRAY: case PCD_INCGLOBALARRAY:
+	case PCD_DECSCRIPTVAR: case PCD_DECMAPVAR: case PCD_DECWORLDVAR: case PCD_DECGLOBALVAR:
+	case PCD_DECSCRIPTARRAY: case PCD_DECMAPARRAY: case PCD_DECWORLDARRAY: case PCD_DECGLOBALARRAY:
+
+		emit(pcd);
+		emit(readarg());
+		break;
+
+	default:
+		emit(pcd);
+		break;
+	}
+	next = pos;
+	return ok;
+}
+
+//==========================================================================
+//
+// FBehavior :: DecodeCode
+//
+// Translates all code reachable from the scripts, functions and jump
+// points into one word per opcode and operand. Instructions are laid out
+// in the same order as in the lump, so falling through to the next one
+// works as before. Returns false if the code can't be decoded safely, in
+// which case the module runs from its original data.
+//
+//==========================================================================
+
+bool FBehavior::DecodeCode(TArray<int32_t> &code, TArray<int> &codemap, TArray<uint32_t> &codeofs) const
+{
+	struct DecodedInstr
+	{
+		uint32_t Ofs, Next;
+		unsigned Start, Count;
+	};
+	TArray<DecodedInstr> instrs;
+	TArray<int32_t> words;
+	TArray<uint32_t> work;
+	uint32_t size = uint32_t(Chunks - Data);
+
+	code.Clear();
+	codeofs.Clear();
+	codemap.Resize(size);
+	for (auto &index : codemap) index = -1;
+
+	for (int i = 0; i < NumScripts; ++i)
+	{
+		work.Push(Scripts[i].Address);
+	}
+	for (int i = 0; i < NumFunctions; ++i)
+	{
+		if (Functions[i].ImportNum == 0 && Functions[i].Address != 0)
+		{
+			work.Push(Functions[i].Address);
+		}
+	}
+	for (auto point : JumpPoints)
+	{
+		work.Push(point);
+	}
+
+	uint32_t ofs;
+	while (work.Pop(ofs))
+	{
+		while (ofs >= size || codemap[ofs] < 0)
+		{
+			DecodedInstr instr;
+			bool fallthrough;
+
+			if (ofs >= size)
+			{
+				return false;
+			}
+			instr.Ofs = ofs;
+			instr.Start = words.Size();
+			if (!DecodeInstruction(Data, size, Format, ofs, instr.Next, fallthrough, work, [&](int val) { words.Push(LittleLong(val)); }))
+			{
+				return false;
+			}
+			instr.Count = words.Size() - instr.Start;
+			codemap[ofs] = instrs.Push(instr);
+			if (!fallthrough)
+			{
+				break;
+			}
+			ofs = instr.Next;
+		}
+	}
+
+	std::sort(instrs.begin(), instrs.end(), [](const DecodedInstr &a, const DecodedInstr &b) { return a.Ofs < b.Ofs; });
+	for (unsigned i = 0; i < instrs.Size(); ++i)
+	{
+		const DecodedInstr &instr = instrs[i];
+
+		// Something jumps into the middle of another instruction.
+		if (i + 1 < instrs.Size() && instr.Next > instrs[i + 1].Ofs)
+		{
+			return false;
+		}
+		codemap[instr.Ofs] = code.Size();
+		for (unsigned j = 0; j < instr.Count; ++j)
+		{
+			code.Push(words[instr.Start + j]);
+			codeofs.Push(j == 0 ? instr.Ofs : instr.Next);
+		}
+	}
+	// Anything that jumps somewhere undecoded ends up here and terminates the script.
+	code.Push(LittleLong(-1));
+	codeofs.Push(size);
+	return true;
+}
+
+//==========================================================================
+//
+// InterpreterOperandWords
+//
+// The number of operand words DLevelScript::RunScript steps over when it
+// executes a pre-decoded instruction and does not jump. This follows the
+// pc increments of the interpreter, not DecodeInstruction, so that
+// acsbench can check the decoder's layout against what actually runs.
+//
+//==========================================================================
+
+static int InterpreterOperandWords(const int32_t *pc)
+{
+	int pcd = LittleLong(pc[0]);
+	switch (pcd)
+	{
+	case PCD_PUSHWORDS:
+		return 1 + LittleLong(pc[1]);
+
+	case PCD_CASEGOTOSORTED:
+		return 1 + 2 * LittleLong(pc[1]);
+
+	case PCD_LSPEC1DIRECT:
+	case PCD_LSPEC2DIRECT:
+	case PCD_LSPEC3DIRECT:
+	case PCD_LSPEC4DIRECT:
+	case PCD_LSPEC5DIRECT:
+		return 1 + (pcd - PCD_LSPEC1DIRECT + 1);
+
+	case PCD_SPAWNDIRECT:
+		return 6;
+
+	case PCD_SPAWNSPOTDIRECT:
+		return 4;
+
+	case PCD_SETMUSICDIRECT:
+	case PCD_LOCALSETMUSICDIRECT:
+	case PCD_CONSOLECOMMANDDIRECT:
+		return 3;
+
+	case PCD_CASEGOTO:
+	case PCD_CALLFUNC:
+	case PCD_RANDOMDIRECT:
+	case PCD_THINGCOUNTDIRECT:
+	case PCD_CHANGEFLOORDIRECT:
+	case PCD_CHANGECEILINGDIRECT:
+	case PCD_GIVEINVENTORYDIRECT:
+	case PCD_TAKEINVENTORYDIRECT:
+		return 2;
+
+	case PCD_GOTO: case PCD_IFGOTO: case PCD_IFNOTGOTO:
+	case PCD_PUSHNUMBER: case PCD_LSPEC5EX: case PCD_LSPEC5EXRESULT:
+	case PCD_DELAYDIRECT: case PCD_TAGWAITDIRECT: case PCD_POLYWAITDIRECT: case PCD_SCRIPTWAITDIRECT:
+	case PCD_SETFONTDIRECT: case PCD_SETGRAVITYDIRECT: case PCD_SETAIRCONTROLDIRECT: case PCD_CHECKINVENTORYDIRECT:
+	case PCD_LSPEC1: case PCD_LSPEC2: case PCD_LSPEC3: case PCD_LSPEC4: case PCD_LSPEC5: case PCD_LSPEC5RESULT:
+	case PCD_CALL: case PCD_CALLDISCARD: case PCD_PUSHFUNCTION:
+	case PCD_ASSIGNSCRIPTVAR: case PCD_ASSIGNMAPVAR: case PCD_ASSIGNWORLDVAR: case PCD_ASSIGNGLOBALVAR:
+	case PCD_ASSIGNSCRIPTARRAY: case PCD_ASSIGNMAPARRAY: case PCD_ASSIGNWORLDARRAY: case PCD_ASSIGNGLOBALARRAY:
+	case PCD_PUSHSCRIPTVAR: case PCD_PUSHMAPVAR: case PCD_PUSHWORLDVAR: case PCD_PUSHGLOBALVAR:
+	case PCD_PUSHSCRIPTARRAY: case PCD_PUSHMAPARRAY: case PCD_PUSHWORLDARRAY: case PCD_PUSHGLOBALARRAY:
+	case PCD_ADDSCRIPTVAR: case PCD_ADDMAPVAR: case PCD_ADDWORLDVAR: case PCD_ADDGLOBALVAR:
+	case PCD_ADDSCRIPTARRAY: case PCD_ADDMAPARRAY: case PCD_ADDWORLDARRAY: case PCD_ADDGLOBALARRAY:
+	case PCD_SUBSCRIPTVAR: case PCD_SUBMAPVAR: case PCD_SUBWORLDVAR: case PCD_SUBGLOBALVAR:
+	case PCD_SUBSCRIPTARRAY: case PCD_SUBMAPARRAY: case PCD_SUBWORLDARRAY: case PCD_SUBGLOBALARRAY:
+	case PCD_MULSCRIPTVAR: case PCD_MULMAPVAR: case PCD_MULWORLDVAR: case PCD_MULGLOBALVAR:
+	case PCD_MULSCRIPTARRAY: case PCD_MULMAPARRAY: case PCD_MULWORLDARRAY: case PCD_MULGLOBALARRAY:
+	case PCD_DIVSCRIPTVAR: case PCD_DIVMAPVAR: case PCD_DIVWORLDVAR: case PCD_DIVGLOBALVAR:
+	case PCD_DIVSCRIPTARRAY: case PCD_DIVMAPARRAY: case PCD_DIVWORLDARRAY: case PCD_DIVGLOBALARRAY:
+	case PCD_MODSCRIPTVAR: case PCD_MODMAPVAR: case PCD_MODWORLDVAR: case PCD_MODGLOBALVAR:
+	case PCD_MODSCRIPTARRAY: case PCD_MODMAPARRAY: case PCD_MODWORLDARRAY: case PCD_MODGLOBALARRAY:
+	case PCD_ANDSCRIPTVAR: case PCD_ANDMAPVAR: case PCD_ANDWORLDVAR: case PCD_ANDGLOBALVAR:
+	case PCD_ANDSCRIPTARRAY: case PCD_ANDMAPARRAY: case PCD_ANDWORLDARRAY: case PCD_ANDGLOBALARRAY:
+	case PCD_EORSCRIPTVAR: case PCD_EORMAPVAR: case PCD_EORWORLDVAR: case PCD_EORGLOBALVAR:
+	case PCD_EORSCRIPTARRAY: case PCD_EORMAPARRAY: case PCD_EORWORLDARRAY: case PCD_EORGLOBALARRAY:
+	case PCD_ORSCRIPTVAR: case PCD_ORMAPVAR: case PCD_ORWORLDVAR: case PCD_ORGLOBALVAR:
+	case PCD_ORSCRIPTARRAY: case PCD_ORMAPARRAY: case PCD_ORWORLDARRAY: case PCD_ORGLOBALARRAY:
+	case PCD_LSSCRIPTVAR: case PCD_LSMAPVAR: case PCD_LSWORLDVAR: case PCD_LSGLOBALVAR:
+	case PCD_LSSCRIPTARRAY: case PCD_LSMAPARRAY: case PCD_LSWORLDARRAY: case PCD_LSGLOBALARRAY:
+	case PCD_RSSCRIPTVAR: case PCD_RSMAPVAR: case PCD_RSWORLDVAR: case PCD_RSGLOBALVAR:
+	case PCD_RSSCRIPTARRAY: case PCD_RSMAPARRAY: case PCD_RSWORLDARRAY: case PCD_RSGLOBALARRAY:
+	case PCD_INCSCRIPTVAR: case PCD_INCMAPVAR: case PCD_INCWORLDVAR: case PCD_INCGLOBALVAR:
+	case PCD_INCSCRIPTARRAY: case PCD_INCMAPARRAY: case PCD_INCWORLDARRAY: case PCD_INCGLOBALARRAY:
+	case PCD_DECSCRIPTVAR: case PCD_DECMAPVAR: case PCD_DECWORLDVAR: case PCD_DECGLOBALVAR:
+	case PCD_DECSCRIPTARRAY: case PCD_DECMAPARRAY: case PCD_DECWORLDARRAY: case PCD_DECGLOBALARRAY:
+		return 1;
+
+	default:
+		return 0;
+	}
+}
+
+//==========================================================================
+//
+// FBehavior :: StaticBenchmarkCode
+//
+// Times the pre-decoding of every loaded module and compares fetching all
+// its instructions with their operands from the lump against reading the
+// pre-decoded words. Both must see the same values. It also steps through
+// the pre-decoded code the way the interpreter does and checks that every
+// instruction ends where the next one starts.
+//
+//==========================================================================
+
+void FBehavior::StaticBenchmarkCode(int passes)
+{
+	for (auto module : StaticModules)
+	{
+		TArray<int32_t> code;
+		TArray<int> codemap;
+		TArray<uint32_t> codeofs;
+		TArray<uint32_t> instrs;
+		TArray<uint32_t> targets;
+		uint32_t size = uint32_t(module->Chunks - module->Data);
+
+		uint64_t decodetime = I_nsTime();
+		bool good = module->DecodeCode(code, codemap, codeofs);
+		decodetime = I_nsTime() - decodetime;
+		if (!good)
+		{
+			Printf("%s: cannot be pre-decoded\n", module->ModuleName);
+			continue;
+		}
+		for (uint32_t ofs = 0; ofs < size; ++ofs)
+		{
+			if (codemap[ofs] >= 0) instrs.Push(ofs);
+		}
+
+		// instrs is sorted, and so are the decoded instructions, which makes
+		// the next instruction's start the end of the current one.
+		unsigned badlayout = 0;
+		int firstbad = -1;
+		for (unsigned i = 0; i < instrs.Size(); ++i)
+		{
+			unsigned start = codemap[instrs[i]];
+			unsigned end = i + 1 < instrs.Size() ? codemap[instrs[i + 1]] : code.Size() - 1;
+			if (start + 1 + InterpreterOperandWords(&code[start]) != end)
+			{
+				if (badlayout++ == 0) firstbad = LittleLong(code[start]);
+			}
+		}
+		if (badlayout > 0)
+		{
+			Printf(TEXTCOLOR_RED "%s: %u instructions do not match the interpreter's operand count, the first is p-code %d\n",
+				module->ModuleName, badlayout, firstbad);
+		}
+
+		uint32_t rawsum = 0, decodedsum = 0;
+		uint64_t rawtime = I_nsTime();
+		for (int pass = 0; pass < passes; ++pass)
+		{
+			for (auto ofs : instrs)
+			{
+				uint32_t next;
+				bool fallthrough;
+				targets.Clear();
+				DecodeInstruction(module->Data, size, module->Format, ofs, next, fallthrough, targets, [&](int val) { rawsum += val; });
+			}
+		}
+		rawtime = I_nsTime() - rawtime;
+
+		uint64_t decodedtime = I_nsTime();
+		for (int pass = 0; pass < passes; ++pass)
+		{
+			// The last word is the terminator for undecoded jump targets.
+			for (unsigned i = 0; i + 1 < code.Size(); ++i)
+			{
+				decodedsum += LittleLong(code[i]);
+			}
+		}
+		decodedtime = I_nsTime() - decodedtime;
+
+		Printf("%s: %u instructions, %u words, decoded in %.3f ms. %d fetch passes: lump %.3f ms, pre-decoded %.3f ms%s\n",
+			module->ModuleName, instrs.Size(), code.Size() - 1, decodetime / 1e6, passes, rawtime / 1e6, decodedtime / 1e6,
+			rawsum == decodedsum ? "" : TEXTCOLOR_RED " MISMATCH");
+	}
+}
+
+//==========================================================================
+//
+// FBehavior :: LowerFunction
+//
+// Translates an ACS function into a VM function that the JIT can compile
+// to native code. Only functions that do nothing but arithmetic on the
+// stack and their own local variables qualify, so running them outside
+// the interpreter can't be observed by anything but the result.
+//
+// The VM function takes the ACS arguments plus the number of instructions
+// the script may still execute before it counts as runaway. It returns
+// the result, the number of ACS instructions it executed and an
+// ACSVM_* status. The instructions are counted per block, so runaway
+// checks and acsprofile see the same numbers as with the interpreter.
+//
+//==========================================================================
+
+enum
+{
+	ACSVM_Return,
+	ACSVM_DivideBy0,
+	ACSVM_ModulusBy0,
+	ACSVM_Runaway,
+};
+
+struct FACSVMCacheEntry
+{
+	uint32_t CRC;
+	int NumLocals;
+	TArray<int32_t> Words;
+	VMFunction *Func;
+};
+
+// Modules are reloaded for every map, so the lowered functions are shared
+// between all modules with the same code.
+static TDeletingArray<FACSVMCacheEntry *> ACSVMCache;
+
+struct FLoweredInstr
+{
+	uint32_t Ofs, Next;
+	TArray<int32_t> Words;
+	TArray<uint32_t> Targets;
+	bool FallThrough;
+	bool Leader = false;
+	bool LoopHead = false;
+	int Depth = -1;
+	size_t Address = 0;
+};
+
+// Returns false for p-codes that can't be lowered. use is the number of
+// stack entries the instruction needs, delta the change to the stack
+// depth when it falls through and jumpdelta when it branches.
+static bool LoweredStackEffect(const TArray<int32_t> &words, int &use, int &delta, int &jumpdelta)
+{
+	use = delta = jumpdelta = 0;
+	switch (words[0])
+	{
+	case PCD_NOP:
+	case PCD_GOTO:
+	case PCD_RETURNVOID:
+	case PCD_INCSCRIPTVAR:
+	case PCD_DECSCRIPTVAR:
+		return true;
+
+	case PCD_PUSHNUMBER:
+	case PCD_PUSHSCRIPTVAR:
+		delta = 1;
+		return true;
+
+	case PCD_PUSHWORDS:
+		delta = words[1];
+		return true;
+
+	case PCD_DUP:
+		use = 1; delta = 1;
+		return true;
+
+	case PCD_SWAP:
+		use = 2;
+		return true;
+
+	case PCD_NEGATELOGICAL:
+	case PCD_NEGATEBINARY:
+	case PCD_UNARYMINUS:
+		use = 1;
+		return true;
+
+	case PCD_DROP:
+	case PCD_RETURNVAL:
+	case PCD_ASSIGNSCRIPTVAR:
+	case PCD_ADDSCRIPTVAR:
+	case PCD_SUBSCRIPTVAR:
+	case PCD_MULSCRIPTVAR:
+	case PCD_DIVSCRIPTVAR:
+	case PCD_MODSCRIPTVAR:
+	case PCD_ANDSCRIPTVAR:
+	case PCD_EORSCRIPTVAR:
+	case PCD_ORSCRIPTVAR:
+	case PCD_LSSCRIPTVAR:
+	case PCD_RSSCRIPTVAR:
+		use = 1; delta = -1;
+		return true;
+
+	case PCD_IFGOTO:
+	case PCD_IFNOTGOTO:
+		use = 1; delta = -1; jumpdelta = -1;
+		return true;
+
+	case PCD_CASEGOTO:
+	case PCD_CASEGOTOSORTED:
+		use = 1; jumpdelta = -1;
+		return true;
+
+	case PCD_ADD:
+	case PCD_SUBTRACT:
+	case PCD_MULTIPLY:
+	case PCD_DIVIDE:
+	case PCD_MODULUS:
+	case PCD_EQ:
+	case PCD_NE:
+	case PCD_LT:
+	case PCD_GT:
+	case PCD_LE:
+	case PCD_GE:
+	case PCD_ANDLOGICAL:
+	case PCD_ORLOGICAL:
+	case PCD_ANDBITWISE:
+	case PCD_ORBITWISE:
+	case PCD_EORBITWISE:
+	case PCD_LSHIFT:
+	case PCD_RSHIFT:
+		use = 2; delta = -1;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+static bool UsesLocal(int pcd)
+{
+	switch (pcd)
+	{
+	case PCD_PUSHSCRIPTVAR:
+	case PCD_ASSIGNSCRIPTVAR:
+	case PCD_ADDSCRIPTVAR:
+	case PCD_SUBSCRIPTVAR:
+	case PCD_MULSCRIPTVAR:
+	case PCD_DIVSCRIPTVAR:
+	case PCD_MODSCRIPTVAR:
+	case PCD_ANDSCRIPTVAR:
+	case PCD_EORSCRIPTVAR:
+	case PCD_ORSCRIPTVAR:
+	case PCD_LSSCRIPTVAR:
+	case PCD_RSSCRIPTVAR:
+	case PCD_INCSCRIPTVAR:
+	case PCD_DECSCRIPTVAR:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+VMFunction *FBehavior::LowerFunction(int funcnum) const
+{
+	const ScriptFunction *func = &Functions[funcnum];
+	const int numargs = func->ArgCount;
+	const int numlocals = func->ArgCount + func->LocalCount;
+	const uint32_t size = uint32_t(Chunks - Data);
+	TArray<FLoweredInstr> instrs;
+	TMap<uint32_t, unsigned> index;
+	TArray<uint32_t> work;
+	uint32_t ofs;
+
+	if (func->ImportNum != 0 || func->Address == 0 || numlocals > 100)
+	{
+		return nullptr;
+	}
+
+	// Collect the function's code.
+	work.Push(func->Address);
+	while (work.Pop(ofs))
+	{
+		while (index.CheckKey(ofs) == nullptr)
+		{
+			FLoweredInstr instr;
+			int use, delta, jumpdelta;
+
+			if (ofs >= size)
+			{
+				return nullptr;
+			}
+			instr.Ofs = ofs;
+			if (!DecodeInstruction(Data, size, Format, ofs, instr.Next, instr.FallThrough, instr.Targets, [&](int val) { instr.Words.Push(val); }) ||
+				!LoweredStackEffect(instr.Words, use, delta, jumpdelta) ||
+				(UsesLocal(instr.Words[0]) && (unsigned)instr.Words[1] >= (unsigned)numlocals))
+			{
+				return nullptr;
+			}
+			for (auto target : instr.Targets)
+			{
+				work.Push(target);
+			}
+			index[ofs] = instrs.Push(instr);
+			if (!instr.FallThrough)
+			{
+				break;
+			}
+			ofs = instr.Next;
+		}
+	}
+
+	// Lay it out in its original order, so that falling through works.
+	std::sort(instrs.begin(), instrs.end(), [](const FLoweredInstr &a, const FLoweredInstr &b) { return a.Ofs < b.Ofs; });
+	index.Clear();
+	for (unsigned i = 0; i < instrs.Size(); ++i)
+	{
+		if (i + 1 < instrs.Size() ? instrs[i].Next != instrs[i + 1].Ofs && (instrs[i].FallThrough || instrs[i].Next > instrs[i + 1].Ofs) : instrs[i].FallThrough)
+		{
+			return nullptr;
+		}
+		index[instrs[i].Ofs] = i;
+	}
+
+	// Reuse the function if a module with the same code was loaded before.
+	uint32_t crc = CalcCRC32((const uint8_t *)&numlocals, sizeof(numlocals));
+	TArray<int32_t> key;
+	for (auto &instr : instrs)
+	{
+		key.Push(instr.Ofs);
+		key.Append(instr.Words);
+	}
+	crc = AddCRC32(crc, (const uint8_t *)&key[0], key.Size() * sizeof(int32_t));
+	FACSVMCacheEntry *cached = nullptr;
+	for (auto entry : ACSVMCache)
+	{
+		if (entry->CRC == crc && entry->NumLocals == numlocals && entry->Words == key)
+		{
+			if (entry->Func != nullptr)
+			{
+				return entry->Func;
+			}
+			cached = entry;
+			break;
+		}
+	}
+
+	// Every instruction must always see the same stack depth.
+	TArray<unsigned> pending;
+	int maxdepth = 0;
+	instrs[index[func->Address]].Depth = 0;
+	pending.Push(index[func->Address]);
+
+	auto propagate = [&](unsigned i, int depth)
+	{
+		if (instrs[i].Depth < 0)
+		{
+			instrs[i].Depth = depth;
+			pending.Push(i);
+			return true;
+		}
+		return instrs[i].Depth == depth;
+	};
+
+	unsigned i;
+	while (pending.Pop(i))
+	{
+		FLoweredInstr &instr = instrs[i];
+		int use, delta, jumpdelta;
+
+		LoweredStackEffect(instr.Words, use, delta, jumpdelta);
+		if (instr.Depth < use)
+		{
+			return nullptr;
+		}
+		maxdepth = MAX(maxdepth, instr.Depth + MAX(delta, 0));
+		if (instr.FallThrough && !propagate(i + 1, instr.Depth + delta))
+		{
+			return nullptr;
+		}
+		for (auto target : instr.Targets)
+		{
+			unsigned t = index[target];
+			if (!propagate(t, instr.Depth + jumpdelta))
+			{
+				return nullptr;
+			}
+			instrs[t].Leader = true;
+			if (target <= instr.Ofs)
+			{
+				instrs[t].LoopHead = true;
+			}
+		}
+		// Instructions that can stop the script end their block, so the
+		// instruction count is exact when they do.
+		switch (instr.Words[0])
+		{
+		case PCD_DIVIDE: case PCD_MODULUS: case PCD_DIVSCRIPTVAR: case PCD_MODSCRIPTVAR:
+		case PCD_IFGOTO: case PCD_IFNOTGOTO: case PCD_CASEGOTO: case PCD_CASEGOTOSORTED:
+			if (i + 1 < instrs.Size()) instrs[i + 1].Leader = true;
+			break;
+		}
+	}
+	instrs[index[func->Address]].Leader = true;
+
+	// Register layout: arguments, instruction limit, other locals, stack, counter, zero, temporary.
+	const int limitreg = numargs;
+	const int stackbase = numlocals + 1;
+	const int countreg = stackbase + maxdepth;
+	const int zeroreg = countreg + 1;
+	const int tempreg = countreg + 2;
+	if (tempreg >= 180)
+	{
+		return nullptr;
+	}
+
+	auto local = [&](int var) { return var < numargs ? var : var + 1; };
+
+	VMFunctionBuilder build(0);
+	for (int reg = 0; reg <= tempreg; ++reg)
+	{
+		build.Registers[REGT_INT].Get(1);
+	}
+
+	build.EmitLoadInt(countreg, 0);
+	build.EmitLoadInt(zeroreg, 0);
+	for (int var = numargs; var < numlocals; ++var)
+	{
+		build.EmitLoadInt(local(var), 0);
+	}
+
+	TArray<size_t> divbail, modbail, runawaybail;
+	TArray<std::pair<size_t, uint32_t>> jumps;
+
+	auto emitbool = [&](int op, int check, int b, int c, int dest)
+	{
+		build.Emit(op, check, b, c);
+		size_t jtrue = build.Emit(OP_JMP, 0);
+		build.EmitLoadInt(dest, 0);
+		size_t jend = build.Emit(OP_JMP, 0);
+		build.BackpatchToHere(jtrue);
+		build.EmitLoadInt(dest, 1);
+		build.BackpatchToHere(jend);
+	};
+	auto emitjump = [&](int op, int check, int b, int c, uint32_t target)
+	{
+		build.Emit(op, check, b, c);
+		jumps.Push(std::make_pair(build.Emit(OP_JMP, 0), target));
+	};
+
+	for (i = 0; i < instrs.Size(); ++i)
+	{
+		FLoweredInstr &instr = instrs[i];
+		const int *words = &instr.Words[0];
+		const int top = stackbase + instr.Depth - 1;
+		const int next = stackbase + instr.Depth - 2;
+
+		if (instr.Depth < 0)
+		{
+			continue;
+		}
+		instr.Address = build.GetAddress();
+		if (instr.Leader)
+		{
+			unsigned blocksize = 1;
+			while (i + blocksize < instrs.Size() && !instrs[i + blocksize].Leader)
+			{
+				blocksize++;
+			}
+			if (blocksize < 128)
+			{
+				build.Emit(OP_ADDI, countreg, countreg, blocksize);
+			}
+			else
+			{
+				build.Emit(OP_ADD_RK, countreg, countreg, build.GetConstantInt(blocksize));
+			}
+			if (instr.LoopHead)
+			{
+				build.Emit(OP_LE_RR, 0, countreg, limitreg);
+				runawaybail.Push(build.Emit(OP_JMP, 0));
+			}
+		}
+
+		switch (words[0])
+		{
+		case PCD_NOP:
+		case PCD_DROP:
+			break;
+
+		case PCD_PUSHNUMBER:
+			build.EmitLoadInt(top + 1, words[1]);
+			break;
+
+		case PCD_PUSHWORDS:
+			for (int j = 0; j < words[1]; ++j)
+			{
+				build.EmitLoadInt(top + 1 + j, words[2 + j]);
+			}
+			break;
+
+		case PCD_DUP:
+			build.Emit(OP_MOVE, top + 1, top);
+			break;
+
+		case PCD_SWAP:
+			build.Emit(OP_MOVE, tempreg, top);
+			build.Emit(OP_MOVE, top, next);
+			build.Emit(OP_MOVE, next, tempreg);
+			break;
+
+		case PCD_ADD:			build.Emit(OP_ADD_RR, next, next, top); break;
+		case PCD_SUBTRACT:		build.Emit(OP_SUB_RR, next, next, top); break;
+		case PCD_MULTIPLY:		build.Emit(OP_MUL_RR, next, next, top); break;
+		case PCD_ANDBITWISE:	build.Emit(OP_AND_RR, next, next, top); break;
+		case PCD_ORBITWISE:		build.Emit(OP_OR_RR, next, next, top); break;
+		case PCD_EORBITWISE:	build.Emit(OP_XOR_RR, next, next, top); break;
+		case PCD_LSHIFT:		build.Emit(OP_SLL_RR, next, next, top); break;
+		case PCD_RSHIFT:		build.Emit(OP_SRA_RR, next, next, top); break;
+
+		case PCD_DIVIDE:
+		case PCD_MODULUS:
+			build.Emit(OP_EQ_R, 1, top, zeroreg);
+			(words[0] == PCD_DIVIDE ? divbail : modbail).Push(build.Emit(OP_JMP, 0));
+			build.Emit(words[0] == PCD_DIVIDE ? OP_DIV_RR : OP_MOD_RR, next, next, top);
+			break;
+
+		case PCD_EQ:			emitbool(OP_EQ_R, 1, next, top, next); break;
+		case PCD_NE:			emitbool(OP_EQ_R, 0, next, top, next); break;
+		case PCD_LT:			emitbool(OP_LT_RR, 1, next, top, next); break;
+		case PCD_GE:			emitbool(OP_LT_RR, 0, next, top, next); break;
+		case PCD_LE:			emitbool(OP_LE_RR, 1, next, top, next); break;
+		case PCD_GT:			emitbool(OP_LE_RR, 0, next, top, next); break;
+		case PCD_NEGATELOGICAL:	emitbool(OP_EQ_R, 1, top, zeroreg, top); break;
+
+		case PCD_ANDLOGICAL:
+		case PCD_ORLOGICAL:
+			{
+				// Both operands are always evaluated by ACS, so this only has to combine them.
+				int check = words[0] == PCD_ANDLOGICAL;
+				build.Emit(OP_EQ_R, check, next, zeroreg);
+				size_t j1 = build.Emit(OP_JMP, 0);
+				build.Emit(OP_EQ_R, check, top, zeroreg);
+				size_t j2 = build.Emit(OP_JMP, 0);
+				build.EmitLoadInt(next, check);
+				size_t jend = build.Emit(OP_JMP, 0);
+				build.BackpatchToHere(j1);
+				build.BackpatchToHere(j2);
+				build.EmitLoadInt(next, !check);
+				build.BackpatchToHere(jend);
+			}
+			break;
+
+		case PCD_NEGATEBINARY:	build.Emit(OP_NOT, top, top, 0); break;
+		case PCD_UNARYMINUS:	build.Emit(OP_NEG, top, top, 0); break;
+
+		case PCD_PUSHSCRIPTVAR:		build.Emit(OP_MOVE, top + 1, local(words[1])); break;
+		case PCD_ASSIGNSCRIPTVAR:	build.Emit(OP_MOVE, local(words[1]), top); break;
+		case PCD_ADDSCRIPTVAR:		build.Emit(OP_ADD_RR, local(words[1]), local(words[1]), top); break;
+		case PCD_SUBSCRIPTVAR:		build.Emit(OP_SUB_RR, local(words[1]), local(words[1]), top); break;
+		case PCD_MULSCRIPTVAR:		build.Emit(OP_MUL_RR, local(words[1]), local(words[1]), top); break;
+		case PCD_ANDSCRIPTVAR:		build.Emit(OP_AND_RR, local(words[1]), local(words[1]), top); break;
+		case PCD_EORSCRIPTVAR:		build.Emit(OP_XOR_RR, local(words[1]), local(words[1]), top); break;
+		case PCD_ORSCRIPTVAR:		build.Emit(OP_OR_RR, local(words[1]), local(words[1]), top); break;
+		case PCD_LSSCRIPTVAR:		build.Emit(OP_SLL_RR, local(words[1]), local(words[1]), top); break;
+		case PCD_RSSCRIPTVAR:		build.Emit(OP_SRA_RR, local(words[1]), local(words[1]), top); break;
+		case PCD_INCSCRIPTVAR:		build.Emit(OP_ADDI, local(words[1]), local(words[1]), 1); break;
+		case PCD_DECSCRIPTVAR:		build.Emit(OP_ADDI, local(words[1]), local(words[1]), 0xff); break;	// C is signed
+
+		case PCD_DIVSCRIPTVAR:
+		case PCD_MODSCRIPTVAR:
+			build.Emit(OP_EQ_R, 1, top, zeroreg);
+			(words[0] == PCD_DIVSCRIPTVAR ? divbail : modbail).Push(build.Emit(OP_JMP, 0));
+			build.Emit(words[0] == PCD_DIVSCRIPTVAR ? OP_DIV_RR : OP_MOD_RR, local(words[1]), local(words[1]), top);
+			break;
+
+		case PCD_GOTO:
+			jumps.Push(std::make_pair(build.Emit(OP_JMP, 0), (uint32_t)words[1]));
+			break;
+
+		case PCD_IFGOTO:		emitjump(OP_EQ_R, 0, top, zeroreg, words[1]); break;
+		case PCD_IFNOTGOTO:		emitjump(OP_EQ_R, 1, top, zeroreg, words[1]); break;
+
+		case PCD_CASEGOTO:
+			build.EmitLoadInt(tempreg, words[1]);
+			emitjump(OP_EQ_R, 1, top, tempreg, words[2]);
+			break;
+
+		case PCD_CASEGOTOSORTED:
+			for (int j = 0; j < words[1]; ++j)
+			{
+				build.EmitLoadInt(tempreg, words[2 + j*2]);
+				emitjump(OP_EQ_R, 1, top, tempreg, words[3 + j*2]);
+			}
+			break;
+
+		case PCD_RETURNVOID:
+		case PCD_RETURNVAL:
+			if (words[0] == PCD_RETURNVAL)
+			{
+				build.Emit(OP_RET, 0, REGT_INT, top);
+			}
+			else
+			{
+				build.EmitRetInt(0, false, 0);
+			}
+			build.Emit(OP_RET, 1, REGT_INT, countreg);
+			build.EmitRetInt(2, true, ACSVM_Return);
+			break;
+		}
+	}
+
+	auto emitbail = [&](TArray<size_t> &bails, int status)
+	{
+		if (bails.Size() > 0)
+		{
+			build.BackpatchListToHere(bails);
+			build.EmitRetInt(0, false, 0);
+			build.Emit(OP_RET, 1, REGT_INT, countreg);
+			build.EmitRetInt(2, true, status);
+		}
+	};
+	emitbail(divbail, ACSVM_DivideBy0);
+	emitbail(modbail, ACSVM_ModulusBy0);
+	emitbail(runawaybail, ACSVM_Runaway);
+
+	for (auto &jump : jumps)
+	{
+		build.Backpatch(jump.first, instrs[index[jump.second]].Address);
+	}
+
+	TArray<PType *> rets, args;
+	for (int j = 0; j < 3; ++j) rets.Push(TypeSInt32);
+	for (int j = 0; j <= numargs; ++j) args.Push(TypeSInt32);
+	uint8_t *regtypes = (uint8_t *)ClassDataAllocator.Alloc(numargs + 1);
+	memset(regtypes, REGT_INT, numargs + 1);
+
+	auto sfunc = new VMScriptFunction;
+	sfunc->Proto = NewPrototype(rets, args);
+	sfunc->RegTypes = regtypes;
+	build.MakeFunction(sfunc);
+	sfunc->NumArgs = numargs + 1;
+	sfunc->PrintableName.Format("ACS.%s.%d", ModuleName, funcnum);
+
+	if (cached == nullptr)
+	{
+		cached = new FACSVMCacheEntry;
+		cached->CRC = crc;
+		cached->NumLocals = numlocals;
+		cached->Words = std::move(key);
+		ACSVMCache.Push(cached);
+	}
+	// The VM deletes all functions when it shuts down.
+	cached->Func = sfunc;
+	PClass::FunctionPtrList.Push(&cached->Func);
+	return sfunc;
+}
+
+
 FBehavior::~FBehavior ()
 {
 	if (Scripts != NULL)
@@ -7002,7 +8136,7 @@ int DLevelScript::RunScript ()
 	int &sp = stackobj.sp;
 
 	int *pc = this->pc;
-	ACSFormat fmt = activeBehavior->GetFormat();
+	ACSFormat fmt = activeBehavior->GetCodeFormat();
 	FBehavior* const savedActiveBehavior = activeBehavior;
 	unsigned int runaway = 0;	// used to prevent infinite loops
 	int pcd;
@@ -7109,6 +8243,13 @@ int DLevelScript::RunScript ()
 			}
 			break;
 
+		case PCD_PUSHWORDS:
+			for (temp = NEXTWORD; temp > 0; temp--)
+			{
+				PushToStack (NEXTWORD);
+			}
+			break;
+
 		case PCD_DUP:
 			Stack[sp] = Stack[sp-1];
 			sp++;
@@ -7320,6 +8461,43 @@ int DLevelScript::RunScript ()
 					state = SCRIPT_PleaseRemove;
 					break;
 				}
+				if (func->VMFunc != nullptr)
+				{
+					// Lowered functions have no side effects, so it makes no difference
+					// that a runaway script is only noticed once they return.
+					VMValue params[102];
+					int result, count, status;
+					VMReturn rets[3] = { &result, &count, &status };
+
+					for (int a = 0; a < func->ArgCount; ++a)
+					{
+						params[a] = VMValue(Stack[sp - func->ArgCount + a]);
+					}
+					params[func->ArgCount] = VMValue(int(2000000 - runaway));
+					VMCall(func->VMFunc, params, func->ArgCount + 1, rets, 3);
+					sp -= func->ArgCount;
+					if (runaway + count > 2000000)
+					{
+						Printf ("Runaway %s terminated\n", ScriptPresentation(script).GetChars());
+						runaway = 2000001;
+						state = SCRIPT_PleaseRemove;
+						break;
+					}
+					runaway += count;
+					if (status != ACSVM_Return)
+					{
+						state = status == ACSVM_DivideBy0 ? SCRIPT_DivideBy0 : SCRIPT_ModulusBy0;
+						break;
+					}
+					ACSProfileInfo *profile = module->GetFunctionProfileData(func);
+					profile->AddRun(count);
+					profile->NumVMRuns++;
+					if (pcd != PCD_CALLDISCARD)
+					{
+						Stack[sp++] = result;
+					}
+					break;
+				}
 				const ACSLocalVariables mylocals = locals;
 				// The function's first argument is also its first local variable.
 				locals.Reset(&Stack[sp - func->ArgCount], func->ArgCount + func->LocalCount);
@@ -7336,7 +8514,7 @@ int DLevelScript::RunScript ()
 				localarrays = &func->LocalArrays;
 				activeFunction = func;
 				activeBehavior = module;
-				fmt = module->GetFormat();
+				fmt = module->GetCodeFormat();
 			}
 			break;
 
@@ -7365,7 +8543,7 @@ int DLevelScript::RunScript ()
 				pc = ret->ReturnModule->Ofs2PC(ret->ReturnAddress);
 				activeFunction = ret->ReturnFunction;
 				activeBehavior = ret->ReturnModule;
-				fmt = activeBehavior->GetFormat();
+				fmt = activeBehavior->GetCodeFormat();
 				locals = ret->ReturnLocals;
 				localarrays = ret->ReturnArrays;
 				if (!ret->bDiscardResult)
@@ -9075,6 +10253,7 @@ scriptwait:
 			{
 				int lineno;
 
+				P_InvalidateSightCache();
 				FLineIdIterator itr(STACK(2));
 				while ((lineno = itr.Next()) >= 0)
 				{
@@ -10682,6 +11861,7 @@ void ACSProfileInfo::Reset()
 	NumRuns = 0;
 	MinInstrPerRun = UINT_MAX;
 	MaxInstrPerRun = 0;
+	NumVMRuns = 0;
 }
 
 void ACSProfileInfo::AddRun(unsigned int num_instr)
@@ -10813,8 +11993,8 @@ static void ShowProfileData(TArray<ProfileCollector> &profiles, long ilimit,
 		limit = UINT_MAX;
 	}
 
-	Printf(TEXTCOLOR_YELLOW "Module       %-20s      Total    Runs     Avg     Min     Max\n", typelabels[functions]);
-	Printf(TEXTCOLOR_YELLOW "------------ -------------------- ---------- ------- ------- ------- -------\n");
+	Printf(TEXTCOLOR_YELLOW "Module       %-20s      Total    Runs     Avg     Min     Max%s\n", typelabels[functions], functions ? "  VMRuns" : "");
+	Printf(TEXTCOLOR_YELLOW "------------ -------------------- ---------- ------- ------- ------- -------%s\n", functions ? " -------" : "");
 	for (unsigned int i = 0; i < limit && i < profiles.Size(); ++i)
 	{
 		ProfileCollector *prof = &profiles[i];
@@ -10845,7 +12025,7 @@ static void ShowProfileData(TArray<ProfileCollector> &profiles, long ilimit,
 			mysnprintf(scriptname, sizeof(scriptname), "%s",
 				ScriptPresentation(prof->Module->GetScriptPtr(prof->Index)->Number).GetChars() + 7);
 		}
-		Printf("%-12s %-20s%11llu%8u%8u%8u%8u\n",
+		Printf("%-12s %-20s%11llu%8u%8u%8u%8u",
 			modname, scriptname,
 			prof->ProfileData->TotalInstr,
 			prof->ProfileData->NumRuns,
@@ -10853,6 +12033,11 @@ static void ShowProfileData(TArray<ProfileCollector> &profiles, long ilimit,
 			prof->ProfileData->MinInstrPerRun,
 			prof->ProfileData->MaxInstrPerRun
 			);
+		if (functions)
+		{
+			Printf("%8u", prof->ProfileData->NumVMRuns);
+		}
+		Printf("\n");
 	}
 }
 
@@ -10925,8 +12110,35 @@ CCMD(acsprofile)
 
 	ShowProfileData(ScriptProfiles, limit, sorter, false);
 	ShowProfileData(FuncProfiles, limit, sorter, true);
+
+	// Summarize how much of the function workload ran through the VM.
+	unsigned int called = 0, vmcalled = 0;
+	uint64_t runs = 0, vmruns = 0;
+	for (auto &prof : FuncProfiles)
+	{
+		if (prof.ProfileData->NumRuns > 0)
+		{
+			called++;
+			runs += prof.ProfileData->NumRuns;
+			vmruns += prof.ProfileData->NumVMRuns;
+			if (prof.ProfileData->NumVMRuns > 0) vmcalled++;
+		}
+	}
+	if (vmcalled > 0)
+	{
+		Printf("%u of %u called functions ran in the VM (%.1f%% of all calls)\n",
+			vmcalled, called, 100. * vmruns / runs);
+	}
+}
+
+CCMD(acsbench)
+{
+	int passes = argv.argc() > 1 ? atoi(argv[1]) : 100;
+	FBehavior::StaticBenchmarkCode(MAX(passes, 1));
 }
 
+ADD_CYCLE_STAT(acs, ACSTime)
+
 ADD_STAT(ACS)
 {
 	return FStringf("ACS time: %f ms", ACSTime.TimeMS());
@@ -44,6 +44,7 @@ class FFont;
 class FileReader;
 struct line_t;
 class FSerializer;
+class VMFunction;
 
 
 enum
@@ -154,6 +155,7 @@ struct ACSProfileInfo
 	unsigned int NumRuns;
 	unsigned int MinInstrPerRun;
 	unsigned int MaxInstrPerRun;
+	unsigned int NumVMRuns;		// runs that were executed by the VM instead of the interpreter
 
 	ACSProfileInfo();
 	void AddRun(unsigned int num_instr);
@@ -313,6 +315,7 @@ struct ScriptFunction
 	int  LocalCount;
 	uint32_t Address;
 	ACSLocalArrays LocalArrays;
+	VMFunction *VMFunc;		// the function lowered to the VM, if it could be
 };
 
 // Script types
@@ -356,10 +359,13 @@ public:
 	uint8_t *NextChunk (uint8_t *chunk) const;
 	const ScriptPtr *FindScript (int number) const;
 	void StartTypedScripts (uint16_t type, AActor *activator, bool always, int arg1, bool runNow);
-	uint32_t PC2Ofs (int *pc) const { return (uint32_t)((uint8_t *)pc - Data); }
-	int *Ofs2PC (uint32_t ofs) const {	return (int *)(Data + ofs); }
+	uint32_t PC2Ofs (int *pc) const { return Code.Size() > 0 ? CodeOfs[pc - &Code[0]] : (uint32_t)((uint8_t *)pc - Data); }
+	int *Ofs2PC (uint32_t ofs) const { return Code.Size() > 0 ? &Code[ofs < CodeMap.Size() && CodeMap[ofs] >= 0 ? CodeMap[ofs] : Code.Size() - 1] : (int *)(Data + ofs); }
 	int *Jump2PC (uint32_t jumpPoint) const { return Ofs2PC(JumpPoints[jumpPoint]); }
 	ACSFormat GetFormat() const { return Format; }
+	// The format the interpreter has to expect at a pc from Ofs2PC. Pre-decoded code only has full words.
+	ACSFormat GetCodeFormat() const { return Code.Size() > 0 && Format == ACS_LittleEnhanced ? ACS_Enhanced : Format; }
+	bool IsPreDecoded() const { return Code.Size() > 0; }
 	ScriptFunction *GetFunction (int funcnum, FBehavior *&module) const;
 	int GetArrayVal (int arraynum, int index) const;
 	void SetArrayVal (int arraynum, int index, int value);
@@ -369,7 +375,7 @@ public:
 	int FindMapVarName (const char *varname) const;
 	int FindMapArray (const char *arrayname) const;
 	int GetLibraryID () const { return LibraryID; }
-	int *GetScriptAddress (const ScriptPtr *ptr) const { return (int *)(ptr->Address + Data); }
+	int *GetScriptAddress (const ScriptPtr *ptr) const { return Ofs2PC(ptr->Address); }
 	int GetScriptIndex (const ScriptPtr *ptr) const { ptrdiff_t index = ptr - Scripts; return index >= NumScripts ? -1 : (int)index; }
 	ScriptPtr *GetScriptPtr(int index) const { return index >= 0 && index < NumScripts ? &Scripts[index] : NULL; }
 	int GetLumpNum() const { return LumpNum; }
@@ -395,6 +401,7 @@ public:
 	static const char *StaticLookupString (uint32_t index, bool forprint = false);
 	static void StaticStartTypedScripts (uint16_t type, AActor *activator, bool always, int arg1=0, bool runNow=false);
 	static void StaticStopMyScripts (AActor *actor);
+	static void StaticBenchmarkCode (int passes);
 
 private:
 	struct ArrayInfo;
@@ -423,9 +430,17 @@ private:
 	char ModuleName[9];
 	TArray<int> JumpPoints;
 
+	// Pre-decoded code: every opcode and operand widened to one word, in the same byte order
+	// as the lump. Jump targets still use lump offsets, which CodeMap translates to Code indices.
+	TArray<int32_t> Code;
+	TArray<int> CodeMap;
+	TArray<uint32_t> CodeOfs;
+
 	static TArray<FBehavior *> StaticModules;
 
 	void LoadScriptsDirectory ();
+	bool DecodeCode (TArray<int32_t> &code, TArray<int> &codemap, TArray<uint32_t> &codeofs) const;
+	VMFunction *LowerFunction (int funcnum) const;
 
 	static int SortScripts (const void *a, const void *b);
 	void UnencryptStrings ();
@@ -9,12 +9,11 @@ class AActor;
 struct FBlockNode
 {
 	AActor *Me;						// actor this node references
-	int BlockIndex;					// index into blocklinks for the block this node is in
+	int BlockIndex;					// index into blockcells for the block this node is in
 	int Group;						// portal group this link belongs to (can be different than the actor's own group
-	FBlockNode **PrevActor;			// previous actor in this block
-	FBlockNode *NextActor;			// next actor in this block
 	FBlockNode **PrevBlock;			// previous block this actor is in
 	FBlockNode *NextBlock;			// next block this actor is in
+	int CellSlot;					// index of this node in the block's FBlockCell
 
 	static FBlockNode *Create (AActor *who, int x, int y, int group = -1);
 	void Release ();
@@ -22,6 +21,21 @@ struct FBlockNode
 	static FBlockNode *FreeBlocks;
 };
 
+// The actors linked into a block, stored contiguously.
+// Actors are appended when linked and their slot is nulled out when they
+// are unlinked. Walking the block from the end to the start visits the
+// most recently linked actor first, like the linked lists these replace.
+// Actors linked during such a walk are not visited and actors unlinked
+// during it are skipped. The holes are removed in FBlockmap::CompactCells
+// once per tic.
+struct FBlockCell
+{
+	TArray<AActor *> Actors;
+	TArray<FBlockNode *> Nodes;
+	TArray<uint8_t> Single;			// actor is only linked into this block
+	bool Dirty;
+};
+
 // BLOCKMAP
 // Created from axis aligned bounding box
 // of the map, a rectangular array of
@@ -39,7 +53,8 @@ struct FBlockmap
 	int					bmapheight; 	// in mapblocks
 	double				bmaporgx;
 	double				bmaporgy;		// origin of block map
-	FBlockNode**		blocklinks; 	// for thing chains
+	FBlockCell*			blockcells;		// for thing chains
+	TArray<int>			dirtycells;		// cells with unlinked slots
 
 	// mapblocks are used to check movement
 	// against lines and things
@@ -75,6 +90,11 @@ struct FBlockmap
 
 	bool VerifyBlockMap(int count);
 
+	void LinkCell(FBlockNode *node);
+	void UnlinkCell(FBlockNode *node);
+	void RestoreCell(FBlockNode *node);
+	void CompactCells();
+
 	void Clear()
 	{
 		if (blockmaplump != NULL)
@@ -82,11 +102,12 @@ struct FBlockmap
 			delete[] blockmaplump;
 			blockmaplump = NULL;
 		}
-		if (blocklinks != NULL)
+		if (blockcells != NULL)
 		{
-			delete[] blocklinks;
-			blocklinks = NULL;
+			delete[] blockcells;
+			blockcells = NULL;
 		}
+		dirtycells.Clear();
 	}
 
 };
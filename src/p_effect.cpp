@@ -55,6 +55,9 @@
 #include "r_utility.h"
 #include "g_levellocals.h"
 #include "vm.h"
+#include "portal.h"
+
+#include <thread>
 
 CVAR (Int, cl_rockettrails, 2, CVAR_ARCHIVE); // Default to using sprite rocket trail particle for VR
 CVAR (Bool, r_rail_smartspiral, 0, CVAR_ARCHIVE);
@@ -62,6 +65,10 @@ CVAR (Int, r_rail_spiralsparsity, 1, CVAR_ARCHIVE);
 CVAR (Int, r_rail_trailsparsity, 1, CVAR_ARCHIVE);
 CVAR (Bool, r_particles, true, 0);
 
+// Particles are updated on several threads once there are enough of them.
+// 0 = one thread per core, 1 = update all particles on the main thread
+CVAR (Int, r_particlethreads, 0, CVAR_ARCHIVE | CVAR_GLOBALCONFIG);
+
 FRandom pr_railtrail("RailTrail");
 
 #define FADEFROMTTL(a)	(1.f/(a))
@@ -70,7 +77,10 @@ FRandom pr_railtrail("RailTrail");
 uint32_t			ActiveParticles;
 uint32_t			InactiveParticles;
 TArray<particle_t>	Particles;
-TArray<uint16_t>	ParticlesInSubsec;
+TArray<uint32_t>	ParticlesInSubsec;
+
+static TArray<uint32_t>	ThinkingParticles;	// the active list in order, rebuilt every tic
+static TArray<uint8_t>	ExpiredParticles;	// parallel to ThinkingParticles
 
 static int grey1, grey2, grey3, grey4, red, green, blue, yellow, black,
 		   red1, green1, blue1, yellow1, purple, purple1, white,
@@ -134,8 +144,8 @@ CUSTOM_CVAR( Int, r_maxparticles, 100, CVAR_ARCHIVE ) //Default to min for VR
 {
 	if ( self == 0 )
 		self = 4000;
-	else if (self > 65535)
-		self = 65535;
+	else if (self > MAX_PARTICLES)
+		self = MAX_PARTICLES;
 	else if (self < 100)
 		self = 100;
 
@@ -157,7 +167,7 @@ void P_InitParticles ()
 		num = r_maxparticles;
 
 	// This should be good, but eh...
-	int NumParticles = clamp<int>(num, 100, 65535);
+	int NumParticles = clamp<int>(num, 100, MAX_PARTICLES);
 
 	Particles.Resize(NumParticles);
 	P_ClearParticles ();
@@ -185,13 +195,16 @@ void P_FindParticleSubsectors ()
 		ParticlesInSubsec.Reserve (level.subsectors.Size() - ParticlesInSubsec.Size());
 	}
 
-	fillshort (&ParticlesInSubsec[0], level.subsectors.Size(), NO_PARTICLE);
+	for (unsigned i = 0; i < level.subsectors.Size(); i++)
+	{
+		ParticlesInSubsec[i] = NO_PARTICLE;
+	}
 
 	if (!r_particles)
 	{
 		return;
 	}
-	for (uint16_t i = ActiveParticles; i != NO_PARTICLE; i = Particles[i].tnext)
+	for (uint32_t i = ActiveParticles; i != NO_PARTICLE; i = Particles[i].tnext)
 	{
 		 // Try to reuse the subsector from the last portal check, if still valid.
 		if (Particles[i].subsector == NULL) Particles[i].subsector = R_PointInSubsector(Particles[i].Pos);
@@ -239,64 +252,131 @@ void P_InitEffects ()
 	blood2 = ParticleColor(RPART(kind)/3, GPART(kind)/3, BPART(kind)/3);
 }
 
+//==========================================================================
+//
+// P_ThinkParticle
+//
+// Returns false if the particle has expired. This only changes the
+// particle itself, so it can run on any thread as long as there are no
+// line portals in the level (P_GetOffsetPosition needs the shared
+// intercept list for those).
+//
+//==========================================================================
+
+static bool P_ThinkParticle (particle_t *particle)
+{
+	auto oldtrans = particle->alpha;
+	particle->alpha -= particle->fadestep;
+	particle->size += particle->sizestep;
+	if (particle->alpha <= 0 || oldtrans < particle->alpha || --particle->ttl <= 0 || (particle->size <= 0))
+	{
+		return false;
+	}
+
+	// Handle crossing a line portal
+	DVector2 newxy = P_GetOffsetPosition(particle->Pos.X, particle->Pos.Y, particle->Vel.X, particle->Vel.Y);
+	particle->Pos.X = newxy.X;
+	particle->Pos.Y = newxy.Y;
+	particle->Pos.Z += particle->Vel.Z;
+	particle->Vel += particle->Acc;
+	particle->subsector = R_PointInSubsector(particle->Pos);
+	sector_t *s = particle->subsector->sector;
+	// Handle crossing a sector portal.
+	if (!s->PortalBlocksMovement(sector_t::ceiling))
+	{
+		if (particle->Pos.Z > s->GetPortalPlaneZ(sector_t::ceiling))
+		{
+			particle->Pos += s->GetPortalDisplacement(sector_t::ceiling);
+			particle->subsector = NULL;
+		}
+	}
+	else if (!s->PortalBlocksMovement(sector_t::floor))
+	{
+		if (particle->Pos.Z < s->GetPortalPlaneZ(sector_t::floor))
+		{
+			particle->Pos += s->GetPortalDisplacement(sector_t::floor);
+			particle->subsector = NULL;
+		}
+	}
+	return true;
+}
+
+//==========================================================================
+//
+// P_ThinkParticles
+//
+// The particles are moved in one pass, which is spread over several
+// threads for large counts, and the expired ones are freed afterward in
+// list order so that the free list is the same as with a serial update.
+//
+//==========================================================================
+
 void P_ThinkParticles ()
 {
-	int i;
-	particle_t *particle, *prev;
+	enum { MIN_PARTICLES_PER_THREAD = 4096 };
 
-	i = ActiveParticles;
-	prev = NULL;
-	while (i != NO_PARTICLE)
+	ThinkingParticles.Clear();
+	for (uint32_t i = ActiveParticles; i != NO_PARTICLE; i = Particles[i].tnext)
 	{
-		particle = &Particles[i];
-		i = particle->tnext;
-		if (!particle->notimefreeze && level.isFrozen())
+		ThinkingParticles.Push(i);
+	}
+	unsigned count = ThinkingParticles.Size();
+	ExpiredParticles.Resize(count);
+
+	bool frozen = level.isFrozen();
+	auto thinkrange = [=](unsigned start, unsigned end)
+	{
+		for (unsigned j = start; j < end; j++)
 		{
-			prev = particle;
-			continue;
+			particle_t *particle = &Particles[ThinkingParticles[j]];
+			ExpiredParticles[j] = (particle->notimefreeze || !frozen) && !P_ThinkParticle(particle);
 		}
-		
-		auto oldtrans = particle->alpha;
-		particle->alpha -= particle->fadestep;
-		particle->size += particle->sizestep;
-		if (particle->alpha <= 0 || oldtrans < particle->alpha || --particle->ttl <= 0 || (particle->size <= 0))
+	};
+
+	int numthreads = r_particlethreads > 0 ? *r_particlethreads : (int)std::thread::hardware_concurrency();
+	if (PortalBlockmap.containsLines)
+	{
+		numthreads = 1;
+	}
+	numthreads = clamp<int>(numthreads, 1, count / MIN_PARTICLES_PER_THREAD + 1);
+
+	if (numthreads == 1)
+	{
+		thinkrange(0, count);
+	}
+	else
+	{
+		std::vector<std::thread> threads;
+		unsigned chunk = (count + numthreads - 1) / numthreads;
+		for (int i = 1; i < numthreads; i++)
+		{
+			threads.push_back(std::thread(thinkrange, MIN(count, chunk * i), MIN(count, chunk * (i + 1))));
+		}
+		thinkrange(0, MIN(count, chunk));
+		for (auto &thread : threads)
+		{
+			thread.join();
+		}
+	}
+
+	uint32_t prev = NO_PARTICLE;
+	for (unsigned j = 0; j < count; j++)
+	{
+		uint32_t i = ThinkingParticles[j];
+		particle_t *particle = &Particles[i];
+		if (ExpiredParticles[j])
 		{ // The particle has expired, so free it
+			uint32_t next = particle->tnext;
 			memset (particle, 0, sizeof(particle_t));
-			if (prev)
-				prev->tnext = i;
+			if (prev != NO_PARTICLE)
+				Particles[prev].tnext = next;
 			else
-				ActiveParticles = i;
+				ActiveParticles = next;
 			particle->tnext = InactiveParticles;
-			InactiveParticles = (int)(particle - Particles.Data());
+			InactiveParticles = i;
 			continue;
 		}
-
-		// Handle crossing a line portal
-		DVector2 newxy = P_GetOffsetPosition(particle->Pos.X, particle->Pos.Y, particle->Vel.X, particle->Vel.Y);
-		particle->Pos.X = newxy.X;
-		particle->Pos.Y = newxy.Y;
-		particle->Pos.Z += particle->Vel.Z;
-		particle->Vel += particle->Acc;
-		particle->subsector = R_PointInSubsector(particle->Pos);
-		sector_t *s = particle->subsector->sector;
-		// Handle crossing a sector portal.
-		if (!s->PortalBlocksMovement(sector_t::ceiling))
-		{
-			if (particle->Pos.Z > s->GetPortalPlaneZ(sector_t::ceiling))
-			{
-				particle->Pos += s->GetPortalDisplacement(sector_t::ceiling);
-				particle->subsector = NULL;
-			}
-		}
-		else if (!s->PortalBlocksMovement(sector_t::floor))
-		{
-			if (particle->Pos.Z < s->GetPortalPlaneZ(sector_t::floor))
-			{
-				particle->Pos += s->GetPortalDisplacement(sector_t::floor);
-				particle->subsector = NULL;
-			}
-		}
-		prev = particle;
+		prev = i;
 	}
 }
 
@@ -59,14 +59,15 @@ struct particle_t
 	float	fadestep;
 	float	alpha;
 	int		color;
-	uint16_t	tnext;
-	uint16_t	snext;
+	uint32_t	tnext;
+	uint32_t	snext;
 };
 
 extern TArray<particle_t>	Particles;
-extern TArray<uint16_t>		ParticlesInSubsec;
+extern TArray<uint32_t>		ParticlesInSubsec;
 
-const uint16_t NO_PARTICLE = 0xffff;
+const uint32_t NO_PARTICLE = 0xffffffff;
+const int MAX_PARTICLES = 1000000;
 
 void P_ClearParticles ();
 void P_FindParticleSubsectors ();
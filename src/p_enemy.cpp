@@ -1264,13 +1264,15 @@ int P_LookForMonsters (AActor *actor)
 AActor *LookForTIDInBlock (AActor *lookee, int index, void *extparams)
 {
 	FLookExParams *params = (FLookExParams *)extparams;
-	FBlockNode *block;
+	FBlockCell &cell = level.blockmap.blockcells[index];
 	AActor *link;
 	AActor *other;
 	
-	for (block = level.blockmap.blocklinks[index]; block != NULL; block = block->NextActor)
+	for (int slot = cell.Actors.Size() - 1; slot >= 0; slot--)
 	{
-		link = block->Me;
+		link = cell.Actors[slot];
+		if (link == NULL)
+			continue;			// unlinked
 
         if (!(link->flags & MF_SHOOTABLE))
 			continue;			// not shootable (observer or dead)
@@ -1434,14 +1436,16 @@ int P_LookForTID (AActor *actor, INTBOOL allaround, FLookExParams *params)
 
 AActor *LookForEnemiesInBlock (AActor *lookee, int index, void *extparam)
 {
-	FBlockNode *block;
+	FBlockCell &cell = level.blockmap.blockcells[index];
 	AActor *link;
 	AActor *other;
 	FLookExParams *params = (FLookExParams *)extparam;
 	
-	for (block = level.blockmap.blocklinks[index]; block != NULL; block = block->NextActor)
+	for (int slot = cell.Actors.Size() - 1; slot >= 0; slot--)
 	{
-		link = block->Me;
+		link = cell.Actors[slot];
+		if (link == NULL)
+			continue;			// unlinked
 
         if (!(link->flags & MF_SHOOTABLE))
 			continue;			// not shootable (observer or dead)
@@ -31,15 +31,20 @@
 **
 */
 #include <math.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <thread>
 #ifdef _MSC_VER
 #include <malloc.h>		// for alloca()
 #endif
 
 #ifndef _WIN32
 #include <unistd.h>
+#include <utime.h>
 
 #else
 #include <direct.h>
+#include <sys/utime.h>
 
 #define rmdir _rmdir
 
@@ -69,16 +74,20 @@
 #include "r_utility.h"
 #include "cmdlib.h"
 #include "g_levellocals.h"
+#include "d_event.h"
+#include "d_main.h"
 #include "i_time.h"
 
 void P_GetPolySpots (MapData * lump, TArray<FNodeBuilder::FPolyStart> &spots, TArray<FNodeBuilder::FPolyStart> &anchors);
 
 CVAR(Bool, gl_cachenodes, true, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
-CVAR(Float, gl_cachetime, 0.6f, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
+CVAR(Float, gl_cachetime, 0.1f, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
+CVAR(Int, gl_cachesize, 256, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)	// in MB, 0 means unlimited
 
 void P_LoadZNodes (FileReader &dalump, uint32_t id);
 static bool CheckCachedNodes(MapData *map);
 static void CreateCachedNodes(MapData *map);
+static bool IsNodeCacheWarmMap();
 
 
 // fixed 32 bit gl_vert format v2.0+ (glBsp 1.91)
@@ -994,7 +1003,7 @@ bool P_CheckNodes(MapData * map, bool rebuilt, int buildtime)
 		// Building nodes in debug is much slower so let's cache them only if cachetime is 0
 		buildtime = 0;
 #endif
-		if (level.maptype != MAPTYPE_BUILD && gl_cachenodes && buildtime/1000.f >= gl_cachetime)
+		if (level.maptype != MAPTYPE_BUILD && gl_cachenodes && (IsNodeCacheWarmMap() || buildtime/1000.f >= gl_cachetime))
 		{
 			DPrintf(DMSG_NOTIFY, "Caching nodes\n");
 			CreateCachedNodes(map);
@@ -1011,25 +1020,198 @@ bool P_CheckNodes(MapData * map, bool rebuilt, int buildtime)
 //
 // Node caching
 //
+// Cache files are content addressed: they are named after the MD5 of the
+// map lumps, so the same map is found again no matter which file or
+// lump name it is loaded from. Files are read ahead on a worker thread
+// while the map data is being set up, written by a worker thread after
+// the nodes have been built, and the cache directory is kept below
+// gl_cachesize by evicting the least recently used files.
+//
 //==========================================================================
 
 typedef TArray<uint8_t> MemFile;
 
-
-static FString CreateCacheName(MapData *map, bool create)
+static std::thread NodeCacheWriter;
+static std::thread NodeCacheReader;
+static TArray<uint8_t> NodeCachePrefetch;
+static uint8_t NodeCachePrefetchKey[16];
+static bool NodeCachePrefetched;
+static FString NodeCacheError;
+static TArray<FString> NodeCacheWarmList;
+static FString NodeCacheWarmMap;	// Map loaded by warmnodecache, always gets its nodes cached
+static unsigned NodeCacheWarmCount;
+
+static FString NodeCacheDir(bool create)
 {
 	FString path = M_GetCachePath(create);
-	FString lumpname = Wads.GetLumpFullPath(map->lumpnum);
-	int separator = lumpname.IndexOf(':');
-	path << '/' << lumpname.Left(separator);
+	path << "/nodes";
 	if (create) CreatePath(path);
+	return path;
+}
 
-	lumpname.ReplaceChars('/', '%');
-	lumpname.ReplaceChars(':', '$');
-	path << '/' << lumpname.Right(lumpname.Len() - separator - 1) << ".gzc";
+static FString CreateCacheName(const uint8_t *md5, bool create)
+{
+	FString path = NodeCacheDir(create);
+	path << '/';
+	for (int i = 0; i < 16; i++)
+	{
+		path.AppendFormat("%02x", md5[i]);
+	}
+	path << ".gzc";
 	return path;
 }
 
+//==========================================================================
+//
+// The worker threads must be done before the next one can be started
+// and before the program exits.
+//
+//==========================================================================
+
+static void WaitForNodeCacheWriter()
+{
+	if (NodeCacheWriter.joinable())
+	{
+		NodeCacheWriter.join();
+	}
+	if (NodeCacheError.IsNotEmpty())
+	{
+		Printf("%s\n", NodeCacheError.GetChars());
+		NodeCacheError = "";
+	}
+}
+
+static void WaitForNodeCacheReader()
+{
+	if (NodeCacheReader.joinable())
+	{
+		NodeCacheReader.join();
+	}
+}
+
+static struct FNodeCacheShutdown
+{
+	~FNodeCacheShutdown()
+	{
+		if (NodeCacheWriter.joinable()) NodeCacheWriter.join();
+		if (NodeCacheReader.joinable()) NodeCacheReader.join();
+	}
+} NodeCacheShutdown;
+
+//==========================================================================
+//
+// Starts reading the cache file for the given map checksum so that it is
+// already in memory when the node loader needs it.
+//
+//==========================================================================
+
+void P_PrefetchCachedNodes(const uint8_t *md5)
+{
+	WaitForNodeCacheReader();
+	NodeCachePrefetch.Clear();
+	NodeCachePrefetched = false;
+	if (!gl_cachenodes) return;
+
+	memcpy(NodeCachePrefetchKey, md5, 16);
+	FString path = CreateCacheName(NodeCachePrefetchKey, false);
+
+	NodeCachePrefetched = true;
+	NodeCacheReader = std::thread([=]()
+	{
+		FileReader fr;
+		if (fr.OpenFile(path))
+		{
+			NodeCachePrefetch.Resize((unsigned)fr.GetLength());
+			if (fr.Read(NodeCachePrefetch.Data(), NodeCachePrefetch.Size()) != (long)NodeCachePrefetch.Size())
+			{
+				NodeCachePrefetch.Clear();
+			}
+		}
+	});
+}
+
+//==========================================================================
+//
+// Checks that a file in the cache directory is a node cache
+// for the content its name claims.
+//
+//==========================================================================
+
+static bool ValidateCacheFile(const FString &path)
+{
+	char magic[4];
+	uint8_t md5[16];
+	FString name;
+	FileReader fr;
+
+	if (!fr.OpenFile(path)) return false;
+	if (fr.Read(magic, 4) != 4 || memcmp(magic, "CACH", 4)) return false;
+	if (fr.Seek(4, FileReader::SeekCur) != 0) return false;
+	if (fr.Read(md5, 16) != 16) return false;
+
+	for (int i = 0; i < 16; i++)
+	{
+		name.AppendFormat("%02x", md5[i]);
+	}
+	name << ".gzc";
+	return path.Len() >= name.Len() && !path.Right(name.Len()).CompareNoCase(name);
+}
+
+//==========================================================================
+//
+// Removes invalid files and evicts the least recently used ones until the
+// cache fits within the given size. Runs on the writer thread.
+//
+//==========================================================================
+
+static void TrimNodeCache(const FString &dir, int64_t limit)
+{
+	struct FCacheEntry
+	{
+		FString Filename;
+		int64_t Size;
+		time_t Time;
+	};
+	TArray<FFileList> list;
+	TArray<FCacheEntry> entries;
+	int64_t total = 0;
+
+	if (!DirExists(dir)) return;
+	try
+	{
+		ScanDirectory(list, dir + "/");
+	}
+	catch (CRecoverableError &)
+	{
+		return;
+	}
+
+	for (auto &file : list)
+	{
+		struct stat info;
+		if (file.isDirectory || stat(file.Filename, &info) != 0) continue;
+
+		if (!ValidateCacheFile(file.Filename))
+		{
+			remove(file.Filename);
+			continue;
+		}
+		entries.Push({ file.Filename, (int64_t)info.st_size, info.st_mtime });
+		total += info.st_size;
+	}
+
+	if (limit <= 0 || total <= limit) return;
+
+	std::sort(entries.begin(), entries.end(), [](const FCacheEntry &a, const FCacheEntry &b) { return a.Time < b.Time; });
+	for (unsigned i = 0; i < entries.Size() && total > limit; i++)
+	{
+		if (remove(entries[i].Filename) == 0)
+		{
+			total -= entries[i].Size;
+		}
+	}
+}
+
 static void WriteByte(MemFile &f, uint8_t b)
 {
 	f.Push(b);
@@ -1051,6 +1233,13 @@ static void WriteLong(MemFile &f, uint32_t b)
 	f[v+3] = (uint8_t)(b>>24);
 }
 
+//==========================================================================
+//
+// Serializes the current nodes on the main thread, then compresses and
+// writes them from the writer thread.
+//
+//==========================================================================
+
 static void CreateCachedNodes(MapData *map)
 {
 	MemFile ZNodes;
@@ -1116,48 +1305,64 @@ static void CreateCachedNodes(MapData *map)
 		}
 	}
 
-	uLongf outlen = ZNodes.Size();
-	TArray<Bytef> compressed;
-	int offset = level.lines.Size() * 8 + 12 + 16;
-	int r;
-	do
-	{
-		compressed.Resize(outlen + offset);
-		r = compress (compressed.Data() + offset, &outlen, &ZNodes[0], ZNodes.Size());
-		if (r == Z_BUF_ERROR)
-		{
-			outlen += 1024;
-		}
-	} 
-	while (r == Z_BUF_ERROR);
-
-	memcpy(compressed.Data(), "CACH", 4);
+	MemFile header;
+	header.Resize(level.lines.Size() * 8 + 12 + 16);
+	memcpy(header.Data(), "CACH", 4);
 	uint32_t len = LittleLong(level.lines.Size());
-	memcpy(&compressed[4], &len, 4);
-	map->GetChecksum(&compressed[8]);
+	memcpy(&header[4], &len, 4);
+	map->GetChecksum(&header[8]);
 	for (unsigned i = 0; i < level.lines.Size(); i++)
 	{
 		uint32_t ndx[2] = { LittleLong(uint32_t(level.lines[i].v1->Index())), LittleLong(uint32_t(level.lines[i].v2->Index())) };
-		memcpy(&compressed[8 + 16 + 8 * i], ndx, 8);
+		memcpy(&header[8 + 16 + 8 * i], ndx, 8);
 	}
-	memcpy(&compressed[offset - 4], "ZGL3", 4);
+	memcpy(&header[header.Size() - 4], "ZGL3", 4);
 
-	FString path = CreateCacheName(map, true);
-	FileWriter *fw = FileWriter::Open(path);
+	FString dir = NodeCacheDir(true);
+	FString path = CreateCacheName(&header[8], true);
+	int64_t limit = int64_t(*gl_cachesize) << 20;
 
-	if (fw != nullptr)
+	WaitForNodeCacheWriter();
+	NodeCacheWriter = std::thread([dir, path, limit, header = std::move(header), ZNodes = std::move(ZNodes)]() mutable
 	{
-		const size_t length = outlen + offset;
-		if (fw->Write(compressed.Data(), length) != length)
+		uLongf outlen = ZNodes.Size();
+		TArray<Bytef> compressed;
+		unsigned offset = header.Size();
+		int r;
+		do
+		{
+			compressed.Resize(outlen + offset);
+			r = compress (compressed.Data() + offset, &outlen, &ZNodes[0], ZNodes.Size());
+			if (r == Z_BUF_ERROR)
+			{
+				outlen += 1024;
+			}
+		} 
+		while (r == Z_BUF_ERROR);
+		memcpy(compressed.Data(), header.Data(), offset);
+
+		// Write to a temporary file first so that an interrupted write never leaves a truncated cache file behind.
+		FString temppath = path + ".tmp";
+		FileWriter *fw = FileWriter::Open(temppath);
+
+		if (fw != nullptr)
 		{
-			Printf("Error saving nodes to file %s\n", path.GetChars());
+			const size_t length = outlen + offset;
+			bool ok = fw->Write(compressed.Data(), length) == length;
+			delete fw;
+			remove(path);
+			if (!ok || rename(temppath, path) != 0)
+			{
+				remove(temppath);
+				NodeCacheError.Format("Error saving nodes to file %s", path.GetChars());
+			}
 		}
-		delete fw;
-	}
-	else
-	{
-		Printf("Cannot open nodes file %s for writing\n", path.GetChars());
-	}
+		else
+		{
+			NodeCacheError.Format("Cannot open nodes file %s for writing", temppath.GetChars());
+		}
+		TrimNodeCache(dir, limit);
+	});
 }
 
 
@@ -1169,10 +1374,16 @@ static bool CheckCachedNodes(MapData *map)
 	uint32_t numlin;
 	TArray<uint32_t> verts;
 
-	FString path = CreateCacheName(map, false);
+	map->GetChecksum(md5map);
+	FString path = CreateCacheName(md5map, false);
 	FileReader fr;
 
-	if (!fr.OpenFile(path)) return false;
+	WaitForNodeCacheReader();
+	if (NodeCachePrefetched && !memcmp(NodeCachePrefetchKey, md5map, 16))
+	{
+		if (NodeCachePrefetch.Size() == 0 || !fr.OpenMemory(NodeCachePrefetch.Data(), NodeCachePrefetch.Size())) return false;
+	}
+	else if (!fr.OpenFile(path)) return false;
 
 	if (fr.Read(magic, 4) != 4) return false;
 	if (memcmp(magic, "CACH", 4))  return false;
@@ -1182,7 +1393,6 @@ static bool CheckCachedNodes(MapData *map)
 	if (numlin != level.lines.Size()) return false;
 
 	if (fr.Read(md5, 16) != 16) return false;
-	map->GetChecksum(md5map);
 	if (memcmp(md5, md5map, 16)) return false;
 
 	verts.Resize(numlin * 2);
@@ -1212,6 +1422,10 @@ static bool CheckCachedNodes(MapData *map)
 		line.v1 = &level.vertexes[LittleLong(verts[i*2])];
 		line.v2 = &level.vertexes[LittleLong(verts[i*2+1])];
 	}
+	NodeCachePrefetch.Clear();
+
+	// Mark the file as recently used for the eviction policy.
+	utime(path, nullptr);
 	return true;
 }
 
@@ -1221,6 +1435,7 @@ UNSAFE_CCMD(clearnodecache)
 	FString path = M_GetCachePath(false);
 	path += "/";
 
+	WaitForNodeCacheWriter();
 	try
 	{
 		ScanDirectory(list, path);
@@ -1248,6 +1463,94 @@ UNSAFE_CCMD(clearnodecache)
 		
 }
 
+//==========================================================================
+//
+// Pre-warms the node cache by loading every map that does not have
+// cached nodes yet, one per tic. An optional argument restricts
+// this to maps whose name or containing file match the given pattern.
+//
+// The maps are loaded as new games, which runs their scripts, so this is
+// only allowed from the title screen or the full screen console, and it
+// stops as soon as something else loads a level.
+//
+//==========================================================================
+
+static bool IsNodeCacheWarmMap()
+{
+	return NodeCacheWarmMap.IsNotEmpty() && !NodeCacheWarmMap.CompareNoCase(level.MapName);
+}
+
+static void StopNodeCacheWarming()
+{
+	NodeCacheWarmList.Clear();
+	NodeCacheWarmMap = "";
+}
+
+CCMD(warmnodecache)
+{
+	if (netgame || demoplayback || demorecording)
+	{
+		Printf("Cannot warm the node cache during a network game or demo.\n");
+		return;
+	}
+	if (gamestate != GS_DEMOSCREEN && gamestate != GS_TITLELEVEL && gamestate != GS_FULLCONSOLE)
+	{
+		Printf("The node cache can only be warmed from the title screen or the full screen console.\n");
+		return;
+	}
+
+	StopNodeCacheWarming();
+	for (unsigned i = 0; i < wadlevelinfos.Size(); i++)
+	{
+		level_info_t *info = &wadlevelinfos[i];
+		MapData *map = P_OpenMapData(info->MapName, true);
+
+		if (map != nullptr)
+		{
+			if (argv.argc() == 1
+				|| CheckWildcards(argv[1], info->MapName.GetChars())
+				|| CheckWildcards(argv[1], Wads.GetWadName(Wads.GetLumpFile(map->lumpnum))))
+			{
+				uint8_t md5[16];
+				map->GetChecksum(md5);
+				if (map->Size(ML_GLZNODES) == 0 && !FileExists(CreateCacheName(md5, false)))
+				{
+					NodeCacheWarmList.Push(info->MapName);
+				}
+			}
+			delete map;
+		}
+	}
+	NodeCacheWarmCount = NodeCacheWarmList.Size();
+	Printf("%u maps need their nodes cached\n", NodeCacheWarmCount);
+}
+
+void P_WarmNodeCacheTicker()
+{
+	if ((NodeCacheWarmList.Size() == 0 && NodeCacheWarmMap.IsEmpty()) || gameaction != ga_nothing) return;
+
+	// The previous map failed to load or the player started something else.
+	if (NodeCacheWarmMap.IsNotEmpty() && (gamestate != GS_LEVEL || !IsNodeCacheWarmMap()))
+	{
+		StopNodeCacheWarming();
+		Printf("Node cache warming stopped\n");
+		return;
+	}
+
+	if (NodeCacheWarmList.Size() == 0)
+	{
+		StopNodeCacheWarming();
+		Printf("Node cache warming done\n");
+		D_StartTitle();
+		return;
+	}
+
+	NodeCacheWarmMap = NodeCacheWarmList[0];
+	NodeCacheWarmList.Delete(0);
+	Printf("Caching nodes for %s (%u/%u)\n", NodeCacheWarmMap.GetChars(), NodeCacheWarmCount - NodeCacheWarmList.Size(), NodeCacheWarmCount);
+	G_DeferedInitNew(NodeCacheWarmMap);
+}
+
 //==========================================================================
 //
 // Keep both the original nodes from the WAD and the GL nodes created here.
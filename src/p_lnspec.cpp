@@ -2771,6 +2771,7 @@ FUNC(LS_Line_SetBlocking)
 		if (arg2 & 1) clearflags |= flagtrans[i];
 	}
 
+	P_InvalidateSightCache();
 	FLineIdIterator itr(arg0);
 	int line;
 	while ((line = itr.Next()) >= 0)
@@ -3268,6 +3269,7 @@ FUNC(LS_GlassBreak)
 	bool quest1, quest2;
 
 	ln->flags &= ~(ML_BLOCKING|ML_BLOCKEVERYTHING);
+	P_InvalidateSightCache();
 	switched = P_ChangeSwitchTexture (ln->sidedef[0], false, 0, &quest1);
 	ln->special = 0;
 	if (ln->sidedef[1] != NULL)
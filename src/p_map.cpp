@@ -60,6 +60,9 @@
 #include <stdlib.h>
 #include <math.h>
 #include <algorithm>
+#ifndef NO_SSE
+#include <emmintrin.h>
+#endif
 
 #include "templates.h"
 
@@ -106,6 +109,7 @@
 CVAR(Bool, cl_bloodsplats, true, CVAR_ARCHIVE)
 CVAR(Int, sv_smartaim, 0, CVAR_ARCHIVE | CVAR_SERVERINFO)
 CVAR(Bool, cl_doautoaim, false, CVAR_ARCHIVE)
+CVAR(Bool, p_fastcheckposition, true, 0)
 
 static void CheckForPushSpecial(line_t *line, int side, AActor *mobj, DVector2 * posforwindowcheck = NULL);
 static void SpawnShootDecal(AActor *t1, AActor *defaults, const FTraceResults &trace, int hand = 0);
@@ -787,7 +791,7 @@ static int LineIsBelow(line_t *line, AActor *actor)
 //==========================================================================
 
 static // killough 3/26/98: make static
-bool PIT_CheckLine(FMultiBlockLinesIterator &mit, FMultiBlockLinesIterator::CheckResult &cres, const FBoundingBox &box, FCheckPosition &tm, const bool wasfit)
+bool PIT_CheckLine(FMultiBlockLinesIterator::CheckResult &cres, const FBoundingBox &box, FCheckPosition &tm, const bool wasfit)
 {
 	line_t *ld = cres.line;
 	bool rail = false;
@@ -1075,7 +1079,7 @@ bool PIT_CheckLine(FMultiBlockLinesIterator &mit, FMultiBlockLinesIterator::Chec
 //
 //==========================================================================
 
-static bool PIT_CheckPortal(FMultiBlockLinesIterator &mit, FMultiBlockLinesIterator::CheckResult cres, const FBoundingBox &box, FCheckPosition &tm)
+static bool PIT_CheckPortal(FMultiBlockLinesIterator::CheckResult cres, const FBoundingBox &box, FCheckPosition &tm)
 {
 	// if in another vertical section let's just ignore it.
 	if (cres.portalflags & (FFCF_NOCEILING | FFCF_NOFLOOR)) return false;
@@ -1294,7 +1298,7 @@ DEFINE_ACTION_FUNCTION(AActor, DoMissileDamage)
 //
 //==========================================================================
 
-bool PIT_CheckThing(FMultiBlockThingsIterator &it, FMultiBlockThingsIterator::CheckResult &cres, const FBoundingBox &box, FCheckPosition &tm)
+bool PIT_CheckThing(FMultiBlockThingsIterator::CheckResult &cres, const FBoundingBox &box, FCheckPosition &tm)
 {
 	AActor *thing = cres.thing;
 	double topz;
@@ -1672,6 +1676,101 @@ MOVEMENT CLIPPING
 ===============================================================================
 */
 
+//==========================================================================
+//
+// FBoxLineTest
+//
+// Same test as FBoundingBox::inRange, done for two axes at once where
+// SSE2 is available.
+//
+//==========================================================================
+
+#if !defined(NO_SSE) && (defined(__amd64__) || defined(__i386__) || defined(_M_IX86) || defined(_M_X64))
+struct FBoxLineTest
+{
+	__m128d topright, bottomleft;
+
+	FBoxLineTest(const FBoundingBox &box)
+	{
+		topright = _mm_setr_pd(box.Top(), box.Right());
+		bottomleft = _mm_setr_pd(box.Bottom(), box.Left());
+	}
+
+	bool operator()(const line_t *ld) const
+	{
+		__m128d tb = _mm_loadu_pd(&ld->bbox[BOXTOP]);		// top, bottom
+		__m128d lr = _mm_loadu_pd(&ld->bbox[BOXLEFT]);		// left, right
+		__m128d lowedges = _mm_shuffle_pd(tb, lr, 1);		// bottom, left
+		__m128d highedges = _mm_shuffle_pd(tb, lr, 2);		// top, right
+		__m128d inside = _mm_and_pd(_mm_cmpgt_pd(topright, lowedges), _mm_cmpgt_pd(highedges, bottomleft));
+		return _mm_movemask_pd(inside) == 3;
+	}
+};
+#else
+struct FBoxLineTest
+{
+	const FBoundingBox &box;
+
+	FBoxLineTest(const FBoundingBox &b) : box(b) {}
+	bool operator()(const line_t *ld) const { return box.inRange(ld); }
+};
+#endif
+
+//==========================================================================
+//
+// CheckStepThing
+//
+// Called by P_CheckPosition for a thing that PIT_CheckThing found to be
+// in the way. Returns false if the move is blocked, otherwise the thing
+// is one that could be stepped onto and checking continues.
+//
+//==========================================================================
+
+static bool CheckStepThing(AActor *thing, FMultiBlockThingsIterator::CheckResult &tcres, AActor *&thingblocker, double realHeight)
+{
+	// [RH] If a thing can be stepped up on, we need to continue checking
+	// other things in the blocks and see if we hit something that is
+	// definitely blocking. Otherwise, we need to check the lines, or we
+	// could end up stuck inside a wall.
+	AActor *BlockingMobj = thing->BlockingMobj;
+
+	// If this blocks through a restricted line portal, it will always completely block.
+	if (BlockingMobj == NULL || (i_compatflags & COMPATF_NO_PASSMOBJ) || (tcres.portalflags & FFCF_RESTRICTEDPORTAL))
+	{ // Thing slammed into something; don't let it move now.
+		thing->Height = realHeight;
+		return false;
+	}
+	else if (!BlockingMobj->player && !(thing->flags & (MF_FLOAT | MF_MISSILE | MF_SKULLFLY)) &&
+		BlockingMobj->Top() - thing->Z() <= thing->MaxStepHeight)
+	{
+		if (thingblocker == NULL ||
+			BlockingMobj->Z() > thingblocker->Z())
+		{
+			thingblocker = BlockingMobj;
+		}
+		thing->BlockingMobj = NULL;
+	}
+	else if (thing->player &&
+		thing->Top() - BlockingMobj->Z() <= thing->MaxStepHeight)
+	{
+		if (thingblocker)
+		{ // There is something to step up on. Return this thing as
+			// the blocker so that we don't step up.
+			thing->Height = realHeight;
+			return false;
+		}
+		// Nothing is blocking us, but this actor potentially could
+		// if there is something else to step on.
+		thing->BlockingMobj = NULL;
+	}
+	else
+	{ // Definitely blocking
+		thing->Height = realHeight;
+		return false;
+	}
+	return true;
+}
+
 //==========================================================================
 //
 // P_CheckPosition
@@ -1794,52 +1893,41 @@ bool P_CheckPosition(AActor *thing, const DVector2 &pos, FCheckPosition &tm, boo
 	tm.stepthing = NULL;
 	FBoundingBox box(pos.X, pos.Y, thing->radius);
 
+	// Without linked portals there is only one portal group, so the multi-group
+	// iterators would just wrap a single block iterator over this box. The fast
+	// path uses those directly and visits exactly the same things and lines in
+	// the same order, so the result is identical.
+	bool fastpath = p_fastcheckposition && Displacements.size == 1 && linePortals.Size() == 0 &&
+		newsec->PortalBlocksMovement(sector_t::ceiling) && newsec->PortalBlocksMovement(sector_t::floor);
+
 	FPortalGroupArray pcheck;
-	FMultiBlockThingsIterator it2(pcheck, pos.X, pos.Y, thing->Z(), thing->Height, thing->radius, false, newsec);
 	FMultiBlockThingsIterator::CheckResult tcres;
 
-	if (!(thing->flags2 & MF2_THRUACTORS))
-	while ((it2.Next(&tcres)))
+	if (fastpath)
 	{
-		if (!PIT_CheckThing(it2, tcres, it2.Box(), tm))
-		{ // [RH] If a thing can be stepped up on, we need to continue checking
-			// other things in the blocks and see if we hit something that is
-			// definitely blocking. Otherwise, we need to check the lines, or we
-			// could end up stuck inside a wall.
-			AActor *BlockingMobj = thing->BlockingMobj;
-
-			// If this blocks through a restricted line portal, it will always completely block.
-			if (BlockingMobj == NULL || (i_compatflags & COMPATF_NO_PASSMOBJ) || (tcres.portalflags & FFCF_RESTRICTEDPORTAL))
-			{ // Thing slammed into something; don't let it move now.
-				thing->Height = realHeight;
-				return false;
-			}
-			else if (!BlockingMobj->player && !(thing->flags & (MF_FLOAT | MF_MISSILE | MF_SKULLFLY)) &&
-				BlockingMobj->Top() - thing->Z() <= thing->MaxStepHeight)
+		tcres.Position = { pos.X, pos.Y, thing->radius };
+		tcres.portalflags = 0;
+		if (!(thing->flags2 & MF2_THRUACTORS))
+		{
+			FBlockThingsIterator it2(box);
+			while ((tcres.thing = it2.Next()))
 			{
-				if (thingblocker == NULL ||
-					BlockingMobj->Z() > thingblocker->Z())
+				if (!PIT_CheckThing(tcres, box, tm) && !CheckStepThing(thing, tcres, thingblocker, realHeight))
 				{
-					thingblocker = BlockingMobj;
-				}
-				thing->BlockingMobj = NULL;
-			}
-			else if (thing->player &&
-				thing->Top() - BlockingMobj->Z() <= thing->MaxStepHeight)
-			{
-				if (thingblocker)
-				{ // There is something to step up on. Return this thing as
-					// the blocker so that we don't step up.
-					thing->Height = realHeight;
 					return false;
 				}
-				// Nothing is blocking us, but this actor potentially could
-				// if there is something else to step on.
-				thing->BlockingMobj = NULL;
 			}
-			else
-			{ // Definitely blocking
-				thing->Height = realHeight;
+		}
+	}
+	else
+	{
+		FMultiBlockThingsIterator it2(pcheck, pos.X, pos.Y, thing->Z(), thing->Height, thing->radius, false, newsec);
+
+		if (!(thing->flags2 & MF2_THRUACTORS))
+		while ((it2.Next(&tcres)))
+		{
+			if (!PIT_CheckThing(tcres, it2.Box(), tm) && !CheckStepThing(thing, tcres, thingblocker, realHeight))
+			{
 				return false;
 			}
 		}
@@ -1868,7 +1956,6 @@ bool P_CheckPosition(AActor *thing, const DVector2 &pos, FCheckPosition &tm, boo
 		return (thing->BlockingMobj = thingblocker) == NULL;
 
 
-	FMultiBlockLinesIterator it(pcheck, pos.X, pos.Y, thing->Z(), thing->Height, thing->radius, newsec);
 	FMultiBlockLinesIterator::CheckResult lcres;
 
 	double thingdropoffz = tm.floorz;
@@ -1877,21 +1964,42 @@ bool P_CheckPosition(AActor *thing, const DVector2 &pos, FCheckPosition &tm, boo
 
 	bool good = true;
 
-	while (it.Next(&lcres))
+	if (fastpath)
 	{
-		bool thisresult = PIT_CheckLine(it, lcres, it.Box(), tm, good);
-		good &= thisresult;
-		if (thisresult)
+		// There are no line portals here, so only lines that touch the box
+		// can do anything and everything else can be skipped right away.
+		FBlockLinesIterator it(box);
+		FBoxLineTest touches(box);
+		lcres.Position = { pos.X, pos.Y, 0 };
+		lcres.portalflags = 0;
+		while ((lcres.line = it.Next()))
 		{
-			FLinePortal *port = lcres.line->getPortal();
-			if (port != NULL && port->mFlags & PORTF_PASSABLE && port->mType != PORTT_LINKED)
+			if (touches(lcres.line))
 			{
-				// Checking the other side of the portal completely is too costly,
-				// but checking the portal's destination line is necessary to 
-				// retrieve the proper sector heights on the other side.
-				if (PIT_CheckPortal(it, lcres, it.Box(), tm))
+				good &= PIT_CheckLine(lcres, box, tm, good);
+			}
+		}
+	}
+	else
+	{
+		FMultiBlockLinesIterator it(pcheck, pos.X, pos.Y, thing->Z(), thing->Height, thing->radius, newsec);
+
+		while (it.Next(&lcres))
+		{
+			bool thisresult = PIT_CheckLine(lcres, it.Box(), tm, good);
+			good &= thisresult;
+			if (thisresult)
+			{
+				FLinePortal *port = lcres.line->getPortal();
+				if (port != NULL && port->mFlags & PORTF_PASSABLE && port->mType != PORTT_LINKED)
 				{
-					tm.thing->BlockingLine = lcres.line;
+					// Checking the other side of the portal completely is too costly,
+					// but checking the portal's destination line is necessary to 
+					// retrieve the proper sector heights on the other side.
+					if (PIT_CheckPortal(lcres, it.Box(), tm))
+					{
+						tm.thing->BlockingLine = lcres.line;
+					}
 				}
 			}
 		}
@@ -6733,6 +6841,7 @@ bool P_ChangeSector(sector_t *sector, int crunch, double amt, int floorOrCeil, b
 	void(*iterator2)(AActor *, FChangePosition *) = NULL;
 	msecnode_t *n;
 
+	P_InvalidateSightCache();
 	cpos.nofit = false;
 	cpos.crushchange = crunch;
 	cpos.moveamt = fabs(amt);
@@ -82,6 +82,8 @@
 #include "po_man.h"
 #include "g_levellocals.h"
 #include "vm.h"
+#include "c_dispatch.h"
+#include "stats.h"
 
 sector_t *P_PointInSectorBuggy(double x, double y);
 int P_VanillaPointOnDivlineSide(double x, double y, const divline_t* line);
@@ -339,11 +341,7 @@ void AActor::UnlinkFromWorld (FLinkContext *ctx)
 
 		while (block != NULL)
 		{
-			if (block->NextActor != NULL)
-			{
-				block->NextActor->PrevActor = block->PrevActor;
-			}
-			*(block->PrevActor) = block->NextActor;
+			level.blockmap.UnlinkCell(block);
 			FBlockNode *next = block->NextBlock;
 			block->Release ();
 			block = next;
@@ -541,16 +539,10 @@ void AActor::LinkToWorld(FLinkContext *ctx, bool spawningmapthing, sector_t *sec
 				{
 					for (int x = x1; x <= x2; ++x)
 					{
-						FBlockNode **link = &level.blockmap.blocklinks[y*level.blockmap.bmapwidth + x];
 						FBlockNode *node = FBlockNode::Create(this, x, y, this->Sector->PortalGroup);
 
 						// Link in to block
-						if ((node->NextActor = *link) != NULL)
-						{
-							(*link)->PrevActor = &node->NextActor;
-						}
-						node->PrevActor = link;
-						*link = node;
+						level.blockmap.LinkCell(node);
 
 						// Link in to actor
 						node->PrevBlock = alink;
@@ -561,6 +553,10 @@ void AActor::LinkToWorld(FLinkContext *ctx, bool spawningmapthing, sector_t *sec
 				}
 			}
 		}
+		if (BlockNode != NULL && BlockNode->NextBlock == NULL)
+		{
+			level.blockmap.blockcells[BlockNode->BlockIndex].Single[BlockNode->CellSlot] = true;
+		}
 	}
 	// Portal links cannot be done unless the level is fully initialized.
 	if (!spawningmapthing) UpdateRenderSectorList();
@@ -599,8 +595,6 @@ FBlockNode *FBlockNode::Create (AActor *who, int x, int y, int group)
 	}
 	block->BlockIndex = x + y*level.blockmap.bmapwidth;
 	block->Me = who;
-	block->NextActor = NULL;
-	block->PrevActor = NULL;
 	block->PrevBlock = NULL;
 	block->NextBlock = NULL;
 	return block;
@@ -612,6 +606,90 @@ void FBlockNode::Release ()
 	FreeBlocks = this;
 }
 
+//===========================================================================
+//
+// FBlockmap :: LinkCell
+//
+// Appends a new node to its block's actor list.
+//
+//===========================================================================
+
+void FBlockmap::LinkCell(FBlockNode *node)
+{
+	FBlockCell &cell = blockcells[node->BlockIndex];
+	node->CellSlot = cell.Actors.Push(node->Me);
+	cell.Nodes.Push(node);
+	cell.Single.Push(false);
+}
+
+//===========================================================================
+//
+// FBlockmap :: UnlinkCell
+//
+// Leaves a hole so that running iterators keep their position.
+//
+//===========================================================================
+
+void FBlockmap::UnlinkCell(FBlockNode *node)
+{
+	FBlockCell &cell = blockcells[node->BlockIndex];
+	cell.Actors[node->CellSlot] = nullptr;
+	if (!cell.Dirty)
+	{
+		cell.Dirty = true;
+		dirtycells.Push(node->BlockIndex);
+	}
+}
+
+//===========================================================================
+//
+// FBlockmap :: RestoreCell
+//
+// Puts a node unlinked with UnlinkCell back into its old slot. This is only
+// valid as long as CompactCells has not been called in between, which is
+// what player prediction relies on.
+//
+//===========================================================================
+
+void FBlockmap::RestoreCell(FBlockNode *node)
+{
+	blockcells[node->BlockIndex].Actors[node->CellSlot] = node->Me;
+}
+
+//===========================================================================
+//
+// FBlockmap :: CompactCells
+//
+// Removes the holes left by unlinked actors. Must not be called while
+// any FBlockThingsIterator is active.
+//
+//===========================================================================
+
+void FBlockmap::CompactCells()
+{
+	for (int index : dirtycells)
+	{
+		FBlockCell &cell = blockcells[index];
+		unsigned count = 0;
+		for (unsigned i = 0; i < cell.Actors.Size(); i++)
+		{
+			if (cell.Actors[i] != nullptr)
+			{
+				cell.Actors[count] = cell.Actors[i];
+				cell.Nodes[count] = cell.Nodes[i];
+				cell.Single[count] = cell.Single[i];
+				cell.Nodes[count]->CellSlot = count;
+				count++;
+			}
+		}
+		cell.Actors.Resize(count);
+		cell.Nodes.Resize(count);
+		cell.Single.Resize(count);
+		cell.Dirty = false;
+	}
+	dirtycells.Clear();
+}
+
 //
 // BLOCK MAP ITERATORS
 // For each line/thing in the given mapblock,
@@ -933,7 +1011,8 @@ FBlockThingsIterator::FBlockThingsIterator()
 	minx = maxx = 0;
 	miny = maxy = 0;
 	ClearHash();
-	block = NULL;
+	cell = NULL;
+	slot = 0;
 }
 
 FBlockThingsIterator::FBlockThingsIterator(int _minx, int _miny, int _maxx, int _maxy)
@@ -982,12 +1061,15 @@ void FBlockThingsIterator::StartBlock(int x, int y)
 	cury = y;
 	if (level.blockmap.isValidBlock(x, y))
 	{
-		block = level.blockmap.blocklinks[y*level.blockmap.bmapwidth + x];
+		int index = y*level.blockmap.bmapwidth + x;
+		cell = &level.blockmap.blockcells[index];
+		slot = cell->Actors.Size();
 	}
 	else
 	{
 		// invalid block
-		block = NULL;
+		cell = NULL;
+		slot = 0;
 	}
 }
 
@@ -1004,6 +1086,65 @@ void FBlockThingsIterator::SwitchBlock(int x, int y)
 	StartBlock(x, y);
 }
 
+//===========================================================================
+//
+// FBlockThingsIterator :: CheckActor
+//
+// Checks if an actor spanning multiple blocks should be returned
+//
+//===========================================================================
+
+bool FBlockThingsIterator::CheckActor(AActor *me, bool centeronly)
+{
+	HashEntry *entry;
+	int i;
+
+	if (centeronly)
+	{
+		// Block boundaries for compatibility mode
+		double blockleft = (curx * FBlockmap::MAPBLOCKUNITS) + level.blockmap.bmaporgx;
+		double blockright = blockleft + FBlockmap::MAPBLOCKUNITS;
+		double blockbottom = (cury * FBlockmap::MAPBLOCKUNITS) + level.blockmap.bmaporgy;
+		double blocktop = blockbottom + FBlockmap::MAPBLOCKUNITS;
+
+		// only return actors with the center in this block
+		return (me->X() >= blockleft && me->X() < blockright &&
+				me->Y() >= blockbottom && me->Y() < blocktop);
+	}
+
+	size_t hash = ((size_t)me >> 3) % countof(Buckets);
+	for (i = Buckets[hash]; i >= 0; )
+	{
+		entry = GetHashEntry(i);
+		if (entry->Actor == me)
+		{ // I've already been checked. Skip to the next actor.
+			return false;
+		}
+		i = entry->Next;
+	}
+
+	// Add me to the hash table and return me.
+	if (NumFixedHash < (int)countof(FixedHash))
+	{
+		entry = &FixedHash[NumFixedHash];
+		entry->Next = Buckets[hash];
+		Buckets[hash] = NumFixedHash++;
+	}
+	else
+	{
+		if (DynHash.Size() == 0)
+		{
+			DynHash.Grow(50);
+		}
+		i = DynHash.Reserve(1);
+		entry = &DynHash[i];
+		entry->Next = Buckets[hash];
+		Buckets[hash] = i + countof(FixedHash);
+	}
+	entry->Actor = me;
+	return true;
+}
+
 //===========================================================================
 //
 // FBlockThingsIterator :: Next
@@ -1014,68 +1155,23 @@ AActor *FBlockThingsIterator::Next(bool centeronly)
 {
 	for (;;)
 	{
-		while (block != NULL)
+		while (slot > 0)
 		{
-			AActor *me = block->Me;
-			FBlockNode *mynode = block;
-			HashEntry *entry;
-			int i;
+			slot--;
+			AActor *me = cell->Actors[slot];
 
-			block = block->NextActor;
+			if (me == NULL)
+			{ // Unlinked since the last compaction
+				continue;
+			}
 			// Don't recheck things that were already checked
-			if (mynode->NextBlock == NULL && mynode->PrevBlock == &me->BlockNode)
+			if (cell->Single[slot])
 			{ // This actor doesn't span blocks, so we know it can only ever be checked once.
 				return me;
 			}
-			if (centeronly)
-			{
-				// Block boundaries for compatibility mode
-				double blockleft = (curx * FBlockmap::MAPBLOCKUNITS) + level.blockmap.bmaporgx;
-				double blockright = blockleft + FBlockmap::MAPBLOCKUNITS;
-				double blockbottom = (cury * FBlockmap::MAPBLOCKUNITS) + level.blockmap.bmaporgy;
-				double blocktop = blockbottom + FBlockmap::MAPBLOCKUNITS;
-
-				// only return actors with the center in this block
-				if (me->X() >= blockleft && me->X() < blockright &&
-					me->Y() >= blockbottom && me->Y() < blocktop)
-				{
-					return me;
-				}
-			}
-			else
+			if (CheckActor(me, centeronly))
 			{
-				size_t hash = ((size_t)me >> 3) % countof(Buckets);
-				for (i = Buckets[hash]; i >= 0; )
-				{
-					entry = GetHashEntry(i);
-					if (entry->Actor == me)
-					{ // I've already been checked. Skip to the next actor.
-						break;
-					}
-					i = entry->Next;
-				}
-				if (i < 0)
-				{ // Add me to the hash table and return me.
-					if (NumFixedHash < (int)countof(FixedHash))
-					{
-						entry = &FixedHash[NumFixedHash];
-						entry->Next = Buckets[hash];
-						Buckets[hash] = NumFixedHash++;
-					}
-					else
-					{
-						if (DynHash.Size() == 0)
-						{
-							DynHash.Grow(50);
-						}
-						i = DynHash.Reserve(1);
-						entry = &DynHash[i];
-						entry->Next = Buckets[hash];
-						Buckets[hash] = i + countof(FixedHash);
-					}
-					entry->Actor = me;
-					return me;
-				}
+				return me;
 			}
 		}
 
@@ -1088,6 +1184,53 @@ AActor *FBlockThingsIterator::Next(bool centeronly)
 	}
 }
 
+//===========================================================================
+//
+// blockmapbench
+//
+// Times thing queries around every actor in the level, for comparing
+// builds against each other at the same point of a demo.
+//
+//===========================================================================
+
+CCMD(blockmapbench)
+{
+	if (gamestate != GS_LEVEL || level.blockmap.blockcells == NULL)
+	{
+		Printf("Not in a level\n");
+		return;
+	}
+
+	int passes = argv.argc() > 1 ? MAX(1, atoi(argv[1])) : 10;
+	double range = argv.argc() > 2 ? MAX(1., atof(argv[2])) : 256.;
+
+	TArray<AActor *> origins;
+	auto it = TThinkerIterator<AActor>();
+	while (auto ac = it.Next())
+	{
+		if (!(ac->flags & MF_NOBLOCKMAP)) origins.Push(ac);
+	}
+
+	cycle_t clock;
+	clock.Reset();
+	clock.Clock();
+	int64_t found = 0;
+	for (int pass = 0; pass < passes; pass++)
+	{
+		for (auto origin : origins)
+		{
+			FBoundingBox box(origin->X(), origin->Y(), range);
+			FBlockThingsIterator bit(box);
+			while (bit.Next()) found++;
+		}
+	}
+	clock.Unclock();
+
+	double queries = double(origins.Size()) * passes;
+	Printf("%.0f queries, %lld actors found, %.3f ms, %.0f queries/s\n",
+		queries, (long long)found, clock.TimeMS(), clock.Time() > 0 ? queries / clock.Time() : 0.);
+}
+
 
 
 //===========================================================================
@@ -1833,23 +1976,24 @@ static AActor *RoughBlockCheck (AActor *mo, int index, void *param)
 {
 	BlockCheckInfo *info = (BlockCheckInfo *)param;
 
-	FBlockNode *link;
+	FBlockCell &cell = level.blockmap.blockcells[index];
 
-	for (link = level.blockmap.blocklinks[index]; link != NULL; link = link->NextActor)
+	for (int slot = cell.Actors.Size() - 1; slot >= 0; slot--)
 	{
-		if (link->Me != mo)
+		AActor *link = cell.Actors[slot];
+		if (link != NULL && link != mo)
 		{
-			if (info->onlyseekable && !mo->CanSeek(link->Me))
+			if (info->onlyseekable && !mo->CanSeek(link))
 			{
 				continue;
 			}
-			if (info->frontonly && P_PointOnDivlineSide(link->Me->X(), link->Me->Y(), &info->frontline) != 0)
+			if (info->frontonly && P_PointOnDivlineSide(link->X(), link->Y(), &info->frontline) != 0)
 			{
 				continue;
 			}
-			if (mo->IsOkayToAttack (link->Me))
+			if (mo->IsOkayToAttack (link))
 			{
-				return link->Me;
+				return link;
 			}
 		}
 	}
@@ -8,6 +8,7 @@
 
 extern int validcount;
 struct FBlockNode;
+struct FBlockCell;
 
 struct divline_t
 {
@@ -282,7 +283,8 @@ class FBlockThingsIterator
 
 	int curx, cury;
 
-	FBlockNode *block;
+	FBlockCell *cell;
+	int slot;				// counts down to 0, so actors appended during iteration are not visited
 
 	int Buckets[32];
 
@@ -300,6 +302,7 @@ class FBlockThingsIterator
 	void StartBlock(int x, int y);
 	void SwitchBlock(int x, int y);
 	void ClearHash();
+	bool CheckActor(AActor *me, bool centeronly);
 
 	// The following is only for use in the path traverser 
 	// and therefore declared private.
@@ -142,6 +142,7 @@ extern int numinterpolations;
 extern unsigned int R_OldBlend;
 
 EXTERN_CVAR(Bool, am_textured)
+EXTERN_CVAR(Int, nodebuild_threads)
 
 CVAR (Bool, genblockmap, false, CVAR_SERVERINFO|CVAR_GLOBALCONFIG);
 CVAR (Bool, gennodes, false, CVAR_SERVERINFO|CVAR_GLOBALCONFIG);
@@ -2714,8 +2715,9 @@ void P_LoadBlockMap (MapData * map)
 
 	// clear out mobj chains
 	count = level.blockmap.bmapwidth*level.blockmap.bmapheight;
-	level.blockmap.blocklinks = new FBlockNode *[count];
-	memset (level.blockmap.blocklinks, 0, count*sizeof(*level.blockmap.blocklinks));
+	level.blockmap.blockcells = new FBlockCell[count];
+	for (int i = 0; i < count; i++) level.blockmap.blockcells[i].Dirty = false;
+	level.blockmap.dirtycells.Clear();
 	level.blockmap.blockmap = level.blockmap.blockmaplump+4;
 }
 
@@ -2997,6 +2999,55 @@ void P_GetPolySpots (MapData * map, TArray<FNodeBuilder::FPolyStart> &spots, TAr
 	}
 }
 
+//===========================================================================
+//
+// P_BenchmarkNodeBuilder
+//
+// -nodebench: Builds GL nodes for the map once on a single thread and once
+// with nodebuild_threads, then reports both times and whether the trees
+// are identical. The level itself is not touched.
+//
+//===========================================================================
+
+static void P_BenchmarkNodeBuilder (MapData *map)
+{
+	for (auto &line : level.lines)
+	{
+		P_AdjustLine(&line);
+	}
+
+	TArray<FNodeBuilder::FPolyStart> polyspots, anchors;
+	P_GetPolySpots(map, polyspots, anchors);
+
+	const int threads = nodebuild_threads;
+	uint32_t checksums[2];
+	double times[2];
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		FNodeBuilder::FLevel leveldata =
+		{
+			&level.vertexes[0], (int)level.vertexes.Size(),
+			&level.sides[0], (int)level.sides.Size(),
+			&level.lines[0], (int)level.lines.Size(),
+			0, 0, 0, 0
+		};
+		leveldata.FindMapBounds();
+
+		cycle_t timer;
+		timer.Reset();
+		timer.Clock();
+		FNodeBuilder builder(leveldata, polyspots, anchors, true, pass == 0 ? 1 : threads);
+		timer.Unclock();
+
+		times[pass] = timer.TimeMS();
+		checksums[pass] = builder.GetChecksum();
+	}
+
+	Printf("Node build for %s: %.3f ms single threaded, %.3f ms threaded (%.2fx), output %s\n", level.MapName.GetChars(),
+		times[0], times[1], times[1] > 0 ? times[0] / times[1] : 0., checksums[0] == checksums[1] ? "identical" : TEXTCOLOR_RED "DIFFERENT");
+}
+
 
 //===========================================================================
 //
@@ -3319,6 +3370,7 @@ void P_SetupLevel(const char *lumpname, int position, bool newGame)
 
 	// generate a checksum for the level, to be included and checked with savegames.
 	map->GetChecksum(level.md5);
+	P_PrefetchCachedNodes(level.md5);
 	// find map num
 	level.lumpnum = map->lumpnum;
 	hasglnodes = false;
@@ -3566,6 +3618,11 @@ void P_SetupLevel(const char *lumpname, int position, bool newGame)
 	}
 	else reloop = true;
 
+	if (Args->CheckParm("-nodebench"))
+	{
+		P_BenchmarkNodeBuilder(map);
+	}
+
 	uint64_t startTime = 0, endTime = 0;
 
 	bool BuildGLNodes;
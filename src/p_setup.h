@@ -165,6 +165,8 @@ FString GetUDMFString(int type, int index, FName key);
 
 bool P_LoadGLNodes(MapData * map);
 bool P_CheckNodes(MapData * map, bool rebuilt, int buildtime);
+void P_PrefetchCachedNodes(const uint8_t *md5);
+void P_WarmNodeCacheTicker();
 bool P_CheckForGLNodes();
 void P_SetRenderSector();
 
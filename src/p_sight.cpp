@@ -43,6 +43,7 @@
 #include "stats.h"
 #include "g_levellocals.h"
 #include "actorinlines.h"
+#include "v_text.h"
 
 static FRandom pr_botchecksight ("BotCheckSight");
 static FRandom pr_checksight ("CheckSight");
@@ -61,6 +62,60 @@ This uses specialized forms of the maputils routines for optimized performance
 static int sightcounts[6];
 static cycle_t SightCycles;
 static cycle_t MaxSightCycles;
+static int sightcachehits, sightcachemisses, sightcachestale;
+
+// 0 = off, 1 = cache sight checks, 2 = also trace every cache hit and report stale entries
+CVAR(Int, sv_sightcache, 0, 0)
+
+//==========================================================================
+//
+// Sight check cache
+//
+// The traversal result only depends on the positions and heights of both
+// actors and the state of the level geometry, so it is cached per actor
+// pair. Anything that changes geometry relevant to sight (moving sectors,
+// polyobjects, portals and changes to the blocking flags of lines) bumps
+// the generation which invalidates all entries at once. The actor
+// pointers are only used for comparison, so stale entries of destroyed
+// actors are harmless.
+//
+// Not every geometry change goes through P_InvalidateSightCache: ZScript
+// can write line flags directly and plane movers do not have to call
+// P_ChangeSector. A cached result can then differ from the real one, so
+// the cache is off by default and sv_sightcache 2 checks every hit.
+//
+//==========================================================================
+
+struct FSightCacheEntry
+{
+	AActor *t1, *t2;
+	sector_t *sec1, *sec2;
+	DVector3 pos1, pos2;
+	double height1, height2;
+	unsigned generation;
+	int flags;
+	bool result;
+};
+
+enum { SIGHTCACHE_BITS = 10 };
+static FSightCacheEntry SightCache[1 << SIGHTCACHE_BITS];
+static unsigned SightGeneration = 1;
+
+void P_InvalidateSightCache()
+{
+	SightGeneration++;
+}
+
+static FSightCacheEntry *FindSightCacheEntry(AActor *t1, AActor *t2, int flags, bool &hit)
+{
+	uint32_t hash = (uint32_t)((uintptr_t)t1 >> 3) * 0x9E3779B1u ^ (uint32_t)((uintptr_t)t2 >> 3) * 0x85EBCA6Bu;
+	FSightCacheEntry *entry = &SightCache[hash >> (32 - SIGHTCACHE_BITS)];
+
+	hit = entry->generation == SightGeneration && entry->t1 == t1 && entry->t2 == t2 && entry->flags == flags &&
+		entry->sec1 == t1->Sector && entry->sec2 == t2->Sector && entry->pos1 == t1->Pos() && entry->pos2 == t2->Pos() &&
+		entry->height1 == t1->Height && entry->height2 == t2->Height;
+	return entry;
+}
 
 enum
 {
@@ -845,6 +900,9 @@ int P_CheckSight (AActor *t1, AActor *t2, int flags)
 	SightCycles.Clock();
 
 	bool res;
+	int cachemode = sv_sightcache;
+	FSightCacheEntry *entry = nullptr;
+	bool checkhit = false, cachedres = false;
 
 	if (t1 == nullptr || t2 == nullptr)
 	{
@@ -904,6 +962,28 @@ sightcounts[0]++;
 	// An unobstructed LOS is possible.
 	// Now look from eyes of t1 to any part of t2.
 
+	if (cachemode > 0)
+	{
+		bool hit;
+		entry = FindSightCacheEntry(t1, t2, flags, hit);
+		if (!hit)
+		{
+			sightcachemisses++;
+		}
+		else if (cachemode == 1)
+		{
+			sightcachehits++;
+			res = entry->result;
+			goto done;
+		}
+		else
+		{
+			sightcachehits++;
+			checkhit = true;
+			cachedres = entry->result;
+		}
+	}
+
 	validcount++;
 	portals.Clear();
 	{
@@ -934,18 +1014,33 @@ sightcounts[0]++;
 			}
 		}
 	}
+	if (checkhit && res != cachedres)
+	{
+		sightcachestale++;
+		Printf(TEXTCOLOR_RED "Stale sight cache entry: %s -> %s cached %d, traced %d\n",
+			t1->GetClass()->TypeName.GetChars(), t2->GetClass()->TypeName.GetChars(), cachedres, res);
+		assert(res == cachedres);
+	}
+	if (cachemode > 0)
+	{
+		*entry = { t1, t2, t1->Sector, t2->Sector, t1->Pos(), t2->Pos(), t1->Height, t2->Height, SightGeneration, flags, res };
+	}
 
 done:
 	SightCycles.Unclock();
 	return res;
 }
 
+ADD_CYCLE_STAT (sight, SightCycles)
+
 ADD_STAT (sight)
 {
 	FString out;
-	out.Format ("%04.1f ms (%04.1f max), %5d %2d%4d%4d%4d%4d\n",
+	int lookups = sightcachehits + sightcachemisses;
+	out.Format ("%04.1f ms (%04.1f max), %5d %2d%4d%4d%4d%4d, cache %d/%d (%.0f%%), %d stale\n",
 		SightCycles.TimeMS(), MaxSightCycles.TimeMS(),
-		sightcounts[3], sightcounts[0], sightcounts[1], sightcounts[2], sightcounts[4], sightcounts[5]);
+		sightcounts[3], sightcounts[0], sightcounts[1], sightcounts[2], sightcounts[4], sightcounts[5],
+		sightcachehits, lookups, lookups > 0 ? sightcachehits * 100. / lookups : 0., sightcachestale);
 	return out;
 }
 
@@ -954,6 +1049,7 @@ void P_ResetSightCounters (bool full)
 	if (full)
 	{
 		MaxSightCycles.Reset();
+		P_InvalidateSightCache();
 	}
 	if (SightCycles.Time() > MaxSightCycles.Time())
 	{
@@ -961,4 +1057,5 @@ void P_ResetSightCounters (bool full)
 	}
 	SightCycles.Reset();
 	memset (sightcounts, 0, sizeof(sightcounts));
+	sightcachehits = sightcachemisses = sightcachestale = 0;
 }
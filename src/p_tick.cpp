@@ -147,6 +147,9 @@ void P_Ticker (void)
 	// Since things will be moving, it's okay to interpolate them in the renderer.
 	r_NoInterpolate = false;
 
+	// No blockmap iterators can be active here, so this is the place to remove the unlinked slots.
+	level.blockmap.CompactCells();
+
 	P_ThinkParticles();	// [RH] make the particles think
 
 	for (i = 0; i<MAXPLAYERS; i++)
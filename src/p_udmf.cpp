@@ -43,6 +43,7 @@
 #include "g_level.h"
 #include "v_palette.h"
 #include "p_udmf.h"
+#include "p_udmfscanner.h"
 #include "r_state.h"
 #include "r_data/colormaps.h"
 #include "w_wad.h"
@@ -152,7 +153,8 @@ extern TArray<int>		linemap;
 //
 //===========================================================================
 
-void UDMFParserBase::Skip()
+template<class TScanner>
+void TUDMFParserBase<TScanner>::Skip()
 {
 	if (developer >= DMSG_WARNING) sc.ScriptMessage("Ignoring unknown UDMF key \"%s\".", sc.String);
 	if(sc.CheckToken('{'))
@@ -192,7 +194,8 @@ void UDMFParserBase::Skip()
 //
 //===========================================================================
 
-FName UDMFParserBase::ParseKey(bool checkblock, bool *isblock)
+template<class TScanner>
+FName TUDMFParserBase<TScanner>::ParseKey(bool checkblock, bool *isblock)
 {
 	sc.MustGetString();
 	FName key = sc.String;
@@ -241,7 +244,8 @@ FName UDMFParserBase::ParseKey(bool checkblock, bool *isblock)
 //
 //===========================================================================
 
-int UDMFParserBase::CheckInt(const char *key)
+template<class TScanner>
+int TUDMFParserBase<TScanner>::CheckInt(const char *key)
 {
 	if (sc.TokenType != TK_IntConst)
 	{
@@ -250,7 +254,8 @@ int UDMFParserBase::CheckInt(const char *key)
 	return sc.Number;
 }
 
-double UDMFParserBase::CheckFloat(const char *key)
+template<class TScanner>
+double TUDMFParserBase<TScanner>::CheckFloat(const char *key)
 {
 	if (sc.TokenType != TK_IntConst && sc.TokenType != TK_FloatConst)
 	{
@@ -259,7 +264,8 @@ double UDMFParserBase::CheckFloat(const char *key)
 	return sc.Float;
 }
 
-double UDMFParserBase::CheckCoordinate(const char *key)
+template<class TScanner>
+double TUDMFParserBase<TScanner>::CheckCoordinate(const char *key)
 {
 	if (sc.TokenType != TK_IntConst && sc.TokenType != TK_FloatConst)
 	{
@@ -273,12 +279,14 @@ double UDMFParserBase::CheckCoordinate(const char *key)
 	return sc.Float;
 }
 
-DAngle UDMFParserBase::CheckAngle(const char *key)
+template<class TScanner>
+DAngle TUDMFParserBase<TScanner>::CheckAngle(const char *key)
 {
 	return DAngle(CheckFloat(key)).Normalized360();
 }
 
-bool UDMFParserBase::CheckBool(const char *key)
+template<class TScanner>
+bool TUDMFParserBase<TScanner>::CheckBool(const char *key)
 {
 	if (sc.TokenType == TK_True) return true;
 	if (sc.TokenType == TK_False) return false;
@@ -286,7 +294,8 @@ bool UDMFParserBase::CheckBool(const char *key)
 	return false;
 }
 
-const char *UDMFParserBase::CheckString(const char *key)
+template<class TScanner>
+const char *TUDMFParserBase<TScanner>::CheckString(const char *key)
 {
 	if (sc.TokenType != TK_StringConst)
 	{
@@ -295,6 +304,9 @@ const char *UDMFParserBase::CheckString(const char *key)
 	return parsedString;
 }
 
+template class TUDMFParserBase<FScanner>;
+template class TUDMFParserBase<FUDMFScanner>;
+
 //===========================================================================
 //
 // Storage of UDMF user properties
@@ -427,7 +439,7 @@ struct UDMFScroll
 	FName type;
 };
 
-class UDMFParser : public UDMFParserBase
+class UDMFParser : public TUDMFParserBase<FUDMFScanner>
 {
 	bool isTranslated;
 	bool isExtended;
@@ -4,10 +4,13 @@
 #include "sc_man.h"
 #include "m_fixed.h"
 
-class UDMFParserBase
+// The scanner is a template parameter so that the map loader can use the
+// pre-lexing FUDMFScanner while other UDMF based formats use FScanner.
+template<class TScanner>
+class TUDMFParserBase
 {
 protected:
-	FScanner sc;
+	TScanner sc;
 	FName namespc = NAME_None;
 	int namespace_bits;
 	FString parsedString;
@@ -33,6 +36,8 @@ protected:
 
 };
 
+typedef TUDMFParserBase<FScanner> UDMFParserBase;
+
 #define BLOCK_ID (ENamedName)-1
 
 #endif
\ No newline at end of file
@@ -0,0 +1,1084 @@
+/*
+** p_udmfscanner.cpp
+** Parallel pre-lexing and token cache for TEXTMAP lumps
+**
+**---------------------------------------------------------------------------
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+**
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+** 3. The name of the author may not be used to endorse or promote products
+**    derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+** OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+** IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+** INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+** NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+** THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**---------------------------------------------------------------------------
+**
+** The UDMF parser has side effects all over the level (tags, user keys,
+** textures, translators) so it has to run in order on the game thread.
+** The part that can be taken off it is the lexing: a TEXTMAP is split
+** into runs of top level blocks, each run is lexed by its own FScanner
+** in a worker thread, following the same sequence of calls the parser
+** makes, and the recorded tokens are concatenated in file order. The
+** parser then replays them through FUDMFScanner and sees exactly what a
+** single FScanner would have given it, line numbers included.
+**
+** The recording only depends on the lump's contents, so it is also kept
+** on disk, named after the TEXTMAP's MD5. Loading the same map again
+** skips lexing and number conversion altogether.
+**
+** Any text that could make the scanner print or throw something, or that
+** the parser would treat as anything other than a plain sequence of
+** blocks, makes the whole lump go through FScanner as before, so that
+** errors are reported at the same point as they always were.
+**
+*/
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <zlib.h>
+
+#ifndef _WIN32
+#include <utime.h>
+#else
+#include <sys/utime.h>
+#endif
+
+#include "c_cvars.h"
+#include "cmdlib.h"
+#include "doomerrors.h"
+#include "doomstat.h"
+#include "files.h"
+#include "i_time.h"
+#include "m_misc.h"
+#include "m_swap.h"
+#include "md5.h"
+#include "p_udmfscanner.h"
+#include "templates.h"
+
+CVAR(Bool, udmf_fastload, true, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
+CVAR(Int, udmf_threads, 0, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
+CVAR(Bool, udmf_cache, true, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
+CVAR(Int, udmf_cachesize, 64, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)	// in MB, 0 means unlimited
+
+enum
+{
+	UTF_Token = 1,			// read with GetToken, otherwise with GetString
+	UTF_Crossed = 2,
+};
+
+static const unsigned MIN_FASTLOAD_SIZE = 256 * 1024;	// smaller maps are not worth the trouble
+static const unsigned MIN_CHUNK_SIZE = 64 * 1024;
+// Must be bumped whenever the scanner or the way the parser reads a TEXTMAP changes.
+static const uint32_t TOKEN_CACHE_VERSION = 1;
+
+//==========================================================================
+//
+// One run of blocks and what has been recorded for it
+//
+//==========================================================================
+
+struct FTextMapChunk
+{
+	const char *Start;
+	const char *End;
+	int FirstLine;
+	bool Header;			// the namespace statement comes before the first block
+	bool Ok;
+
+	TArray<FUDMFToken> Tokens;
+	TArray<char> Strings;
+	TArray<uint32_t> StringHash;	// open addressing, pool offset + 1
+	unsigned NumHashed = 0;
+
+	uint32_t AddString(const char *str, int len);
+};
+
+//==========================================================================
+//
+// Keys, '=' and ';' make up most of a map, so strings are pooled.
+//
+//==========================================================================
+
+uint32_t FTextMapChunk::AddString(const char *str, int len)
+{
+	// Strings with embedded nulls could match a shorter one, keep them apart.
+	bool pool = memchr(str, 0, len) == nullptr;
+	uint32_t hash = 2166136261u;
+	unsigned slot = 0;
+
+	if (pool)
+	{
+		for (int i = 0; i < len; i++)
+		{
+			hash = (hash ^ (uint8_t)str[i]) * 16777619u;
+		}
+		if (StringHash.Size() == 0)
+		{
+			StringHash.Resize(1024);
+			memset(StringHash.Data(), 0, StringHash.Size() * sizeof(uint32_t));
+		}
+		unsigned mask = StringHash.Size() - 1;
+		for (slot = hash & mask; StringHash[slot] != 0; slot = (slot + 1) & mask)
+		{
+			const char *entry = &Strings[StringHash[slot] - 1];
+			if (memcmp(entry, str, len) == 0 && entry[len] == 0)
+			{
+				return StringHash[slot] - 1;
+			}
+		}
+	}
+
+	uint32_t ofs = Strings.Reserve(len + 1);
+	memcpy(&Strings[ofs], str, len);
+	Strings[ofs + len] = 0;
+
+	if (pool)
+	{
+		StringHash[slot] = ofs + 1;
+		if (++NumHashed * 2 > StringHash.Size())
+		{
+			TArray<uint32_t> old(std::move(StringHash));
+			StringHash.Resize(old.Size() * 4);
+			memset(StringHash.Data(), 0, StringHash.Size() * sizeof(uint32_t));
+			unsigned mask = StringHash.Size() - 1;
+			for (auto entry : old)
+			{
+				if (entry == 0) continue;
+				uint32_t h = 2166136261u;
+				for (const char *c = &Strings[entry - 1]; *c != 0; c++)
+				{
+					h = (h ^ (uint8_t)*c) * 16777619u;
+				}
+				unsigned s;
+				for (s = h & mask; StringHash[s] != 0; s = (s + 1) & mask) {}
+				StringHash[s] = entry;
+			}
+		}
+	}
+	return ofs;
+}
+
+//==========================================================================
+//
+// FTextMapRecorder
+//
+// An FScanner that scans a range of a shared buffer in place and records
+// every token it produces. A token that is ungotten and read again is
+// only recorded once, just like FScanner only scans it once.
+//
+//==========================================================================
+
+class FTextMapRecorder : public FScanner
+{
+public:
+	FTextMapRecorder(FTextMapChunk &chunk)
+		: Chunk(chunk)
+	{
+		ScriptOpen = true;
+		ScriptPtr = chunk.Start;
+		ScriptEndPtr = chunk.End;
+		Line = 1;
+		End = false;
+		Crossed = false;
+		String = StringBuffer;
+		StringBuffer[0] = 0;
+		StringLen = 0;
+		AlreadyGot = false;
+		LastGotToken = false;
+		LastGotPtr = nullptr;
+		LastGotLine = 1;
+		CMode = true;
+		Escape = true;
+		StateMode = 0;
+		StateOptions = false;
+		// Long tokens replace this buffer. Starting with a private one keeps
+		// the workers away from the shared empty string's reference count.
+		BigStringBuffer = FString(" ");
+	}
+
+	bool Get(bool tokens)
+	{
+		bool ungot = AlreadyGot;
+		if (ungot && tokens && !LastGotToken)
+		{
+			// This would scan the string again in token mode. The parser never does it.
+			Failed = true;
+			return false;
+		}
+		if (!(tokens ? GetToken() : GetString()))
+		{
+			return false;
+		}
+		if (!ungot)
+		{
+			Record(tokens);
+		}
+		return true;
+	}
+
+	bool Expect(int token)
+	{
+		return Get(true) && TokenType == token;
+	}
+
+	bool Failed = false;
+
+private:
+	void Record(bool tokens)
+	{
+		FUDMFToken tok;
+		tok.BigNumber = 0;
+		if (tokens && (TokenType == TK_IntConst || TokenType == TK_UIntConst))
+		{
+			tok.BigNumber = BigNumber;
+		}
+		else if (tokens && TokenType == TK_FloatConst)
+		{
+			tok.Float = Float;
+		}
+		tok.StringOfs = Chunk.AddString(String, StringLen);
+		tok.StringLen = StringLen;
+		tok.Line = Line + Chunk.FirstLine - 1;
+		tok.TokenType = tokens ? TokenType : 0;
+		tok.Flags = (tokens ? UTF_Token : 0) | (Crossed ? UTF_Crossed : 0);
+		Chunk.Tokens.Push(tok);
+	}
+
+	FTextMapChunk &Chunk;
+};
+
+//==========================================================================
+//
+// Lexes one chunk in the order UDMFParser::ParseTextMap reads it. Nothing
+// here may print or throw since it runs on a worker thread, so every
+// check the parser makes with a Must* function is made here first and
+// fails the chunk instead.
+//
+//==========================================================================
+
+static void LexTextMapChunk(FTextMapRecorder &sc, FTextMapChunk &chunk)
+{
+	static const char *const blocknames[] = { "thing", "linedef", "sidedef", "sector", "vertex" };
+
+	chunk.Ok = false;
+	if (chunk.Header && sc.Get(false))
+	{
+		if (sc.Compare("namespace"))
+		{
+			if (!sc.Get(false) || !sc.Compare("=")) return;
+			if (!sc.Get(false)) return;
+			if (!sc.Get(false) || !sc.Compare(";")) return;
+		}
+		else
+		{
+			sc.UnGet();
+		}
+	}
+
+	while (sc.Get(false))
+	{
+		bool known = false;
+		for (auto name : blocknames)
+		{
+			known |= sc.Compare(name);
+		}
+		if (!known)
+		{
+			// Skip() would print a message, so leave this map to FScanner.
+			return;
+		}
+
+		if (!sc.Expect('{')) return;
+		for (;;)
+		{
+			// while (!sc.CheckToken('}')) ParseKey();
+			if (!sc.Get(true)) return;
+			if (sc.TokenType == '}') break;
+			sc.UnGet();
+
+			if (!sc.Get(false)) return;
+			if (!sc.Expect('=')) return;
+			if (!sc.Get(true)) return;
+			if (sc.TokenType == '+' || sc.TokenType == '-')
+			{
+				if (!sc.Get(true)) return;
+			}
+			if (!sc.Expect(';')) return;
+		}
+	}
+	chunk.Ok = !sc.Failed;
+}
+
+//==========================================================================
+//
+// Finds the ends of all top level blocks. Only the characters UDMF maps
+// actually consist of are accepted outside of strings and comments, so
+// the scanner can neither complain about an unexpected character nor
+// turn something into a #region. Returns false for anything else.
+//
+//==========================================================================
+
+struct FBlockEnd
+{
+	const char *Pos;
+	int Line;
+};
+
+static bool FindTextMapBlocks(const char *text, const char *end, TArray<FBlockEnd> &blocks)
+{
+	const char *p = text;
+	int line = 1;
+	int depth = 0;
+
+	while (p < end)
+	{
+		unsigned char c = *p++;
+		if (c == '\n')
+		{
+			line++;
+		}
+		else if (c <= ' ')
+		{
+		}
+		else if (c == '"')
+		{
+			for (;;)
+			{
+				if (p >= end) return false;
+				c = *p++;
+				if (c == '"') break;
+				if (c == '\n')
+				{
+					// Only valid inside blocks, where strings are read in token mode.
+					if (depth == 0) return false;
+					line++;
+				}
+				else if (c == '\\' && p < end && *p == '"')
+				{
+					p++;
+				}
+			}
+		}
+		else if (c == '/' && p < end && *p == '/')
+		{
+			while (p < end && *p != '\n') p++;
+		}
+		else if (c == '/' && p < end && *p == '*')
+		{
+			for (p++; ; p++)
+			{
+				if (p + 1 >= end) return false;
+				if (*p == '\n') line++;
+				else if (p[0] == '*' && p[1] == '/') break;
+			}
+			p += 2;
+		}
+		else if (c == '{')
+		{
+			if (depth++ != 0) return false;
+		}
+		else if (c == '}')
+		{
+			if (--depth != 0) return false;
+			blocks.Push({ p, line });
+		}
+		else if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+			c == '_' || c == '=' || c == ';' || c == '+' || c == '-' || c == '.'))
+		{
+			return false;
+		}
+	}
+	return depth == 0;
+}
+
+//==========================================================================
+//
+// TextMapThreads
+//
+//==========================================================================
+
+static int TextMapThreads()
+{
+	int numthreads = udmf_threads > 0 ? *udmf_threads : (int)std::thread::hardware_concurrency();
+	return clamp<int>(numthreads, 1, 16);
+}
+
+//==========================================================================
+//
+// Lexes a whole TEXTMAP. The chunks start right after a block's closing
+// brace, where the scanner has no state that the next token depends on.
+//
+//==========================================================================
+
+static bool LexTextMap(const TArray<uint8_t> &buffer, TArray<FUDMFToken> &tokens, TArray<char> &strings)
+{
+	// Terminate the text the same way FScanner::PrepareScript does.
+	TArray<char> text;
+	text.Resize(buffer.Size() + 1);
+	memcpy(text.Data(), buffer.Data(), buffer.Size());
+	unsigned size = buffer.Size();
+	if (size == 0 || text[size - 1] != '\n')
+	{
+		if (size > 0 && text[size - 1] == '\0') text[size - 1] = '\n';
+		else text[size++] = '\n';
+	}
+	const char *start = text.Data();
+	const char *end = start + size;
+
+	TArray<FBlockEnd> blocks;
+	if (!FindTextMapBlocks(start, end, blocks) || blocks.Size() == 0)
+	{
+		return false;
+	}
+
+	int numthreads = TextMapThreads();
+	// More chunks than threads, so that a run of heavy blocks does not hold up the others.
+	unsigned numchunks = clamp<unsigned>(size / MIN_CHUNK_SIZE, 1, numthreads * 4);
+
+	std::vector<FTextMapChunk> chunks;
+	chunks.reserve(numchunks);
+	const char *chunkstart = start;
+	int chunkline = 1;
+	unsigned b = 0;
+	for (unsigned i = 1; i <= numchunks && chunkstart < end; i++)
+	{
+		const char *chunkend = end;
+		int endline = 0;
+		if (i < numchunks)
+		{
+			const char *target = start + size_t(size) * i / numchunks;
+			while (b < blocks.Size() && (blocks[b].Pos <= chunkstart || blocks[b].Pos < target)) b++;
+			if (b == blocks.Size()) i = numchunks;
+			else chunkend = blocks[b].Pos, endline = blocks[b].Line;
+		}
+		chunks.emplace_back();
+		FTextMapChunk &chunk = chunks.back();
+		chunk.Start = chunkstart;
+		chunk.End = chunkend;
+		chunk.FirstLine = chunkline;
+		chunk.Header = chunkstart == start;
+		chunk.Ok = false;
+		chunkstart = chunkend;
+		chunkline = endline;
+	}
+
+	// The scanners are created and destroyed here, so that the worker threads
+	// do not have to construct any strings.
+	std::vector<std::unique_ptr<FTextMapRecorder>> scanners;
+	for (auto &chunk : chunks)
+	{
+		scanners.emplace_back(new FTextMapRecorder(chunk));
+	}
+
+	std::atomic<unsigned> next(0);
+	auto work = [&]()
+	{
+		for (unsigned i; (i = next++) < chunks.size(); )
+		{
+			LexTextMapChunk(*scanners[i], chunks[i]);
+		}
+	};
+	numthreads = MIN<int>(numthreads, chunks.size());
+	std::vector<std::thread> threads;
+	for (int i = 1; i < numthreads; i++)
+	{
+		threads.push_back(std::thread(work));
+	}
+	work();
+	for (auto &thread : threads)
+	{
+		thread.join();
+	}
+
+	unsigned numtokens = 0, numchars = 0;
+	for (auto &chunk : chunks)
+	{
+		if (!chunk.Ok) return false;
+		numtokens += chunk.Tokens.Size();
+		numchars += chunk.Strings.Size();
+	}
+
+	tokens.Resize(numtokens);
+	strings.Resize(numchars);
+	numtokens = numchars = 0;
+	for (auto &chunk : chunks)
+	{
+		FUDMFToken *out = &tokens[numtokens];
+		memcpy(out, chunk.Tokens.Data(), chunk.Tokens.Size() * sizeof(FUDMFToken));
+		for (unsigned i = 0; i < chunk.Tokens.Size(); i++)
+		{
+			out[i].StringOfs += numchars;
+		}
+		memcpy(&strings[numchars], chunk.Strings.Data(), chunk.Strings.Size());
+		numtokens += chunk.Tokens.Size();
+		numchars += chunk.Strings.Size();
+	}
+	return true;
+}
+
+//==========================================================================
+//
+// Token cache
+//
+// Works like the upscale cache: one deflated file per TEXTMAP in the
+// "udmf" cache folder, the least recently used ones are evicted when the
+// folder grows beyond udmf_cachesize.
+//
+// The tokens are packed before they are deflated, which makes loading
+// considerably faster than lexing, even on a single core. Each token is
+// a byte holding its kind, the Crossed flag and the line delta, then the
+// token type, the value of numeric tokens and a string. Strings are
+// numbered in order of appearance, and only the first occurrence is
+// stored in full.
+//
+//==========================================================================
+
+enum
+{
+	PT_String,			// read with GetString
+	PT_Token,
+	PT_Int,
+	PT_Float,
+
+	PT_Crossed = 4,
+	PT_LineShift = 3,
+	PT_MaxLineDelta = 31,
+};
+
+struct FTokenCacheHeader
+{
+	char Magic[4];
+	uint32_t Version;
+	uint32_t TextSize;
+	uint32_t NumTokens;
+	uint32_t NumChars;
+	uint32_t PackedSize;
+};
+
+static void PutVarint(TArray<uint8_t> &out, uint64_t v)
+{
+	while (v >= 0x80)
+	{
+		out.Push(uint8_t(v | 0x80));
+		v >>= 7;
+	}
+	out.Push(uint8_t(v));
+}
+
+static void PutBytes(TArray<uint8_t> &out, const void *data, size_t len)
+{
+	if (len > 0)
+	{
+		unsigned ofs = out.Reserve(len);
+		memcpy(&out[ofs], data, len);
+	}
+}
+
+static void PackTokens(const TArray<FUDMFToken> &tokens, const TArray<char> &strings, TArray<uint8_t> &out)
+{
+	TArray<uint32_t> ids(strings.Size(), true);		// pool offset -> string number + 1
+	uint32_t numids = 0;
+	int line = 1;
+
+	if (ids.Size() > 0) memset(ids.Data(), 0, ids.Size() * sizeof(uint32_t));
+	for (auto &tok : tokens)
+	{
+		int kind = !(tok.Flags & UTF_Token) ? PT_String :
+			(tok.TokenType == TK_IntConst || tok.TokenType == TK_UIntConst) ? PT_Int :
+			tok.TokenType == TK_FloatConst ? PT_Float : PT_Token;
+		unsigned delta = tok.Line - line;
+		line = tok.Line;
+
+		out.Push(uint8_t(kind | ((tok.Flags & UTF_Crossed) ? PT_Crossed : 0) | (MIN<unsigned>(delta, PT_MaxLineDelta) << PT_LineShift)));
+		if (delta >= PT_MaxLineDelta) PutVarint(out, delta - PT_MaxLineDelta);
+		if (kind != PT_String) PutVarint(out, uint16_t(tok.TokenType));
+		if (kind == PT_Int)
+		{
+			PutVarint(out, (uint64_t(tok.BigNumber) << 1) ^ uint64_t(tok.BigNumber >> 63));
+		}
+		else if (kind == PT_Float)
+		{
+			uint64_t bits;
+			memcpy(&bits, &tok.Float, 8);
+			for (int i = 0; i < 8; i++)
+			{
+				out.Push(uint8_t(bits >> (i * 8)));
+			}
+		}
+
+		uint32_t &id = ids[tok.StringOfs];
+		if (id != 0)
+		{
+			PutVarint(out, id);
+		}
+		else
+		{
+			id = ++numids;
+			PutVarint(out, 0);
+			PutVarint(out, tok.StringLen);
+			PutBytes(out, &strings[tok.StringOfs], tok.StringLen);
+		}
+	}
+}
+
+struct FPackedReader
+{
+	const uint8_t *Pos, *End;
+	bool Ok = true;
+
+	uint64_t Varint()
+	{
+		uint64_t v = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			if (Pos >= End) break;
+			uint8_t b = *Pos++;
+			v |= uint64_t(b & 0x7f) << shift;
+			if (!(b & 0x80)) return v;
+		}
+		Ok = false;
+		return 0;
+	}
+
+	const uint8_t *Bytes(size_t count)
+	{
+		if (size_t(End - Pos) < count)
+		{
+			Ok = false;
+			return nullptr;
+		}
+		Pos += count;
+		return Pos - count;
+	}
+};
+
+static bool UnpackTokens(const uint8_t *data, size_t size, unsigned numtokens, unsigned numchars, TArray<FUDMFToken> &tokens, TArray<char> &strings)
+{
+	FPackedReader in = { data, data + size };
+	TArray<uint32_t> offsets, lengths;
+	int line = 1;
+
+	tokens.Resize(numtokens);
+	strings.Clear();
+	strings.Grow(numchars);
+	for (auto &tok : tokens)
+	{
+		const uint8_t *b = in.Bytes(1);
+		if (b == nullptr) return false;
+		int kind = *b & 3;
+		unsigned delta = *b >> PT_LineShift;
+		if (delta == PT_MaxLineDelta) delta += unsigned(in.Varint());
+		line += delta;
+
+		tok.Line = line;
+		tok.Flags = (kind != PT_String ? UTF_Token : 0) | ((*b & PT_Crossed) ? UTF_Crossed : 0);
+		tok.TokenType = kind != PT_String ? int16_t(in.Varint()) : 0;
+		tok.BigNumber = 0;
+		if (kind == PT_Int)
+		{
+			uint64_t v = in.Varint();
+			tok.BigNumber = int64_t(v >> 1) ^ -int64_t(v & 1);
+		}
+		else if (kind == PT_Float)
+		{
+			const uint8_t *bits = in.Bytes(8);
+			if (bits == nullptr) return false;
+			uint64_t v = 0;
+			for (int i = 0; i < 8; i++)
+			{
+				v |= uint64_t(bits[i]) << (i * 8);
+			}
+			memcpy(&tok.Float, &v, 8);
+		}
+
+		uint64_t id = in.Varint();
+		if (id == 0)
+		{
+			uint64_t len = in.Varint();
+			const uint8_t *str = in.Bytes(len);
+			if (str == nullptr || strings.Size() + len + 1 > numchars) return false;
+			uint32_t ofs = strings.Reserve(unsigned(len) + 1);
+			memcpy(&strings[ofs], str, len);
+			strings[ofs + unsigned(len)] = 0;
+			offsets.Push(ofs);
+			lengths.Push(uint32_t(len));
+			tok.StringOfs = ofs;
+			tok.StringLen = int(len);
+		}
+		else if (id <= offsets.Size())
+		{
+			tok.StringOfs = offsets[unsigned(id) - 1];
+			tok.StringLen = int(lengths[unsigned(id) - 1]);
+		}
+		else
+		{
+			return false;
+		}
+		if (!in.Ok) return false;
+	}
+	return in.Pos == in.End;
+}
+
+static FString TokenCacheDir(bool create)
+{
+	FString path = M_GetCachePath(create);
+	path << "/udmf";
+	if (create) CreatePath(path);
+	return path;
+}
+
+static FString TokenCacheName(const uint8_t *md5, bool create)
+{
+	FString path = TokenCacheDir(create);
+	path << '/';
+	for (int i = 0; i < 16; i++)
+	{
+		path.AppendFormat("%02x", md5[i]);
+	}
+	path << ".utc";
+	return path;
+}
+
+static bool ReadTokenCache(const uint8_t *md5, unsigned textsize, TArray<FUDMFToken> &tokens, TArray<char> &strings)
+{
+	FString path = TokenCacheName(md5, false);
+	FileReader fr;
+	FTokenCacheHeader header;
+
+	if (!fr.OpenFile(path) || fr.Read(&header, sizeof(header)) != sizeof(header) ||
+		memcmp(header.Magic, "UDTC", 4) || LittleLong(header.Version) != TOKEN_CACHE_VERSION ||
+		LittleLong(header.TextSize) != textsize)
+	{
+		return false;
+	}
+
+	TArray<Bytef> compressed;
+	compressed.Resize(unsigned(fr.GetLength() - sizeof(header)));
+	if (fr.Read(compressed.Data(), compressed.Size()) != (long)compressed.Size())
+	{
+		return false;
+	}
+	fr.Close();
+
+	uLongf size = LittleLong(header.PackedSize);
+	TArray<Bytef> packed;
+	packed.Resize(unsigned(size));
+	if (uncompress(packed.Data(), &size, compressed.Data(), compressed.Size()) != Z_OK || size != packed.Size() ||
+		!UnpackTokens(packed.Data(), size, LittleLong(header.NumTokens), LittleLong(header.NumChars), tokens, strings))
+	{
+		tokens.Clear();
+		strings.Clear();
+		return false;
+	}
+	// Mark the file as recently used for the eviction policy.
+	utime(path, nullptr);
+	return true;
+}
+
+static void TrimTokenCache()
+{
+	struct FCacheEntry
+	{
+		FString Filename;
+		int64_t Size;
+		time_t Time;
+	};
+	TArray<FFileList> list;
+	TArray<FCacheEntry> entries;
+	int64_t total = 0;
+	int64_t limit = int64_t(*udmf_cachesize) << 20;
+	FString dir = TokenCacheDir(false);
+
+	if (limit <= 0 || !DirExists(dir)) return;
+	try
+	{
+		ScanDirectory(list, dir + "/");
+	}
+	catch (CRecoverableError &)
+	{
+		return;
+	}
+
+	for (auto &file : list)
+	{
+		struct stat info;
+		if (file.isDirectory || stat(file.Filename, &info) != 0) continue;
+		if (file.Filename.Len() < 4 || file.Filename.Right(4).CompareNoCase(".utc"))
+		{
+			remove(file.Filename);
+			continue;
+		}
+		entries.Push({ file.Filename, (int64_t)info.st_size, info.st_mtime });
+		total += info.st_size;
+	}
+
+	if (total <= limit) return;
+
+	std::sort(entries.begin(), entries.end(), [](const FCacheEntry &a, const FCacheEntry &b) { return a.Time < b.Time; });
+	for (unsigned i = 0; i < entries.Size() && total > limit; i++)
+	{
+		if (remove(entries[i].Filename) == 0)
+		{
+			total -= entries[i].Size;
+		}
+	}
+}
+
+static void WriteTokenCache(const uint8_t *md5, unsigned textsize, const TArray<FUDMFToken> &tokens, const TArray<char> &strings)
+{
+	TArray<uint8_t> packed;
+	PackTokens(tokens, strings, packed);
+
+	FTokenCacheHeader header;
+	memcpy(header.Magic, "UDTC", 4);
+	header.Version = LittleLong(TOKEN_CACHE_VERSION);
+	header.TextSize = LittleLong(textsize);
+	header.NumTokens = LittleLong(tokens.Size());
+	header.NumChars = LittleLong(strings.Size());
+	header.PackedSize = LittleLong(packed.Size());
+
+	uLongf outlen = compressBound(packed.Size());
+	TArray<Bytef> compressed;
+	compressed.Resize(unsigned(outlen + sizeof(header)));
+	memcpy(compressed.Data(), &header, sizeof(header));
+	if (compress2(compressed.Data() + sizeof(header), &outlen, packed.Data(), packed.Size(), Z_BEST_SPEED) != Z_OK)
+	{
+		return;
+	}
+
+	FString path = TokenCacheName(md5, true);
+	FString temp = path + ".tmp";
+	FILE *f = fopen(temp, "wb");
+	if (f != nullptr)
+	{
+		bool ok = fwrite(compressed.Data(), 1, outlen + sizeof(header), f) == outlen + sizeof(header);
+		ok &= fclose(f) == 0;
+		remove(path);
+		if (!ok || rename(temp, path) != 0)
+		{
+			remove(temp);
+		}
+	}
+	TrimTokenCache();
+}
+
+//==========================================================================
+//
+// FUDMFScanner :: OpenMem
+//
+//==========================================================================
+
+void FUDMFScanner::OpenMem(const char *name, const TArray<uint8_t> &buffer)
+{
+	Replaying = false;
+	Tokens.Clear();
+	Strings.Clear();
+
+	if (udmf_fastload && buffer.Size() >= MIN_FASTLOAD_SIZE)
+	{
+		uint64_t start = I_nsTime();
+		uint8_t md5[16] = {};
+		bool cached = false;
+
+		if (udmf_cache)
+		{
+			MD5Context context;
+			context.Update(buffer.Data(), buffer.Size());
+			context.Final(md5);
+			cached = ReadTokenCache(md5, buffer.Size(), Tokens, Strings);
+		}
+		if (cached)
+		{
+			Replaying = true;
+		}
+		// With a single thread recording the tokens costs more than it saves,
+		// unless the recording can be written to the cache for the next time.
+		else if ((udmf_cache || TextMapThreads() > 1) && LexTextMap(buffer, Tokens, Strings))
+		{
+			Replaying = true;
+			if (udmf_cache) WriteTokenCache(md5, buffer.Size(), Tokens, Strings);
+		}
+		else
+		{
+			Tokens.Clear();
+			Strings.Clear();
+		}
+		if (Replaying)
+		{
+			DPrintf(DMSG_NOTIFY, "%s: %u tokens %s in %.1f ms\n", name, Tokens.Size(),
+				cached ? "read from cache" : "lexed", (I_nsTime() - start) / 1e6);
+		}
+	}
+
+	if (!Replaying)
+	{
+		FScanner::OpenMem(name, buffer);
+		return;
+	}
+
+	Close();
+	ScriptName = name;
+	LumpNum = -1;
+	NextToken = 0;
+	Line = 1;
+	End = false;
+	Crossed = false;
+	StringLen = 0;
+	AlreadyGot = false;
+	LastGotToken = false;
+	LastGotPtr = nullptr;
+	LastGotLine = 1;
+	CMode = false;
+	Escape = true;
+	StateMode = 0;
+}
+
+//==========================================================================
+//
+// FUDMFScanner :: ReplayToken
+//
+// Does what FScanner::ScanString and GetToken would have done.
+//
+//==========================================================================
+
+bool FUDMFScanner::ReplayToken(bool tokens)
+{
+	if (AlreadyGot)
+	{
+		AlreadyGot = false;
+		// The recording never contains a string that is read again as a token.
+		return true;
+	}
+
+	Crossed = false;
+	if (NextToken >= Tokens.Size())
+	{
+		End = true;
+		return false;
+	}
+
+	const FUDMFToken &tok = Tokens[NextToken++];
+	LastGotLine = Line;
+	LastGotToken = tokens;
+	Line = tok.Line;
+	Crossed = !!(tok.Flags & UTF_Crossed);
+	String = &Strings[tok.StringOfs];
+	StringLen = tok.StringLen;
+
+	if (tok.Flags & UTF_Token)
+	{
+		TokenType = tok.TokenType;
+		if (TokenType == TK_IntConst)
+		{
+			BigNumber = tok.BigNumber;
+			Number = (int)BigNumber;
+			Float = Number;
+		}
+		else if (TokenType == TK_UIntConst)
+		{
+			BigNumber = tok.BigNumber;
+			Number = (int)BigNumber;
+			Float = (unsigned)Number;
+		}
+		else if (TokenType == TK_FloatConst)
+		{
+			Float = tok.Float;
+		}
+	}
+	return true;
+}
+
+//==========================================================================
+//
+// The FScanner methods the parser uses. Only the primitives differ, the
+// rest are copies that call these instead of FScanner's. UnGet works on
+// the replayed state as it is.
+//
+//==========================================================================
+
+bool FUDMFScanner::GetString()
+{
+	return Replaying ? ReplayToken(false) : FScanner::GetString();
+}
+
+void FUDMFScanner::MustGetString()
+{
+	if (GetString() == false)
+	{
+		ScriptError("Missing string (unexpected end of file).");
+	}
+}
+
+void FUDMFScanner::MustGetStringName(const char *name)
+{
+	MustGetString();
+	if (Compare(name) == false)
+	{
+		ScriptError("Expected '%s', got '%s'.", name, String);
+	}
+}
+
+bool FUDMFScanner::CheckString(const char *name)
+{
+	if (GetString())
+	{
+		if (Compare(name))
+		{
+			return true;
+		}
+		UnGet();
+	}
+	return false;
+}
+
+bool FUDMFScanner::GetToken()
+{
+	return Replaying ? ReplayToken(true) : FScanner::GetToken();
+}
+
+void FUDMFScanner::MustGetAnyToken()
+{
+	if (GetToken() == false)
+	{
+		ScriptError("Missing token (unexpected end of file).");
+	}
+}
+
+void FUDMFScanner::MustGetToken(int token)
+{
+	MustGetAnyToken();
+	TokenMustBe(token);
+}
+
+bool FUDMFScanner::CheckToken(int token)
+{
+	if (GetToken())
+	{
+		if (TokenType == token)
+		{
+			return true;
+		}
+		UnGet();
+	}
+	return false;
+}
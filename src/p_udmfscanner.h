@@ -0,0 +1,57 @@
+#ifndef __P_UDMFSCANNER_H
+#define __P_UDMFSCANNER_H
+
+#include "sc_man.h"
+
+//==========================================================================
+//
+// A scanner for TEXTMAP lumps
+//
+// Large maps are lexed up front, in parallel, and the parser is fed the
+// recorded tokens. The methods the UDMF parser uses are redeclared here so
+// that they replay the recording, the rest of FScanner (Compare, the
+// script messages and so on) works on the replayed state as usual.
+// Anything that cannot be recorded exactly is parsed by the regular
+// FScanner code.
+//
+//==========================================================================
+
+struct FUDMFToken
+{
+	union
+	{
+		int64_t BigNumber;		// TK_IntConst and TK_UIntConst
+		double Float;			// TK_FloatConst
+	};
+	uint32_t StringOfs;
+	int32_t StringLen;
+	int32_t Line;
+	int16_t TokenType;
+	uint8_t Flags;
+};
+
+class FUDMFScanner : public FScanner
+{
+public:
+	void OpenMem(const char *name, const TArray<uint8_t> &buffer);
+
+	bool GetString();
+	void MustGetString();
+	void MustGetStringName(const char *name);
+	bool CheckString(const char *name);
+
+	bool GetToken();
+	void MustGetAnyToken();
+	void MustGetToken(int token);
+	bool CheckToken(int token);
+
+private:
+	bool ReplayToken(bool tokens);
+
+	bool Replaying = false;
+	unsigned NextToken;
+	TArray<FUDMFToken> Tokens;
+	TArray<char> Strings;
+};
+
+#endif
@@ -1534,11 +1534,7 @@ void P_PredictPlayer (player_t *player)
 
 	while (block != NULL)
 	{
-		if (block->NextActor != NULL)
-		{
-			block->NextActor->PrevActor = block->PrevActor;
-		}
-		*(block->PrevActor) = block->NextActor;
+		level.blockmap.UnlinkCell(block);
 		block = block->NextBlock;
 	}
 	act->BlockNode = NULL;
@@ -1672,16 +1668,12 @@ void P_UnPredictPlayer ()
 			act->touching_lineportallist = RestoreNodeList(act, lineportal_list, &FLinePortal::lineportal_thinglist, PredictionPortalLines_sprev_Backup, PredictionPortalLinesBackup);
 		}
 
-		// Now fix the pointers in the blocknode chain
+		// Now put the block nodes back into their blocks
 		FBlockNode *block = act->BlockNode;
 
 		while (block != NULL)
 		{
-			*(block->PrevActor) = block;
-			if (block->NextActor != NULL)
-			{
-				block->NextActor->PrevActor = &block->NextActor;
-			}
+			level.blockmap.RestoreCell(block);
 			block = block->NextBlock;
 		}
 
@@ -944,6 +944,7 @@ void FPolyObj::CalcCenter()
 bool FPolyObj::MovePolyobj (const DVector2 &pos, bool force)
 {
 	FBoundingBox oldbounds = Bounds;
+	P_InvalidateSightCache();
 	UnLinkPolyobj ();
 	DoMovePolyobj (pos);
 
@@ -1026,6 +1027,7 @@ bool FPolyObj::RotatePolyobj (DAngle angle, bool fromsave)
 
 	an = Angle + angle;
 
+	P_InvalidateSightCache();
 	UnLinkPolyobj();
 
 	for(unsigned i=0;i < Vertices.Size(); i++)
@@ -1111,7 +1113,6 @@ void FPolyObj::UnLinkPolyobj ()
 bool FPolyObj::CheckMobjBlocking (side_t *sd)
 {
 	static TArray<AActor *> checker;
-	FBlockNode *block;
 	AActor *mobj;
 	int i, j, k;
 	int left, right, top, bottom;
@@ -1144,9 +1145,11 @@ bool FPolyObj::CheckMobjBlocking (side_t *sd)
 	{
 		for (i = left; i <= right; i++)
 		{
-			for (block = level.blockmap.blocklinks[j+i]; block != NULL; block = block->NextActor)
+			FBlockCell &cell = level.blockmap.blockcells[j+i];
+			for (int slot = cell.Actors.Size() - 1; slot >= 0; slot--)
 			{
-				mobj = block->Me;
+				mobj = cell.Actors[slot];
+				if (mobj == NULL) continue;
 				for (k = (int)checker.Size()-1; k >= 0; --k)
 				{
 					if (checker[k] == mobj)
@@ -261,6 +261,11 @@ PolyPortalViewpoint PolyRenderer::SetupPerspectiveMatrix(bool mirror)
 cycle_t PolyCullCycles, PolyOpaqueCycles, PolyMaskedCycles, PolyDrawerWaitCycles;
 int PolyTotalBatches, PolyTotalTriangles, PolyTotalDrawCalls;
 
+ADD_CYCLE_STAT(polycull, PolyCullCycles)
+ADD_CYCLE_STAT(polyopaque, PolyOpaqueCycles)
+ADD_CYCLE_STAT(polymasked, PolyMaskedCycles)
+ADD_CYCLE_STAT(polydrawers, PolyDrawerWaitCycles)
+
 ADD_STAT(polyfps)
 {
 	FString out;
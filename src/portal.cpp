@@ -481,6 +481,8 @@ bool P_ChangePortal(line_t *ln, int thisid, int destid)
 {
 	int lineno;
 
+	P_InvalidateSightCache();
+
 	if (thisid == 0) return ChangePortalLine(ln, destid);
 	FLineIdIterator it(thisid);
 	bool res = false;
@@ -50,6 +50,9 @@ void I_Init (void);
 // Return a seed value for the RNG.
 unsigned int I_MakeRNGSeed();
 
+// Return the peak resident memory of the process in bytes, or 0 if unknown.
+size_t I_GetPeakMemoryUsage();
+
 
 //
 // Called by D_DoomLoop,
@@ -20,6 +20,7 @@
 //
 
 #include <fnmatch.h>
+#include <sys/resource.h>
 
 #ifdef __APPLE__
 #include <AvailabilityMacros.h>
@@ -56,6 +57,21 @@ void I_Init()
 }
 
 
+size_t I_GetPeakMemoryUsage()
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+	{
+		return 0;
+	}
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss;			// already in bytes
+#else
+	return (size_t)usage.ru_maxrss * 1024;	// in kilobytes
+#endif
+}
+
 bool I_WriteIniFailed()
 {
 	printf("The config file %s could not be saved:\n%s\n", GameConfig->GetPathName(), strerror(errno));
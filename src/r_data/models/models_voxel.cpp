@@ -57,6 +57,7 @@ class FVoxelTexture : public FWorldTexture
 {
 public:
 	FVoxelTexture(FVoxel *voxel);
+	const char *GetFormatName() override { return "Voxel"; }
 
 	int CopyTrueColorPixels(FBitmap *bmp, int x, int y, int rotate, FCopyInfo *inf) override;
 	bool UseBasePalette() override { return false; }
@@ -12,6 +12,7 @@ class player_t;
 struct sector_t;
 class FCanvasTexture;
 class FileWriter;
+class DCanvas;
 
 struct FRenderer
 {
@@ -37,6 +38,9 @@ struct FRenderer
 	// renders view to a savegame picture
 	virtual void WriteSavePic (player_t *player, FileWriter *file, int width, int height) = 0;
 
+	// renders view into an offscreen canvas. Returns false if the renderer cannot do this.
+	virtual bool RenderViewToCanvas (player_t *player, DCanvas *canvas, int width, int height) { return false; }
+
 	// draws player sprites with hardware acceleration (only useful for software rendering)
 	virtual void DrawRemainingPlayerSprites() {}
 
@@ -34,6 +34,7 @@
 */
 
 #include <time.h>
+#include <zlib.h>
 #include "file_zip.h"
 #include "cmdlib.h"
 #include "templates.h"
@@ -109,6 +110,65 @@ bool FCompressedBuffer::Decompress(char *destbuffer)
 	return UncompressZipLump(destbuffer, mr, mMethod, mSize, mCompressedSize, mZipFlags);
 }
 
+//==========================================================================
+//
+// Deflates a stored buffer in place and sets its CRC.
+// If compression fails the buffer is left stored.
+//
+//==========================================================================
+
+bool FCompressedBuffer::Compress()
+{
+	if (mMethod != METHOD_STORED || mBuffer == nullptr) return false;
+
+	mCRC32 = crc32(0, (const Bytef*)mBuffer, mSize);
+
+	uint8_t *compressbuf = new uint8_t[mSize+1];
+
+	z_stream stream;
+	int err;
+
+	stream.next_in = (Bytef *)mBuffer;
+	stream.avail_in = mSize;
+	stream.next_out = (Bytef*)compressbuf;
+	stream.avail_out = mSize;
+	stream.zalloc = (alloc_func)0;
+	stream.zfree = (free_func)0;
+	stream.opaque = (voidpf)0;
+
+	// create output in zip-compatible form
+	err = deflateInit2(&stream, 8, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY);
+	if (err != Z_OK)
+	{
+		delete[] compressbuf;
+		return false;
+	}
+
+	err = deflate(&stream, Z_FINISH);
+	if (err != Z_STREAM_END) 
+	{
+		deflateEnd(&stream);
+		delete[] compressbuf;
+		return false;
+	}
+	unsigned compressedsize = stream.total_out;
+
+	err = deflateEnd(&stream);
+	if (err != Z_OK)
+	{
+		delete[] compressbuf;
+		return false;
+	}
+
+	delete[] mBuffer;
+	mBuffer = new char[compressedsize];
+	memcpy(mBuffer, compressbuf, compressedsize);
+	delete[] compressbuf;
+	mCompressedSize = compressedsize;
+	mMethod = METHOD_DEFLATE;
+	return true;
+}
+
 //-----------------------------------------------------------------------
 //
 // Finds the central directory end record in the end of the file.
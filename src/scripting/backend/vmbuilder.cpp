@@ -923,6 +923,13 @@ void FFunctionBuildList::Build()
 	FScriptPosition::StrictErrors = false;
 
 	if (FScriptPosition::ErrorCounter == 0 && Args->CheckParm("-dumpjit")) DumpJit();
+	if (FScriptPosition::ErrorCounter == 0)
+	{
+		for (auto &item : mItems)
+		{
+			item.Function->CompileAhead();
+		}
+	}
 	mItems.Clear();
 	mItems.ShrinkToFit();
 	FxAlloc.FreeAllBlocks();
@@ -1,6 +1,8 @@
 
 #include "jit.h"
 #include "jitintern.h"
+#include "c_dispatch.h"
+#include "v_text.h"
 
 extern PString *TypeString;
 extern PStruct *TypeVector2;
@@ -8,6 +10,25 @@ extern PStruct *TypeVector3;
 
 static void OutputJitLog(const asmjit::StringLogger &logger);
 
+struct JitClassStats
+{
+	int Functions = 0;
+	int Failed = 0;
+	size_t CodeSize = 0;
+	int64_t CompileTime = 0;
+};
+
+static TMap<FName, JitClassStats> JitStats;
+
+static JitClassStats &GetJitStats(VMScriptFunction *sfunc)
+{
+	// The printable name starts with the class name.
+	const char *name = sfunc->PrintableName.GetChars();
+	const char *dot = strchr(name, '.');
+	FString classname(name, dot != nullptr ? (int)(ptrdiff_t)(dot - name) : (int)strlen(name));
+	return JitStats[FName(classname)];
+}
+
 JitFuncPtr JitCompile(VMScriptFunction *sfunc)
 {
 #if 0
@@ -16,7 +37,13 @@ JitFuncPtr JitCompile(VMScriptFunction *sfunc)
 #endif
 
 	using namespace asmjit;
+	JitClassStats &stats = GetJitStats(sfunc);
+	cycle_t timer;
+	timer.Reset();
+	timer.Clock();
+
 	StringLogger logger;
+	JitFuncPtr result = nullptr;
 	try
 	{
 		ThrowingErrorHandler errorHandler;
@@ -26,14 +53,59 @@ JitFuncPtr JitCompile(VMScriptFunction *sfunc)
 		code.setLogger(&logger);
 
 		JitCompiler compiler(&code, sfunc);
-		return reinterpret_cast<JitFuncPtr>(AddJitFunction(&code, &compiler));
+		result = reinterpret_cast<JitFuncPtr>(AddJitFunction(&code, &compiler));
+		if (result) stats.CodeSize += code.getCodeSize();
 	}
 	catch (const CRecoverableError &e)
 	{
 		OutputJitLog(logger);
 		Printf("%s: Unexpected JIT error: %s\n",sfunc->PrintableName.GetChars(), e.what());
-		return nullptr;
 	}
+
+	timer.Unclock();
+	stats.CompileTime += timer.GetRawCounter();
+	if (result) stats.Functions++;
+	else stats.Failed++;
+	return result;
+}
+
+CCMD(vm_jitstats)
+{
+	struct SortedStats
+	{
+		FName ClassName;
+		JitClassStats Stats;
+	};
+
+	TArray<SortedStats> sorted;
+	JitClassStats total;
+
+	TMap<FName, JitClassStats>::Iterator it(JitStats);
+	TMap<FName, JitClassStats>::Pair *pair;
+	while (it.NextPair(pair))
+	{
+		sorted.Push({ pair->Key, pair->Value });
+		total.Functions += pair->Value.Functions;
+		total.Failed += pair->Value.Failed;
+		total.CodeSize += pair->Value.CodeSize;
+		total.CompileTime += pair->Value.CompileTime;
+	}
+
+	std::sort(sorted.begin(), sorted.end(), [](const SortedStats &left, const SortedStats &right)
+	{
+		return right.Stats.CompileTime < left.Stats.CompileTime;
+	});
+
+	const unsigned count = argv.argc() > 1 ? MIN<unsigned>(atoi(argv[1]), sorted.Size()) : sorted.Size();
+
+	Printf(TEXTCOLOR_YELLOW "Time, ms    Code, bytes  Funcs  Failed  Class\n");
+	Printf(TEXTCOLOR_YELLOW "----------  -----------  -----  ------  --------------------\n");
+	for (unsigned i = 0; i < count; i++)
+	{
+		const JitClassStats &stats = sorted[i].Stats;
+		Printf("%10.3f  %11zu  %5d  %6d  %s\n", stats.CompileTime / 1'000'000.0, stats.CodeSize, stats.Functions, stats.Failed, sorted[i].ClassName.GetChars());
+	}
+	Printf(TEXTCOLOR_YELLOW "%10.3f  %11zu  %5d  %6d  Total\n", total.CompileTime / 1'000'000.0, total.CodeSize, total.Functions, total.Failed);
 }
 
 void JitDumpLog(FILE *file, VMScriptFunction *sfunc)
@@ -54,6 +54,7 @@ extern FMemArena ClassDataAllocator;
 #define MAX_TRY_DEPTH	8	// Maximum number of nested TRYs in a single function
 
 void JitRelease();
+void VMProfileReset();
 
 
 typedef unsigned char		VM_UBYTE;
@@ -411,6 +412,8 @@ public:
 	TArray<uint32_t> ArgFlags;		// Should be the same length as Proto->ArgumentTypes
 
 	int(*ScriptCall)(VMFunction *func, VMValue *params, int numparams, VMReturn *ret, int numret) = nullptr;
+	// While the profiler runs, ScriptCall points to it and this is what it calls.
+	int(*UnprofiledCall)(VMFunction *func, VMValue *params, int numparams, VMReturn *ret, int numret) = nullptr;
 
 	VMFunction(FName name = NAME_None) : ImplicitArgs(0), Name(name), Proto(NULL)
 	{
@@ -427,6 +430,7 @@ public:
 	void operator delete[](void *block) {}
 	static void DeleteAll()
 	{
+		VMProfileReset();
 		for (auto f : AllFunctions)
 		{
 			f->~VMFunction();
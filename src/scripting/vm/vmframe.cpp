@@ -50,6 +50,8 @@ CUSTOM_CVAR(Bool, vm_jit, true, CVAR_NOINITCALL)
 	Printf("You must restart " GAMENAME " for this change to take effect.\n");
 	Printf("This cvar is currently not saved. You must specify it on the command line.");
 }
+// Compile all script functions right after the scripts are loaded instead of on their first call.
+CVAR(Bool, vm_jit_aot, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
 #else
 CVAR(Bool, vm_jit, false, CVAR_NOINITCALL|CVAR_NOSET)
 FString JitCaptureStackTrace(int framesToSkip, bool includeNativeFrames) { return FString(); }
@@ -303,6 +305,35 @@ int VMScriptFunction::FirstScriptCall(VMFunction *func, VMValue *params, int num
 	return func->ScriptCall(func, params, numparams, ret, numret);
 }
 
+//===========================================================================
+//
+// VMScriptFunction :: CompileAhead
+//
+// Does the work of FirstScriptCall without calling the function, so that
+// the compile time is spent while loading instead of in the middle of
+// gameplay.
+//
+//===========================================================================
+
+void VMScriptFunction::CompileAhead()
+{
+#ifdef HAVE_VM_JIT
+	if (!vm_jit || !vm_jit_aot || ScriptCall != &VMScriptFunction::FirstScriptCall || (VarFlags & VARF_Abstract) || Code == nullptr)
+		return;
+
+	if (CanJit(this))
+	{
+		ScriptCall = JitCompile(this);
+		if (!ScriptCall)
+			ScriptCall = VMExec;
+	}
+	else
+	{
+		ScriptCall = VMExec;
+	}
+#endif // HAVE_VM_JIT
+}
+
 int VMNativeFunction::NativeScriptCall(VMFunction *func, VMValue *params, int numparams, VMReturn *returns, int numret)
 {
 	try
@@ -551,6 +582,7 @@ int VMCall(VMFunction *func, VMValue *params, int numparams, VMReturn *results,
 	{	
 		if (func->VarFlags & VARF_Native)
 		{
+			FVMProfileScope profile(func);
 			return static_cast<VMNativeFunction *>(func)->NativeCall(VM_INVOKE(params, numparams, results, numresults, func->RegTypes));
 		}
 		else
@@ -439,6 +439,27 @@ void VMDisasm(FILE *out, const VMOP *code, int codesize, const VMScriptFunction
 
 extern thread_local VMFrameStack GlobalVMStack;
 
+// Function profiler (see vmprofile.cpp). Script functions are profiled by
+// replacing their ScriptCall, native functions the VM calls directly need
+// an FVMProfileScope around the call.
+extern bool VMProfiling;
+void VMProfileEnter(VMFunction *func);
+void VMProfileLeave();
+
+struct FVMProfileScope
+{
+	bool Active;
+
+	FVMProfileScope(VMFunction *func) : Active(VMProfiling)
+	{
+		if (Active) VMProfileEnter(func);
+	}
+	~FVMProfileScope()
+	{
+		if (Active) VMProfileLeave();
+	}
+};
+
 typedef std::pair<const class PType *, unsigned> FTypeAndOffset;
 
 typedef int(*JitFuncPtr)(VMFunction *func, VMValue *params, int numparams, VMReturn *ret, int numret);
@@ -477,6 +498,7 @@ public:
 	void DestroyExtra(void *addr);
 	int AllocExtraStack(PType *type);
 	int PCToLine(const VMOP *pc);
+	void CompileAhead();
 
 private:
 	static int FirstScriptCall(VMFunction *func, VMValue *params, int numparams, VMReturn *ret, int numret);
@@ -0,0 +1,360 @@
+/*
+** vmprofile.cpp
+** Function level profiler for the VM
+**
+**---------------------------------------------------------------------------
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+**
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+** 3. The name of the author may not be used to endorse or promote products
+**    derived from this software without specific prior written permission.
+**
+** THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+** IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+** OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+** IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+** INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+** NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+** DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+** THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+** (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+** THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+**---------------------------------------------------------------------------
+**
+** While the profiler runs, every function's ScriptCall points to
+** ProfiledCall, which times the call and then calls the function's real
+** entry point. All calls to script functions go through ScriptCall, from
+** VMCall, the interpreter and JIT compiled code alike, so nothing about
+** the VM or the generated code changes while the profiler is off. The
+** interpreter and VMCall call native functions directly and wrap those
+** calls in an FVMProfileScope, which costs a test of VMProfiling when the
+** profiler is off. Natives that JIT compiled code calls directly through
+** DirectNativeCall are not seen and count as their caller's own time.
+**
+** The calls are recorded in a call tree, so that both per function totals
+** and the collapsed stacks flame graph tools read can be produced from it.
+** Only the thread that started the profiler is recorded.
+**
+*/
+
+#include <thread>
+#include <algorithm>
+
+#include "vmintern.h"
+#include "c_dispatch.h"
+#include "files.h"
+#include "i_time.h"
+#include "m_misc.h"
+#include "templates.h"
+#include "v_text.h"
+
+bool VMProfiling;
+
+struct FProfileNode
+{
+	VMFunction *Func;
+	int Parent;
+	int FirstChild;
+	int NextSibling;
+	uint64_t Calls;
+	int64_t Time;			// including the callees
+	int64_t ChildTime;
+};
+
+struct FProfileFrame
+{
+	int Node;
+	int64_t Start;
+};
+
+static TArray<FProfileNode> ProfileNodes;
+static TArray<FProfileFrame> ProfileStack;
+static int ProfileCurrent;
+static std::thread::id ProfileThread;
+static int64_t ProfileStart, ProfileTime;
+
+//==========================================================================
+//
+// Call tree
+//
+//==========================================================================
+
+static void ClearProfile()
+{
+	ProfileNodes.Clear();
+	ProfileStack.Clear();
+	ProfileNodes.Push({ nullptr, -1, -1, -1, 0, 0, 0 });
+	ProfileCurrent = 0;
+	ProfileTime = 0;
+}
+
+void VMProfileEnter(VMFunction *func)
+{
+	if (std::this_thread::get_id() != ProfileThread) return;
+
+	// The most recently called child is kept first in the list.
+	FProfileNode &parent = ProfileNodes[ProfileCurrent];
+	int prev = -1;
+	int node = parent.FirstChild;
+	while (node >= 0 && ProfileNodes[node].Func != func)
+	{
+		prev = node;
+		node = ProfileNodes[node].NextSibling;
+	}
+	if (node < 0)
+	{
+		node = ProfileNodes.Push({ func, ProfileCurrent, -1, parent.FirstChild, 0, 0, 0 });
+		ProfileNodes[ProfileCurrent].FirstChild = node;
+	}
+	else if (prev >= 0)
+	{
+		ProfileNodes[prev].NextSibling = ProfileNodes[node].NextSibling;
+		ProfileNodes[node].NextSibling = parent.FirstChild;
+		parent.FirstChild = node;
+	}
+
+	ProfileCurrent = node;
+	ProfileStack.Push({ node, (int64_t)I_nsTime() });
+}
+
+void VMProfileLeave()
+{
+	int64_t now = I_nsTime();
+	if (std::this_thread::get_id() != ProfileThread || ProfileStack.Size() == 0) return;
+
+	FProfileFrame frame;
+	ProfileStack.Pop(frame);
+	FProfileNode &node = ProfileNodes[frame.Node];
+	int64_t elapsed = now - frame.Start;
+	node.Calls++;
+	node.Time += elapsed;
+	ProfileNodes[node.Parent].ChildTime += elapsed;
+	ProfileCurrent = node.Parent;
+}
+
+//==========================================================================
+//
+// ProfiledCall
+//
+// Calling a script function the first time replaces its ScriptCall with
+// the compiled code, so the profiler has to put itself back afterwards.
+//
+//==========================================================================
+
+static int ProfiledCall(VMFunction *func, VMValue *params, int numparams, VMReturn *ret, int numret)
+{
+	struct FRestore
+	{
+		VMFunction *Func;
+		~FRestore()
+		{
+			if (VMProfiling && Func->ScriptCall != &ProfiledCall)
+			{
+				Func->UnprofiledCall = Func->ScriptCall;
+				Func->ScriptCall = &ProfiledCall;
+			}
+		}
+	} restore = { func };
+
+	FVMProfileScope profile(func);
+	return func->UnprofiledCall(func, params, numparams, ret, numret);
+}
+
+//==========================================================================
+//
+// Starting and stopping
+//
+//==========================================================================
+
+static void StartProfiling()
+{
+	if (VMProfiling) return;
+
+	if (ProfileNodes.Size() == 0) ClearProfile();
+	for (auto func : VMFunction::AllFunctions)
+	{
+		if (func->ScriptCall != nullptr)
+		{
+			func->UnprofiledCall = func->ScriptCall;
+			func->ScriptCall = &ProfiledCall;
+		}
+	}
+	ProfileThread = std::this_thread::get_id();
+	ProfileStart = I_nsTime();
+	VMProfiling = true;
+}
+
+static void StopProfiling()
+{
+	if (!VMProfiling) return;
+
+	VMProfiling = false;
+	for (auto func : VMFunction::AllFunctions)
+	{
+		if (func->ScriptCall == &ProfiledCall)
+		{
+			func->ScriptCall = func->UnprofiledCall;
+		}
+	}
+	ProfileTime += I_nsTime() - ProfileStart;
+	ProfileStack.Clear();
+	ProfileCurrent = 0;
+}
+
+// The recorded functions are about to be deleted.
+void VMProfileReset()
+{
+	StopProfiling();
+	ProfileNodes.Clear();
+	ProfileStack.Clear();
+}
+
+//==========================================================================
+//
+// Output
+//
+//==========================================================================
+
+static FString ProfileName(VMFunction *func)
+{
+	FString name = func->PrintableName.IsNotEmpty() ? func->PrintableName : FString(func->Name.GetChars());
+	// Separators of the collapsed stack format
+	name.ReplaceChars("; ", '_');
+	return name;
+}
+
+static void PrintProfile(unsigned count)
+{
+	struct FFunctionProfile
+	{
+		VMFunction *Func;
+		uint64_t Calls;
+		int64_t Time;
+		int64_t SelfTime;
+	};
+
+	TArray<FFunctionProfile> funcs;
+	TMap<VMFunction *, unsigned> index;
+
+	for (unsigned i = 1; i < ProfileNodes.Size(); i++)
+	{
+		const FProfileNode &node = ProfileNodes[i];
+		unsigned *pindex = index.CheckKey(node.Func);
+		if (pindex == nullptr)
+		{
+			pindex = &index.Insert(node.Func, funcs.Push({ node.Func, 0, 0, 0 }));
+		}
+		FFunctionProfile &func = funcs[*pindex];
+		func.Calls += node.Calls;
+		func.SelfTime += node.Time - node.ChildTime;
+
+		// Recursive calls are already included in the outermost call's time.
+		int parent = node.Parent;
+		while (parent > 0 && ProfileNodes[parent].Func != node.Func) parent = ProfileNodes[parent].Parent;
+		if (parent <= 0) func.Time += node.Time;
+	}
+
+	std::sort(funcs.begin(), funcs.end(), [](const FFunctionProfile &left, const FFunctionProfile &right)
+	{
+		return right.SelfTime < left.SelfTime;
+	});
+
+	int64_t total = ProfileTime + (VMProfiling ? I_nsTime() - ProfileStart : 0);
+	int64_t vmtime = ProfileNodes.Size() > 0 ? ProfileNodes[0].ChildTime : 0;
+	count = count > 0 ? MIN(count, funcs.Size()) : funcs.Size();
+
+	Printf(TEXTCOLOR_YELLOW "  Self, ms  Total, ms       Calls  Avg, us  Function\n");
+	Printf(TEXTCOLOR_YELLOW "----------  ---------  ----------  -------  --------------------\n");
+	for (unsigned i = 0; i < count; i++)
+	{
+		const FFunctionProfile &func = funcs[i];
+		Printf("%10.3f %10.3f  %10llu  %7.2f  %s\n", func.SelfTime / 1'000'000.0, func.Time / 1'000'000.0,
+			(unsigned long long)func.Calls, func.Calls > 0 ? func.Time / 1'000.0 / func.Calls : 0., ProfileName(func.Func).GetChars());
+	}
+	Printf(TEXTCOLOR_YELLOW "%.3f ms in the VM out of %.3f ms profiled, %u functions\n", vmtime / 1'000'000.0, total / 1'000'000.0, funcs.Size());
+}
+
+// One line per call path with the path's own time in microseconds.
+static bool WriteCollapsedStacks(const char *filename)
+{
+	FileWriter *f = FileWriter::Open(filename);
+	if (f == nullptr) return false;
+
+	TArray<int> path;
+	for (unsigned i = 1; i < ProfileNodes.Size(); i++)
+	{
+		const FProfileNode &node = ProfileNodes[i];
+		int64_t self = (node.Time - node.ChildTime) / 1000;
+		if (self <= 0) continue;
+
+		path.Clear();
+		for (int n = i; n > 0; n = ProfileNodes[n].Parent) path.Push(n);
+
+		FString line;
+		for (int j = path.Size() - 1; j >= 0; j--)
+		{
+			line << ProfileName(ProfileNodes[path[j]].Func) << (j > 0 ? ";" : " ");
+		}
+		line.AppendFormat("%lld\n", (long long)self);
+		f->Write(line.GetChars(), line.Len());
+	}
+	delete f;
+	return true;
+}
+
+//==========================================================================
+//
+// CCMD vmprofile
+//
+//==========================================================================
+
+CCMD(vmprofile)
+{
+	const char *cmd = argv.argc() > 1 ? argv[1] : "";
+
+	if (!stricmp(cmd, "start"))
+	{
+		StartProfiling();
+		Printf("VM profiling started\n");
+	}
+	else if (!stricmp(cmd, "stop"))
+	{
+		StopProfiling();
+		Printf("VM profiling stopped\n");
+	}
+	else if (!stricmp(cmd, "clear"))
+	{
+		bool running = VMProfiling;
+		StopProfiling();
+		ClearProfile();
+		if (running) StartProfiling();
+	}
+	else if (!stricmp(cmd, "report"))
+	{
+		PrintProfile(argv.argc() > 2 ? atoi(argv[2]) : 30);
+	}
+	else if (!stricmp(cmd, "dump"))
+	{
+		FString filename = M_GetDocumentsPath() + (argv.argc() > 2 ? argv[2] : "vmprofile.folded");
+		if (WriteCollapsedStacks(filename)) Printf("Collapsed stacks written to %s\n", filename.GetChars());
+		else Printf("Could not write %s\n", filename.GetChars());
+	}
+	else
+	{
+		Printf(
+			"Usage: vmprofile start|stop|clear\n"
+			"       vmprofile report [count]\n"
+			"       vmprofile dump [filename]\n\n"
+			"Records the time spent in each ZScript and native function called\n"
+			"through the VM. " TEXTCOLOR_YELLOW "report" TEXTCOLOR_NORMAL " lists the functions by their own time, "
+			TEXTCOLOR_YELLOW "dump" TEXTCOLOR_NORMAL " writes\n"
+			"collapsed stacks for flame graph tools to the documents folder.\n");
+	}
+}
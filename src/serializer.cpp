@@ -38,6 +38,8 @@
 #define RAPIDJSON_PARSE_DEFAULT_FLAGS kParseFullPrecisionFlag
 
 #include <zlib.h>
+#include <cmath>
+#include <limits.h>
 #include "rapidjson/rapidjson.h"
 #include "rapidjson/writer.h"
 #include "rapidjson/prettywriter.h"
@@ -146,6 +148,373 @@ struct FJSONObject
 	}
 };
 
+//==========================================================================
+//
+// Binary savegame encoding
+//
+// This stores the same token stream the JSON writer gets, but keys and
+// strings are only stored once and referenced by index afterward, and
+// numbers are written as varints. When reading, the data is turned back
+// into a rapidjson document so that everything above FReader works the
+// same for both formats.
+//
+//==========================================================================
+
+static const char BinaryMagic[4] = { 0, 'Z', 'B', 'S' };	// A JSON document can never start with a 0.
+
+enum EBinaryToken
+{
+	BT_StartObject = 1,
+	BT_EndObject,
+	BT_StartArray,
+	BT_EndArray,
+	BT_Null,
+	BT_False,
+	BT_True,
+	BT_PosInt,			// varint
+	BT_NegInt,			// varint of -(value + 1)
+	BT_PosIntDouble,	// integral doubles, same encoding as the ints.
+	BT_NegIntDouble,
+	BT_Double,			// 8 bytes, little endian
+	BT_NewKey,			// varint length + characters, gets the next free key index
+	BT_Key,				// varint key index
+	BT_NewString,		// same for strings
+	BT_String,
+};
+
+//==========================================================================
+//
+// Maps strings to consecutive indices
+//
+//==========================================================================
+
+class FStringIndexer
+{
+	TArray<char> mChars;
+	TArray<unsigned> mOffsets;
+	TArray<unsigned> mLengths;
+	TArray<int> mHash;
+
+	static unsigned HashString(const char *str, unsigned len)
+	{
+		unsigned hash = 2166136261u;
+		for (unsigned i = 0; i < len; i++) hash = (hash ^ (uint8_t)str[i]) * 16777619u;
+		return hash;
+	}
+
+	void Rehash()
+	{
+		mHash.Resize(mHash.Size() == 0 ? 1024 : mHash.Size() * 2);
+		for (auto &h : mHash) h = -1;
+		for (unsigned i = 0; i < mOffsets.Size(); i++)
+		{
+			unsigned slot = HashString(&mChars[mOffsets[i]], mLengths[i]) & (mHash.Size() - 1);
+			while (mHash[slot] >= 0) slot = (slot + 1) & (mHash.Size() - 1);
+			mHash[slot] = i;
+		}
+	}
+
+public:
+	// Returns the string's index and whether it was added by this call.
+	unsigned Find(const char *str, unsigned len, bool &added)
+	{
+		if (mOffsets.Size() * 2 >= mHash.Size()) Rehash();
+
+		unsigned slot = HashString(str, len) & (mHash.Size() - 1);
+		while (mHash[slot] >= 0)
+		{
+			int index = mHash[slot];
+			if (mLengths[index] == len && !memcmp(&mChars[mOffsets[index]], str, len))
+			{
+				added = false;
+				return index;
+			}
+			slot = (slot + 1) & (mHash.Size() - 1);
+		}
+		added = true;
+		mHash[slot] = mOffsets.Size();
+		mOffsets.Push(mChars.Size());
+		mLengths.Push(len);
+		if (len > 0) memcpy(&mChars[mChars.Reserve(len)], str, len);
+		return mOffsets.Size() - 1;
+	}
+};
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+struct FBinaryWriter
+{
+	rapidjson::StringBuffer &mOut;
+	FStringIndexer mKeys;
+	FStringIndexer mStrings;
+
+	FBinaryWriter(rapidjson::StringBuffer &out)
+		: mOut(out)
+	{
+		memcpy(mOut.Push(sizeof(BinaryMagic)), BinaryMagic, sizeof(BinaryMagic));
+	}
+
+	void Token(int tok)
+	{
+		mOut.Put((char)tok);
+	}
+
+	void Varint(uint64_t v)
+	{
+		while (v >= 0x80)
+		{
+			mOut.Put((char)(v | 0x80));
+			v >>= 7;
+		}
+		mOut.Put((char)v);
+	}
+
+	void Name(FStringIndexer &table, int newtok, int reftok, const char *str, unsigned len)
+	{
+		bool added;
+		unsigned index = table.Find(str, len, added);
+		if (added)
+		{
+			Token(newtok);
+			Varint(len);
+			memcpy(mOut.Push(len), str, len);
+		}
+		else
+		{
+			Token(reftok);
+			Varint(index);
+		}
+	}
+
+	void Integer(int64_t v, int postok, int negtok)
+	{
+		if (v >= 0)
+		{
+			Token(postok);
+			Varint(v);
+		}
+		else
+		{
+			Token(negtok);
+			Varint(uint64_t(-(v + 1)));
+		}
+	}
+
+	void StartObject() { Token(BT_StartObject); }
+	void EndObject() { Token(BT_EndObject); }
+	void StartArray() { Token(BT_StartArray); }
+	void EndArray() { Token(BT_EndArray); }
+	void Null() { Token(BT_Null); }
+	void Bool(bool k) { Token(k ? BT_True : BT_False); }
+	void Int(int32_t k) { Integer(k, BT_PosInt, BT_NegInt); }
+	void Int64(int64_t k) { Integer(k, BT_PosInt, BT_NegInt); }
+	void Uint(uint32_t k) { Integer(k, BT_PosInt, BT_NegInt); }
+
+	void Uint64(uint64_t k)
+	{
+		Token(BT_PosInt);
+		Varint(k);
+	}
+
+	void Key(const char *k)
+	{
+		Name(mKeys, BT_NewKey, BT_Key, k, (unsigned)strlen(k));
+	}
+
+	void String(const char *k)
+	{
+		Name(mStrings, BT_NewString, BT_String, k, (unsigned)strlen(k));
+	}
+
+	void Double(double k)
+	{
+		// Most coordinates and angles are integral so this saves a lot of space.
+		if (fabs(k) < 9007199254740992. && k == (double)(int64_t)k && !(k == 0 && std::signbit(k)))
+		{
+			Integer((int64_t)k, BT_PosIntDouble, BT_NegIntDouble);
+		}
+		else
+		{
+			uint64_t bits;
+			memcpy(&bits, &k, 8);
+			Token(BT_Double);
+			for (int i = 0; i < 8; i++) mOut.Put((char)(bits >> (i * 8)));
+		}
+	}
+};
+
+//==========================================================================
+//
+// Generates the document for a binary save.
+// Must be passed to rapidjson::Document::Populate.
+//
+//==========================================================================
+
+class FBinaryReader
+{
+	const uint8_t *mPos;
+	const uint8_t *mEnd;
+	TArray<std::pair<const char *, unsigned>> mKeys;
+	TArray<std::pair<const char *, unsigned>> mStrings;
+
+	bool Varint(uint64_t &v)
+	{
+		v = 0;
+		for (int shift = 0; shift < 64 && mPos < mEnd; shift += 7)
+		{
+			uint8_t b = *mPos++;
+			v |= uint64_t(b & 0x7f) << shift;
+			if (!(b & 0x80)) return true;
+		}
+		return false;
+	}
+
+	bool Name(TArray<std::pair<const char *, unsigned>> &table, bool isnew, const char *&str, unsigned &len)
+	{
+		uint64_t v;
+		if (!Varint(v)) return false;
+		if (isnew)
+		{
+			if (v > uint64_t(mEnd - mPos)) return false;
+			str = (const char *)mPos;
+			len = (unsigned)v;
+			mPos += len;
+			table.Push(std::make_pair(str, len));
+		}
+		else
+		{
+			if (v >= table.Size()) return false;
+			str = table[(unsigned)v].first;
+			len = table[(unsigned)v].second;
+		}
+		return true;
+	}
+
+public:
+	FBinaryReader(const char *buffer, size_t length)
+	{
+		mPos = (const uint8_t *)buffer + sizeof(BinaryMagic);
+		mEnd = (const uint8_t *)buffer + length;
+	}
+
+	static bool Check(const char *buffer, size_t length)
+	{
+		return length >= sizeof(BinaryMagic) && !memcmp(buffer, BinaryMagic, sizeof(BinaryMagic));
+	}
+
+	template<class Handler> bool operator()(Handler &handler)
+	{
+		// Number of values in each open container. For objects this is the member count.
+		TArray<unsigned> counts;
+		counts.Push(0);
+
+		while (mPos < mEnd)
+		{
+			int tok = *mPos++;
+			uint64_t v;
+			const char *str;
+			unsigned len;
+			bool ok;
+
+			if (tok != BT_EndObject && tok != BT_EndArray && tok != BT_NewKey && tok != BT_Key)
+			{
+				counts.Last()++;
+			}
+
+			switch (tok)
+			{
+			case BT_StartObject:
+				ok = handler.StartObject();
+				counts.Push(0);
+				break;
+
+			case BT_StartArray:
+				ok = handler.StartArray();
+				counts.Push(0);
+				break;
+
+			case BT_EndObject:
+				if (counts.Size() < 2) return false;
+				ok = handler.EndObject(counts.Last());
+				counts.Pop();
+				break;
+
+			case BT_EndArray:
+				if (counts.Size() < 2) return false;
+				ok = handler.EndArray(counts.Last());
+				counts.Pop();
+				break;
+
+			case BT_Null:
+				ok = handler.Null();
+				break;
+
+			case BT_False:
+			case BT_True:
+				ok = handler.Bool(tok == BT_True);
+				break;
+
+			case BT_PosInt:
+				if (!Varint(v)) return false;
+				if (v <= INT_MAX) ok = handler.Int((int)v);
+				else if (v <= UINT_MAX) ok = handler.Uint((unsigned)v);
+				else if (v <= INT64_MAX) ok = handler.Int64((int64_t)v);
+				else ok = handler.Uint64(v);
+				break;
+
+			case BT_NegInt:
+				if (!Varint(v) || v > INT64_MAX) return false;
+				if (v <= INT_MAX) ok = handler.Int(-(int)v - 1);
+				else ok = handler.Int64(-(int64_t)v - 1);
+				break;
+
+			case BT_PosIntDouble:
+				if (!Varint(v)) return false;
+				ok = handler.Double((double)v);
+				break;
+
+			case BT_NegIntDouble:
+				if (!Varint(v)) return false;
+				ok = handler.Double(-(double)v - 1);
+				break;
+
+			case BT_Double:
+			{
+				if (mEnd - mPos < 8) return false;
+				uint64_t bits = 0;
+				for (int i = 0; i < 8; i++) bits |= uint64_t(mPos[i]) << (i * 8);
+				mPos += 8;
+				double d;
+				memcpy(&d, &bits, 8);
+				ok = handler.Double(d);
+				break;
+			}
+
+			case BT_NewKey:
+			case BT_Key:
+				if (!Name(mKeys, tok == BT_NewKey, str, len)) return false;
+				ok = handler.Key(str, len, true);
+				break;
+
+			case BT_NewString:
+			case BT_String:
+				if (!Name(mStrings, tok == BT_NewString, str, len)) return false;
+				ok = handler.String(str, len, true);
+				break;
+
+			default:
+				return false;
+			}
+			if (!ok) return false;
+		}
+		return counts.Size() == 1 && counts[0] == 1;
+	}
+};
+
 //==========================================================================
 //
 // some wrapper stuff to keep the RapidJSON dependencies out of the global headers.
@@ -160,21 +529,27 @@ struct FWriter
 
 	Writer *mWriter1;
 	PrettyWriter *mWriter2;
+	FBinaryWriter *mWriter3;
 	TArray<bool> mInObject;
 	rapidjson::StringBuffer mOutString;
 	TArray<DObject *> mDObjects;
 	TMap<DObject *, int> mObjectMap;
 	
-	FWriter(bool pretty)
+	FWriter(bool pretty, bool binary)
 	{
-		if (!pretty)
+		mWriter1 = nullptr;
+		mWriter2 = nullptr;
+		mWriter3 = nullptr;
+		if (binary)
+		{
+			mWriter3 = new FBinaryWriter(mOutString);
+		}
+		else if (!pretty)
 		{
 			mWriter1 = new Writer(mOutString);
-			mWriter2 = nullptr;
 		}
 		else
 		{
-			mWriter1 = nullptr;
 			mWriter2 = new PrettyWriter(mOutString);
 		}
 	}
@@ -183,6 +558,7 @@ struct FWriter
 	{
 		if (mWriter1) delete mWriter1;
 		if (mWriter2) delete mWriter2;
+		if (mWriter3) delete mWriter3;
 	}
 
 
@@ -195,36 +571,42 @@ struct FWriter
 	{
 		if (mWriter1) mWriter1->StartObject();
 		else if (mWriter2) mWriter2->StartObject();
+		else if (mWriter3) mWriter3->StartObject();
 	}
 
 	void EndObject()
 	{
 		if (mWriter1) mWriter1->EndObject();
 		else if (mWriter2) mWriter2->EndObject();
+		else if (mWriter3) mWriter3->EndObject();
 	}
 
 	void StartArray()
 	{
 		if (mWriter1) mWriter1->StartArray();
 		else if (mWriter2) mWriter2->StartArray();
+		else if (mWriter3) mWriter3->StartArray();
 	}
 
 	void EndArray()
 	{
 		if (mWriter1) mWriter1->EndArray();
 		else if (mWriter2) mWriter2->EndArray();
+		else if (mWriter3) mWriter3->EndArray();
 	}
 
 	void Key(const char *k)
 	{
 		if (mWriter1) mWriter1->Key(k);
 		else if (mWriter2) mWriter2->Key(k);
+		else if (mWriter3) mWriter3->Key(k);
 	}
 
 	void Null()
 	{
 		if (mWriter1) mWriter1->Null();
 		else if (mWriter2) mWriter2->Null();
+		else if (mWriter3) mWriter3->Null();
 	}
 
 	void StringU(const char *k, bool encode)
@@ -232,6 +614,7 @@ struct FWriter
 		if (encode) k = StringToUnicode(k);
 		if (mWriter1) mWriter1->String(k);
 		else if (mWriter2) mWriter2->String(k);
+		else if (mWriter3) mWriter3->String(k);
 	}
 
 	void String(const char *k)
@@ -239,6 +622,7 @@ struct FWriter
 		k = StringToUnicode(k);
 		if (mWriter1) mWriter1->String(k);
 		else if (mWriter2) mWriter2->String(k);
+		else if (mWriter3) mWriter3->String(k);
 	}
 
 	void String(const char *k, int size)
@@ -246,36 +630,42 @@ struct FWriter
 		k = StringToUnicode(k, size);
 		if (mWriter1) mWriter1->String(k);
 		else if (mWriter2) mWriter2->String(k);
+		else if (mWriter3) mWriter3->String(k);
 	}
 
 	void Bool(bool k)
 	{
 		if (mWriter1) mWriter1->Bool(k);
 		else if (mWriter2) mWriter2->Bool(k);
+		else if (mWriter3) mWriter3->Bool(k);
 	}
 
 	void Int(int32_t k)
 	{
 		if (mWriter1) mWriter1->Int(k);
 		else if (mWriter2) mWriter2->Int(k);
+		else if (mWriter3) mWriter3->Int(k);
 	}
 
 	void Int64(int64_t k)
 	{
 		if (mWriter1) mWriter1->Int64(k);
 		else if (mWriter2) mWriter2->Int64(k);
+		else if (mWriter3) mWriter3->Int64(k);
 	}
 
 	void Uint(uint32_t k)
 	{
 		if (mWriter1) mWriter1->Uint(k);
 		else if (mWriter2) mWriter2->Uint(k);
+		else if (mWriter3) mWriter3->Uint(k);
 	}
 
 	void Uint64(int64_t k)
 	{
 		if (mWriter1) mWriter1->Uint64(k);
 		else if (mWriter2) mWriter2->Uint64(k);
+		else if (mWriter3) mWriter3->Uint64(k);
 	}
 
 	void Double(double k)
@@ -288,6 +678,10 @@ struct FWriter
 		{
 			mWriter2->Double(k);
 		}
+		else if (mWriter3)
+		{
+			mWriter3->Double(k);
+		}
 	}
 
 };
@@ -308,7 +702,15 @@ struct FReader
 
 	FReader(const char *buffer, size_t length)
 	{
-		mDoc.Parse(buffer, length);
+		if (FBinaryReader::Check(buffer, length))
+		{
+			FBinaryReader reader(buffer, length);
+			mDoc.Populate(reader);
+		}
+		else
+		{
+			mDoc.Parse(buffer, length);
+		}
 		mObjects.Push(FJSONObject(&mDoc));
 	}
 
@@ -348,12 +750,12 @@ struct FReader
 //
 //==========================================================================
 
-bool FSerializer::OpenWriter(bool pretty)
+bool FSerializer::OpenWriter(bool pretty, bool binary)
 {
 	if (w != nullptr || r != nullptr) return false;
 
 	mErrors = 0;
-	w = new FWriter(pretty);
+	w = new FWriter(pretty, binary);
 	BeginObject(nullptr);
 	return true;
 }
@@ -1051,57 +1453,32 @@ const char *FSerializer::GetOutput(unsigned *len)
 //==========================================================================
 
 FCompressedBuffer FSerializer::GetCompressedOutput()
+{
+	FCompressedBuffer buff = GetStoredOutput();
+	buff.Compress();
+	return buff;
+}
+
+//==========================================================================
+//
+// Returns an uncompressed copy of the output. Its CRC is not set,
+// this needs to be done by calling Compress on it before it can be
+// written to a zip.
+//
+//==========================================================================
+
+FCompressedBuffer FSerializer::GetStoredOutput()
 {
 	if (isReading()) return{ 0,0,0,0,0,nullptr };
 	FCompressedBuffer buff;
 	WriteObjects();
 	EndObject();
-	buff.mSize = (unsigned)w->mOutString.GetSize();
+	buff.mSize = buff.mCompressedSize = (unsigned)w->mOutString.GetSize();
 	buff.mZipFlags = 0;
-	buff.mCRC32 = crc32(0, (const Bytef*)w->mOutString.GetString(), buff.mSize);
-
-	uint8_t *compressbuf = new uint8_t[buff.mSize+1];
-
-	z_stream stream;
-	int err;
-
-	stream.next_in = (Bytef *)w->mOutString.GetString();
-	stream.avail_in = buff.mSize;
-	stream.next_out = (Bytef*)compressbuf;
-	stream.avail_out = buff.mSize;
-	stream.zalloc = (alloc_func)0;
-	stream.zfree = (free_func)0;
-	stream.opaque = (voidpf)0;
-
-	// create output in zip-compatible form as required by FCompressedBuffer
-	err = deflateInit2(&stream, 8, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY);
-	if (err != Z_OK)
-	{
-		goto error;
-	}
-
-	err = deflate(&stream, Z_FINISH);
-	if (err != Z_STREAM_END) 
-	{
-		deflateEnd(&stream);
-		goto error;
-	}
-	buff.mCompressedSize = stream.total_out;
-
-	err = deflateEnd(&stream);
-	if (err == Z_OK)
-	{
-		buff.mBuffer = new char[buff.mCompressedSize];
-		buff.mMethod = METHOD_DEFLATE;
-		memcpy(buff.mBuffer, compressbuf, buff.mCompressedSize);
-		delete[] compressbuf;
-		return buff;
-	}
-
-error:
-	memcpy(compressbuf, w->mOutString.GetString(), buff.mSize + 1);
-	buff.mCompressedSize = buff.mSize;
+	buff.mCRC32 = 0;
 	buff.mMethod = METHOD_STORED;
+	buff.mBuffer = new char[buff.mSize + 1];
+	memcpy(buff.mBuffer, w->mOutString.GetString(), buff.mSize + 1);
 	return buff;
 }
 
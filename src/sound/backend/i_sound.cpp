@@ -34,6 +34,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <mutex>
 
 #include "oalsound.h"
 
@@ -333,23 +334,163 @@ FString SoundStream::GetStats()
 
 //==========================================================================
 //
-// SoundRenderer :: LoadSoundVoc
+// S_DecodeSound
+//
+// Decodes a compressed sound to PCM. Mono and stereo 8 and 16 bit
+// sounds are supported.
+//
+// This gets called from the decoding threads. Opening a decoder loads
+// libsndfile and libmpg123 on first use and initializes mpg123, none of
+// which is thread safe, so only the decoding itself runs in parallel.
 //
 //==========================================================================
 
-SoundHandle SoundRenderer::LoadSoundVoc(uint8_t *sfxdata, int length)
+static std::mutex DecoderLock;
+
+//==========================================================================
+//
+// S_InitDecoders
+//
+// Opening a decoder on data no decoder accepts tries all of them, so
+// this gets the libraries loaded on the main thread. Music also opens
+// decoders there, and that does not go through DecoderLock.
+//
+//==========================================================================
+
+void S_InitDecoders()
+{
+	static bool inited;
+	if (inited) return;
+	inited = true;
+
+	uint8_t dummy[64] = {};
+	std::lock_guard<std::mutex> lock(DecoderLock);
+	auto decoder = CreateDecoder(dummy, sizeof(dummy), true);
+	if (decoder) SoundDecoder_Close(decoder);
+}
+
+bool S_DecodeSound(uint8_t *sfxdata, int length, FDecodedSound &out)
 {
-	uint8_t * data = NULL;
+#ifdef __MOBILE__ // 3D sounds are very loud without making the sound mono. This needs to be fixed because it is making all sounds mono for now..
+	bool monoize = true;
+#else
+	bool monoize = false;
+#endif
+
+	ChannelConfig chans;
+	SampleType type;
+	int srate;
+	uint32_t loop_start = 0, loop_end = ~0u;
+	bool startass = false, endass = false;
+
+	FindLoopTags(sfxdata, length, &loop_start, &startass, &loop_end, &endass);
+	SoundDecoder *decoder;
+	{
+		std::lock_guard<std::mutex> lock(DecoderLock);
+		decoder = CreateDecoder(sfxdata, length, true);
+	}
+	if (!decoder)
+		return false;
+
+	SoundDecoder_GetInfo(decoder, &srate, &chans, &type);
+	int channels = 0, bits = 0;
+	if (chans == ChannelConfig_Mono) channels = 1;
+	else if (chans == ChannelConfig_Stereo) channels = 2;
+	if (type == SampleType_UInt8) bits = 8;
+	else if (type == SampleType_Int16) bits = 16;
+
+	if (channels == 0 || bits == 0)
+	{
+		SoundDecoder_Close(decoder);
+		out.Error.Format("Unsupported audio format: %s, %s", GetChannelConfigName(chans), GetSampleTypeName(type));
+		return false;
+	}
+
+	std::vector<uint8_t> &data = out.Data;
+	unsigned total = 0;
+	unsigned got;
+
+	data.resize(total + 32768);
+	while ((got = (unsigned)SoundDecoder_Read(decoder, (char*)&data[total], data.size() - total)) > 0)
+	{
+		total += got;
+		data.resize(total * 2);
+	}
+	data.resize(total);
+	SoundDecoder_Close(decoder);
+	if (total == 0)
+	{
+		return false;
+	}
+
+	if (channels > 1 && monoize)
+	{
+		size_t frames = data.size() / channels / (bits / 8);
+		if (bits == 16)
+		{
+			short *sfxdata = (short*)&data[0];
+			for (size_t i = 0; i < frames; i++)
+			{
+				int sum = 0;
+				for (int c = 0; c < channels; c++)
+					sum += sfxdata[i*channels + c];
+				sfxdata[i] = short(sum / channels);
+			}
+		}
+		else
+		{
+			uint8_t *sfxdata = &data[0];
+			for (size_t i = 0; i < frames; i++)
+			{
+				int sum = 0;
+				for (int c = 0; c < channels; c++)
+					sum += sfxdata[i*channels + c] - 128;
+				sfxdata[i] = uint8_t((sum / channels) + 128);
+			}
+		}
+		data.resize(frames * (bits / 8));
+		channels = 1;
+	}
+
+	if (!startass) loop_start = uint32_t((int64_t)loop_start * srate / 1000);
+	if (!endass && loop_end != ~0u) loop_end = uint32_t((int64_t)loop_end * srate / 1000);
+	const uint32_t samples = (uint32_t)data.size() / (channels * bits / 8);
+	if (loop_start > samples) loop_start = 0;
+	if (loop_end > samples) loop_end = samples;
+
+	// A loop over the whole sound is what the renderer does anyway.
+	if ((loop_start > 0 || loop_end > 0) && loop_end > loop_start && (loop_start > 0 || loop_end < samples))
+	{
+		out.LoopStart = loop_start;
+		out.LoopEnd = loop_end;
+	}
+	out.Frequency = srate;
+	out.Channels = channels;
+	out.Bits = bits;
+	return true;
+}
+
+//==========================================================================
+//
+// S_DecodeSoundVoc
+//
+//==========================================================================
+
+bool S_DecodeSoundVoc(uint8_t *sfxdata, int length, FDecodedSound &out)
+{
+	std::vector<uint8_t> &data = out.Data;
 	int len, frequency, channels, bits, loopstart, loopend;
 	len = frequency = channels = bits = 0;
 	loopstart = loopend = -1;
+	bool okay = false;
 	do if (length > 26)
 	{
 		// First pass to parse data and validate the file
 		if (strncmp ((const char *)sfxdata, "Creative Voice File", 19))
 			break;
 		int i = 26, blocktype = 0, blocksize = 0, codec = -1;
-		bool noextra = true, okay = true;
+		bool noextra = true;
+		okay = true;
 		while (i < length)
 		{
 			// Read block header
@@ -445,7 +586,7 @@ SoundHandle SoundRenderer::LoadSoundVoc(uint8_t *sfxdata, int length)
 		// Second pass to write the data
 		if (okay)
 		{
-			data = new uint8_t[len];
+			data.resize(len);
 			i = 26;
 			int j = 0;
 			while (i < length)
@@ -457,20 +598,20 @@ SoundHandle SoundRenderer::LoadSoundVoc(uint8_t *sfxdata, int length)
 				i += 4;
 				switch (blocktype)
 				{
-				case 1: memcpy(data+j, sfxdata+i+2,  blocksize-2 ); j += blocksize-2;	break;
-				case 2: memcpy(data+j, sfxdata+i,    blocksize   ); j += blocksize;		break;
-				case 9: memcpy(data+j, sfxdata+i+12, blocksize-12); j += blocksize-12;	break;
+				case 1: memcpy(&data[j], sfxdata+i+2,  blocksize-2 ); j += blocksize-2;	break;
+				case 2: memcpy(&data[j], sfxdata+i,    blocksize   ); j += blocksize;		break;
+				case 9: memcpy(&data[j], sfxdata+i+12, blocksize-12); j += blocksize-12;	break;
 				case 3:
 					{
 						int silength = 1 + sfxdata[i] + (sfxdata[i+1]<<8);
 						if (bits == 8)
 						{
-							memset(data+j, 128, silength);
+							memset(&data[j], 128, silength);
 							j += silength;
 						}
 						else if (bits == -16)
 						{
-							memset(data+j, 0, silength<<1);
+							memset(&data[j], 0, silength<<1);
 							j += silength<<1;
 						}
 					}
@@ -482,7 +623,23 @@ SoundHandle SoundRenderer::LoadSoundVoc(uint8_t *sfxdata, int length)
 		}
 
 	} while (false);
-	SoundHandle retval = LoadSoundRaw(data, len, frequency, channels, bits, loopstart, loopend);
-	if (data) delete[] data;
-	return retval;
+	out.Frequency = frequency;
+	out.Channels = channels;
+	out.Bits = bits;
+	out.LoopStart = loopstart;
+	out.LoopEnd = loopend;
+	return okay;
+}
+
+//==========================================================================
+//
+// SoundRenderer :: LoadSoundVoc
+//
+//==========================================================================
+
+SoundHandle SoundRenderer::LoadSoundVoc(uint8_t *sfxdata, int length)
+{
+	FDecodedSound decoded;
+	S_DecodeSoundVoc(sfxdata, length, decoded);
+	return LoadSoundRaw(decoded.Data.size() > 0 ? &decoded.Data[0] : nullptr, (int)decoded.Data.size(), decoded.Frequency, decoded.Channels, decoded.Bits, decoded.LoopStart, decoded.LoopEnd);
 }
@@ -88,6 +88,24 @@ typedef bool (*SoundStreamCallback)(SoundStream *stream, void *buff, int len, vo
 struct SoundDecoder;
 class MIDIDevice;
 
+// PCM data produced by the sound decoders, ready to be passed to LoadSoundRaw.
+struct FDecodedSound
+{
+	std::vector<uint8_t> Data;
+	int Frequency = 0;
+	int Channels = 0;
+	int Bits = 0;
+	int LoopStart = -1;
+	int LoopEnd = -1;
+	FString Error;		// set if decoding failed for a reason worth reporting
+};
+
+// These do not touch the sound renderer and may be called from any thread.
+bool S_DecodeSound(uint8_t *sfxdata, int length, FDecodedSound &out);
+bool S_DecodeSoundVoc(uint8_t *sfxdata, int length, FDecodedSound &out);
+// Must be called on the main thread before the first decoding thread starts.
+void S_InitDecoders();
+
 class SoundRenderer
 {
 public:
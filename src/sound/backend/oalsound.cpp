@@ -484,16 +484,6 @@ public:
 
 #define PITCH(pitch) (snd_pitched ? (pitch)/128.f : 1.f)
 
-static size_t GetChannelCount(ChannelConfig chans)
-{
-	switch(chans)
-	{
-		case ChannelConfig_Mono: return 1;
-		case ChannelConfig_Stereo: return 2;
-	}
-	return 0;
-}
-
 static float GetRolloff(const FRolloffInfo *rolloff, float distance)
 {
 	return soundEngine->GetRolloff(rolloff, distance);
@@ -1053,125 +1043,15 @@ SoundHandle OpenALSoundRenderer::LoadSoundRaw(uint8_t *sfxdata, int length, int
 
 SoundHandle OpenALSoundRenderer::LoadSound(uint8_t *sfxdata, int length)
 {
-#ifdef __MOBILE__ // 3D sounds are very loud without making the sound mono. This needs to be fixed because it is making all sounds mono for now..
-	bool monoize = true;
-#endif
-
 	SoundHandle retval = { NULL };
-	ALenum format = AL_NONE;
-	ChannelConfig chans;
-	SampleType type;
-	int srate;
-	uint32_t loop_start = 0, loop_end = ~0u;
-	bool startass = false, endass = false;
-
-	FindLoopTags(sfxdata, length, &loop_start, &startass, &loop_end, &endass);
-	auto decoder = CreateDecoder(sfxdata, length, true);
-	if (!decoder)
-		return retval;
-
-	SoundDecoder_GetInfo(decoder, &srate, &chans, &type);
-	int samplesize = 1;
-#ifdef __MOBILE__
-	if (chans == ChannelConfig_Mono || monoize)
-#else
-	if (chans == ChannelConfig_Mono)
-#endif
-	{
-		if (type == SampleType_UInt8) format = AL_FORMAT_MONO8, samplesize = 1;
-		if (type == SampleType_Int16) format = AL_FORMAT_MONO16, samplesize = 2;
-	}
-	else if (chans == ChannelConfig_Stereo)
-	{
-		if (type == SampleType_UInt8) format = AL_FORMAT_STEREO8, samplesize = 2;
-		if (type == SampleType_Int16) format = AL_FORMAT_STEREO16, samplesize = 4;
-	}
-
-	if (format == AL_NONE)
-	{
-		SoundDecoder_Close(decoder);
-		Printf("Unsupported audio format: %s, %s\n", GetChannelConfigName(chans),
-			GetSampleTypeName(type));
-		return retval;
-	}
-
-	std::vector<uint8_t> data;
-	unsigned total = 0;
-	unsigned got;
-
-	data.resize(total + 32768);
-	while ((got = (unsigned)SoundDecoder_Read(decoder, (char*)&data[total], data.size() - total)) > 0)
-	{
-		total += got;
-		data.resize(total * 2);
-	}
-	data.resize(total);
-	if (total == 0)
-	{
-		return retval;
-	}
-	SoundDecoder_Close(decoder);
+	FDecodedSound decoded;
 
-#ifdef __MOBILE__
-	if(chans != ChannelConfig_Mono && monoize)
+	if (!S_DecodeSound(sfxdata, length, decoded))
 	{
-		size_t chancount = GetChannelCount(chans);
-		size_t frames = data.size() / chancount /
-						(type == SampleType_Int16 ? 2 : 1);
-		if(type == SampleType_Int16)
-		{
-			short *sfxdata = (short*)&data[0];
-			for(size_t i = 0;i < frames;i++)
-			{
-				int sum = 0;
-				for(size_t c = 0;c < chancount;c++)
-					sum += sfxdata[i*chancount + c];
-				sfxdata[i] = short(sum / chancount);
-			}
-		}
-		else if(type == SampleType_UInt8)
-		{
-			uint8_t *sfxdata = (uint8_t*)&data[0];
-			for(size_t i = 0;i < frames;i++)
-			{
-				int sum = 0;
-				for(size_t c = 0;c < chancount;c++)
-					sum += sfxdata[i*chancount + c] - 128;
-				sfxdata[i] = uint8_t((sum / chancount) + 128);
-			}
-		}
-		data.resize((data.size()/chancount));
-	}
-#endif
-
-	ALenum err;
-	ALuint buffer = 0;
-	alGenBuffers(1, &buffer);
-	alBufferData(buffer, format, &data[0], (ALsizei)data.size(), srate);
-	if((err=getALError()) != AL_NO_ERROR)
-	{
-		Printf("Failed to buffer data: %s\n", alGetString(err));
-		alDeleteBuffers(1, &buffer);
-		getALError();
+		if (decoded.Error.IsNotEmpty()) Printf("%s\n", decoded.Error.GetChars());
 		return retval;
 	}
-
-	if (!startass) loop_start = Scale(loop_start, srate, 1000);
-	if (!endass && loop_end != ~0u) loop_end = Scale(loop_end, srate, 1000);
-	const uint32_t samples = (uint32_t)data.size() / samplesize;
-	if (loop_start > samples) loop_start = 0;
-	if (loop_end > samples) loop_end = samples;
-
-	if ((loop_start > 0 || loop_end > 0) && loop_end > loop_start && AL.SOFT_loop_points)
-	{
-		ALint loops[2] = { static_cast<ALint>(loop_start), static_cast<ALint>(loop_end) };
-		DPrintf(DMSG_NOTIFY, "Setting loop points %d -> %d\n", loops[0], loops[1]);
-		alBufferiv(buffer, AL_LOOP_POINTS_SOFT, loops);
-		// no console messages here, please!
-	}
-
-	retval.data = MAKE_PTRID(buffer);
-	return retval;
+	return LoadSoundRaw(&decoded.Data[0], (int)decoded.Data.size(), decoded.Frequency, decoded.Channels, decoded.Bits, decoded.LoopStart, decoded.LoopEnd);
 }
 
 void OpenALSoundRenderer::UnloadSound(SoundHandle sfx)
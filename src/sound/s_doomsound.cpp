@@ -71,6 +71,14 @@
 
 FBoolCVar noisedebug("noise", false, 0);	// [RH] Print sound debugging info?
 
+// Number of threads decoding sounds while precaching. 0 decodes on the main thread.
+CUSTOM_CVAR(Int, snd_decodethreads, 2, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
+{
+	if (self < 0) self = 0;
+	else if (self > 8) self = 8;
+	else if (soundEngine) soundEngine->SetDecodeThreads(self);
+}
+
 
 static FString LastLocalSndInfo;
 static FString LastLocalSndSeq;
@@ -121,6 +129,7 @@ void S_Init()
 	if (!soundEngine)
 	{
 		soundEngine = new DoomSoundEngine;
+		soundEngine->SetDecodeThreads(snd_decodethreads);
 	}
 
 	I_InitSound();
@@ -39,6 +39,12 @@
 #include <io.h>
 #endif
 #include <fcntl.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <algorithm>
 
 #include "templates.h"
 #include "s_soundinternal.h"
@@ -55,6 +61,116 @@ enum
 static FRandom pr_soundpitch ("SoundPitch");
 SoundEngine* soundEngine;
 
+//==========================================================================
+//
+// Background sound decoding
+//
+// While precaching, the lumps are read on the main thread and decoded
+// to PCM by a small pool of worker threads. The results are handed to
+// the sound renderer on the main thread, so the backend never sees
+// more than one thread.
+//
+//==========================================================================
+
+struct FDecodeJob
+{
+	unsigned SfxIndex;
+	int LumpNum;
+	int Generation;
+	bool bLoadRAW;
+	int RawRate;
+	int LoopStart;
+	TArray<uint8_t> LumpData;
+	FDecodedSound Result;
+	bool Success = false;
+};
+
+static struct FSoundDecodePool
+{
+	std::mutex Lock;
+	std::condition_variable Wake;
+	std::condition_variable Done;
+	std::vector<std::thread> Threads;
+	std::deque<FDecodeJob *> Queue;
+	TArray<FDecodeJob *> Finished;
+	int Generation = 0;
+	int Pending = 0;		// jobs queued or decoding, but not finished yet
+	std::atomic<int> Outstanding = { 0 };	// jobs not collected by the main thread yet
+	bool Quit = false;
+
+	void Worker();
+	void Start(int count);
+	void Stop();
+	void Cancel();
+
+	~FSoundDecodePool()
+	{
+		// SoundEngine::Shutdown stops the threads. Don't wait for any
+		// that are left this late, during static destruction.
+		for (auto &thread : Threads) thread.detach();
+	}
+} DecodePool;
+
+static bool DecodeSoundLump(TArray<uint8_t> &sfxdata, bool raw, int rawrate, int loopstart, FDecodedSound &out);
+
+void FSoundDecodePool::Worker()
+{
+	std::unique_lock<std::mutex> lock(Lock);
+	while (true)
+	{
+		Wake.wait(lock, [this] { return Quit || !Queue.empty(); });
+		if (Quit) break;
+
+		FDecodeJob *job = Queue.front();
+		Queue.pop_front();
+		lock.unlock();
+		job->Success = DecodeSoundLump(job->LumpData, job->bLoadRAW, job->RawRate, job->LoopStart, job->Result);
+		job->LumpData.Reset();
+		lock.lock();
+		Finished.Push(job);
+		Pending--;
+		Done.notify_all();
+	}
+}
+
+void FSoundDecodePool::Start(int count)
+{
+	if ((int)Threads.size() == count) return;
+	Stop();
+	Quit = false;
+	if (count > 0) S_InitDecoders();
+	for (int i = 0; i < count; i++)
+	{
+		Threads.emplace_back([this] { Worker(); });
+	}
+}
+
+void FSoundDecodePool::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(Lock);
+		Quit = true;
+	}
+	Wake.notify_all();
+	for (auto &thread : Threads) thread.join();
+	Threads.clear();
+}
+
+// Discards all jobs. Jobs that are being decoded right now get
+// thrown away when they are collected.
+void FSoundDecodePool::Cancel()
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	Generation++;
+	for (auto job : Queue) delete job;
+	Pending -= (int)Queue.size();
+	Outstanding -= (int)Queue.size();
+	Queue.clear();
+	for (auto job : Finished) delete job;
+	Outstanding -= (int)Finished.Size();
+	Finished.Clear();
+}
+
 //==========================================================================
 //
 // S_Init
@@ -82,6 +198,7 @@ void SoundEngine::Clear()
 {
 	StopAllChannels();
 	UnloadAllSounds();
+	LumpToSfx.Clear();
 	GetSounds().Clear();
 	ClearRandoms();
 }
@@ -97,6 +214,10 @@ void SoundEngine::Shutdown ()
 	FSoundChan *chan, *next;
 
 	StopAllChannels();
+	CancelDecoding();
+	DecodePool.Stop();
+	// Throw away whatever was being decoded while the threads stopped.
+	DecodePool.Cancel();
 
 	for (chan = FreeChannels; chan != NULL; chan = next)
 	{
@@ -134,6 +255,7 @@ void SoundEngine::CacheMarkedSounds()
 		MarkUsed(chan->SoundID);
 	}
 
+	DecodeInBackground = DecodeThreads > 0;
 	for (unsigned i = 1; i < S_sfx.Size(); ++i)
 	{
 		if (S_sfx[i].bUsed)
@@ -141,6 +263,7 @@ void SoundEngine::CacheMarkedSounds()
 			CacheSound(&S_sfx[i]);
 		}
 	}
+	DecodeInBackground = false;
 	for (unsigned i = 1; i < S_sfx.Size(); ++i)
 	{
 		if (!S_sfx[i].bUsed && S_sfx[i].link == sfxinfo_t::NO_LINK)
@@ -191,6 +314,25 @@ void SoundEngine::UnloadSound (sfxinfo_t *sfx)
 		DPrintf(DMSG_NOTIFY, "Unloaded sound \"%s\" (%td)\n", sfx->name.GetChars(), sfx - &S_sfx[0]);
 	}
 	sfx->data.Clear();
+	sfx->bDecoding = false;
+	RemoveLumpOwner(sfx);
+}
+
+//==========================================================================
+//
+// SoundEngine :: RemoveLumpOwner
+//
+// Other sounds may no longer be linked to this one.
+//
+//==========================================================================
+
+void SoundEngine::RemoveLumpOwner(sfxinfo_t *sfx)
+{
+	auto owner = LumpToSfx.CheckKey(sfx->lumpnum);
+	if (owner != nullptr && *owner == unsigned(sfx - &S_sfx[0]))
+	{
+		LumpToSfx.Remove(sfx->lumpnum);
+	}
 }
 
 //==========================================================================
@@ -483,7 +625,9 @@ FSoundChan *SoundEngine::StartSound(int type, const void *source,
 		return NULL;
 	}
 
-	// Make sure the sound is loaded.
+	// Make sure the sound is loaded. A sound that is still being decoded
+	// gets an evicted channel that RestoreEvictedChannels starts once the
+	// sound is ready, so the game never waits for the decoder.
 	sfx = LoadSound(sfx);
 
 	// The empty sound never plays.
@@ -492,6 +636,11 @@ FSoundChan *SoundEngine::StartSound(int type, const void *source,
 		return NULL;
 	}
 
+	if (sfx->bDecoding)
+	{
+		chanflags |= CHANF_EVICTED | CHANF_DECODING;
+	}
+
 	// Select priority.
 	if (type == SOURCE_None || source == listener.ListenerObject)
 	{
@@ -572,7 +721,7 @@ FSoundChan *SoundEngine::StartSound(int type, const void *source,
 			chan = (FSoundChan*)GSnd->StartSound (sfx->data, float(volume), pitch, startflags, NULL, startTime);
 		}
 	}
-	if (chan == NULL && (chanflags & CHANF_LOOP))
+	if (chan == NULL && (chanflags & (CHANF_LOOP | CHANF_DECODING)))
 	{
 		chan = (FSoundChan*)GetChannel(NULL);
 		GSnd->MarkStartTime(chan);
@@ -647,13 +796,18 @@ void SoundEngine::RestartChannel(FSoundChan *chan)
 	assert(chan->ChanFlags & CHANF_EVICTED);
 
 	FSoundChan *ochan;
-	sfxinfo_t *sfx = &S_sfx[chan->SoundID];
+	sfxinfo_t *sfx = LoadSound(&S_sfx[chan->SoundID]);
 
-	// If this is a singular sound, don't play it if it's already playing.
-	if (sfx->bSingular && CheckSingular(chan->SoundID))
+	// A sound that is still being decoded cannot play yet.
+	if (sfx->bDecoding)
+	{
 		return;
+	}
+	chan->ChanFlags &= ~CHANF_DECODING;
 
-	sfx = LoadSound(sfx);
+	// If this is a singular sound, don't play it if it's already playing.
+	if (S_sfx[chan->SoundID].bSingular && CheckSingular(chan->SoundID))
+		return;
 
 	// The empty sound never plays.
 	if (sfx->lumpnum == sfx_empty)
@@ -703,21 +857,103 @@ void SoundEngine::RestartChannel(FSoundChan *chan)
 	}
 }
 
+//==========================================================================
+//
+// DecodeSoundLump
+//
+// Converts a sound lump to PCM data. This is thread safe.
+//
+//==========================================================================
+
+static bool DecodeSoundLump(TArray<uint8_t> &sfxdata, bool raw, int rawrate, int loopstart, FDecodedSound &out)
+{
+	int size = sfxdata.Size();
+	if (size <= 8)
+	{
+		return false;
+	}
+
+	int32_t dmxlen = LittleLong(((int32_t *)sfxdata.Data())[1]);
+
+	// If the sound is voc, use the custom loader.
+	if (strncmp ((const char *)sfxdata.Data(), "Creative Voice File", 19) == 0)
+	{
+		return S_DecodeSoundVoc(sfxdata.Data(), size, out);
+	}
+	// If the sound is raw, just load it as such.
+	else if (raw)
+	{
+		out.Data.assign(sfxdata.Data(), sfxdata.Data() + size);
+		out.Frequency = rawrate;
+		out.LoopStart = loopstart;
+	}
+	// Otherwise, try the sound as DMX format.
+	else if (((uint8_t *)sfxdata.Data())[0] == 3 && ((uint8_t *)sfxdata.Data())[1] == 0 && dmxlen <= size - 8)
+	{
+		int frequency = LittleShort(((uint16_t *)sfxdata.Data())[1]);
+		if (frequency == 0) frequency = 11025;
+		out.Data.assign(sfxdata.Data() + 8, sfxdata.Data() + 8 + dmxlen);
+		out.Frequency = frequency;
+		out.LoopStart = loopstart;
+	}
+	// If that fails, let the decoders try and figure it out.
+	else
+	{
+		return S_DecodeSound(sfxdata.Data(), size, out);
+	}
+	out.Channels = 1;
+	out.Bits = 8;
+	return true;
+}
+
+//==========================================================================
+//
+// UploadSound
+//
+//==========================================================================
+
+static SoundHandle UploadSound(FDecodedSound &decoded, bool success)
+{
+	SoundHandle handle = {};
+	if (success && decoded.Data.size() > 0)
+	{
+		handle = GSnd->LoadSoundRaw(&decoded.Data[0], (int)decoded.Data.size(), decoded.Frequency, decoded.Channels, decoded.Bits, decoded.LoopStart, decoded.LoopEnd);
+	}
+	else if (decoded.Error.IsNotEmpty())
+	{
+		Printf("%s\n", decoded.Error.GetChars());
+	}
+	return handle;
+}
+
 //==========================================================================
 //
 // S_LoadSound
 //
 // Returns a pointer to the sfxinfo with the actual sound data.
+// If the sound is still being decoded, the returned sfxinfo has bDecoding
+// set unless wait is true. Playing sounds never wait, only queries that
+// need the decoded data, like S_GetMSLength, do.
 //
 //==========================================================================
 
-sfxinfo_t *SoundEngine::LoadSound(sfxinfo_t *sfx)
+sfxinfo_t *SoundEngine::LoadSound(sfxinfo_t *sfx, bool wait)
 {
 	if (GSnd->IsNull()) return sfx;
 
+	if (DecodePool.Outstanding > 0)
+	{
+		FinishDecodedSounds(false);
+	}
+
 	while (!sfx->data.isValid())
 	{
-		unsigned int i;
+		if (sfx->bDecoding)
+		{
+			if (!wait) return sfx;
+			WaitForDecode(sfx);
+			continue;
+		}
 
 		if (sfx->lumpnum == sfx_empty)
 		{
@@ -726,51 +962,44 @@ sfxinfo_t *SoundEngine::LoadSound(sfxinfo_t *sfx)
 		
 		// See if there is another sound already initialized with this lump. If so,
 		// then set this one up as a link, and don't load the sound again.
-		for (i = 0; i < S_sfx.Size(); i++)
+		auto owner = LumpToSfx.CheckKey(sfx->lumpnum);
+		if (owner != nullptr)
 		{
-			if (S_sfx[i].data.isValid() && S_sfx[i].link == sfxinfo_t::NO_LINK && S_sfx[i].lumpnum == sfx->lumpnum &&
-				(!sfx->bLoadRAW || (sfx->RawRate == S_sfx[i].RawRate)))	// Raw sounds with different sample rates may not share buffers, even if they use the same source data.
+			unsigned i = *owner;
+			if (i < S_sfx.Size() && &S_sfx[i] != sfx && S_sfx[i].lumpnum == sfx->lumpnum && S_sfx[i].link == sfxinfo_t::NO_LINK &&
+				(S_sfx[i].data.isValid() || S_sfx[i].bDecoding))
+			{
+				// Raw sounds with different sample rates may not share buffers, even if they use the same source data.
+				if (!sfx->bLoadRAW || (sfx->RawRate == S_sfx[i].RawRate))
+				{
+					DPrintf (DMSG_NOTIFY, "Linked %s to %s (%d)\n", sfx->name.GetChars(), S_sfx[i].name.GetChars(), i);
+					sfx->link = i;
+					// This is necessary to avoid using the rolloff settings of the linked sound if its
+					// settings are different.
+					if (sfx->Rolloff.MinDistance == 0) sfx->Rolloff = S_Rolloff;
+					if (S_sfx[i].bDecoding && wait) WaitForDecode(&S_sfx[i]);
+					return &S_sfx[i];
+				}
+			}
+			else
 			{
-				DPrintf (DMSG_NOTIFY, "Linked %s to %s (%d)\n", sfx->name.GetChars(), S_sfx[i].name.GetChars(), i);
-				sfx->link = i;
-				// This is necessary to avoid using the rolloff settings of the linked sound if its
-				// settings are different.
-				if (sfx->Rolloff.MinDistance == 0) sfx->Rolloff = S_Rolloff;
-				return &S_sfx[i];
+				// The sound this pointed to is gone.
+				LumpToSfx.Remove(sfx->lumpnum);
 			}
 		}
 
+		if (DecodeInBackground)
+		{
+			QueueDecode(sfx);
+			return sfx;
+		}
+
 		DPrintf(DMSG_NOTIFY, "Loading sound \"%s\" (%td)\n", sfx->name.GetChars(), sfx - &S_sfx[0]);
 
 		auto sfxdata = ReadSound(sfx->lumpnum);
-		int size = sfxdata.Size();
-		if (size > 8)
-		{
-			int32_t dmxlen = LittleLong(((int32_t *)sfxdata.Data())[1]);
-
-			// If the sound is voc, use the custom loader.
-			if (strncmp ((const char *)sfxdata.Data(), "Creative Voice File", 19) == 0)
-			{
-				sfx->data = GSnd->LoadSoundVoc(sfxdata.Data(), size);
-			}
-			// If the sound is raw, just load it as such.
-			else if (sfx->bLoadRAW)
-			{
-				sfx->data = GSnd->LoadSoundRaw(sfxdata.Data(), size, sfx->RawRate, 1, 8, sfx->LoopStart);
-			}
-			// Otherwise, try the sound as DMX format.
-			else if (((uint8_t *)sfxdata.Data())[0] == 3 && ((uint8_t *)sfxdata.Data())[1] == 0 && dmxlen <= size - 8)
-			{
-				int frequency = LittleShort(((uint16_t *)sfxdata.Data())[1]);
-				if (frequency == 0) frequency = 11025;
-				sfx->data = GSnd->LoadSoundRaw(sfxdata.Data()+8, dmxlen, frequency, 1, 8, sfx->LoopStart);
-			}
-			// If that fails, let the sound system try and figure it out.
-			else
-			{
-				sfx->data = GSnd->LoadSound(sfxdata.Data(), size);
-			}
-		}
+		FDecodedSound decoded;
+		bool success = DecodeSoundLump(sfxdata, sfx->bLoadRAW, sfx->RawRate, sfx->LoopStart, decoded);
+		sfx->data = UploadSound(decoded, success);
 
 		if (!sfx->data.isValid())
 		{
@@ -780,11 +1009,175 @@ sfxinfo_t *SoundEngine::LoadSound(sfxinfo_t *sfx)
 				continue;
 			}
 		}
+		else if (LumpToSfx.CheckKey(sfx->lumpnum) == nullptr)
+		{
+			LumpToSfx[sfx->lumpnum] = unsigned(sfx - &S_sfx[0]);
+		}
 		break;
 	}
 	return sfx;
 }
 
+//==========================================================================
+//
+// SoundEngine :: QueueDecode
+//
+// Reads the sound's lump and hands it to the decoding threads.
+//
+//==========================================================================
+
+void SoundEngine::QueueDecode(sfxinfo_t *sfx)
+{
+	DPrintf(DMSG_NOTIFY, "Queuing sound \"%s\" (%td)\n", sfx->name.GetChars(), sfx - &S_sfx[0]);
+
+	auto job = new FDecodeJob;
+	job->SfxIndex = unsigned(sfx - &S_sfx[0]);
+	job->LumpNum = sfx->lumpnum;
+	job->bLoadRAW = sfx->bLoadRAW;
+	job->RawRate = sfx->RawRate;
+	job->LoopStart = sfx->LoopStart;
+	job->LumpData = ReadSound(sfx->lumpnum);
+
+	sfx->bDecoding = true;
+	if (LumpToSfx.CheckKey(sfx->lumpnum) == nullptr)
+	{
+		LumpToSfx[sfx->lumpnum] = job->SfxIndex;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(DecodePool.Lock);
+		job->Generation = DecodePool.Generation;
+		DecodePool.Queue.push_back(job);
+		DecodePool.Pending++;
+		DecodePool.Outstanding++;
+	}
+	DecodePool.Wake.notify_one();
+}
+
+//==========================================================================
+//
+// SoundEngine :: FinishDecodedSounds
+//
+// Passes all decoded sounds to the sound renderer. If wait is true,
+// this blocks until all queued sounds are done.
+//
+//==========================================================================
+
+void SoundEngine::FinishDecodedSounds(bool wait)
+{
+	TArray<FDecodeJob *> finished;
+	int generation;
+	{
+		std::unique_lock<std::mutex> lock(DecodePool.Lock);
+		if (wait)
+		{
+			DecodePool.Done.wait(lock, [] { return DecodePool.Pending <= 0; });
+		}
+		finished = std::move(DecodePool.Finished);
+		DecodePool.Finished.Clear();
+		DecodePool.Outstanding -= (int)finished.Size();
+		generation = DecodePool.Generation;
+	}
+
+	for (auto job : finished)
+	{
+		if (job->Generation == generation && job->SfxIndex < S_sfx.Size())
+		{
+			sfxinfo_t *sfx = &S_sfx[job->SfxIndex];
+			if (sfx->bDecoding && sfx->lumpnum == job->LumpNum)
+			{
+				sfx->bDecoding = false;
+				sfx->data = UploadSound(job->Result, job->Success);
+				if (!sfx->data.isValid())
+				{
+					// Everything linked to this sound won't play either, just like when loading it directly.
+					RemoveLumpOwner(sfx);
+					sfx->lumpnum = sfx_empty;
+				}
+			}
+		}
+		delete job;
+	}
+}
+
+//==========================================================================
+//
+// SoundEngine :: WaitForDecode
+//
+// Waits for a single sound. If no thread has picked it up yet, it gets
+// decoded right here instead of waiting behind the rest of the queue.
+//
+//==========================================================================
+
+void SoundEngine::WaitForDecode(sfxinfo_t *sfx)
+{
+	unsigned index = unsigned(sfx - &S_sfx[0]);
+	FDecodeJob *job = nullptr;
+	{
+		std::unique_lock<std::mutex> lock(DecodePool.Lock);
+		auto matches = [&](FDecodeJob *j) { return j->SfxIndex == index && j->Generation == DecodePool.Generation; };
+		auto it = std::find_if(DecodePool.Queue.begin(), DecodePool.Queue.end(), matches);
+		if (it != DecodePool.Queue.end())
+		{
+			job = *it;
+			DecodePool.Queue.erase(it);
+		}
+		else
+		{
+			DecodePool.Done.wait(lock, [&] { return std::find_if(DecodePool.Finished.begin(), DecodePool.Finished.end(), matches) != DecodePool.Finished.end(); });
+		}
+	}
+
+	if (job != nullptr)
+	{
+		job->Success = DecodeSoundLump(job->LumpData, job->bLoadRAW, job->RawRate, job->LoopStart, job->Result);
+		job->LumpData.Reset();
+		std::lock_guard<std::mutex> lock(DecodePool.Lock);
+		DecodePool.Finished.Push(job);
+		DecodePool.Pending--;
+		DecodePool.Done.notify_all();
+	}
+	FinishDecodedSounds(false);
+}
+
+//==========================================================================
+//
+// SoundEngine :: CancelDecoding
+//
+//==========================================================================
+
+void SoundEngine::CancelDecoding()
+{
+	DecodePool.Cancel();
+	for (auto &sfx : S_sfx)
+	{
+		if (sfx.bDecoding)
+		{
+			sfx.bDecoding = false;
+			RemoveLumpOwner(&sfx);
+		}
+	}
+}
+
+//==========================================================================
+//
+// SoundEngine :: SetDecodeThreads
+//
+// 0 decodes all sounds on the main thread.
+//
+//==========================================================================
+
+void SoundEngine::SetDecodeThreads(int count)
+{
+	DecodeThreads = clamp(count, 0, 8);
+	if (DecodeThreads == 0)
+	{
+		// Let the workers finish what they have before they go away.
+		FinishDecodedSounds(true);
+	}
+	DecodePool.Start(DecodeThreads);
+}
+
 //==========================================================================
 //
 // S_CheckSingular
@@ -1218,8 +1611,8 @@ void SoundEngine::RestoreEvictedChannel(FSoundChan *chan)
 		RestartChannel(chan);
 		if (!(chan->ChanFlags & CHANF_LOOP))
 		{
-			if (chan->ChanFlags & CHANF_EVICTED)
-			{ // Still evicted and not looping? Forget about it.
+			if ((chan->ChanFlags & (CHANF_EVICTED | CHANF_DECODING)) == CHANF_EVICTED)
+			{ // Still evicted and not looping or waiting for its sound? Forget about it.
 				ReturnChannel(chan);
 			}
 			else if (!(chan->ChanFlags & CHANF_JUSTSTARTED))
@@ -1260,6 +1653,11 @@ void SoundEngine::UpdateSounds(int time)
 {
 	FVector3 pos, vel;
 
+	if (DecodePool.Outstanding > 0)
+	{
+		FinishDecodedSounds(false);
+	}
+
 	for (FSoundChan* chan = Channels; chan != NULL; chan = chan->NextChan)
 	{
 		if ((chan->ChanFlags & (CHANF_EVICTED | CHANF_IS3D)) == CHANF_IS3D)
@@ -1438,6 +1836,7 @@ void SoundEngine::StopChannel(FSoundChan *chan)
 
 void SoundEngine::UnloadAllSounds()
 {
+	CancelDecoding();
 	for (unsigned i = 0; i < S_sfx.Size(); i++)
 	{
 		UnloadSound(&S_sfx[i]);
@@ -1638,7 +2037,7 @@ unsigned int SoundEngine::GetMSLength(FSoundID sound)
 		}
 	}
 
-	sfx = LoadSound(sfx);
+	sfx = LoadSound(sfx, true);
 	if (sfx != NULL) return GSnd->GetMSLength(sfx->data);
 	else return 0;
 }
@@ -43,6 +43,7 @@ struct sfxinfo_t
 	bool		bUsed = false;
 	bool		bSingular = false;
 	bool		bTentative = true;
+	bool		bDecoding = false;					// queued for decoding on a worker thread
 
 	TArray<int> UserData;
 
@@ -215,7 +216,10 @@ protected:
 	TArray<uint8_t> S_SoundCurve;
 	TMap<int, int> ResIdMap;
 	TArray<FRandomSoundList> S_rnd;
+	TMap<int, unsigned> LumpToSfx;	// lump -> loaded sound using it, so other sounds can link to it
 	bool blockNewSounds = false;
+	int DecodeThreads = 0;
+	bool DecodeInBackground = false;
 
 private:
 	void LinkChannel(FSoundChan* chan, FSoundChan** head);
@@ -235,6 +239,12 @@ private:
 	// Checks if a copy of this sound is already playing.
 	bool CheckSingular(int sound_id);
 	virtual TArray<uint8_t> ReadSound(int lumpnum) = 0;
+
+	void QueueDecode(sfxinfo_t* sfx);
+	void FinishDecodedSounds(bool wait);
+	void WaitForDecode(sfxinfo_t* sfx);
+	void CancelDecoding();
+	void RemoveLumpOwner(sfxinfo_t* sfx);
 protected:
 	virtual bool CheckSoundLimit(sfxinfo_t* sfx, const FVector3& pos, int near_limit, float limit_range, int sourcetype, const void* actor, int channel, float attenuation);
 	virtual FSoundID ResolveSound(const void *ent, int srctype, FSoundID soundid, float &attenuation);
@@ -255,7 +265,8 @@ public:
 	virtual void SetSource(FSoundChan* chan, int index) {}
 
 	virtual void StopChannel(FSoundChan* chan);
-	sfxinfo_t* LoadSound(sfxinfo_t* sfx);
+	sfxinfo_t* LoadSound(sfxinfo_t* sfx, bool wait = false);
+	void SetDecodeThreads(int count);
 
 	// Initializes sound stuff, including volume
 	// Sets channels, SFX and music volume,
@@ -43,6 +43,7 @@
 #include "sbar.h"
 
 FStat *FStat::FirstStat;
+FCycleStat *FCycleStat::FirstCycleStat;
 
 FStat::FStat (const char *name)
 {
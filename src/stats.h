@@ -91,7 +91,17 @@ public:
 		return m_Active;
 	}
 
+	const char *GetName() const
+	{
+		return m_Name;
+	}
+	FStat *GetNext() const
+	{
+		return m_Next;
+	}
+
 	static void PrintStat ();
+	static FStat *GetFirst() { return FirstStat; }
 	static FStat *FindStat (const char *name);
 	static void ToggleStat (const char *name);
 	static void DumpRegisteredStats ();
@@ -104,6 +114,43 @@ private:
 	static FStat *FirstStat;
 };
 
+// A cycle counter under a name, so that its time can be read as a number
+// instead of through a stat's text. Used by the headless benchmark.
+class FCycleStat
+{
+public:
+	FCycleStat (const char *name, cycle_t &cycles)
+		: m_Cycles(cycles), m_Name(name), m_Next(FirstCycleStat)
+	{
+		FirstCycleStat = this;
+	}
+
+	const char *GetName() const
+	{
+		return m_Name;
+	}
+	double TimeMS() const
+	{
+		return m_Cycles.TimeMS();
+	}
+	FCycleStat *GetNext() const
+	{
+		return m_Next;
+	}
+
+	static FCycleStat *GetFirst() { return FirstCycleStat; }
+
+private:
+	cycle_t &m_Cycles;
+	const char *m_Name;
+	FCycleStat *m_Next;
+
+	static FCycleStat *FirstCycleStat;
+};
+
+#define ADD_CYCLE_STAT(n, cycles) \
+	static FCycleStat Icyclestat##n (#n, cycles);
+
 #define ADD_STAT(n) \
 	static class Stat_##n : public FStat { \
 		public: \
@@ -36,6 +36,9 @@
 #ifndef NO_SSE
 #include <xmmintrin.h>
 #endif
+#if !defined(NO_SSE) && (defined(__amd64__) || defined(__i386__) || defined(_M_IX86) || defined(_M_X64))
+#define PAL_DRAWERS_AVX2
+#endif
 #include "templates.h"
 #include "doomtype.h"
 #include "doomdef.h"
@@ -45,9 +48,16 @@
 #include "r_draw_pal.h"
 #include "swrenderer/viewport/r_viewport.h"
 #include "swrenderer/scene/r_light.h"
+#include "c_dispatch.h"
+#include "i_time.h"
+#include "x86.h"
+#ifdef PAL_DRAWERS_AVX2
+#include "r_draw_pal_avx2.h"
+#endif
 
 // [SP] r_blendmethod - false = rgb555 matching (ZDoom classic), true = rgb666 (refactored)
 CVAR(Bool, r_blendmethod, false, CVAR_GLOBALCONFIG | CVAR_ARCHIVE)
+CVAR(Bool, r_drawer_simd, true, CVAR_GLOBALCONFIG | CVAR_ARCHIVE)
 EXTERN_CVAR(Int, gl_particles_style)
 
 /*
@@ -93,6 +103,69 @@ EXTERN_CVAR(Int, gl_particles_style)
 
 namespace swrenderer
 {
+	//==========================================================================
+	//
+	// The plain colormapped column and span loops shared by several drawers.
+	// On CPUs with AVX2 these are replaced by vectorized versions producing
+	// identical output.
+	//
+	//==========================================================================
+
+	static void DrawColumnScalar(uint8_t *dest, int pitch, int count, uint32_t frac, uint32_t fracstep, int bits, const uint8_t *source, uint32_t height, const uint8_t *colormap)
+	{
+		do
+		{
+			*dest = colormap[source[frac >> bits]];
+			frac += fracstep;
+			dest += pitch;
+		} while (--count);
+	}
+
+	static void DrawSpan64Scalar(uint8_t *dest, int count, uint32_t xfrac, uint32_t yfrac, uint32_t xstep, uint32_t ystep, const uint8_t *source, const uint8_t *colormap)
+	{
+		do
+		{
+			// Current texture index in u,v.
+			int spot = ((xfrac >> (32 - 6 - 6))&(63 * 64)) + (yfrac >> (32 - 6));
+
+			// Lookup pixel from flat texture tile,
+			//  re-index using light/colormap.
+			*dest++ = colormap[source[spot]];
+
+			// Next step in u,v.
+			xfrac += xstep;
+			yfrac += ystep;
+		} while (--count);
+	}
+
+	typedef void (*PalColumnFunc)(uint8_t *dest, int pitch, int count, uint32_t frac, uint32_t fracstep, int bits, const uint8_t *source, uint32_t height, const uint8_t *colormap);
+	typedef void (*PalSpan64Func)(uint8_t *dest, int count, uint32_t xfrac, uint32_t yfrac, uint32_t xstep, uint32_t ystep, const uint8_t *source, const uint8_t *colormap);
+
+	static bool UseSIMDDrawers()
+	{
+#ifdef PAL_DRAWERS_AVX2
+		return r_drawer_simd && CPU.bAVX2;
+#else
+		return false;
+#endif
+	}
+
+	static PalColumnFunc GetColumnFunc(bool simd)
+	{
+#ifdef PAL_DRAWERS_AVX2
+		if (simd) return PalAVX2::DrawColumn;
+#endif
+		return DrawColumnScalar;
+	}
+
+	static PalSpan64Func GetSpan64Func(bool simd)
+	{
+#ifdef PAL_DRAWERS_AVX2
+		if (simd) return PalAVX2::DrawSpan64;
+#endif
+		return DrawSpan64Scalar;
+	}
+
 	PalWall1Command::PalWall1Command(const WallDrawerArgs &args) : args(args)
 	{
 	}
@@ -176,12 +249,7 @@ namespace swrenderer
 
 		if (num_dynlights == 0)
 		{
-			do
-			{
-				*dest = colormap[source[frac >> bits]];
-				frac += fracstep;
-				dest += pitch;
-			} while (--count);
+			GetColumnFunc(UseSIMDDrawers())(dest, pitch, count, frac, fracstep, bits, source, args.TextureHeight(), colormap);
 		}
 		else
 		{
@@ -898,14 +966,7 @@ namespace swrenderer
 		uint32_t dynlight = args.DynamicLight();
 		if (dynlight == 0)
 		{
-			do
-			{
-				*dest = colormap[source[frac >> FRACBITS]];
-
-				dest += pitch;
-				frac += fracstep;
-
-			} while (--count);
+			GetColumnFunc(UseSIMDDrawers())(dest, pitch, count, frac, fracstep, FRACBITS, source, args.TextureHeight(), colormap);
 		}
 		else
 		{
@@ -2123,19 +2184,7 @@ namespace swrenderer
 		if (_srcwidth == 64 && _srcheight == 64 && num_dynlights == 0)
 		{
 			// 64x64 is the most common case by far, so special case it.
-			do
-			{
-				// Current texture index in u,v.
-				spot = ((xfrac >> (32 - 6 - 6))&(63 * 64)) + (yfrac >> (32 - 6));
-
-				// Lookup pixel from flat texture tile,
-				//  re-index using light/colormap.
-				*dest++ = colormap[source[spot]];
-
-				// Next step in u,v.
-				xfrac += xstep;
-				yfrac += ystep;
-			} while (--count);
+			GetSpan64Func(UseSIMDDrawers())(dest, count, xfrac, yfrac, xstep, ystep, source, colormap);
 		}
 		else if (_srcwidth == 64 && _srcheight == 64)
 		{
@@ -3164,3 +3213,63 @@ namespace swrenderer
 		}
 	}
 }
+
+//==========================================================================
+//
+// Compares the scalar and SIMD paletted drawer loops on synthetic data:
+// throughput per column type and whether the output is identical.
+//
+//==========================================================================
+
+CCMD(bench_paldrawers)
+{
+	using namespace swrenderer;
+
+	if (!UseSIMDDrawers())
+	{
+		Printf("SIMD drawers are not available%s.\n", r_drawer_simd ? " on this CPU" : " (r_drawer_simd is off)");
+	}
+
+	const int width = 640, height = 400, passes = argv.argc() > 1 ? MAX(atoi(argv[1]), 1) : 50;
+	TArray<uint8_t> texture(64 * 64 * 2, true), colormap(256, true), dest[2];
+	for (unsigned i = 0; i < texture.Size(); i++) texture[i] = (uint8_t)(i * 2654435761u >> 24);
+	for (int i = 0; i < 256; i++) colormap[i] = (uint8_t)(255 - i);
+
+	static const char *names[] = { "wall column", "sprite column", "64x64 span" };
+	for (int type = 0; type < 3; type++)
+	{
+		double times[2];
+		for (int simd = 0; simd < 2; simd++)
+		{
+			PalColumnFunc column = GetColumnFunc(simd && UseSIMDDrawers());
+			PalSpan64Func span = GetSpan64Func(simd && UseSIMDDrawers());
+			dest[simd].Resize(width * height);
+			memset(dest[simd].Data(), 0, width * height);
+
+			uint64_t start = I_nsTime();
+			for (int pass = 0; pass < passes; pass++)
+			{
+				for (int i = 0; i < (type == 2 ? height : width); i++)
+				{
+					uint32_t step = 0x1000 + i * 0x135;
+					switch (type)
+					{
+					case 0: // 128 tall wall texture, wrapping
+						column(&dest[simd][i], width, height, i * 0x3456789u, step << 9, 32 - 7, texture.Data() + (i & 63) * 128, 128, colormap.Data());
+						break;
+					case 1: // 128 tall sprite column, scaled to stay within the column
+						column(&dest[simd][i], width, height, 0, (128 << FRACBITS) / height, FRACBITS, texture.Data() + (i & 63) * 128, 128, colormap.Data());
+						break;
+					default:
+						span(&dest[simd][i * width], width, i * 0x1234567u, i * 0x7654321u, step << 12, step << 11, texture.Data(), colormap.Data());
+						break;
+					}
+				}
+			}
+			times[simd] = (I_nsTime() - start) / 1e9;
+		}
+		double mpixels = double(width) * height * passes / 1e6;
+		Printf("%-14s scalar %7.1f Mpix/s, simd %7.1f Mpix/s (%.2fx), output %s\n", names[type], mpixels / times[0], mpixels / times[1],
+			times[0] / times[1], memcmp(dest[0].Data(), dest[1].Data(), width * height) ? TEXTCOLOR_RED "DIFFERENT" : "identical");
+	}
+}
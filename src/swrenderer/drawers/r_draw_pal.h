@@ -15,6 +15,7 @@ namespace swrenderer
 	{
 	public:
 		PalWall1Command(const WallDrawerArgs &args);
+		bool GetRows(int &first_line, int &count) const override { first_line = args.DestY(); count = args.Count(); return true; }
 
 	protected:
 		inline static uint8_t AddLights(const DrawerLight *lights, int num_lights, float viewpos_z, uint8_t fg, uint8_t material);
@@ -33,6 +34,7 @@ namespace swrenderer
 	{
 	public:
 		PalSkyCommand(const SkyDrawerArgs &args);
+		bool GetRows(int &first_line, int &count) const override { first_line = args.DestY(); count = args.Count(); return true; }
 
 	protected:
 		SkyDrawerArgs args;
@@ -45,6 +47,7 @@ namespace swrenderer
 	{
 	public:
 		PalColumnCommand(const SpriteDrawerArgs &args);
+		bool GetRows(int &first_line, int &count) const override { first_line = args.DestY(); count = args.Count(); return true; }
 
 		SpriteDrawerArgs args;
 
@@ -106,6 +109,7 @@ namespace swrenderer
 	{
 	public:
 		PalSpanCommand(const SpanDrawerArgs &args);
+		bool GetRows(int &first_line, int &count) const override { first_line = _y; count = 1; return true; }
 
 	protected:
 		inline static uint8_t AddLights(const DrawerLight *lights, int num_lights, float viewpos_x, uint8_t fg, uint8_t material);
@@ -146,6 +150,7 @@ namespace swrenderer
 	public:
 		DrawTiltedSpanPalCommand(const SpanDrawerArgs &args, const FVector3 &plane_sz, const FVector3 &plane_su, const FVector3 &plane_sv, bool plane_shade, int planeshade, float planelightfloat, fixed_t pviewx, fixed_t pviewy, FDynamicColormap *basecolormap);
 		void Execute(DrawerThread *thread) override;
+		bool GetRows(int &first_line, int &count) const override { first_line = y; count = 1; return true; }
 
 	private:
 		void CalcTiltedLighting(double lval, double lend, int width, DrawerThread *thread);
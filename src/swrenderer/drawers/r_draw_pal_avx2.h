@@ -0,0 +1,134 @@
+/*
+**  AVX2 kernels for the paletted column and span drawers
+**
+**  This software is provided 'as-is', without any express or implied
+**  warranty.  In no event will the authors be held liable for any damages
+**  arising from the use of this software.
+**
+**  Permission is granted to anyone to use this software for any purpose,
+**  including commercial applications, and to alter it and redistribute it
+**  freely, subject to the following restrictions:
+**
+**  1. The origin of this software must not be misrepresented; you must not
+**     claim that you wrote the original software. If you use this software
+**     in a product, an acknowledgment in the product documentation would be
+**     appreciated but is not required.
+**  2. Altered source versions must be plainly marked as such, and must not be
+**     misrepresented as being the original software.
+**  3. This notice may not be removed or altered from any source distribution.
+**
+*/
+
+#pragma once
+
+#include <immintrin.h>
+
+// The rest of the renderer is compiled for SSE2 only, so these functions
+// enable AVX2 individually and must only be called if CPU.bAVX2 is set.
+#if defined(__GNUC__) || defined(__clang__)
+#define PAL_AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define PAL_AVX2_TARGET
+#endif
+
+namespace swrenderer
+{
+	namespace PalAVX2
+	{
+		// Fetches 8 bytes at base[index]. Gathers read 4 bytes, so the read address is clamped to
+		// maxbase (size - 4) and the wanted byte is shifted down, which never reads past the buffer.
+		PAL_AVX2_TARGET inline __m256i GatherBytes(const uint8_t *base, __m256i index, __m256i maxbase)
+		{
+			__m256i clamped = _mm256_min_epu32(index, maxbase);
+			__m256i shift = _mm256_slli_epi32(_mm256_sub_epi32(index, clamped), 3);
+			__m256i data = _mm256_i32gather_epi32((const int *)base, clamped, 1);
+			return _mm256_and_si256(_mm256_srlv_epi32(data, shift), _mm256_set1_epi32(0xff));
+		}
+
+		// Packs the low bytes of all 8 lanes into 8 consecutive bytes.
+		PAL_AVX2_TARGET inline uint64_t PackBytes(__m256i color)
+		{
+			__m256i packed = _mm256_packus_epi32(color, color);
+			packed = _mm256_packus_epi16(packed, packed);
+			uint64_t lo = (uint32_t)_mm256_cvtsi256_si32(packed);
+			uint64_t hi = (uint32_t)_mm256_extract_epi32(packed, 4);
+			return lo | (hi << 32);
+		}
+
+		// dest = colormap[source[frac >> bits]], one pixel per row. The texture column must be height bytes long.
+		PAL_AVX2_TARGET inline void DrawColumn(uint8_t *dest, int pitch, int count, uint32_t frac, uint32_t fracstep, int bits, const uint8_t *source, uint32_t height, const uint8_t *colormap)
+		{
+			if (height >= 4 && count >= 8)
+			{
+				__m256i vfrac = _mm256_add_epi32(_mm256_set1_epi32(frac), _mm256_mullo_epi32(_mm256_set1_epi32(fracstep), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+				__m256i vstep = _mm256_set1_epi32(fracstep * 8);
+				__m128i vbits = _mm_cvtsi32_si128(bits);
+				__m256i maxsource = _mm256_set1_epi32(height - 4);
+				__m256i maxcolormap = _mm256_set1_epi32(256 - 4);
+
+				int blocks = count / 8;
+				for (int i = 0; i < blocks; i++)
+				{
+					__m256i texel = GatherBytes(source, _mm256_srl_epi32(vfrac, vbits), maxsource);
+					uint64_t pixels = PackBytes(GatherBytes(colormap, texel, maxcolormap));
+					for (int j = 0; j < 8; j++)
+					{
+						*dest = (uint8_t)(pixels >> (j * 8));
+						dest += pitch;
+					}
+					vfrac = _mm256_add_epi32(vfrac, vstep);
+				}
+				frac += fracstep * 8 * blocks;
+				count -= blocks * 8;
+			}
+
+			while (count > 0)
+			{
+				*dest = colormap[source[frac >> bits]];
+				frac += fracstep;
+				dest += pitch;
+				count--;
+			}
+		}
+
+		// Unlit 64x64 span: dest[x] = colormap[source[spot(xfrac, yfrac)]]
+		PAL_AVX2_TARGET inline void DrawSpan64(uint8_t *dest, int count, uint32_t xfrac, uint32_t yfrac, uint32_t xstep, uint32_t ystep, const uint8_t *source, const uint8_t *colormap)
+		{
+			if (count >= 8)
+			{
+				__m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+				__m256i vxfrac = _mm256_add_epi32(_mm256_set1_epi32(xfrac), _mm256_mullo_epi32(_mm256_set1_epi32(xstep), lanes));
+				__m256i vyfrac = _mm256_add_epi32(_mm256_set1_epi32(yfrac), _mm256_mullo_epi32(_mm256_set1_epi32(ystep), lanes));
+				__m256i vxstep = _mm256_set1_epi32(xstep * 8);
+				__m256i vystep = _mm256_set1_epi32(ystep * 8);
+				__m256i xmask = _mm256_set1_epi32(63 * 64);
+				__m256i maxsource = _mm256_set1_epi32(64 * 64 - 4);
+				__m256i maxcolormap = _mm256_set1_epi32(256 - 4);
+
+				int blocks = count / 8;
+				for (int i = 0; i < blocks; i++)
+				{
+					__m256i spot = _mm256_add_epi32(_mm256_and_si256(_mm256_srli_epi32(vxfrac, 32 - 6 - 6), xmask), _mm256_srli_epi32(vyfrac, 32 - 6));
+					__m256i texel = GatherBytes(source, spot, maxsource);
+					uint64_t pixels = PackBytes(GatherBytes(colormap, texel, maxcolormap));
+					memcpy(dest, &pixels, 8);
+					dest += 8;
+					vxfrac = _mm256_add_epi32(vxfrac, vxstep);
+					vyfrac = _mm256_add_epi32(vyfrac, vystep);
+				}
+				xfrac += xstep * 8 * blocks;
+				yfrac += ystep * 8 * blocks;
+				count -= blocks * 8;
+			}
+
+			while (count > 0)
+			{
+				int spot = ((xfrac >> (32 - 6 - 6))&(63 * 64)) + (yfrac >> (32 - 6));
+				*dest++ = colormap[source[spot]];
+				xfrac += xstep;
+				yfrac += ystep;
+				count--;
+			}
+		}
+	}
+}
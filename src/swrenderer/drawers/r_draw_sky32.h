@@ -35,6 +35,7 @@ namespace swrenderer
 		
 	public:
 		DrawSkySingle32Command(const SkyDrawerArgs &args) : args(args) { }
+		bool GetRows(int &first_line, int &count) const override { first_line = args.DestY(); count = args.Count(); return true; }
 		
 		void Execute(DrawerThread *thread) override
 		{
@@ -167,6 +168,7 @@ namespace swrenderer
 		
 	public:
 		DrawSkyDouble32Command(const SkyDrawerArgs &args) : args(args) { }
+		bool GetRows(int &first_line, int &count) const override { first_line = args.DestY(); count = args.Count(); return true; }
 		
 		void Execute(DrawerThread *thread) override
 		{
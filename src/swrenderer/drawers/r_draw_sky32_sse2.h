@@ -34,6 +34,7 @@ namespace swrenderer
 		
 	public:
 		DrawSkySingle32Command(const SkyDrawerArgs &args) : args(args) { }
+		bool GetRows(int &first_line, int &count) const override { first_line = args.DestY(); count = args.Count(); return true; }
 		
 		void Execute(DrawerThread *thread) override
 		{
@@ -162,6 +163,7 @@ namespace swrenderer
 		
 	public:
 		DrawSkyDouble32Command(const SkyDrawerArgs &args) : args(args) { }
+		bool GetRows(int &first_line, int &count) const override { first_line = args.DestY(); count = args.Count(); return true; }
 		
 		void Execute(DrawerThread *thread) override
 		{
@@ -58,6 +58,7 @@ namespace swrenderer
 
 	public:
 		DrawSpan32T(const SpanDrawerArgs &drawerargs) : args(drawerargs) { }
+		bool GetRows(int &first_line, int &count) const override { first_line = args.DestY(); count = 1; return true; }
 
 		struct TextureData
 		{
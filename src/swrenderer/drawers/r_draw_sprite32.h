@@ -60,6 +60,7 @@ namespace swrenderer
 		SpriteDrawerArgs args;
 
 		DrawSprite32T(const SpriteDrawerArgs &drawerargs) : args(drawerargs) { }
+		bool GetRows(int &first_line, int &count) const override { first_line = args.DestY(); count = args.Count(); return true; }
 
 		void Execute(DrawerThread *thread) override
 		{
@@ -53,6 +53,7 @@ namespace swrenderer
 
 	public:
 		DrawWall32T(const WallDrawerArgs &drawerargs) : args(drawerargs) { }
+		bool GetRows(int &first_line, int &count) const override { first_line = args.DestY(); count = args.Count(); return true; }
 
 		void Execute(DrawerThread *thread) override
 		{
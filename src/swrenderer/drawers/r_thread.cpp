@@ -33,6 +33,7 @@
 #include "r_thread.h"
 #include "swrenderer/r_memory.h"
 #include "swrenderer/r_renderthread.h"
+#include "stats.h"
 #include <chrono>
 
 #ifdef WIN32
@@ -40,6 +41,7 @@ void PeekThreadedErrorPane();
 #endif
 
 CVAR(Int, r_multithreaded, 1, CVAR_ARCHIVE | CVAR_GLOBALCONFIG);
+CVAR(Int, r_drawer_slices, 4, CVAR_ARCHIVE | CVAR_GLOBALCONFIG);
 CVAR(Int, r_debug_draw, 0, 0);
 
 /////////////////////////////////////////////////////////////////////////////
@@ -67,12 +69,15 @@ void DrawerThreads::Execute(DrawerCommandQueuePtr commands)
 	auto queue = Instance();
 
 	queue->StartThreads();
+	commands->SplitRows((int)queue->slices.size());
 
 	// Add to queue and awaken worker threads
 	std::unique_lock<std::mutex> start_lock(queue->start_mutex);
 	std::unique_lock<std::mutex> end_lock(queue->end_mutex);
+	if (queue->active_commands.empty())
+		queue->batch_start = I_nsTime();
 	queue->active_commands.push_back(commands);
-	queue->tasks_left += queue->threads.size();
+	queue->tasks_left += queue->slices.size();
 	end_lock.unlock();
 	start_lock.unlock();
 	queue->start_condition.notify_all();
@@ -83,11 +88,11 @@ void DrawerThreads::ResetDebugDrawPos()
 	auto queue = Instance();
 	std::unique_lock<std::mutex> start_lock(queue->start_mutex);
 	bool reached_end = false;
-	for (auto &thread : queue->threads)
+	for (auto &slice : queue->slices)
 	{
-		if (thread.debug_draw_pos + r_debug_draw * 60 * 2 < queue->debug_draw_end)
+		if (slice.debug_draw_pos + r_debug_draw * 60 * 2 < queue->debug_draw_end)
 			reached_end = true;
-		thread.debug_draw_pos = 0;
+		slice.debug_draw_pos = 0;
 	}
 	if (!reached_end)
 		queue->debug_draw_end += r_debug_draw;
@@ -115,8 +120,14 @@ void DrawerThreads::WaitForWorkers()
 
 	// Clean up
 	std::unique_lock<std::mutex> start_lock(queue->start_mutex);
-	for (auto &thread : queue->threads)
-		thread.current_queue = 0;
+	for (auto &slice : queue->slices)
+		slice.current_queue = 0;
+
+	if (!queue->active_commands.empty())
+	{
+		queue->batch_ns += I_nsTime() - queue->batch_start;
+		queue->batches++;
+	}
 
 	for (auto &list : queue->active_commands)
 	{
@@ -127,25 +138,57 @@ void DrawerThreads::WaitForWorkers()
 	queue->active_commands.clear();
 }
 
-void DrawerThreads::WorkerMain(DrawerThread *thread)
+DrawerThread *DrawerThreads::FindWork(DrawerWorker *worker)
+{
+	auto pending = [&](DrawerThread *slice) { return !slice->busy && slice->current_queue < active_commands.size(); };
+
+	// Stay on the same slice while it has more queues to run
+	if (worker->last_slice && pending(worker->last_slice))
+		return worker->last_slice;
+
+	// Then the slices owned by this worker
+	size_t num_workers = workers.size();
+	for (size_t i = worker->index; i < slices.size(); i += num_workers)
+	{
+		if (pending(&slices[i]))
+			return &slices[i];
+	}
+
+	// Steal from the workers that have fallen behind
+	for (auto &slice : slices)
+	{
+		if (pending(&slice))
+		{
+			worker->slices_stolen++;
+			return &slice;
+		}
+	}
+	return nullptr;
+}
+
+void DrawerThreads::WorkerMain(DrawerWorker *worker)
 {
 	while (true)
 	{
 		// Wait until we are signalled to run:
+		DrawerThread *thread = nullptr;
 		std::unique_lock<std::mutex> start_lock(start_mutex);
-		start_condition.wait(start_lock, [&]() { return thread->current_queue < active_commands.size() || shutdown_flag; });
+		start_condition.wait(start_lock, [&]() { return shutdown_flag || (thread = FindWork(worker)) != nullptr; });
 		if (shutdown_flag)
 			break;
 
 		// Grab the commands
 		DrawerCommandQueuePtr list = active_commands[thread->current_queue];
-		thread->current_queue++;
+		thread->busy = true;
+		worker->last_slice = thread;
 		start_lock.unlock();
 
 		// Do the work:
+		uint64_t start_time = I_nsTime();
+		auto &commands = list->slice_commands[thread->core];
 		if (r_debug_draw)
 		{
-			for (auto& command : list->commands)
+			for (auto& command : commands)
 			{
 				thread->debug_draw_pos++;
 				if (thread->debug_draw_pos < debug_draw_end)
@@ -154,12 +197,23 @@ void DrawerThreads::WorkerMain(DrawerThread *thread)
 		}
 		else
 		{
-			for (auto& command : list->commands)
+			for (auto& command : commands)
 			{
 				command->Execute(thread);
 			}
 		}
 
+		// Release the slice so the next queue for it can be picked up by any worker:
+		start_lock.lock();
+		worker->busy_ns += I_nsTime() - start_time;
+		worker->slices_run++;
+		thread->current_queue++;
+		thread->busy = false;
+		bool morework = thread->current_queue < active_commands.size();
+		start_lock.unlock();
+		if (morework)
+			start_condition.notify_one();
+
 		// Notify main thread that we finished:
 		std::unique_lock<std::mutex> end_lock(end_mutex);
 		tasks_left--;
@@ -182,24 +236,32 @@ void DrawerThreads::StartThreads()
 			Printf ("Could not determine number of CPU cores (assuming 2). Set r_multithreaded.\n");
 	}
 
+	int num_workers = num_threads;
 	if (r_multithreaded == 0)
-		num_threads = 1;
+		num_workers = 1;
 	else if (r_multithreaded != 1)
-		num_threads = r_multithreaded;
+		num_workers = r_multithreaded;
 
-	if (num_threads != (int)threads.size())
+	int num_slices = num_workers * clamp<int>(r_drawer_slices, 1, 64);
+
+	if (num_workers != (int)workers.size() || num_slices != (int)slices.size())
 	{
 		StopThreads();
 
-		threads.resize(num_threads);
+		slices.resize(num_slices);
+		for (int i = 0; i < num_slices; i++)
+		{
+			slices[i].core = i;
+			slices[i].num_cores = num_slices;
+		}
 
-		for (int i = 0; i < num_threads; i++)
+		workers.resize(num_workers);
+		for (int i = 0; i < num_workers; i++)
 		{
 			DrawerThreads *queue = this;
-			DrawerThread *thread = &threads[i];
-			thread->core = i;
-			thread->num_cores = num_threads;
-			thread->thread = std::thread([=]() { queue->WorkerMain(thread); });
+			DrawerWorker *worker = &workers[i];
+			worker->index = i;
+			worker->thread = std::thread([=]() { queue->WorkerMain(worker); });
 		}
 	}
 }
@@ -210,13 +272,48 @@ void DrawerThreads::StopThreads()
 	shutdown_flag = true;
 	lock.unlock();
 	start_condition.notify_all();
-	for (auto &thread : threads)
-		thread.thread.join();
-	threads.clear();
+	for (auto &worker : workers)
+		worker.thread.join();
+	workers.clear();
+	slices.clear();
 	lock.lock();
 	shutdown_flag = false;
 }
 
+FString DrawerThreads::GetStats()
+{
+	auto queue = Instance();
+	std::unique_lock<std::mutex> start_lock(queue->start_mutex);
+
+	FString out;
+	out.Format("%d workers, %d slices, %d batches, %.2f ms", (int)queue->workers.size(), (int)queue->slices.size(), queue->batches, queue->batch_ns / 1'000'000.0);
+
+	int64_t total_busy = 0;
+	int total_stolen = 0;
+	for (auto &worker : queue->workers)
+	{
+		double utilisation = queue->batch_ns > 0 ? worker.busy_ns * 100.0 / queue->batch_ns : 0.0;
+		out.AppendFormat("\n  worker %d: %3.0f%% busy, %d runs, %d stolen", worker.index, utilisation, worker.slices_run, worker.slices_stolen);
+		total_busy += worker.busy_ns;
+		total_stolen += worker.slices_stolen;
+		worker.busy_ns = 0;
+		worker.slices_run = 0;
+		worker.slices_stolen = 0;
+	}
+
+	if (!queue->workers.empty() && queue->batch_ns > 0)
+		out.AppendFormat("\n  average: %3.0f%% busy, %d stolen", total_busy * 100.0 / (queue->batch_ns * queue->workers.size()), total_stolen);
+
+	queue->batch_ns = 0;
+	queue->batches = 0;
+	return out;
+}
+
+ADD_STAT(drawerthreads)
+{
+	return DrawerThreads::GetStats();
+}
+
 /////////////////////////////////////////////////////////////////////////////
 
 DrawerCommandQueue::DrawerCommandQueue(RenderMemory *frameMemory) : FrameMemory(frameMemory)
@@ -228,12 +325,40 @@ void *DrawerCommandQueue::AllocMemory(size_t size)
 	return FrameMemory->AllocMemory<uint8_t>((int)size);
 }
 
-/////////////////////////////////////////////////////////////////////////////
+void DrawerCommandQueue::Clear()
+{
+	commands.clear();
+	for (auto &list : slice_commands)
+		list.clear();
+}
 
-void GroupMemoryBarrierCommand::Execute(DrawerThread *thread)
+void DrawerCommandQueue::SplitRows(int num_slices)
 {
-	std::unique_lock<std::mutex> lock(mutex);
-	count++;
-	condition.notify_all();
-	condition.wait(lock, [&]() { return count >= thread->num_cores; });
+	if ((int)slice_commands.size() != num_slices)
+		slice_commands.resize(num_slices);
+	for (auto &list : slice_commands)
+		list.clear();
+
+	for (auto &command : commands)
+	{
+		int first_line, count;
+		if (!command->GetRows(first_line, count) || count >= num_slices)
+		{
+			for (auto &list : slice_commands)
+				list.push_back(command);
+		}
+		else
+		{
+			// Line y belongs to slice y % num_slices
+			int slice = first_line % num_slices;
+			if (slice < 0)
+				slice += num_slices;
+			for (int i = 0; i < count; i++)
+			{
+				slice_commands[slice].push_back(command);
+				if (++slice == num_slices)
+					slice = 0;
+			}
+		}
+	}
 }
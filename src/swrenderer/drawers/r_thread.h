@@ -34,19 +34,26 @@ EXTERN_CVAR(Int, r_multithreaded)
 
 class PolyTriangleThreadData;
 
-// Worker data for each thread executing drawer commands
+// Line slice of the render target executing drawer commands
+//
+// The rows of the screen are interleaved between all slices (line % num_cores == core).
+// There are more slices than worker threads and a slice is run by whichever worker
+// is idle first, so a worker that falls behind gets its slices stolen by the others.
+// A slice only runs the commands drawing to any of its rows.
 class DrawerThread
 {
 public:
-	std::thread thread;
 	size_t current_queue = 0;
 
-	// Thread line index of this thread
+	// Thread line index of this slice
 	int core = 0;
 
-	// Number of active threads
+	// Number of active slices
 	int num_cores = 1;
 
+	// Set while a worker thread is executing commands for this slice
+	bool busy = false;
+
 	// Working buffer used by the tilted (sloped) span drawer
 	const uint8_t *tiltlighting[MAXWIDTH];
 
@@ -88,25 +95,35 @@ public:
 	}
 };
 
-// Task to be executed by each worker thread
-class DrawerCommand
+// Worker thread executing drawer commands for the line slices
+class DrawerWorker
 {
 public:
-	virtual ~DrawerCommand() { }
+	std::thread thread;
 
-	virtual void Execute(DrawerThread *thread) = 0;
+	// Index of this worker. Slices where core % num_workers == index are run by this worker unless stolen.
+	int index = 0;
+
+	// Slice the worker ran last
+	DrawerThread *last_slice = nullptr;
+
+	// Time spent executing commands and the number of slice queues run or stolen since the stats were last read
+	int64_t busy_ns = 0;
+	int slices_run = 0;
+	int slices_stolen = 0;
 };
 
-// Wait for all worker threads before executing next command
-class GroupMemoryBarrierCommand : public DrawerCommand
+// Task to be executed for each line slice
+class DrawerCommand
 {
 public:
-	void Execute(DrawerThread *thread);
+	virtual ~DrawerCommand() { }
 
-private:
-	std::mutex mutex;
-	std::condition_variable condition;
-	size_t count = 0;
+	virtual void Execute(DrawerThread *thread) = 0;
+
+	// The rows drawn by the command. It is only run by the slices owning any of them.
+	// Commands that return false are run by all slices.
+	virtual bool GetRows(int &first_line, int &count) const { return false; }
 };
 
 class DrawerCommandQueue;
@@ -122,6 +139,9 @@ public:
 	static void WaitForWorkers();
 
 	static void ResetDebugDrawPos();
+
+	// Thread utilisation since the last call
+	static FString GetStats();
 	
 private:
 	DrawerThreads();
@@ -129,12 +149,14 @@ private:
 	
 	void StartThreads();
 	void StopThreads();
-	void WorkerMain(DrawerThread *thread);
+	void WorkerMain(DrawerWorker *worker);
+	DrawerThread *FindWork(DrawerWorker *worker);
 
 	static DrawerThreads *Instance();
 	
 	std::mutex threads_mutex;
-	std::vector<DrawerThread> threads;
+	std::vector<DrawerWorker> workers;
+	std::vector<DrawerThread> slices;
 
 	std::mutex start_mutex;
 	std::condition_variable start_condition;
@@ -147,6 +169,11 @@ private:
 
 	size_t debug_draw_end = 0;
 
+	// Wall time from the first Execute until WaitForWorkers returned
+	uint64_t batch_start = 0;
+	int64_t batch_ns = 0;
+	int batches = 0;
+
 	DrawerThread single_core_thread;
 	
 	friend class DrawerCommandQueue;
@@ -159,7 +186,7 @@ class DrawerCommandQueue
 public:
 	DrawerCommandQueue(RenderMemory *memoryAllocator);
 	
-	void Clear() { commands.clear(); }
+	void Clear();
 	
 	// Queue command to be executed by drawer worker threads
 	template<typename T, typename... Types>
@@ -184,8 +211,12 @@ public:
 private:
 	// Allocate memory valid for the duration of a command execution
 	void *AllocMemory(size_t size);
+
+	// Sorts the commands into the lists of the slices owning their rows
+	void SplitRows(int num_slices);
 	
 	std::vector<DrawerCommand *> commands;
+	std::vector<std::vector<DrawerCommand *>> slice_commands;
 	RenderMemory *FrameMemory;
 	
 	friend class DrawerThreads;
@@ -163,11 +163,18 @@ void FSoftwareRenderer::Precache(uint8_t *texhitlist, TMap<PClassActor*, bool> &
 	}
 	delete[] spritelist;
 
+	cycle_t precache;
+	precache.Reset();
+	precache.Clock();
+
 	int cnt = TexMan.NumTextures();
 	for (int i = cnt - 1; i >= 0; i--)
 	{
 		PrecacheTexture(TexMan.ByIndex(i), texhitlist[i]);
 	}
+
+	precache.Unclock();
+	DPrintf(DMSG_NOTIFY, "Textures precached in %.3f ms\n", precache.TimeMS());
 }
 
 void FSoftwareRenderer::RenderView(player_t *player)
@@ -208,11 +215,19 @@ void FSoftwareRenderer::WriteSavePic (player_t *player, FileWriter *file, int wi
 
 	// Take a snapshot of the player's view
 	pic.Lock ();
+	RenderViewToCanvas(player, &pic, width, height);
+	screen->GetFlashedPalette (palette);
+	M_CreatePNG (file, pic.GetBuffer(), palette, SS_PAL, width, height, pic.GetPitch(), Gamma);
+	pic.Unlock ();
+}
+
+bool FSoftwareRenderer::RenderViewToCanvas(player_t *player, DCanvas *canvas, int width, int height)
+{
 	if (r_polyrenderer)
 	{
 		PolyRenderer::Instance()->Viewpoint = r_viewpoint;
 		PolyRenderer::Instance()->Viewwindow = r_viewwindow;
-		PolyRenderer::Instance()->RenderViewToCanvas(player->mo, &pic, 0, 0, width, height, true);
+		PolyRenderer::Instance()->RenderViewToCanvas(player->mo, canvas, 0, 0, width, height, true);
 		r_viewpoint = PolyRenderer::Instance()->Viewpoint;
 		r_viewwindow = PolyRenderer::Instance()->Viewwindow;
 	}
@@ -220,13 +235,11 @@ void FSoftwareRenderer::WriteSavePic (player_t *player, FileWriter *file, int wi
 	{
 		mScene.MainThread()->Viewport->viewpoint = r_viewpoint;
 		mScene.MainThread()->Viewport->viewwindow = r_viewwindow;
-		mScene.RenderViewToCanvas(player->mo, &pic, 0, 0, width, height);
+		mScene.RenderViewToCanvas(player->mo, canvas, 0, 0, width, height);
 		r_viewpoint = mScene.MainThread()->Viewport->viewpoint;
 		r_viewwindow = mScene.MainThread()->Viewport->viewwindow;
 	}
-	screen->GetFlashedPalette (palette);
-	M_CreatePNG (file, pic.GetBuffer(), palette, SS_PAL, width, height, pic.GetPitch(), Gamma);
-	pic.Unlock ();
+	return true;
 }
 
 void FSoftwareRenderer::DrawRemainingPlayerSprites()
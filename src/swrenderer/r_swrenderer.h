@@ -20,6 +20,7 @@ struct FSoftwareRenderer : public FRenderer
 
 	// renders view to a savegame picture
 	void WriteSavePic (player_t *player, FileWriter *file, int width, int height) override;
+	bool RenderViewToCanvas (player_t *player, DCanvas *canvas, int width, int height) override;
 
 	// draws player sprites with hardware acceleration (only useful for software rendering)
 	void DrawRemainingPlayerSprites() override;
@@ -57,6 +57,7 @@
 #include "swrenderer/r_memory.h"
 #include "swrenderer/r_renderthread.h"
 #include "swrenderer/things/r_playersprite.h"
+#include "i_time.h"
 #include <chrono>
 
 #ifdef WIN32
@@ -68,6 +69,8 @@ EXTERN_CVAR(Int, r_clearbuffer)
 EXTERN_CVAR(Int, r_debug_draw)
 
 CVAR(Int, r_scene_multithreaded, 0, 0);
+CVAR(Bool, r_scene_balance, true, 0);			// move the slice boundaries to even out the thread timings
+CVAR(Int, r_scene_slicesperthread, 1, 0);		// more than 1 splits the view into smaller slices the threads take from a queue
 CVAR(Bool, r_models, true, CVAR_ARCHIVE | CVAR_GLOBALCONFIG);
 CVAR(Bool, r_models_carmack, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG);
 
@@ -76,6 +79,11 @@ bool r_modelscene = false;
 namespace swrenderer
 {
 	cycle_t WallCycles, PlaneCycles, MaskedCycles, DrawerWaitCycles;
+
+	enum { MinSliceWidth = 8 };
+
+	static int slicestat_threads, slicestat_slices, slicestat_minwidth, slicestat_maxwidth;
+	static double slicestat_busymax, slicestat_busyavg;
 	
 	RenderScene::RenderScene()
 	{
@@ -225,15 +233,18 @@ namespace swrenderer
 			StartThreads(numThreads);
 		}
 
+		int numSlices = numThreads * clamp<int>(r_scene_slicesperthread, 1, 16);
+		numSlices = clamp(numSlices, 1, MAX(viewwidth / MinSliceWidth, 1));
+		SetupSlices(numSlices);
+
 		// Setup threads:
 		std::unique_lock<std::mutex> start_lock(start_mutex);
 		for (int i = 0; i < numThreads; i++)
 		{
 			*Threads[i]->Viewport = *MainThread()->Viewport;
 			*Threads[i]->Light = *MainThread()->Light;
-			Threads[i]->X1 = viewwidth * i / numThreads;
-			Threads[i]->X2 = viewwidth * (i + 1) / numThreads;
 		}
+		next_slice = 0;
 		run_id++;
 		start_lock.unlock();
 
@@ -244,7 +255,7 @@ namespace swrenderer
 		}
 
 		// Do the main thread ourselves:
-		RenderThreadSlice(MainThread());
+		RenderThreadSlice(MainThread(), 0);
 
 		// Wait for everyone to finish:
 		if (Threads.size() > 1)
@@ -264,15 +275,116 @@ namespace swrenderer
 			finished_threads = 0;
 		}
 
+		if (Slices == &MainSlices)
+		{
+			uint64_t busymax = 0, busytotal = 0;
+			for (auto time : ThreadTime)
+			{
+				busymax = MAX(busymax, time);
+				busytotal += time;
+			}
+			slicestat_threads = numThreads;
+			slicestat_slices = numSlices;
+			slicestat_busymax = busymax / 1e6;
+			slicestat_busyavg = busytotal / 1e6 / numThreads;
+			slicestat_minwidth = viewwidth;
+			slicestat_maxwidth = 0;
+			for (int i = 0; i < numSlices; i++)
+			{
+				int width = Slices->X[i + 1] - Slices->X[i];
+				slicestat_minwidth = MIN(slicestat_minwidth, width);
+				slicestat_maxwidth = MAX(slicestat_maxwidth, width);
+			}
+		}
+
 		// Change main thread back to covering the whole screen for player sprites
 		MainThread()->X1 = 0;
 		MainThread()->X2 = viewwidth;
 	}
 
-	void RenderScene::RenderThreadSlice(RenderThread *thread)
+	void RenderScene::SetupSlices(int numSlices)
+	{
+		SliceLayout &layout = *Slices;
+		bool balanced = false;
+
+		if (r_scene_balance && (int)layout.X.size() == numSlices + 1 && layout.ViewWidth == viewwidth)
+		{
+			uint64_t total = 0;
+			for (auto time : layout.Time)
+				total += time;
+
+			if (total > 0)
+			{
+				// Assume that each slice's time was spread evenly over its columns and
+				// find the columns where the cost reaches 1/n, 2/n, ... of the total.
+				std::vector<int> x(numSlices + 1);
+				x[0] = 0;
+				x[numSlices] = viewwidth;
+				int slice = 0;
+				double before = 0;
+				for (int i = 1; i < numSlices; i++)
+				{
+					double target = (double)total * i / numSlices;
+					while (slice < numSlices - 1 && before + layout.Time[slice] < target)
+					{
+						before += layout.Time[slice];
+						slice++;
+					}
+					double frac = layout.Time[slice] > 0 ? clamp((target - before) / layout.Time[slice], 0.0, 1.0) : 0.0;
+					double col = layout.X[slice] + frac * (layout.X[slice + 1] - layout.X[slice]);
+
+					// Only move halfway to damp oscillation between frames.
+					x[i] = xs_RoundToInt((layout.X[i] + col) * 0.5);
+				}
+
+				for (int i = 1; i < numSlices; i++)
+					x[i] = MAX(x[i], x[i - 1] + MinSliceWidth);
+				for (int i = numSlices - 1; i > 0; i--)
+					x[i] = MIN(x[i], x[i + 1] - MinSliceWidth);
+
+				layout.X = std::move(x);
+				balanced = true;
+			}
+		}
+
+		if (!balanced)
+		{
+			layout.X.resize(numSlices + 1);
+			for (int i = 0; i <= numSlices; i++)
+				layout.X[i] = viewwidth * i / numSlices;
+		}
+		layout.ViewWidth = viewwidth;
+		layout.Time.assign(numSlices, 0);
+		ThreadTime.assign(Threads.size(), 0);
+	}
+
+	void RenderScene::RenderThreadSlice(RenderThread *thread, size_t index)
 	{
 		thread->DrawQueue->Clear();
 		thread->FrameMemory->Clear();
+
+		// Keep taking slices until all are done. The draw commands of all of them
+		// go into one queue, so the frame memory must only be cleared once.
+		uint64_t busy = 0;
+		int numSlices = (int)Slices->Time.size();
+		int slice;
+		while ((slice = next_slice++) < numSlices)
+		{
+			uint64_t start = I_nsTime();
+			RenderSlice(thread, Slices->X[slice], Slices->X[slice + 1]);
+			uint64_t time = I_nsTime() - start;
+			Slices->Time[slice] = time;
+			busy += time;
+		}
+		ThreadTime[index] = busy;
+
+		DrawerThreads::Execute(thread->DrawQueue);
+	}
+
+	void RenderScene::RenderSlice(RenderThread *thread, int x1, int x2)
+	{
+		thread->X1 = x1;
+		thread->X2 = x2;
 		thread->Clip3D->Cleanup();
 		thread->Clip3D->ResetClip(); // reset clips (floor/ceiling)
 		thread->Portal->CopyStackedViewParameters();
@@ -286,7 +398,7 @@ namespace swrenderer
 
 		PolyTriangleDrawer::SetViewport(thread->DrawQueue, viewwindowx, viewwindowy, viewwidth, viewheight, thread->Viewport->RenderTarget, true);
 
-		// Cull things outside the range seen by this thread
+		// Cull things outside the range of this slice
 		VisibleSegmentRenderer visitor;
 		if (thread->X1 > 0)
 			thread->ClipSegments->Clip(0, thread->X1, true, &visitor);
@@ -305,8 +417,6 @@ namespace swrenderer
 
 			thread->TranslucentPass->Render();
 		}
-
-		DrawerThreads::Execute(thread->DrawQueue);
 	}
 
 	void RenderScene::StartThreads(size_t numThreads)
@@ -315,6 +425,7 @@ namespace swrenderer
 		{
 			std::unique_ptr<RenderThread> thread(new RenderThread(this, false));
 			auto renderthread = thread.get();
+			size_t index = Threads.size();
 			int start_run_id = run_id;
 			thread->thread = std::thread([=]()
 			{
@@ -329,7 +440,7 @@ namespace swrenderer
 					last_run_id = run_id;
 					start_lock.unlock();
 
-					RenderThreadSlice(renderthread);
+					RenderThreadSlice(renderthread, index);
 
 					// Notify main thread that we finished:
 					std::unique_lock<std::mutex> end_lock(end_mutex);
@@ -374,7 +485,10 @@ namespace swrenderer
 		if (r_modelscene && r_models_carmack)
 			PolyTriangleDrawer::ClearBuffers(viewport->RenderTarget);
 
+		// Camera textures have their own slice layout so they don't upset the balancing of the main view.
+		Slices = &CanvasSlices;
 		RenderActorView(actor, dontmaplines);
+		Slices = &MainSlices;
 		DrawerWaitCycles.Clock();
 		DrawerThreads::WaitForWorkers();
 		DrawerWaitCycles.Unclock();
@@ -420,6 +534,11 @@ namespace swrenderer
 
 	/////////////////////////////////////////////////////////////////////////
 
+	ADD_CYCLE_STAT(walls, WallCycles)
+	ADD_CYCLE_STAT(planes, PlaneCycles)
+	ADD_CYCLE_STAT(masked, MaskedCycles)
+	ADD_CYCLE_STAT(drawers, DrawerWaitCycles)
+
 	ADD_STAT(fps)
 	{
 		FString out;
@@ -446,6 +565,15 @@ namespace swrenderer
 		return out;
 	}
 
+	ADD_STAT(scene_slices)
+	{
+		FString out;
+		double imbalance = slicestat_busyavg > 0 ? (slicestat_busymax / slicestat_busyavg - 1) * 100 : 0;
+		out.Format("threads=%d  slices=%d  width=%d-%d  busy max=%04.2f ms  avg=%04.2f ms  imbalance=%.0f%%",
+			slicestat_threads, slicestat_slices, slicestat_minwidth, slicestat_maxwidth, slicestat_busymax, slicestat_busyavg, imbalance);
+		return out;
+	}
+
 	static double bestwallcycles = HUGE_VAL;
 
 	ADD_STAT(wallcycles)
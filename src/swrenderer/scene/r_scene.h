@@ -27,6 +27,7 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 #include "r_defs.h"
 #include "d_player.h"
 
@@ -60,7 +61,9 @@ namespace swrenderer
 	private:
 		void RenderActorView(AActor *actor, bool dontmaplines = false);
 		void RenderThreadSlices();
-		void RenderThreadSlice(RenderThread *thread);
+		void RenderThreadSlice(RenderThread *thread, size_t index);
+		void RenderSlice(RenderThread *thread, int x1, int x2);
+		void SetupSlices(int numSlices);
 		void RenderPSprites();
 
 		void StartThreads(size_t numThreads);
@@ -77,5 +80,18 @@ namespace swrenderer
 		std::mutex end_mutex;
 		std::condition_variable end_condition;
 		size_t finished_threads = 0;
+
+		// Column ranges rendered by the threads. They are rebalanced every frame
+		// from how long each slice took in the previous one.
+		struct SliceLayout
+		{
+			std::vector<int> X;
+			std::vector<uint64_t> Time;
+			int ViewWidth = 0;
+		};
+		SliceLayout MainSlices, CanvasSlices;
+		SliceLayout *Slices = &MainSlices;
+		std::vector<uint64_t> ThreadTime;
+		std::atomic<int> next_slice = { 0 };
 	};
 }
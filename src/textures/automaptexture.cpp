@@ -51,6 +51,7 @@ class FAutomapTexture : public FWorldTexture
 {
 public:
 	FAutomapTexture(int lumpnum);
+	const char *GetFormatName() override { return "Automap"; }
 	uint8_t *MakeTexture (FRenderStyle style);
 };
 
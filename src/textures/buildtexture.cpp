@@ -58,6 +58,7 @@ class FBuildTexture : public FWorldTexture
 {
 public:
 	FBuildTexture (const FString &pathprefix, int tilenum, const uint8_t *pixels, int translation, int width, int height, int left, int top);
+	const char *GetFormatName() override { return "Build"; }
 	uint8_t *MakeTexture(FRenderStyle style) override;
 	int CopyTrueColorPixels(FBitmap *bmp, int x, int y, int rotate, FCopyInfo *inf = NULL) override;
 	bool UseBasePalette() override { return false; }
@@ -163,6 +163,7 @@ class FDDSTexture : public FWorldTexture
 	};
 public:
 	FDDSTexture (FileReader &lump, int lumpnum, void *surfdesc);
+	const char *GetFormatName() override { return "DDS"; }
 
 	FTextureFormat GetFormat () override;
 	uint8_t *MakeTexture(FRenderStyle style) override;
@@ -51,6 +51,7 @@ class FEmptyTexture : public FWorldTexture
 	uint8_t Pixel = 0;
 public:
 	FEmptyTexture (int lumpnum);
+	const char *GetFormatName() override { return "Empty"; }
 	uint8_t *MakeTexture(FRenderStyle style) override;
 };
 
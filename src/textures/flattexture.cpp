@@ -49,6 +49,7 @@ class FFlatTexture : public FWorldTexture
 {
 public:
 	FFlatTexture (int lumpnum);
+	const char *GetFormatName() override { return "Flat"; }
 	uint8_t *MakeTexture (FRenderStyle style) override;
 };
 
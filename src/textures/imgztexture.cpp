@@ -69,6 +69,7 @@ class FIMGZTexture : public FWorldTexture
 
 public:
 	FIMGZTexture (int lumpnum, uint16_t w, uint16_t h, int16_t l, int16_t t, bool isalpha);
+	const char *GetFormatName() override { return "IMGZ"; }
 	uint8_t *MakeTexture (FRenderStyle style) override;
 	int CopyTrueColorPixels(FBitmap *bmp, int x, int y, int rotate, FCopyInfo *inf) override;
 
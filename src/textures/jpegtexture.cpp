@@ -183,6 +183,7 @@ class FJPEGTexture : public FWorldTexture
 {
 public:
 	FJPEGTexture (int lumpnum, int width, int height);
+	const char *GetFormatName() override { return "JPEG"; }
 
 	FTextureFormat GetFormat () override;
 	int CopyTrueColorPixels(FBitmap *bmp, int x, int y, int rotate, FCopyInfo *inf = NULL) override;
@@ -155,6 +155,7 @@ public:
 	FMultiPatchTexture (const void *texdef, FPatchLookup *patchlookup, int maxpatchnum, bool strife, int deflump);
 	FMultiPatchTexture (FScanner &sc, ETextureType usetype);
 	~FMultiPatchTexture ();
+	const char *GetFormatName() override { return "Multipatch"; }
 
 	FTextureFormat GetFormat() override;
 	bool UseBasePalette() override;
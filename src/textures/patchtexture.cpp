@@ -65,6 +65,7 @@ class FPatchTexture : public FWorldTexture
 	bool isalpha = false;
 public:
 	FPatchTexture (int lumpnum, patch_t *header, bool isalphatex);
+	const char *GetFormatName() override { return "Patch"; }
 	uint8_t *MakeTexture (FRenderStyle style) override;
 	int CopyTrueColorPixels(FBitmap *bmp, int x, int y, int rotate, FCopyInfo *inf) override;
 	void DetectBadPatches();
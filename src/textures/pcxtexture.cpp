@@ -85,6 +85,7 @@ class FPCXTexture : public FWorldTexture
 {
 public:
 	FPCXTexture (int lumpnum, PCXHeader &);
+	const char *GetFormatName() override { return "PCX"; }
 
 	FTextureFormat GetFormat () override;
 
@@ -50,6 +50,7 @@ class FRawPageTexture : public FWorldTexture
 {
 public:
 	FRawPageTexture (int lumpnum);
+	const char *GetFormatName() override { return "Raw page"; }
 	uint8_t *MakeTexture (FRenderStyle style) override;
 };
 
@@ -281,6 +281,9 @@ public:
 	// Returns the native pixel format for this image
 	virtual FTextureFormat GetFormat();
 
+	// Returns the name of the image format, for statistics
+	virtual const char *GetFormatName() { return "Other"; }
+
 	// Returns a native 3D representation of the texture
 	FNativeTexture *GetNative(FTextureFormat fmt, bool wrapping);
 
@@ -698,6 +701,7 @@ class FWarpTexture : public FWorldTexture
 public:
 	FWarpTexture (FTexture *source, int warptype);
 	~FWarpTexture ();
+	const char *GetFormatName() override { return "Warp"; }
 	void Unload() override;
 
 	virtual int CopyTrueColorPixels(FBitmap *bmp, int x, int y, int rotate=0, FCopyInfo *inf = NULL) override;
@@ -730,6 +734,7 @@ class FCanvasTexture : public FTexture
 public:
 	FCanvasTexture (const char *name, int width, int height);
 	~FCanvasTexture ();
+	const char *GetFormatName() override { return "Canvas"; }
 
 	const uint8_t *GetColumn(FRenderStyle style, unsigned int column, const Span **spans_out);
 	const uint8_t *GetPixels (FRenderStyle style);
@@ -80,6 +80,7 @@ class FTGATexture : public FWorldTexture
 {
 public:
 	FTGATexture (int lumpnum, TGAHeader *);
+	const char *GetFormatName() override { return "TGA"; }
 
 	FTextureFormat GetFormat () override;
 	int CopyTrueColorPixels(FBitmap *bmp, int x, int y, int rotate, FCopyInfo *inf = NULL) override;
@@ -211,6 +211,7 @@ void FWadCollection::AddFile (const char *filename, FileReader *wadr)
 	int startlump;
 	bool isdir = false;
 	FileReader wadreader;
+	static bool nommap = !!Args->CheckParm("-nommap");
 
 	if (wadr == nullptr)
 	{
@@ -224,7 +225,8 @@ void FWadCollection::AddFile (const char *filename, FileReader *wadr)
 
 		if (!isdir)
 		{
-			if (!wadreader.OpenFile(filename))
+			// Mapping the file lets stored lumps be used in place instead of reading them into a heap buffer.
+			if ((nommap || !wadreader.OpenMappedFile(filename)) && !wadreader.OpenFile(filename))
 			{ // Didn't find file
 				Printf (TEXTCOLOR_RED "%s: File not found\n", filename);
 				PrintLastError ();
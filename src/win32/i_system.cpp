@@ -55,6 +55,7 @@
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <psapi.h>
 #include <mmsystem.h>
 #include <richedit.h>
 #include <wincrypt.h>
@@ -1292,6 +1293,31 @@ unsigned int I_MakeRNGSeed()
 	return seed;
 }
 
+//==========================================================================
+//
+// I_GetPeakMemoryUsage
+//
+// Returns the peak working set size. K32GetProcessMemoryInfo is looked up
+// at runtime so that psapi.dll does not need to be linked.
+//
+//==========================================================================
+
+size_t I_GetPeakMemoryUsage()
+{
+	HMODULE kernel = GetModuleHandleA("kernel32.dll");
+	if (kernel != NULL)
+	{
+		BOOL (WINAPI *pGetProcessMemoryInfo)(HANDLE, PROCESS_MEMORY_COUNTERS *, DWORD) =
+			(BOOL (WINAPI *)(HANDLE, PROCESS_MEMORY_COUNTERS *, DWORD))GetProcAddress(kernel, "K32GetProcessMemoryInfo");
+		PROCESS_MEMORY_COUNTERS counters;
+		if (pGetProcessMemoryInfo != NULL && pGetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		{
+			return counters.PeakWorkingSetSize;
+		}
+	}
+	return 0;
+}
+
 //==========================================================================
 //
 // I_GetLongPathName